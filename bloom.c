@@ -164,7 +164,40 @@ uint32_t murmur3_seeded_v2(uint32_t seed, const char *data, size_t len)
 	return seed;
 }
 
-static uint32_t murmur3_seeded_v1(uint32_t seed, const char *data, size_t len)
+static inline uint32_t murmur3_byte(const char *data, size_t i, int version)
+{
+	/*
+	 * Version 1 of the hash had a bug: it sign-extended each byte on
+	 * platforms where "char" is signed. Filters written with it must
+	 * still be read the same way.
+	 */
+	if (version == 1)
+		return (uint32_t)data[i];
+	return (uint32_t)(unsigned char)data[i];
+}
+
+static inline uint32_t murmur3_fmix(uint32_t h, size_t len)
+{
+	h ^= (uint32_t)len;
+	h ^= (h >> 16);
+	h *= 0x85ebca6b;
+	h ^= (h >> 13);
+	h *= 0xc2b2ae35;
+	h ^= (h >> 16);
+	return h;
+}
+
+/*
+ * Compute the murmur3 hashes of "data" for the two seeds "*h0" and
+ * "*h1" at once, giving the same results as murmur3_seeded_v2() called once
+ * for each seed (or its buggy predecessor if "version" is 1).
+ *
+ * Mixing a block of input does not depend on the seed, so a single
+ * pass over the data does half the work, and the two independent seed
+ * updates can be interleaved by the CPU.
+ */
+static inline void murmur3_seeded_pair(uint32_t *h0, uint32_t *h1, int version,
+				const char *data, size_t len)
 {
 	const uint32_t c1 = 0xcc9e2d51;
 	const uint32_t c2 = 0x1b873593;
@@ -172,53 +205,61 @@ static uint32_t murmur3_seeded_v1(uint32_t seed, const char *data, size_t len)
 	const uint32_t r2 = 13;
 	const uint32_t m = 5;
 	const uint32_t n = 0xe6546b64;
-	int i;
-	uint32_t k1 = 0;
-	const char *tail;
-
-	int len4 = len / sizeof(uint32_t);
-
+	uint32_t s0 = *h0, s1 = *h1;
+	size_t i, len4 = len / sizeof(uint32_t);
 	uint32_t k;
+
 	for (i = 0; i < len4; i++) {
-		uint32_t byte1 = (uint32_t)data[4*i];
-		uint32_t byte2 = ((uint32_t)data[4*i + 1]) << 8;
-		uint32_t byte3 = ((uint32_t)data[4*i + 2]) << 16;
-		uint32_t byte4 = ((uint32_t)data[4*i + 3]) << 24;
-		k = byte1 | byte2 | byte3 | byte4;
+		k = murmur3_byte(data, 4*i, version) |
+		    murmur3_byte(data, 4*i + 1, version) << 8 |
+		    murmur3_byte(data, 4*i + 2, version) << 16 |
+		    murmur3_byte(data, 4*i + 3, version) << 24;
 		k *= c1;
 		k = rotate_left(k, r1);
 		k *= c2;
 
-		seed ^= k;
-		seed = rotate_left(seed, r2) * m + n;
+		s0 ^= k;
+		s1 ^= k;
+		s0 = rotate_left(s0, r2) * m + n;
+		s1 = rotate_left(s1, r2) * m + n;
 	}
 
-	tail = (data + len4 * sizeof(uint32_t));
-
+	k = 0;
 	switch (len & (sizeof(uint32_t) - 1)) {
 	case 3:
-		k1 ^= ((uint32_t)tail[2]) << 16;
+		k ^= murmur3_byte(data, 4*len4 + 2, version) << 16;
 		/*-fallthrough*/
 	case 2:
-		k1 ^= ((uint32_t)tail[1]) << 8;
+		k ^= murmur3_byte(data, 4*len4 + 1, version) << 8;
 		/*-fallthrough*/
 	case 1:
-		k1 ^= ((uint32_t)tail[0]) << 0;
-		k1 *= c1;
-		k1 = rotate_left(k1, r1);
-		k1 *= c2;
-		seed ^= k1;
+		k ^= murmur3_byte(data, 4*len4, version);
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+		s0 ^= k;
+		s1 ^= k;
 		break;
 	}
 
-	seed ^= (uint32_t)len;
-	seed ^= (seed >> 16);
-	seed *= 0x85ebca6b;
-	seed ^= (seed >> 13);
-	seed *= 0xc2b2ae35;
-	seed ^= (seed >> 16);
+	*h0 = murmur3_fmix(s0, len);
+	*h1 = murmur3_fmix(s1, len);
+}
 
-	return seed;
+static void fill_bloom_hashes(const char *data, size_t len, uint32_t *hashes,
+			      const struct bloom_filter_settings *settings)
+{
+	uint32_t hash0 = 0x293ae76f;
+	uint32_t hash1 = 0x7e646e2c;
+	int i;
+
+	/* pass "version" as a constant so that the check is optimized out */
+	if (settings->hash_version == 2)
+		murmur3_seeded_pair(&hash0, &hash1, 2, data, len);
+	else
+		murmur3_seeded_pair(&hash0, &hash1, 1, data, len);
+	for (i = 0; i < settings->num_hashes; i++)
+		hashes[i] = hash0 + i * hash1;
 }
 
 void fill_bloom_key(const char *data,
@@ -226,21 +267,8 @@ void fill_bloom_key(const char *data,
 		    struct bloom_key *key,
 		    const struct bloom_filter_settings *settings)
 {
-	int i;
-	const uint32_t seed0 = 0x293ae76f;
-	const uint32_t seed1 = 0x7e646e2c;
-	uint32_t hash0, hash1;
-	if (settings->hash_version == 2) {
-		hash0 = murmur3_seeded_v2(seed0, data, len);
-		hash1 = murmur3_seeded_v2(seed1, data, len);
-	} else {
-		hash0 = murmur3_seeded_v1(seed0, data, len);
-		hash1 = murmur3_seeded_v1(seed1, data, len);
-	}
-
 	key->hashes = (uint32_t *)xcalloc(settings->num_hashes, sizeof(uint32_t));
-	for (i = 0; i < settings->num_hashes; i++)
-		key->hashes[i] = hash0 + i * hash1;
+	fill_bloom_hashes(data, len, key->hashes, settings);
 }
 
 void clear_bloom_key(struct bloom_key *key)
@@ -386,18 +414,18 @@ struct bloom_filter *get_bloom_filter(struct repository *r, struct commit *c)
 	return filter;
 }
 
-struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
-						 struct commit *c,
-						 int compute_if_not_present,
-						 const struct bloom_filter_settings *settings,
-						 enum bloom_filter_computed *computed)
+struct bloom_filter *lookup_bloom_filter(struct repository *r,
+					 struct commit *c,
+					 int upgrade,
+					 const struct bloom_filter_settings *settings,
+					 enum bloom_filter_computed *computed,
+					 int *ready)
 {
 	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
 
 	if (computed)
 		*computed = BLOOM_NOT_COMPUTED;
+	*ready = 0;
 
 	if (!bloom_filters.slab_size)
 		return NULL;
@@ -412,112 +440,184 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	}
 
 	if (filter->data && filter->len) {
-		struct bloom_filter *upgrade;
-		if (!settings || settings->hash_version == filter->version)
+		struct bloom_filter *upgraded;
+		if (!settings || settings->hash_version == filter->version) {
+			*ready = 1;
 			return filter;
+		}
 
 		/* version mismatch, see if we can upgrade */
-		if (compute_if_not_present &&
+		if (upgrade &&
 		    git_env_bool("GIT_TEST_UPGRADE_BLOOM_FILTERS", 1)) {
-			upgrade = upgrade_filter(r, c, filter,
+			upgraded = upgrade_filter(r, c, filter,
 						 settings->hash_version);
-			if (upgrade) {
+			if (upgraded) {
 				if (computed)
 					*computed |= BLOOM_UPGRADED;
-				return upgrade;
+				*ready = 1;
+				return upgraded;
 			}
 		}
 	}
-	if (!compute_if_not_present)
-		return NULL;
 
+	return filter;
+}
+
+struct bloom_diff_data {
+	struct hashmap pathmap;
+	int nr_changes;
+	int max_changes;
+};
+
+static void add_changed_path(struct diff_options *opt, const char *path)
+{
+	struct bloom_diff_data *data = opt->change_fn_data;
+	size_t len = strlen(path);
+
+	if (++data->nr_changes > data->max_changes) {
+		/* too many changes; make the tree diff stop early */
+		opt->flags.quick = 1;
+		opt->flags.has_changes = 1;
+		return;
+	}
+
+	/*
+	 * Add each leading directory of the changed file, i.e. for
+	 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
+	 * the Bloom filter could be used to speed up commands like
+	 * 'git log dir/subdir', too.
+	 *
+	 * Note that directories are added without the trailing '/'.
+	 * Once we find a path that is already in the map, all of its
+	 * leading directories are there as well.
+	 */
+	while (len) {
+		struct pathmap_hash_entry *e;
+
+		FLEX_ALLOC_MEM(e, path, path, len);
+		hashmap_entry_init(&e->entry, strhash(e->path));
+
+		if (hashmap_get(&data->pathmap, &e->entry, NULL)) {
+			free(e);
+			break;
+		}
+		hashmap_add(&data->pathmap, &e->entry);
+
+		while (len && path[len - 1] != '/')
+			len--;
+		if (len)
+			len--;
+	}
+}
+
+static void bloom_diff_addremove(struct diff_options *opt,
+				 int addremove UNUSED,
+				 unsigned mode UNUSED,
+				 const struct object_id *oid UNUSED,
+				 int oid_valid UNUSED,
+				 const char *fullpath,
+				 unsigned dirty_submodule UNUSED)
+{
+	add_changed_path(opt, fullpath);
+}
+
+static void bloom_diff_change(struct diff_options *opt,
+			      unsigned old_mode UNUSED,
+			      unsigned new_mode UNUSED,
+			      const struct object_id *old_oid UNUSED,
+			      const struct object_id *new_oid UNUSED,
+			      int old_oid_valid UNUSED,
+			      int new_oid_valid UNUSED,
+			      const char *fullpath,
+			      unsigned old_dirty_submodule UNUSED,
+			      unsigned new_dirty_submodule UNUSED)
+{
+	add_changed_path(opt, fullpath);
+}
+
+enum bloom_filter_computed compute_bloom_filter(struct repository *r,
+						const struct object_id *old_oid,
+						const struct object_id *new_oid,
+						const struct bloom_filter_settings *settings,
+						struct bloom_filter *filter)
+{
+	enum bloom_filter_computed computed = BLOOM_COMPUTED;
+	struct bloom_diff_data data = {
+		.pathmap = HASHMAP_INIT(pathmap_cmp, NULL),
+		.max_changes = settings->max_changed_paths,
+	};
+	struct diff_options diffopt;
+
+	/*
+	 * Rather than queueing the changes in the global diff queue,
+	 * collect the changed paths directly through the callbacks, which
+	 * makes it possible to compute several filters in parallel.
+	 */
 	repo_diff_setup(r, &diffopt);
 	diffopt.flags.recursive = 1;
 	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
+	diffopt.add_remove = bloom_diff_addremove;
+	diffopt.change = bloom_diff_change;
+	diffopt.change_fn_data = &data;
 	diff_setup_done(&diffopt);
 
-	/* ensure commit is parsed so we have parent information */
-	repo_parse_commit(r, c);
+	diff_tree_oid(old_oid, new_oid, "", &diffopt);
+	diff_free(&diffopt);
 
-	if (c->parents)
-		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
-	else
-		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
-
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
-		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
+	if (data.nr_changes <= settings->max_changed_paths &&
+	    hashmap_get_size(&data.pathmap) <= settings->max_changed_paths) {
 		struct pathmap_hash_entry *e;
 		struct hashmap_iter iter;
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-		}
-
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
-			init_truncated_large_filter(filter,
-						    settings->hash_version);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
-			goto cleanup;
-		}
-
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+		filter->len = (hashmap_get_size(&data.pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
 		filter->version = settings->hash_version;
 		if (!filter->len) {
-			if (computed)
-				*computed |= BLOOM_TRUNC_EMPTY;
+			computed |= BLOOM_TRUNC_EMPTY;
 			filter->len = 1;
 		}
 		CALLOC_ARRAY(filter->data, filter->len);
 		filter->to_free = filter->data;
 
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
+		hashmap_for_each_entry(&data.pathmap, &iter, e, entry) {
 			struct bloom_key key;
 			fill_bloom_key(e->path, strlen(e->path), &key, settings);
 			add_key_to_filter(&key, filter, settings);
 			clear_bloom_key(&key);
 		}
-
-	cleanup:
-		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
 	} else {
 		init_truncated_large_filter(filter, settings->hash_version);
-
-		if (computed)
-			*computed |= BLOOM_TRUNC_LARGE;
+		computed |= BLOOM_TRUNC_LARGE;
 	}
 
-	if (computed)
-		*computed |= BLOOM_COMPUTED;
+	hashmap_clear_and_free(&data.pathmap, struct pathmap_hash_entry, entry);
+	return computed;
+}
+
+struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
+						 struct commit *c,
+						 int compute_if_not_present,
+						 const struct bloom_filter_settings *settings,
+						 enum bloom_filter_computed *computed)
+{
+	struct bloom_filter *filter;
+	enum bloom_filter_computed result;
+	int ready;
+
+	filter = lookup_bloom_filter(r, c, compute_if_not_present, settings,
+				     computed, &ready);
+	if (!filter || ready)
+		return filter;
+	if (!compute_if_not_present)
+		return NULL;
+
+	/* ensure commit is parsed so we have parent information */
+	repo_parse_commit(r, c);
 
-	diff_queue_clear(&diff_queued_diff);
+	result = compute_bloom_filter(r,
+				      c->parents ? &c->parents->item->object.oid : NULL,
+				      &c->object.oid, settings, filter);
+	if (computed)
+		*computed = result;
 	return filter;
 }
 
@@ -540,3 +640,96 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 
 	return 1;
 }
+
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings)
+{
+	struct bloom_keyvec *vec;
+	size_t nr = 1, i;
+
+	for (i = 1; i < len; i++)
+		if (path[i] == '/')
+			nr++;
+
+	CALLOC_ARRAY(vec, 1);
+	vec->count = nr;
+	vec->num_hashes = settings->num_hashes;
+	ALLOC_ARRAY(vec->hashes, st_mult(nr, vec->num_hashes));
+
+	/*
+	 * The key for the whole path comes first, followed by its leading
+	 * directories from the deepest to the shallowest: longer paths
+	 * are changed less often, so their keys are the most likely to
+	 * rule out a commit early.
+	 */
+	fill_bloom_hashes(path, len, vec->hashes, settings);
+	nr = 1;
+	for (i = len - 1; i > 0; i--)
+		if (path[i] == '/')
+			fill_bloom_hashes(path, i,
+					  vec->hashes + nr++ * vec->num_hashes,
+					  settings);
+
+	return vec;
+}
+
+void bloom_keyvec_free(struct bloom_keyvec *vec)
+{
+	if (!vec)
+		return;
+	for (size_t i = 0; i < ARRAY_SIZE(vec->positions); i++)
+		free(vec->positions[i]);
+	free(vec->hashes);
+	free(vec);
+}
+
+/*
+ * The bit positions of the keys only depend on the length of the
+ * filter, and most filters are short, so compute them once for each
+ * such length instead of doing "num_hashes" divisions per key and
+ * filter.
+ */
+static const uint16_t *bloom_keyvec_positions(struct bloom_keyvec *vec,
+					      size_t filter_len)
+{
+	uint16_t *pos = vec->positions[filter_len];
+
+	if (!pos) {
+		size_t nr = st_mult(vec->count, vec->num_hashes);
+		uint32_t mod = filter_len * BITS_PER_WORD;
+
+		ALLOC_ARRAY(pos, nr);
+		for (size_t i = 0; i < nr; i++)
+			pos[i] = vec->hashes[i] % mod;
+		vec->positions[filter_len] = pos;
+	}
+	return pos;
+}
+
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      struct bloom_keyvec *vec)
+{
+	size_t nr = st_mult(vec->count, vec->num_hashes);
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	if (!mod)
+		return -1;
+
+	if (filter->len < ARRAY_SIZE(vec->positions)) {
+		const uint16_t *pos = bloom_keyvec_positions(vec, filter->len);
+
+		for (size_t i = 0; i < nr; i++)
+			if (!(filter->data[pos[i] / BITS_PER_WORD] &
+			      get_bitmask(pos[i])))
+				return 0;
+	} else {
+		for (size_t i = 0; i < nr; i++) {
+			uint64_t hash_mod = vec->hashes[i] % mod;
+			if (!(filter->data[hash_mod / BITS_PER_WORD] &
+			      get_bitmask(hash_mod)))
+				return 0;
+		}
+	}
+
+	return 1;
+}
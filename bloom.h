@@ -4,6 +4,7 @@
 struct commit;
 struct repository;
 struct commit_graph;
+struct object_id;
 
 struct bloom_filter_settings {
 	/*
@@ -74,6 +75,34 @@ struct bloom_key {
 	uint32_t *hashes;
 };
 
+/*
+ * A bloom_keyvec holds the keys for a path and for each of its leading
+ * directories, all of which must be present in a filter for the path
+ * to possibly have changed. This is what a revision walk limited to a
+ * pathspec probes for each commit.
+ *
+ * The walk only learns which commit to look at next after it has
+ * decided about the current one, so the keys are batched against one
+ * filter at a time rather than against the filters of many commits.
+ * Work is shared across commits by caching bit positions per filter
+ * length instead.
+ */
+#define BLOOM_KEYVEC_CACHED_LEN 256
+
+struct bloom_keyvec {
+	size_t count;
+	uint32_t num_hashes;
+
+	/* "num_hashes" hashes for each of the "count" keys */
+	uint32_t *hashes;
+
+	/*
+	 * Bit positions of all hashes in filters of each (short) length,
+	 * computed on first use.
+	 */
+	uint16_t *positions[BLOOM_KEYVEC_CACHED_LEN];
+};
+
 int load_bloom_filter_from_graph(struct commit_graph *g,
 				 struct bloom_filter *filter,
 				 uint32_t graph_pos);
@@ -108,6 +137,40 @@ enum bloom_filter_computed {
 	BLOOM_UPGRADED     = (1 << 4),
 };
 
+/*
+ * Look up the Bloom filter for commit "c", loading it from the
+ * commit-graph if necessary. If "upgrade" is set, a filter using a
+ * different hash version than the one in "settings" is upgraded when
+ * possible. Unlike get_or_compute_bloom_filter(), a missing filter is
+ * never computed.
+ *
+ * Returns NULL if Bloom filters have not been initialized. Otherwise
+ * returns the slab entry for "c" and sets "*ready" if the filter can
+ * be used as-is; if not, it can be filled in with
+ * compute_bloom_filter().
+ */
+struct bloom_filter *lookup_bloom_filter(struct repository *r,
+					 struct commit *c,
+					 int upgrade,
+					 const struct bloom_filter_settings *settings,
+					 enum bloom_filter_computed *computed,
+					 int *ready);
+
+/*
+ * Compute the changed-path Bloom filter between the tree-ishes
+ * "old_oid" (which may be NULL for a root commit) and "new_oid" into
+ * "filter", replacing its contents.
+ *
+ * This only reads objects and does not touch any other global state,
+ * so it may be called from several threads at once for different
+ * filters, provided that enable_obj_read_lock() has been called.
+ */
+enum bloom_filter_computed compute_bloom_filter(struct repository *r,
+						const struct object_id *old_oid,
+						const struct object_id *new_oid,
+						const struct bloom_filter_settings *settings,
+						struct bloom_filter *filter);
+
 struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 struct commit *c,
 						 int compute_if_not_present,
@@ -137,4 +200,22 @@ int bloom_filter_contains(const struct bloom_filter *filter,
 			  const struct bloom_key *key,
 			  const struct bloom_filter_settings *settings);
 
+/*
+ * Create the keys for "path" (which must use '/' as directory
+ * separator and must not end with one) and all its leading
+ * directories.
+ */
+struct bloom_keyvec *bloom_keyvec_new(const char *path, size_t len,
+				      const struct bloom_filter_settings *settings);
+void bloom_keyvec_free(struct bloom_keyvec *vec);
+
+/*
+ * Like bloom_filter_contains(), but check all keys of "vec" at once.
+ * Returns 1 if all of them may be present in "filter", 0 if at least
+ * one of them is definitely not present, and -1 if the filter is
+ * empty.
+ */
+int bloom_filter_contains_vec(const struct bloom_filter *filter,
+			      struct bloom_keyvec *vec);
+
 #endif
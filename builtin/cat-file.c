@@ -27,6 +27,7 @@
 #include "promisor-remote.h"
 #include "mailmap.h"
 #include "write-or-die.h"
+#include "thread-utils.h"
 
 enum batch_mode {
 	BATCH_MODE_CONTENTS,
@@ -34,6 +35,8 @@ enum batch_mode {
 	BATCH_MODE_QUEUE_AND_DISPATCH,
 };
 
+struct batch_pool;
+
 struct batch_options {
 	int enabled;
 	int follow_symlinks;
@@ -45,6 +48,8 @@ struct batch_options {
 	char input_delim;
 	char output_delim;
 	const char *format;
+	int threads;
+	struct batch_pool *pool;
 };
 
 static const char *force_path;
@@ -380,6 +385,36 @@ static void batch_write(struct batch_options *opt, const void *data, int len)
 		write_or_die(1, data, len);
 }
 
+/*
+ * Read the contents of the object described by "data" into memory,
+ * applying the mailmap to commits and tags if requested.
+ */
+static void *read_batch_object(struct expand_data *data, unsigned long *sizep)
+{
+	const struct object_id *oid = &data->oid;
+	enum object_type type;
+	unsigned long size;
+	void *contents;
+
+	contents = repo_read_object_file(the_repository, oid, &type, &size);
+	if (!contents)
+		die("object %s disappeared", oid_to_hex(oid));
+
+	if (use_mailmap && type != OBJ_BLOB) {
+		size_t s = size;
+		contents = replace_idents_using_mailmap(contents, &s);
+		size = cast_size_t_to_ulong(s);
+	}
+
+	if (type != data->type)
+		die("object %s changed type!?", oid_to_hex(oid));
+	if (data->info.sizep && size != data->size && !use_mailmap)
+		die("object %s changed size!?", oid_to_hex(oid));
+
+	*sizep = size;
+	return contents;
+}
+
 static void print_object_or_die(struct batch_options *opt, struct expand_data *data)
 {
 	const struct object_id *oid = &data->oid;
@@ -422,26 +457,10 @@ static void print_object_or_die(struct batch_options *opt, struct expand_data *d
 		}
 	}
 	else {
-		enum object_type type;
 		unsigned long size;
 		void *contents;
 
-		contents = repo_read_object_file(the_repository, oid, &type,
-						 &size);
-		if (!contents)
-			die("object %s disappeared", oid_to_hex(oid));
-
-		if (use_mailmap) {
-			size_t s = size;
-			contents = replace_idents_using_mailmap(contents, &s);
-			size = cast_size_t_to_ulong(s);
-		}
-
-		if (type != data->type)
-			die("object %s changed type!?", oid_to_hex(oid));
-		if (data->info.sizep && size != data->size && !use_mailmap)
-			die("object %s changed size!?", oid_to_hex(oid));
-
+		contents = read_batch_object(data, &size);
 		batch_write(opt, contents, size);
 		free(contents);
 	}
@@ -460,48 +479,58 @@ static void print_default_format(struct strbuf *scratch, struct expand_data *dat
  * which the object may be accessed (though note that we may also rely on
  * data->oid, too). If "pack" is NULL, then offset is ignored.
  */
-static void batch_object_write(const char *obj_name,
-			       struct strbuf *scratch,
-			       struct batch_options *opt,
-			       struct expand_data *data,
+static int batch_object_lookup(struct expand_data *data,
 			       struct packed_git *pack,
 			       off_t offset)
 {
-	if (!data->skip_object_info) {
-		int ret;
-
-		if (use_mailmap)
-			data->info.typep = &data->type;
+	int ret;
 
-		if (pack)
-			ret = packed_object_info(the_repository, pack, offset,
-						 &data->info);
-		else
-			ret = oid_object_info_extended(the_repository,
-						       &data->oid, &data->info,
-						       OBJECT_INFO_LOOKUP_REPLACE);
-		if (ret < 0) {
-			printf("%s missing%c",
-			       obj_name ? obj_name : oid_to_hex(&data->oid), opt->output_delim);
-			fflush(stdout);
-			return;
-		}
+	if (data->skip_object_info)
+		return 0;
 
-		if (use_mailmap && (data->type == OBJ_COMMIT || data->type == OBJ_TAG)) {
-			size_t s = data->size;
-			char *buf = NULL;
+	if (use_mailmap)
+		data->info.typep = &data->type;
 
-			buf = repo_read_object_file(the_repository, &data->oid, &data->type,
-						    &data->size);
-			if (!buf)
-				die(_("unable to read %s"), oid_to_hex(&data->oid));
-			buf = replace_idents_using_mailmap(buf, &s);
-			data->size = cast_size_t_to_ulong(s);
+	if (pack)
+		ret = packed_object_info(the_repository, pack, offset,
+					 &data->info);
+	else
+		ret = oid_object_info_extended(the_repository,
+					       &data->oid, &data->info,
+					       OBJECT_INFO_LOOKUP_REPLACE);
+	if (ret < 0)
+		return ret;
+
+	if (use_mailmap && (data->type == OBJ_COMMIT || data->type == OBJ_TAG)) {
+		size_t s = data->size;
+		char *buf = NULL;
+
+		buf = repo_read_object_file(the_repository, &data->oid, &data->type,
+					    &data->size);
+		if (!buf)
+			die(_("unable to read %s"), oid_to_hex(&data->oid));
+		buf = replace_idents_using_mailmap(buf, &s);
+		data->size = cast_size_t_to_ulong(s);
 
-			free(buf);
-		}
+		free(buf);
 	}
 
+	return 0;
+}
+
+static void batch_object_missing(const char *obj_name,
+				 struct batch_options *opt,
+				 struct expand_data *data)
+{
+	printf("%s missing%c",
+	       obj_name ? obj_name : oid_to_hex(&data->oid), opt->output_delim);
+	fflush(stdout);
+}
+
+static void batch_object_header(struct strbuf *scratch,
+				struct batch_options *opt,
+				struct expand_data *data)
+{
 	strbuf_reset(scratch);
 
 	if (!opt->format) {
@@ -512,6 +541,21 @@ static void batch_object_write(const char *obj_name,
 	}
 
 	batch_write(opt, scratch->buf, scratch->len);
+}
+
+static void batch_object_write(const char *obj_name,
+			       struct strbuf *scratch,
+			       struct batch_options *opt,
+			       struct expand_data *data,
+			       struct packed_git *pack,
+			       off_t offset)
+{
+	if (batch_object_lookup(data, pack, offset) < 0) {
+		batch_object_missing(obj_name, opt, data);
+		return;
+	}
+
+	batch_object_header(scratch, opt, data);
 
 	if (opt->batch_mode == BATCH_MODE_CONTENTS) {
 		print_object_or_die(opt, data);
@@ -519,6 +563,302 @@ static void batch_object_write(const char *obj_name,
 	}
 }
 
+static void report_unresolved(const char *obj_name,
+			      struct batch_options *opt,
+			      enum get_oid_result result,
+			      struct object_context *ctx)
+{
+	switch (result) {
+	case FOUND:
+		/* resolved, but to a symlink pointing outside the tree */
+		printf("symlink %"PRIuMAX"%c%s%c",
+		       (uintmax_t)ctx->symlink_path.len,
+		       opt->output_delim, ctx->symlink_path.buf, opt->output_delim);
+		break;
+	case MISSING_OBJECT:
+		printf("%s missing%c", obj_name, opt->output_delim);
+		break;
+	case SHORT_NAME_AMBIGUOUS:
+		printf("%s ambiguous%c", obj_name, opt->output_delim);
+		break;
+	case DANGLING_SYMLINK:
+		printf("dangling %"PRIuMAX"%c%s%c",
+		       (uintmax_t)strlen(obj_name),
+		       opt->output_delim, obj_name, opt->output_delim);
+		break;
+	case SYMLINK_LOOP:
+		printf("loop %"PRIuMAX"%c%s%c",
+		       (uintmax_t)strlen(obj_name),
+		       opt->output_delim, obj_name, opt->output_delim);
+		break;
+	case NOT_DIR:
+		printf("notdir %"PRIuMAX"%c%s%c",
+		       (uintmax_t)strlen(obj_name),
+		       opt->output_delim, obj_name, opt->output_delim);
+		break;
+	default:
+		BUG("unknown get_sha1_with_context result %d\n",
+		       result);
+		break;
+	}
+	fflush(stdout);
+}
+
+/*
+ * With --threads, requests read from stdin are put into a ring of
+ * jobs. The main thread resolves each name (which may need the index,
+ * the refs or the tree being walked) and appends the job to the ring;
+ * worker threads then look up the object info and, for --batch, inflate
+ * the contents. The main thread emits finished jobs strictly in the
+ * order they were queued, so the output is identical to the unthreaded
+ * case.
+ *
+ * Blobs larger than core.bigFileThreshold are not read by the workers;
+ * they are streamed by the main thread when their turn comes, as usual.
+ */
+struct batch_job {
+	char *name;
+	char *rest;
+	enum batch_mode mode;
+	enum get_oid_result result;
+	struct object_context ctx;
+	struct expand_data data;
+	int ret;
+	void *contents;
+	unsigned long size;
+	unsigned done : 1;
+};
+
+struct batch_pool {
+	struct batch_options *opt;
+	struct batch_job *jobs;
+	size_t alloc;
+
+	/*
+	 * Monotonic counters; job "n" lives in jobs[n % alloc]. We
+	 * always have emitted <= started <= queued.
+	 */
+	size_t queued, started, emitted;
+
+	pthread_t *threads;
+	int nr_threads;
+	int shutdown;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_work;
+	pthread_cond_t cond_done;
+};
+
+#define BATCH_JOBS_PER_THREAD 16
+
+static void batch_job_run(struct batch_options *opt, struct batch_job *job)
+{
+	struct expand_data *data = &job->data;
+
+	job->ret = batch_object_lookup(data, NULL, 0);
+	if (job->ret < 0 ||
+	    job->mode != BATCH_MODE_CONTENTS ||
+	    opt->transform_mode)
+		return;
+	if (data->type == OBJ_BLOB &&
+	    (!data->info.sizep || data->size > big_file_threshold))
+		return;
+
+	job->contents = read_batch_object(data, &job->size);
+}
+
+static void *batch_pool_worker(void *arg)
+{
+	struct batch_pool *pool = arg;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		struct batch_job *job;
+
+		while (pool->started == pool->queued && !pool->shutdown)
+			pthread_cond_wait(&pool->cond_work, &pool->mutex);
+		if (pool->started == pool->queued)
+			break;
+
+		job = &pool->jobs[pool->started++ % pool->alloc];
+		if (job->done)
+			continue;
+
+		pthread_mutex_unlock(&pool->mutex);
+		batch_job_run(pool->opt, job);
+		pthread_mutex_lock(&pool->mutex);
+
+		job->done = 1;
+		pthread_cond_signal(&pool->cond_done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void batch_job_emit(struct batch_options *opt,
+			   struct strbuf *scratch,
+			   struct batch_job *job)
+{
+	if (job->result != FOUND || job->ctx.mode == 0) {
+		report_unresolved(job->name, opt, job->result, &job->ctx);
+		return;
+	}
+
+	if (job->ret < 0) {
+		batch_object_missing(job->name, opt, &job->data);
+		return;
+	}
+
+	batch_object_header(scratch, opt, &job->data);
+
+	if (job->mode == BATCH_MODE_CONTENTS) {
+		if (job->contents) {
+			batch_write(opt, job->contents, job->size);
+		} else {
+			/* workers may be reading packs concurrently */
+			obj_read_lock();
+			print_object_or_die(opt, &job->data);
+			obj_read_unlock();
+		}
+		batch_write(opt, &opt->output_delim, 1);
+	}
+}
+
+static void batch_job_release(struct batch_job *job)
+{
+	FREE_AND_NULL(job->name);
+	FREE_AND_NULL(job->rest);
+	FREE_AND_NULL(job->contents);
+	object_context_release(&job->ctx);
+}
+
+/*
+ * Emit finished jobs in order until at most "keep" jobs are left
+ * in flight.
+ */
+static void batch_pool_flush(struct batch_pool *pool,
+			     struct strbuf *scratch,
+			     size_t keep)
+{
+	while (pool->queued - pool->emitted > keep) {
+		struct batch_job *job = &pool->jobs[pool->emitted % pool->alloc];
+
+		pthread_mutex_lock(&pool->mutex);
+		while (!job->done)
+			pthread_cond_wait(&pool->cond_done, &pool->mutex);
+		/*
+		 * Jobs that needed no worker may be emitted before any
+		 * worker got to them; make sure that nobody picks up
+		 * their slot once it is reused.
+		 */
+		if (pool->started <= pool->emitted)
+			pool->started = pool->emitted + 1;
+		pthread_mutex_unlock(&pool->mutex);
+
+		batch_job_emit(pool->opt, scratch, job);
+		batch_job_release(job);
+		pool->emitted++;
+	}
+}
+
+static void batch_pool_submit(struct batch_pool *pool,
+			      const char *obj_name,
+			      struct strbuf *scratch,
+			      struct expand_data *data)
+{
+	struct batch_options *opt = pool->opt;
+	struct batch_job *job;
+	int flags =
+		GET_OID_HASH_ANY |
+		(opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0);
+
+	batch_pool_flush(pool, scratch, pool->alloc - 1);
+
+	job = &pool->jobs[pool->queued % pool->alloc];
+	job->name = xstrdup(obj_name);
+	job->rest = xstrdup_or_null(data->rest);
+	job->mode = opt->batch_mode;
+	job->ret = 0;
+	job->done = 0;
+	memset(&job->ctx, 0, sizeof(job->ctx));
+
+	/* point the object_info at the copy, not at the template */
+	job->data = *data;
+	job->data.rest = job->rest;
+	if (data->info.typep)
+		job->data.info.typep = &job->data.type;
+	if (data->info.sizep)
+		job->data.info.sizep = &job->data.size;
+	if (data->info.disk_sizep)
+		job->data.info.disk_sizep = &job->data.disk_size;
+	if (data->info.delta_base_oid)
+		job->data.info.delta_base_oid = &job->data.delta_base_oid;
+
+	obj_read_lock();
+	job->result = get_oid_with_context(the_repository, obj_name, flags,
+					   &job->data.oid, &job->ctx);
+	obj_read_unlock();
+	if (job->result != FOUND || job->ctx.mode == 0)
+		job->done = 1;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->queued++;
+	pthread_cond_signal(&pool->cond_work);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static struct batch_pool *batch_pool_start(struct batch_options *opt)
+{
+	struct batch_pool *pool;
+	int i;
+
+	CALLOC_ARRAY(pool, 1);
+	pool->opt = opt;
+	pool->nr_threads = opt->threads;
+	pool->alloc = st_mult(opt->threads, BATCH_JOBS_PER_THREAD);
+	CALLOC_ARRAY(pool->jobs, pool->alloc);
+	CALLOC_ARRAY(pool->threads, pool->nr_threads);
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond_work, NULL);
+	pthread_cond_init(&pool->cond_done, NULL);
+
+	enable_obj_read_lock();
+
+	for (i = 0; i < pool->nr_threads; i++) {
+		int err = pthread_create(&pool->threads[i], NULL,
+					 batch_pool_worker, pool);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	return pool;
+}
+
+static void batch_pool_finish(struct batch_pool *pool, struct strbuf *scratch)
+{
+	int i;
+
+	batch_pool_flush(pool, scratch, 0);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->cond_work);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->nr_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	disable_obj_read_lock();
+
+	pthread_cond_destroy(&pool->cond_done);
+	pthread_cond_destroy(&pool->cond_work);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool->jobs);
+	free(pool);
+}
+
 static void batch_one_object(const char *obj_name,
 			     struct strbuf *scratch,
 			     struct batch_options *opt,
@@ -530,46 +870,15 @@ static void batch_one_object(const char *obj_name,
 		(opt->follow_symlinks ? GET_OID_FOLLOW_SYMLINKS : 0);
 	enum get_oid_result result;
 
-	result = get_oid_with_context(the_repository, obj_name,
-				      flags, &data->oid, &ctx);
-	if (result != FOUND) {
-		switch (result) {
-		case MISSING_OBJECT:
-			printf("%s missing%c", obj_name, opt->output_delim);
-			break;
-		case SHORT_NAME_AMBIGUOUS:
-			printf("%s ambiguous%c", obj_name, opt->output_delim);
-			break;
-		case DANGLING_SYMLINK:
-			printf("dangling %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
-			break;
-		case SYMLINK_LOOP:
-			printf("loop %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
-			break;
-		case NOT_DIR:
-			printf("notdir %"PRIuMAX"%c%s%c",
-			       (uintmax_t)strlen(obj_name),
-			       opt->output_delim, obj_name, opt->output_delim);
-			break;
-		default:
-			BUG("unknown get_sha1_with_context result %d\n",
-			       result);
-			break;
-		}
-		fflush(stdout);
-
-		goto out;
+	if (opt->pool && opt->buffer_output) {
+		batch_pool_submit(opt->pool, obj_name, scratch, data);
+		return;
 	}
 
-	if (ctx.mode == 0) {
-		printf("symlink %"PRIuMAX"%c%s%c",
-		       (uintmax_t)ctx.symlink_path.len,
-		       opt->output_delim, ctx.symlink_path.buf, opt->output_delim);
-		fflush(stdout);
+	result = get_oid_with_context(the_repository, obj_name,
+				      flags, &data->oid, &ctx);
+	if (result != FOUND || ctx.mode == 0) {
+		report_unresolved(obj_name, opt, result, &ctx);
 		goto out;
 	}
 
@@ -683,6 +992,8 @@ static void dispatch_calls(struct batch_options *opt,
 
 	for (i = 0; i < nr; i++)
 		cmd[i].fn(opt, cmd[i].line, output, data);
+	if (opt->pool)
+		batch_pool_flush(opt->pool, output, 0);
 
 	fflush(stdout);
 }
@@ -860,6 +1171,9 @@ static int batch_objects(struct batch_options *opt)
 	save_warning = warn_on_object_refname_ambiguity;
 	warn_on_object_refname_ambiguity = 0;
 
+	if (opt->threads > 1)
+		opt->pool = batch_pool_start(opt);
+
 	if (opt->batch_mode == BATCH_MODE_QUEUE_AND_DISPATCH) {
 		batch_objects_command(opt, &output, &data);
 		goto cleanup;
@@ -884,6 +1198,10 @@ static int batch_objects(struct batch_options *opt)
 	}
 
  cleanup:
+	if (opt->pool) {
+		batch_pool_finish(opt->pool, &output);
+		opt->pool = NULL;
+	}
 	strbuf_release(&input);
 	strbuf_release(&output);
 	warn_on_object_refname_ambiguity = save_warning;
@@ -948,7 +1266,7 @@ int cmd_cat_file(int argc,
 		N_("git cat-file (--textconv | --filters)\n"
 		   "             [<rev>:<path|tree-ish> | --path=<path|tree-ish> <rev>]"),
 		N_("git cat-file (--batch | --batch-check | --batch-command) [--batch-all-objects]\n"
-		   "             [--buffer] [--follow-symlinks] [--unordered]\n"
+		   "             [--buffer] [--threads=<n>] [--follow-symlinks] [--unordered]\n"
 		   "             [--textconv | --filters] [-Z]"),
 		NULL
 	};
@@ -988,6 +1306,8 @@ int cmd_cat_file(int argc,
 		/* Batch-specific options */
 		OPT_GROUP(N_("Change or optimize batch output")),
 		OPT_BOOL(0, "buffer", &batch.buffer_output, N_("buffer --batch output")),
+		OPT_INTEGER(0, "threads", &batch.threads,
+			    N_("use <n> threads to look up and read objects")),
 		OPT_BOOL(0, "follow-symlinks", &batch.follow_symlinks,
 			 N_("follow in-tree symlinks")),
 		OPT_BOOL(0, "unordered", &batch.unordered,
@@ -1006,6 +1326,7 @@ int cmd_cat_file(int argc,
 	git_config(git_cat_file_config, NULL);
 
 	batch.buffer_output = -1;
+	batch.threads = 1;
 
 	argc = parse_options(argc, argv, prefix, options, usage, 0);
 	opt_cw = (opt == 'c' || opt == 'w');
@@ -1034,6 +1355,9 @@ int cmd_cat_file(int argc,
 	else if (batch.buffer_output >= 0)
 		usage_msg_optf(_("'%s' requires a batch mode"), usage, options,
 			       "--buffer");
+	else if (batch.threads != 1)
+		usage_msg_optf(_("'%s' requires a batch mode"), usage, options,
+			       "--threads");
 	else if (batch.all_objects)
 		usage_msg_optf(_("'%s' requires a batch mode"), usage, options,
 			       "--batch-all-objects");
@@ -1051,8 +1375,16 @@ int cmd_cat_file(int argc,
 		batch.input_delim = batch.output_delim = '\0';
 
 	/* Batch defaults */
+	if (batch.threads < 0)
+		die(_("invalid number of threads specified (%d)"), batch.threads);
+	if (!batch.threads)
+		batch.threads = online_cpus();
+	if (batch.threads > 1 && !HAVE_THREADS) {
+		warning(_("no threads support, ignoring --threads"));
+		batch.threads = 1;
+	}
 	if (batch.buffer_output < 0)
-		batch.buffer_output = batch.all_objects;
+		batch.buffer_output = batch.all_objects || batch.threads > 1;
 
 	prepare_repo_settings(the_repository);
 	the_repository->settings.command_requires_full_index = 0;
@@ -6,6 +6,7 @@
 #include "entry.h"
 #include "gettext.h"
 #include "parallel-checkout.h"
+#include "parse.h"
 #include "parse-options.h"
 #include "pkt-line.h"
 #include "read-cache-ll.h"
@@ -81,31 +82,58 @@ static void release_pc_item_data(struct parallel_checkout_item *pc_item)
 	discard_cache_entry(pc_item->ce);
 }
 
+static void write_batch(struct checkout *state,
+			struct parallel_checkout_item *items, size_t nr)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		struct parallel_checkout_item *pc_item = &items[i];
+		write_pc_item(pc_item, state);
+		report_result(pc_item);
+		release_pc_item_data(pc_item);
+	}
+}
+
+/*
+ * The main process sends the items in one or more batches, each one ended
+ * by a flush packet, and closes our stdin after the last one. The batches
+ * are written as soon as they arrive, so that the main process can keep on
+ * queueing entries while we work.
+ */
 static void worker_loop(struct checkout *state)
 {
 	struct parallel_checkout_item *items = NULL;
-	size_t i, nr = 0, alloc = 0;
+	size_t nr = 0, alloc = 0;
+	unsigned long batches = 0;
+	unsigned long die_after = git_env_ulong("GIT_TEST_CHECKOUT_WORKER_DIE_AFTER", 0);
 
 	while (1) {
-		int len = packet_read(0, packet_buffer, sizeof(packet_buffer),
-				      0);
+		enum packet_read_status status;
+		int len;
+
+		status = packet_read_with_status(0, NULL, NULL, packet_buffer,
+						 sizeof(packet_buffer), &len,
+						 PACKET_READ_GENTLE_ON_EOF);
 
-		if (len < 0)
-			BUG("packet_read() returned negative value");
-		else if (!len)
+		if (status == PACKET_READ_EOF) {
+			if (nr)
+				die("checkout worker got incomplete batch");
 			break;
+		} else if (status == PACKET_READ_FLUSH) {
+			write_batch(state, items, nr);
+			nr = 0;
+			if (die_after && ++batches == die_after)
+				die("checkout worker exiting as requested");
+			continue;
+		} else if (status != PACKET_READ_NORMAL) {
+			BUG("unexpected packet from main process");
+		}
 
 		ALLOC_GROW(items, nr + 1, alloc);
 		packet_to_pc_item(packet_buffer, len, &items[nr++]);
 	}
 
-	for (i = 0; i < nr; i++) {
-		struct parallel_checkout_item *pc_item = &items[i];
-		write_pc_item(pc_item, state);
-		report_result(pc_item);
-		release_pc_item_data(pc_item);
-	}
-
 	packet_flush(1);
 
 	free(items);
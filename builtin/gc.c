@@ -38,6 +38,7 @@
 #include "promisor-remote.h"
 #include "refs.h"
 #include "remote.h"
+#include "rename-cache.h"
 #include "exec-cmd.h"
 #include "gettext.h"
 #include "hook.h"
@@ -883,6 +884,8 @@ struct repository *repo UNUSED)
 					     !quiet && !daemonized ? COMMIT_GRAPH_WRITE_PROGRESS : 0,
 					     NULL);
 
+	rename_cache_gc(the_repository);
+
 	if (opts.auto_flag && too_many_loose_objects(&cfg))
 		warning(_("There are too many unreachable loose objects; "
 			"run 'git prune' to remove them."));
@@ -979,12 +979,13 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
  * Ensure that this node has been reconstructed and return its contents.
  *
  * In the typical and best case, this node would already be reconstructed
- * (through the invocation to resolve_delta() in threaded_second_pass()) and it
- * would not be pruned. However, if pruning of this node was necessary due to
- * reaching delta_base_cache_limit, this function will find the closest
- * ancestor with reconstructed data that has not been pruned (or if there is
- * none, the ultimate base object), and reconstruct each node in the delta
- * chain in order to generate the reconstructed data for this node.
+ * (through the invocation to resolve_deltas_of() in threaded_second_pass())
+ * and it would not be pruned. However, if pruning of this node was
+ * necessary due to reaching delta_base_cache_limit, this function will
+ * find the closest ancestor with reconstructed data that has not been
+ * pruned (or if there is none, the ultimate base object), and reconstruct
+ * each node in the delta chain in order to generate the reconstructed data
+ * for this node.
  */
 static void *get_base_data(struct base_data *c)
 {
@@ -1040,44 +1041,60 @@ static struct base_data *make_base(struct object_entry *obj,
 	return base;
 }
 
-static struct base_data *resolve_delta(struct object_entry *delta_obj,
-				       struct base_data *base)
+/*
+ * The most children of one base that threaded_second_pass() resolves
+ * at once, so that their names can be computed in parallel (see
+ * hash_object_file_multi()).
+ */
+#define MAX_SIBLINGS 8
+
+static void resolve_deltas_of(struct base_data *base,
+			      struct object_entry **delta_obj,
+			      struct base_data **result, int nr)
 {
-	void *delta_data, *result_data;
-	struct base_data *result;
-	unsigned long result_size;
-
-	if (show_stat) {
-		int i = delta_obj - objects;
-		int j = base->obj - objects;
-		obj_stat[i].delta_depth = obj_stat[j].delta_depth + 1;
-		deepest_delta_lock();
-		if (deepest_delta < obj_stat[i].delta_depth)
-			deepest_delta = obj_stat[i].delta_depth;
-		deepest_delta_unlock();
-		obj_stat[i].base_object_no = j;
+	struct hash_object_item item[MAX_SIBLINGS];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		void *delta_data;
+
+		if (show_stat) {
+			int k = delta_obj[i] - objects;
+			int j = base->obj - objects;
+			obj_stat[k].delta_depth = obj_stat[j].delta_depth + 1;
+			deepest_delta_lock();
+			if (deepest_delta < obj_stat[k].delta_depth)
+				deepest_delta = obj_stat[k].delta_depth;
+			deepest_delta_unlock();
+			obj_stat[k].base_object_no = j;
+		}
+		delta_data = get_data_from_pack(delta_obj[i]);
+		assert(base->data);
+		item[i].buf = patch_delta(base->data, base->size,
+					  delta_data, delta_obj[i]->size,
+					  &item[i].len);
+		free(delta_data);
+		if (!item[i].buf)
+			bad_object(delta_obj[i]->idx.offset,
+				   _("failed to apply delta"));
+		item[i].type = delta_obj[i]->real_type;
+	}
+
+	hash_object_file_multi(the_hash_algo, item, nr);
+
+	for (i = 0; i < nr; i++) {
+		oidcpy(&delta_obj[i]->idx.oid, &item[i].oid);
+		sha1_object(item[i].buf, NULL, item[i].len, item[i].type,
+			    &delta_obj[i]->idx.oid);
+
+		result[i] = make_base(delta_obj[i], base);
+		result[i]->data = (void *)item[i].buf;
+		result[i]->size = item[i].len;
 	}
-	delta_data = get_data_from_pack(delta_obj);
-	assert(base->data);
-	result_data = patch_delta(base->data, base->size,
-				  delta_data, delta_obj->size, &result_size);
-	free(delta_data);
-	if (!result_data)
-		bad_object(delta_obj->idx.offset, _("failed to apply delta"));
-	hash_object_file(the_hash_algo, result_data, result_size,
-			 delta_obj->real_type, &delta_obj->idx.oid);
-	sha1_object(result_data, NULL, result_size, delta_obj->real_type,
-		    &delta_obj->idx.oid);
-
-	result = make_base(delta_obj, base);
-	result->data = result_data;
-	result->size = result_size;
 
 	counter_lock();
-	nr_resolved_deltas++;
+	nr_resolved_deltas += nr;
 	counter_unlock();
-
-	return result;
 }
 
 static int compare_ofs_delta_entry(const void *a, const void *b)
@@ -1100,12 +1117,17 @@ static int compare_ref_delta_entry(const void *a, const void *b)
 
 static void *threaded_second_pass(void *data)
 {
+	int max_siblings = the_hash_algo->multi_lanes > 1 ?
+		MAX_SIBLINGS : 1;
+
 	if (data)
 		set_thread_data(data);
 	for (;;) {
 		struct base_data *parent = NULL;
-		struct object_entry *child_obj;
-		struct base_data *child;
+		struct object_entry *child_obj[MAX_SIBLINGS];
+		struct base_data *child[MAX_SIBLINGS];
+		int nr_children = 0;
+		int i;
 
 		counter_lock();
 		display_progress(progress, nr_resolved_deltas);
@@ -1123,28 +1145,36 @@ static void *threaded_second_pass(void *data)
 				work_unlock();
 				break;
 			}
-			child_obj = &objects[nr_dispatched++];
+			child_obj[nr_children++] = &objects[nr_dispatched++];
 		} else {
 			/*
-			 * Peek at the top of the stack, and take a child from
-			 * it.
+			 * Peek at the top of the stack, and take some of its
+			 * children.
 			 */
 			parent = list_first_entry(&work_head, struct base_data,
 						  list);
 
-			if (parent->ref_first <= parent->ref_last) {
-				int offset = ref_deltas[parent->ref_first++].obj_no;
-				child_obj = objects + offset;
-				if (child_obj->real_type != OBJ_REF_DELTA)
-					die("REF_DELTA at offset %"PRIuMAX" already resolved (duplicate base %s?)",
-					    (uintmax_t) child_obj->idx.offset,
-					    oid_to_hex(&parent->obj->idx.oid));
-				child_obj->real_type = parent->obj->real_type;
-			} else {
-				child_obj = objects +
-					ofs_deltas[parent->ofs_first++].obj_no;
-				assert(child_obj->real_type == OBJ_OFS_DELTA);
-				child_obj->real_type = parent->obj->real_type;
+			while (nr_children < max_siblings &&
+			       (parent->ref_first <= parent->ref_last ||
+				parent->ofs_first <= parent->ofs_last)) {
+				struct object_entry *obj;
+
+				if (parent->ref_first <= parent->ref_last) {
+					int offset = ref_deltas[parent->ref_first++].obj_no;
+					obj = objects + offset;
+					if (obj->real_type != OBJ_REF_DELTA)
+						die("REF_DELTA at offset %"PRIuMAX" already resolved (duplicate base %s?)",
+						    (uintmax_t) obj->idx.offset,
+						    oid_to_hex(&parent->obj->idx.oid));
+					obj->real_type = parent->obj->real_type;
+				} else {
+					obj = objects +
+						ofs_deltas[parent->ofs_first++].obj_no;
+					assert(obj->real_type == OBJ_OFS_DELTA);
+					obj->real_type = parent->obj->real_type;
+				}
+				child_obj[nr_children++] = obj;
+				parent->retain_data++;
 			}
 
 			if (parent->ref_first > parent->ref_last &&
@@ -1169,17 +1199,17 @@ static void *threaded_second_pass(void *data)
 			 * not happen.
 			 */
 			get_base_data(parent);
-			parent->retain_data++;
 		}
 		work_unlock();
 
 		if (parent) {
-			child = resolve_delta(child_obj, parent);
-			if (!child->children_remaining)
-				FREE_AND_NULL(child->data);
+			resolve_deltas_of(parent, child_obj, child, nr_children);
+			for (i = 0; i < nr_children; i++)
+				if (!child[i]->children_remaining)
+					FREE_AND_NULL(child[i]->data);
 		} else {
-			child = make_base(child_obj, NULL);
-			if (child->children_remaining) {
+			child[0] = make_base(child_obj[0], NULL);
+			if (child[0]->children_remaining) {
 				/*
 				 * Since this child has its own delta children,
 				 * we will need this data in the future.
@@ -1187,46 +1217,48 @@ static void *threaded_second_pass(void *data)
 				 * have access to this object's data while
 				 * outside the work mutex.
 				 */
-				child->data = get_data_from_pack(child_obj);
-				child->size = child_obj->size;
+				child[0]->data = get_data_from_pack(child_obj[0]);
+				child[0]->size = child_obj[0]->size;
 			}
 		}
 
 		work_lock();
-		if (parent)
-			parent->retain_data--;
-		if (child->data) {
-			/*
-			 * This child has its own children, so add it to
-			 * work_head.
-			 */
-			list_add(&child->list, &work_head);
-			base_cache_used += child->size;
-			prune_base_data(NULL);
-			free_base_data(child);
-		} else {
-			/*
-			 * This child does not have its own children. It may be
-			 * the last descendant of its ancestors; free those
-			 * that we can.
-			 */
-			struct base_data *p = parent;
+		for (i = 0; i < nr_children; i++) {
+			if (parent)
+				parent->retain_data--;
+			if (child[i]->data) {
+				/*
+				 * This child has its own children, so add it
+				 * to work_head.
+				 */
+				list_add(&child[i]->list, &work_head);
+				base_cache_used += child[i]->size;
+				prune_base_data(NULL);
+				free_base_data(child[i]);
+			} else {
+				/*
+				 * This child does not have its own children.
+				 * It may be the last descendant of its
+				 * ancestors; free those that we can.
+				 */
+				struct base_data *p = parent;
 
-			while (p) {
-				struct base_data *next_p;
+				while (p) {
+					struct base_data *next_p;
 
-				p->children_remaining--;
-				if (p->children_remaining)
-					break;
+					p->children_remaining--;
+					if (p->children_remaining)
+						break;
 
-				next_p = p->base;
-				free_base_data(p);
-				list_del(&p->list);
-				free(p);
+					next_p = p->base;
+					free_base_data(p);
+					list_del(&p->list);
+					free(p);
 
-				p = next_p;
+					p = next_p;
+				}
+				FREE_AND_NULL(child[i]);
 			}
-			FREE_AND_NULL(child);
 		}
 		work_unlock();
 	}
@@ -39,7 +39,8 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void trivial_merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base,
+				int depth);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -239,7 +240,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(r, t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	trivial_merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase, info->depth);
 
 	free(buf0);
 	free(buf1);
@@ -358,12 +359,14 @@ static int threeway_callback(int n UNUSED, unsigned long mask,
 	return mask;
 }
 
-static void trivial_merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base,
+				int depth)
 {
 	struct traverse_info info;
 
 	setup_traverse_info(&info, base);
 	info.fn = threeway_callback;
+	info.depth = depth;
 	traverse_trees(the_repository->index, 3, t, &info);
 }
 
@@ -393,7 +396,7 @@ static int trivial_merge(const char *base,
 	buf1 = get_tree_descriptor(r, t+0, base);
 	buf2 = get_tree_descriptor(r, t+1, branch1);
 	buf3 = get_tree_descriptor(r, t+2, branch2);
-	trivial_merge_trees(t, "");
+	trivial_merge_trees(t, "", 0);
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -415,8 +418,23 @@ struct merge_tree_options {
 	int name_only;
 	int use_stdin;
 	struct merge_options merge_options;
+
+	/*
+	 * With --stdin, the result of the previous merge, so that the next
+	 * one can reuse its allocations, and its renames when it continues
+	 * a sequence of cherry-picks.
+	 */
+	struct merge_result batch_result;
 };
 
+static void free_commit_tree_buffer(struct commit *commit)
+{
+	struct tree *tree = repo_get_commit_tree(the_repository, commit);
+
+	if (tree)
+		free_tree_buffer(tree);
+}
+
 static int real_merge(struct merge_tree_options *o,
 		      const char *merge_base,
 		      const char *branch1, const char *branch2,
@@ -424,7 +442,8 @@ static int real_merge(struct merge_tree_options *o,
 {
 	struct commit *parent1, *parent2;
 	struct commit_list *merge_bases = NULL;
-	struct merge_result result = { 0 };
+	struct merge_result single_result = { 0 };
+	struct merge_result *result = &single_result;
 	int show_messages = o->show_messages;
 	struct merge_options opt;
 
@@ -460,8 +479,27 @@ static int real_merge(struct merge_tree_options *o,
 			die(_("unable to read tree (%s)"), oid_to_hex(&merge_oid));
 
 		opt.ancestor = merge_base;
-		merge_incore_nonrecursive(&opt, base_tree, parent1_tree, parent2_tree, &result);
+		if (o->use_stdin)
+			result = &o->batch_result;
+		merge_incore_nonrecursive(&opt, base_tree, parent1_tree, parent2_tree, result);
+
+		/*
+		 * The trees are only needed again if the next merge reuses
+		 * this result, and then only for their object names.
+		 */
+		free_tree_buffer(base_tree);
+		free_tree_buffer(parent1_tree);
+		free_tree_buffer(parent2_tree);
 	} else {
+		struct commit_list *j;
+
+		/*
+		 * Renames cannot be reused by a recursive merge; release
+		 * the result of a previous merge from --stdin.
+		 */
+		merge_finalize(&o->merge_options, &o->batch_result);
+		memset(&o->batch_result, 0, sizeof(o->batch_result));
+
 		parent1 = get_merge_parent(branch1);
 		if (!parent1)
 			help_unknown_ref(branch1, "merge-tree",
@@ -482,24 +520,30 @@ static int real_merge(struct merge_tree_options *o,
 		if (!merge_bases && !o->allow_unrelated_histories)
 			die(_("refusing to merge unrelated histories"));
 		merge_bases = reverse_commit_list(merge_bases);
-		merge_incore_recursive(&opt, merge_bases, parent1, parent2, &result);
+		merge_incore_recursive(&opt, merge_bases, parent1, parent2, result);
+
+		free_commit_tree_buffer(parent1);
+		free_commit_tree_buffer(parent2);
+		for (j = merge_bases; j; j = j->next)
+			free_commit_tree_buffer(j->item);
 		free_commit_list(merge_bases);
 	}
 
-	if (result.clean < 0)
+	if (result->clean < 0)
 		die(_("failure to merge"));
+	free_tree_buffer(result->tree);
 
 	if (show_messages == -1)
-		show_messages = !result.clean;
+		show_messages = !result->clean;
 
 	if (o->use_stdin)
-		printf("%d%c", result.clean, line_termination);
-	printf("%s%c", oid_to_hex(&result.tree->object.oid), line_termination);
-	if (!result.clean) {
+		printf("%d%c", result->clean, line_termination);
+	printf("%s%c", oid_to_hex(&result->tree->object.oid), line_termination);
+	if (!result->clean) {
 		struct string_list conflicted_files = STRING_LIST_INIT_NODUP;
 		const char *last = NULL;
 
-		merge_get_conflicted_files(&result, &conflicted_files);
+		merge_get_conflicted_files(result, &conflicted_files);
 		for (size_t i = 0; i < conflicted_files.nr; i++) {
 			const char *name = conflicted_files.items[i].string;
 			struct stage_info *c = conflicted_files.items[i].util;
@@ -517,13 +561,14 @@ static int real_merge(struct merge_tree_options *o,
 	if (show_messages) {
 		putchar(line_termination);
 		merge_display_update_messages(&opt, line_termination == '\0',
-					      &result);
+					      result);
 	}
 	if (o->use_stdin)
 		putchar(line_termination);
-	merge_finalize(&opt, &result);
+	if (result == &single_result)
+		merge_finalize(&opt, result);
 	clear_merge_options(&opt);
-	return !result.clean; /* result.clean < 0 handled above */
+	return !result->clean; /* result->clean < 0 handled above */
 }
 
 int cmd_merge_tree(int argc,
@@ -598,6 +643,11 @@ int cmd_merge_tree(int argc,
 			die(_("options '%s' and '%s' cannot be used together"),
 			    "--merge-base", "--stdin");
 		line_termination = '\0';
+		/*
+		 * Commit messages are not needed by the merges, and would
+		 * otherwise accumulate in memory over many input lines.
+		 */
+		save_commit_buffer = 0;
 		while (strbuf_getline_lf(&buf, stdin) != EOF) {
 			struct strbuf **split;
 			int result;
@@ -629,6 +679,7 @@ int cmd_merge_tree(int argc,
 			strbuf_list_free(split);
 		}
 		strbuf_release(&buf);
+		merge_finalize(&o.merge_options, &o.batch_result);
 
 		ret = 0;
 		goto out;
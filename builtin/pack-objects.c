@@ -225,6 +225,7 @@ static size_t reuse_packfiles_nr;
 static size_t reuse_packfiles_used_nr;
 static uint32_t reuse_packfile_objects;
 static struct bitmap *reuse_packfile_bitmap;
+static struct bitmap *reuse_packfile_rewrite;
 
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
@@ -1101,6 +1102,43 @@ static void write_reused_pack_one(struct packed_git *reuse_packfile,
 	copy_pack_data(out, reuse_packfile, w_curs, offset, next - offset);
 }
 
+/*
+ * Consecutive objects of the reused pack that are copied verbatim are
+ * collected here and written with a single copy_pack_data().
+ */
+struct reused_range {
+	off_t start;
+	off_t end;
+};
+
+static void flush_reused_range(struct packed_git *reuse_packfile,
+			       struct hashfile *out,
+			       struct pack_window **w_curs,
+			       struct reused_range *range)
+{
+	if (range->start < range->end)
+		copy_pack_data(out, reuse_packfile, w_curs, range->start,
+			       range->end - range->start);
+	range->start = range->end = 0;
+}
+
+static void add_reused_range(struct packed_git *reuse_packfile,
+			     size_t pos, struct hashfile *out,
+			     off_t pack_start,
+			     struct pack_window **w_curs,
+			     struct reused_range *range)
+{
+	off_t offset = pack_pos_to_offset(reuse_packfile, pos);
+
+	if (offset != range->end) {
+		flush_reused_range(reuse_packfile, out, w_curs, range);
+		record_reused_object(offset,
+				     offset - (hashfile_total(out) - pack_start));
+		range->start = offset;
+	}
+	range->end = pack_pos_to_offset(reuse_packfile, pos + 1);
+}
+
 static size_t write_reused_pack_verbatim(struct bitmapped_pack *reuse_packfile,
 					 struct hashfile *out,
 					 struct pack_window **w_curs)
@@ -1170,6 +1208,13 @@ static void write_reused_pack(struct bitmapped_pack *reuse_packfile,
 	uint32_t offset;
 	off_t pack_start = hashfile_total(f) - sizeof(struct pack_header);
 	struct pack_window *w_curs = NULL;
+	struct reused_range range = { 0 };
+	/*
+	 * Objects of the first pack that do not need their delta base
+	 * offset rewritten follow each other in the output as they do in
+	 * the pack, so they can be copied without looking at them.
+	 */
+	int copy_ranges = allow_ofs_delta && !reuse_packfile->bitmap_pos;
 
 	if (allow_ofs_delta)
 		i = write_reused_pack_verbatim(reuse_packfile, f, &w_curs);
@@ -1221,13 +1266,22 @@ static void write_reused_pack(struct bitmapped_pack *reuse_packfile,
 				pack_pos = pos + offset;
 			}
 
-			write_reused_pack_one(reuse_packfile->p, pack_pos, f,
-					      pack_start, &w_curs);
+			if (copy_ranges &&
+			    !bitmap_get(reuse_packfile_rewrite, pos + offset)) {
+				add_reused_range(reuse_packfile->p, pack_pos, f,
+						 pack_start, &w_curs, &range);
+			} else {
+				flush_reused_range(reuse_packfile->p, f,
+						   &w_curs, &range);
+				write_reused_pack_one(reuse_packfile->p, pack_pos,
+						      f, pack_start, &w_curs);
+			}
 			display_progress(progress_state, ++written);
 		}
 	}
 
 done:
+	flush_reused_range(reuse_packfile->p, f, &w_curs, &range);
 	unuse_pack(&w_curs);
 }
 
@@ -1358,7 +1412,8 @@ static void write_pack_file(void)
 
 			if (write_bitmap_index) {
 				bitmap_writer_init(&bitmap_writer,
-						   the_repository, &to_pack);
+						   the_repository, &to_pack,
+						   NULL);
 				bitmap_writer_set_checksum(&bitmap_writer, hash);
 				bitmap_writer_build_type_index(&bitmap_writer,
 							       written_list);
@@ -2498,10 +2553,7 @@ static pthread_mutex_t cache_mutex;
 #define cache_lock()		pthread_mutex_lock(&cache_mutex)
 #define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
 
-/*
- * Protect object list partitioning (e.g. struct thread_param) and
- * progress_state
- */
+/* Protect progress_state and the shared count of processed objects */
 static pthread_mutex_t progress_mutex;
 #define progress_lock()		pthread_mutex_lock(&progress_mutex)
 #define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
@@ -2510,7 +2562,7 @@ static pthread_mutex_t progress_mutex;
  * Access to struct object_entry is unprotected since each thread owns
  * a portion of the main object list. Just don't access object entries
  * ahead in the list because they can be stolen and would need
- * progress_mutex for protection.
+ * the owning thread's mutex (see struct thread_params) for protection.
  */
 
 static inline int oe_size_less_than(struct packing_data *pack,
@@ -2752,12 +2804,39 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
+/*
+ * Number of objects a delta search thread processes before it adds
+ * them to the shared progress count.  Taking progress_mutex for every
+ * single object makes it the hottest lock in the process when there
+ * are many threads.
+ */
+#define DELTA_PROGRESS_BATCH 64
+
+static void flush_delta_progress(unsigned *processed, unsigned *pending)
+{
+	if (!*pending)
+		return;
+	progress_lock();
+	*processed += *pending;
+	display_progress(progress_state, *processed);
+	progress_unlock();
+	*pending = 0;
+}
+
+/*
+ * Search for deltas among the first *list_size entries of list.
+ *
+ * *list_size is protected by list_mutex: other threads may shrink it
+ * from the tail to steal work from us while we are running.
+ */
 static void find_deltas(struct object_entry **list, unsigned *list_size,
-			int window, int depth, unsigned *processed)
+			int window, int depth, unsigned *processed,
+			pthread_mutex_t *list_mutex)
 {
 	uint32_t i, idx = 0, count = 0;
 	struct unpacked *array;
 	unsigned long mem_usage = 0;
+	unsigned pending = 0;
 
 	CALLOC_ARRAY(array, window);
 
@@ -2766,18 +2845,18 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		struct unpacked *n = array + idx;
 		int j, max_depth, best_base = -1;
 
-		progress_lock();
+		pthread_mutex_lock(list_mutex);
 		if (!*list_size) {
-			progress_unlock();
+			pthread_mutex_unlock(list_mutex);
 			break;
 		}
 		entry = *list++;
 		(*list_size)--;
-		if (!entry->preferred_base) {
-			(*processed)++;
-			display_progress(progress_state, *processed);
-		}
-		progress_unlock();
+		pthread_mutex_unlock(list_mutex);
+
+		if (!entry->preferred_base &&
+		    ++pending >= DELTA_PROGRESS_BATCH)
+			flush_delta_progress(processed, &pending);
 
 		mem_usage -= free_unpacked(n);
 		n->entry = entry;
@@ -2887,6 +2966,8 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 			idx = 0;
 	}
 
+	flush_delta_progress(processed, &pending);
+
 	for (i = 0; i < window; ++i) {
 		free_delta_index(array[i].index);
 		free(array[i].data);
@@ -2898,16 +2979,15 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
  * The main object list is split into smaller lists, each is handed to
  * one worker.
  *
- * The main thread waits on the condition that (at least) one of the workers
- * has stopped working (which is indicated in the .working member of
- * struct thread_params).
- *
- * When a work thread has completed its work, it sets .working to 0 and
- * signals the main thread and waits on the condition that .data_ready
- * becomes 1.
+ * Each worker takes objects from the front of its own list, under its
+ * own mutex, which nobody else touches unless they are out of work.
  *
- * The main thread steals half of the work from the worker that has
- * most work left to hand it to the idle worker.
+ * When a worker has completed its list, it steals half of the work
+ * from the tail of the list of the worker that has most work left,
+ * splitting on "path" (name hash) boundaries where possible so that
+ * objects which are likely to delta against each other stay in the
+ * same window.  A worker exits once no other list is long enough to
+ * be worth splitting anymore.
  */
 
 struct thread_params {
@@ -2917,15 +2997,12 @@ struct thread_params {
 	unsigned remaining;
 	int window;
 	int depth;
-	int working;
-	int data_ready;
 	pthread_mutex_t mutex;
-	pthread_cond_t cond;
 	unsigned *processed;
+	struct thread_params *all;
+	int nr_threads;
 };
 
-static pthread_cond_t progress_cond;
-
 /*
  * Mutex and conditional variable can't be statically-initialized on Windows.
  */
@@ -2933,50 +3010,97 @@ static void init_threaded_search(void)
 {
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
-	pthread_cond_init(&progress_cond, NULL);
 }
 
 static void cleanup_threaded_search(void)
 {
-	pthread_cond_destroy(&progress_cond);
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
 }
 
-static void *threaded_find_deltas(void *arg)
+/*
+ * Steal half of the remaining work of the busiest other worker and
+ * make it our own.  Only one mutex is held at a time, so workers that
+ * steal from each other cannot deadlock.
+ *
+ * Returns 1 if we got more work, 0 if there is nothing left worth
+ * stealing.
+ */
+static int steal_delta_work(struct thread_params *me)
 {
-	struct thread_params *me = arg;
+	for (;;) {
+		struct thread_params *victim = NULL;
+		struct object_entry **list;
+		unsigned victim_remaining = 0;
+		unsigned sub_size;
+		int i;
 
-	progress_lock();
-	while (me->remaining) {
-		progress_unlock();
+		for (i = 0; i < me->nr_threads; i++) {
+			struct thread_params *p = &me->all[i];
+			unsigned remaining;
 
-		find_deltas(me->list, &me->remaining,
-			    me->window, me->depth, me->processed);
+			if (p == me)
+				continue;
+			pthread_mutex_lock(&p->mutex);
+			remaining = p->remaining;
+			pthread_mutex_unlock(&p->mutex);
+
+			if (remaining > 2 * me->window &&
+			    remaining > victim_remaining) {
+				victim = p;
+				victim_remaining = remaining;
+			}
+		}
+		if (!victim)
+			return 0;
 
-		progress_lock();
-		me->working = 0;
-		pthread_cond_signal(&progress_cond);
-		progress_unlock();
+		pthread_mutex_lock(&victim->mutex);
+		if (victim->remaining <= 2 * me->window) {
+			/* somebody else got there first; look again */
+			pthread_mutex_unlock(&victim->mutex);
+			continue;
+		}
+
+		sub_size = victim->remaining / 2;
+		list = victim->list + victim->list_size - sub_size;
+		while (sub_size && list[0]->hash &&
+		       list[0]->hash == list[-1]->hash) {
+			list++;
+			sub_size--;
+		}
+		if (!sub_size) {
+			/*
+			 * It is possible for some "paths" to have
+			 * so many objects that no hash boundary
+			 * might be found.  Let's just steal the
+			 * exact half in that case.
+			 */
+			sub_size = victim->remaining / 2;
+			list -= sub_size;
+		}
+		victim->list_size -= sub_size;
+		victim->remaining -= sub_size;
+		pthread_mutex_unlock(&victim->mutex);
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
 		pthread_mutex_lock(&me->mutex);
-		while (!me->data_ready)
-			pthread_cond_wait(&me->cond, &me->mutex);
-		me->data_ready = 0;
+		me->list = list;
+		me->list_size = sub_size;
+		me->remaining = sub_size;
 		pthread_mutex_unlock(&me->mutex);
-
-		progress_lock();
+		return 1;
 	}
-	progress_unlock();
-	/* leave ->working 1 so that this doesn't get more work assigned */
+}
+
+static void *threaded_find_deltas(void *arg)
+{
+	struct thread_params *me = arg;
+
+	do {
+		find_deltas(me->list, &me->remaining,
+			    me->window, me->depth, me->processed,
+			    &me->mutex);
+	} while (steal_delta_work(me));
+
 	return NULL;
 }
 
@@ -2984,12 +3108,13 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 			   int window, int depth, unsigned *processed)
 {
 	struct thread_params *p;
-	int i, ret, active_threads = 0;
+	int i, ret;
 
 	init_threaded_search();
 
 	if (delta_search_threads <= 1) {
-		find_deltas(list, &list_size, window, depth, processed);
+		find_deltas(list, &list_size, window, depth, processed,
+			    &progress_mutex);
 		cleanup_threaded_search();
 		return;
 	}
@@ -3009,8 +3134,9 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		p[i].window = window;
 		p[i].depth = depth;
 		p[i].processed = processed;
-		p[i].working = 1;
-		p[i].data_ready = 0;
+		p[i].all = p;
+		p[i].nr_threads = delta_search_threads;
+		pthread_mutex_init(&p[i].mutex, NULL);
 
 		/* try to split chunks on "path" boundaries */
 		while (sub_size && sub_size < list_size &&
@@ -3026,84 +3152,21 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		list_size -= sub_size;
 	}
 
-	/* Start work threads. */
+	/*
+	 * Start work threads.  Those that got an empty segment above
+	 * (because the list is too short to split evenly) go straight
+	 * to stealing from the others.
+	 */
 	for (i = 0; i < delta_search_threads; i++) {
-		if (!p[i].list_size)
-			continue;
-		pthread_mutex_init(&p[i].mutex, NULL);
-		pthread_cond_init(&p[i].cond, NULL);
 		ret = pthread_create(&p[i].thread, NULL,
 				     threaded_find_deltas, &p[i]);
 		if (ret)
 			die(_("unable to create thread: %s"), strerror(ret));
-		active_threads++;
 	}
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		unsigned sub_size = 0;
-
-		progress_lock();
-		for (;;) {
-			for (i = 0; !target && i < delta_search_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			pthread_cond_wait(&progress_cond, &progress_mutex);
-		}
-
-		for (i = 0; i < delta_search_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
-			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
-		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		progress_unlock();
-
-		pthread_mutex_lock(&target->mutex);
-		target->data_ready = 1;
-		pthread_cond_signal(&target->cond);
-		pthread_mutex_unlock(&target->mutex);
-
-		if (!sub_size) {
-			pthread_join(target->thread, NULL);
-			pthread_cond_destroy(&target->cond);
-			pthread_mutex_destroy(&target->mutex);
-			active_threads--;
-		}
+	for (i = 0; i < delta_search_threads; i++) {
+		pthread_join(p[i].thread, NULL);
+		pthread_mutex_destroy(&p[i].mutex);
 	}
 	cleanup_threaded_search();
 	free(p);
@@ -4065,6 +4128,7 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 						   &reuse_packfiles,
 						   &reuse_packfiles_nr,
 						   &reuse_packfile_bitmap,
+						   &reuse_packfile_rewrite,
 						   allow_pack_reuse == MULTI_PACK_REUSE);
 
 	if (reuse_packfiles) {
@@ -28,6 +28,7 @@
 #include "trace2.h"
 #include "tree.h"
 #include "chunk-format.h"
+#include "thread-utils.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -1176,6 +1177,8 @@ struct write_commit_graph_context {
 	int count_bloom_filter_trunc_empty;
 	int count_bloom_filter_trunc_large;
 	int count_bloom_filter_upgraded;
+
+	int nr_threads;
 };
 
 static int write_graph_chunk_fanout(struct hashfile *f,
@@ -1787,39 +1790,155 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_upgraded);
 }
 
+/*
+ * Number of filters a thread claims at once. Tree diffs vary a lot
+ * in cost, so keep this small enough for the threads to stay busy
+ * until the end.
+ */
+#define BLOOM_COMPUTE_BATCH 32
+
+struct bloom_compute_data {
+	struct repository *r;
+	const struct bloom_filter_settings *settings;
+	struct commit **commits;
+	struct bloom_filter **filters;
+	enum bloom_filter_computed *computed;
+	uint32_t *todo;
+	uint32_t todo_nr;
+
+	pthread_mutex_t mutex;
+	uint32_t todo_next;
+	struct progress *progress;
+	uint64_t progress_cnt;
+};
+
+static void *compute_bloom_filters_thread(void *arg)
+{
+	struct bloom_compute_data *data = arg;
+	uint32_t begin = 0, end = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&data->mutex);
+		data->progress_cnt += end - begin;
+		display_progress(data->progress, data->progress_cnt);
+		begin = data->todo_next;
+		end = begin + BLOOM_COMPUTE_BATCH;
+		if (end > data->todo_nr)
+			end = data->todo_nr;
+		data->todo_next = end;
+		pthread_mutex_unlock(&data->mutex);
+
+		if (begin == end)
+			break;
+
+		for (uint32_t i = begin; i < end; i++) {
+			uint32_t pos = data->todo[i];
+			struct commit *c = data->commits[pos];
+			struct commit_list *p = c->parents;
+
+			data->computed[pos] = compute_bloom_filter(
+				data->r,
+				p ? &p->item->object.oid : NULL,
+				&c->object.oid,
+				data->settings,
+				data->filters[pos]);
+		}
+	}
+
+	return NULL;
+}
+
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
 	int i;
-	struct progress *progress = NULL;
-	struct commit **sorted_commits;
+	struct bloom_compute_data data = {
+		.r = ctx->r,
+		.settings = ctx->bloom_settings,
+	};
 	int max_new_filters;
+	int nr_threads = ctx->nr_threads;
 
 	init_bloom_filters();
 
 	if (ctx->report_progress)
-		progress = start_delayed_progress(
+		data.progress = start_delayed_progress(
 			_("Computing commit changed paths Bloom filters"),
 			ctx->commits.nr);
 
-	DUP_ARRAY(sorted_commits, ctx->commits.list, ctx->commits.nr);
+	DUP_ARRAY(data.commits, ctx->commits.list, ctx->commits.nr);
 
 	if (ctx->order_by_pack)
-		QSORT(sorted_commits, ctx->commits.nr, commit_pos_cmp);
+		QSORT(data.commits, ctx->commits.nr, commit_pos_cmp);
 	else
-		QSORT(sorted_commits, ctx->commits.nr, commit_gen_cmp);
+		QSORT(data.commits, ctx->commits.nr, commit_gen_cmp);
 
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	/*
+	 * Looking up existing filters (and upgrading them) touches shared
+	 * state, so do that first on this thread and only collect the
+	 * filters that actually need a tree diff. Those are then computed
+	 * by the worker threads, which only read objects.
+	 */
+	ALLOC_ARRAY(data.filters, ctx->commits.nr);
+	ALLOC_ARRAY(data.computed, ctx->commits.nr);
+	ALLOC_ARRAY(data.todo, ctx->commits.nr);
 	for (i = 0; i < ctx->commits.nr; i++) {
-		enum bloom_filter_computed computed = 0;
-		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
+		struct commit *c = data.commits[i];
+		int compute = data.todo_nr < max_new_filters;
+		int ready;
+
+		data.filters[i] = lookup_bloom_filter(ctx->r, c, compute,
+						      ctx->bloom_settings,
+						      &data.computed[i], &ready);
+		if (!ready && compute) {
+			/* ensure commit is parsed so we have parent information */
+			repo_parse_commit(ctx->r, c);
+			data.todo[data.todo_nr++] = i;
+		} else {
+			if (!ready)
+				data.filters[i] = NULL;
+			display_progress(data.progress, ++data.progress_cnt);
+		}
+	}
+
+	if (nr_threads > DIV_ROUND_UP(data.todo_nr, BLOOM_COMPUTE_BATCH))
+		nr_threads = DIV_ROUND_UP(data.todo_nr, BLOOM_COMPUTE_BATCH);
+
+	trace2_region_enter("commit-graph", "compute_bloom_filters", ctx->r);
+	pthread_mutex_init(&data.mutex, NULL);
+	if (nr_threads <= 1) {
+		compute_bloom_filters_thread(&data);
+	} else {
+		pthread_t *threads;
+
+		enable_obj_read_lock();
+
+		CALLOC_ARRAY(threads, nr_threads);
+		for (i = 0; i < nr_threads; i++) {
+			int err = pthread_create(&threads[i], NULL,
+						 compute_bloom_filters_thread,
+						 &data);
+			if (err)
+				die(_("unable to create thread: %s"),
+				    strerror(err));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+
+		disable_obj_read_lock();
+	}
+	pthread_mutex_destroy(&data.mutex);
+	trace2_data_intmax("commit-graph", ctx->r, "bloom-threads",
+			   nr_threads < 1 ? 1 : nr_threads);
+	trace2_region_leave("commit-graph", "compute_bloom_filters", ctx->r);
+
+	for (i = 0; i < ctx->commits.nr; i++) {
+		enum bloom_filter_computed computed = data.computed[i];
+		struct bloom_filter *filter = data.filters[i];
+
 		if (computed & BLOOM_COMPUTED) {
 			ctx->count_bloom_filter_computed++;
 			if (computed & BLOOM_TRUNC_EMPTY)
@@ -1832,14 +1951,16 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 			ctx->count_bloom_filter_not_computed++;
 		ctx->total_bloom_filter_data_size += filter
 			? sizeof(unsigned char) * filter->len : 0;
-		display_progress(progress, i + 1);
 	}
 
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
-	free(sorted_commits);
-	stop_progress(&progress);
+	free(data.commits);
+	free(data.filters);
+	free(data.computed);
+	free(data.todo);
+	stop_progress(&data.progress);
 }
 
 struct refs_cb_data {
@@ -2525,6 +2646,14 @@ int write_commit_graph(struct object_directory *odb,
 	ctx->split = flags & COMMIT_GRAPH_WRITE_SPLIT ? 1 : 0;
 	ctx->opts = opts;
 	ctx->total_bloom_filter_data_size = 0;
+
+	if (opts && opts->threads > 0)
+		ctx->nr_threads = opts->threads;
+	else if (repo_config_get_int(r, "commitgraph.threads", &ctx->nr_threads) ||
+		 ctx->nr_threads < 1)
+		ctx->nr_threads = online_cpus();
+	if (!HAVE_THREADS)
+		ctx->nr_threads = 1;
 	ctx->write_generation_data = (get_configured_generation_version(r) == 2);
 	ctx->num_generation_data_overflows = 0;
 
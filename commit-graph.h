@@ -165,6 +165,13 @@ struct commit_graph_opts {
 	timestamp_t expire_time;
 	enum commit_graph_split_flags split_flags;
 	int max_new_filters;
+
+	/*
+	 * Number of threads used to compute changed-path Bloom filters.
+	 * Zero or less means "commitGraph.threads", or the number of CPUs
+	 * if that is not set either.
+	 */
+	int threads;
 };
 
 /*
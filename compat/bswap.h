@@ -190,4 +190,35 @@ static inline void put_be64(void *ptr, uint64_t value)
 	p[7] = value >>  0;
 }
 
+static inline uint32_t get_le32(const void *ptr)
+{
+	const unsigned char *p = ptr;
+	return	(uint32_t)p[0] <<  0 |
+		(uint32_t)p[1] <<  8 |
+		(uint32_t)p[2] << 16 |
+		(uint32_t)p[3] << 24;
+}
+
+static inline uint64_t get_le64(const void *ptr)
+{
+	const unsigned char *p = ptr;
+	return	(uint64_t)get_le32(&p[0]) <<  0 |
+		(uint64_t)get_le32(&p[4]) << 32;
+}
+
+static inline void put_le32(void *ptr, uint32_t value)
+{
+	unsigned char *p = ptr;
+	p[0] = value >>  0;
+	p[1] = value >>  8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static inline void put_le64(void *ptr, uint64_t value)
+{
+	put_le32((unsigned char *)ptr + 0, value >>  0);
+	put_le32((unsigned char *)ptr + 4, value >> 32);
+}
+
 #endif /* COMPAT_BSWAP_H */
@@ -0,0 +1,671 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "fsmonitor-ll.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "simple-ipc.h"
+#include "string-list.h"
+#include "trace.h"
+#include <sys/inotify.h>
+
+/*
+ * The Linux backend is built upon inotify(7).  Unlike FSEvents and
+ * ReadDirectoryChangesW(), inotify watches are not recursive, so we
+ * have to walk the worktree at startup and add a watch on every
+ * directory in it, and then add (or drop) watches as directories are
+ * created, moved or deleted.  Each watch descriptor is mapped back to
+ * the absolute path of its directory so that we can turn the
+ * (wd, name) pair in each event into the absolute path that the
+ * daemon's path classification routines expect.
+ *
+ * We do not recurse into ".git": it is ignored by the daemon anyway
+ * and it is usually the busiest directory on disk.  We only watch the
+ * cookie directory inside of it (so that we can sync with clients).
+ *
+ * (fanotify(7) can watch a whole filesystem at once, but it requires
+ * CAP_SYS_ADMIN, which we cannot expect a user's daemon to have.)
+ */
+
+/*
+ * The events that we ask the kernel for on every directory.  We do
+ * not need IN_ACCESS, IN_OPEN or IN_CLOSE_NOWRITE because they don't
+ * change anything, and IN_CLOSE_WRITE is always preceded by IN_MODIFY
+ * when the content actually changed.
+ */
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+		    IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_DELETE_SELF | IN_MOVE_SELF | \
+		    IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/*
+ * Size of the buffer used to read() events from the inotify fd.  Each
+ * event is at most `sizeof(struct inotify_event) + NAME_MAX + 1` bytes,
+ * and the kernel will happily give us as many as fit.
+ */
+#define EVENT_BUF_SIZE (64 * 1024)
+
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	char *path; /* absolute path of the watched directory */
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2]; /* self-pipe to wake up the listener thread */
+
+	struct hashmap watches; /* wd -> struct watch_entry */
+	int wd_worktree;
+	int wd_gitdir;
+
+	char *event_buf;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+static int watch_entry_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata UNUSED)
+{
+	const struct watch_entry *a =
+		container_of(eptr, const struct watch_entry, ent);
+	const struct watch_entry *b =
+		container_of(entry_or_key, const struct watch_entry, ent);
+
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void forget_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+	struct watch_entry *w;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+
+	w = hashmap_remove_entry(&data->watches, &key, ent, NULL);
+	if (!w)
+		return;
+
+	free(w->path);
+	free(w);
+}
+
+/*
+ * Add a watch on a single directory.  Returns the watch descriptor
+ * or -1 on error.
+ *
+ * If the kernel already has a watch on this inode (because it was
+ * reached through a different spelling, or because we raced with a
+ * rename), it returns the existing wd; we just update its path.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *path,
+		     uint32_t mask)
+{
+	struct watch_entry *w;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, path, mask);
+	if (wd < 0) {
+		if (errno == ENOSPC)
+			return error(_("inotify watch limit reached while "
+				       "watching '%s'; consider raising "
+				       "fs.inotify.max_user_watches"),
+				     path);
+		/*
+		 * The directory may have disappeared (or been replaced
+		 * by a file) before we got to it.  We will see (or have
+		 * already seen) an event for that in its parent.
+		 */
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 0;
+		return error_errno(_("inotify_add_watch('%s') failed"), path);
+	}
+
+	w = find_watch(data, wd);
+	if (w) {
+		free(w->path);
+		w->path = xstrdup(path);
+		return wd;
+	}
+
+	CALLOC_ARRAY(w, 1);
+	w->wd = wd;
+	w->path = xstrdup(path);
+	hashmap_entry_init(&w->ent, memhash(&wd, sizeof(wd)));
+	hashmap_add(&data->watches, &w->ent);
+
+	return wd;
+}
+
+/*
+ * Recursively add watches on `path` (an absolute pathname inside the
+ * worktree) and every directory below it.  Returns the watch
+ * descriptor of `path` itself, 0 if it vanished, or -1 on error.
+ *
+ * If `batch` is given, also report every pathname that we find while
+ * walking.  When a directory is created or moved into the worktree,
+ * its contents may have been populated before we were able to add a
+ * watch on it, and we would not otherwise hear about those paths.
+ */
+static int add_watches_recursive(struct fsmonitor_daemon_state *state,
+				 struct strbuf *path,
+				 struct fsmonitor_batch **batch)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	DIR *dir;
+	struct dirent *de;
+	size_t baselen;
+	int wd;
+
+	wd = add_watch(data, path->buf, WATCH_MASK);
+	if (wd <= 0)
+		return wd;
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return wd; /* raced with a delete; we'll get an event */
+
+	strbuf_addch(path, '/');
+	baselen = path->len;
+
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		enum fsmonitor_path_type t;
+		int dtype = DTYPE(de);
+
+		strbuf_setlen(path, baselen);
+		strbuf_addstr(path, de->d_name);
+
+		t = fsmonitor_classify_path_absolute(state, path->buf);
+		if (t != IS_WORKDIR_PATH)
+			continue;
+
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+			if (lstat(path->buf, &st))
+				continue;
+			dtype = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		}
+
+		if (batch) {
+			const char *rel = path->buf +
+				state->path_worktree_watch.len + 1;
+
+			if (!*batch)
+				*batch = fsmonitor_batch__new();
+			fsmonitor_batch__add_path(*batch, rel);
+		}
+
+		if (dtype != DT_DIR)
+			continue;
+
+		if (batch) {
+			strbuf_addch(path, '/');
+			fsmonitor_batch__add_path(*batch,
+				path->buf + state->path_worktree_watch.len + 1);
+			strbuf_setlen(path, path->len - 1);
+		}
+
+		if (add_watches_recursive(state, path, batch) < 0) {
+			wd = -1;
+			break;
+		}
+	}
+
+	strbuf_setlen(path, baselen - 1);
+	closedir(dir);
+	return wd;
+}
+
+/*
+ * A directory was moved out from under us (or deleted).  Drop our
+ * watches on it and everything below it: the kernel keeps them on
+ * the (possibly relocated) inodes, so any further events from them
+ * would be reported with stale pathnames.
+ */
+static void remove_watches_recursive(struct fsm_listen_data *data,
+				     const char *path)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	int *doomed = NULL;
+	size_t doomed_nr = 0, doomed_alloc = 0;
+	size_t len = strlen(path);
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (!strncmp(w->path, path, len) &&
+		    (!w->path[len] || w->path[len] == '/')) {
+			ALLOC_GROW(doomed, doomed_nr + 1, doomed_alloc);
+			doomed[doomed_nr++] = w->wd;
+		}
+	}
+
+	for (size_t k = 0; k < doomed_nr; k++) {
+		inotify_rm_watch(data->fd_inotify, doomed[k]);
+		forget_watch(data, doomed[k]);
+	}
+
+	free(doomed);
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ACCESS)
+		strbuf_addstr(&msg, "IN_ACCESS|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CLOSE_WRITE)
+		strbuf_addstr(&msg, "IN_CLOSE_WRITE|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+	if (mask & IN_UNMOUNT)
+		strbuf_addstr(&msg, "IN_UNMOUNT|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+static int em_is_dir_gone(uint32_t mask)
+{
+	return (mask & IN_ISDIR) && (mask & (IN_DELETE | IN_MOVED_FROM));
+}
+
+static int em_is_dir_arrived(uint32_t mask)
+{
+	return (mask & IN_ISDIR) && (mask & (IN_CREATE | IN_MOVED_TO));
+}
+
+static int em_is_self_gone(uint32_t mask)
+{
+	return mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT);
+}
+
+/*
+ * Process one buffer full of events.  Like the other backends, build
+ * a private batch of changed paths without holding any locks and then
+ * publish it (along with any cookies that we saw) all at once.
+ *
+ * Returns 0 to keep listening, or -1 if the daemon must shut down.
+ */
+static int process_events(struct fsmonitor_daemon_state *state,
+			  const char *buf, ssize_t len)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	const struct inotify_event *ev;
+	const char *p;
+
+	for (p = buf; p < buf + len;
+	     p += sizeof(struct inotify_event) + ev->len) {
+		struct watch_entry *w;
+		const char *rel;
+		const char *slash;
+		int wd;
+
+		ev = (const struct inotify_event *)p;
+
+		/*
+		 * The kernel's event queue overflowed and we lost
+		 * some number of events.  Like a dropped FSEvent, we
+		 * have lost sync with the filesystem and must flush
+		 * our cached data and discard the batch we were
+		 * building (since it is relative to the flushed token).
+		 *
+		 * The lost events may also have included directories
+		 * that were created in the meantime, so walk the
+		 * worktree again to make sure that they are watched.
+		 * Directories that we already watch just keep their
+		 * watch descriptor.
+		 */
+		if (ev->mask & IN_Q_OVERFLOW) {
+			trace_printf_key(&trace_fsmonitor,
+					 "inotify: queue overflow");
+			fsmonitor_force_resync(state);
+			fsmonitor_batch__free_list(batch);
+			string_list_clear(&cookie_list, 0);
+			batch = NULL;
+
+			strbuf_reset(&path);
+			strbuf_addbuf(&path, &state->path_worktree_watch);
+			wd = add_watches_recursive(state, &path, NULL);
+			if (wd < 0)
+				goto force_error_stop;
+			if (!wd)
+				goto force_shutdown; /* the worktree is gone */
+			continue;
+		}
+
+		if (ev->mask & IN_IGNORED) {
+			forget_watch(data, ev->wd);
+			continue;
+		}
+
+		w = find_watch(data, ev->wd);
+		if (!w)
+			continue; /* a stale event for a dropped watch */
+
+		strbuf_reset(&path);
+		strbuf_addstr(&path, w->path);
+		if (ev->len && *ev->name) {
+			strbuf_addch(&path, '/');
+			strbuf_addstr(&path, ev->name);
+		}
+
+		if (trace_pass_fl(&trace_fsmonitor))
+			log_mask_set(path.buf, ev->mask);
+
+		if (ev->wd == data->wd_worktree && em_is_self_gone(ev->mask)) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: worktree root removed");
+			goto force_shutdown;
+		}
+
+		if (ev->wd == data->wd_gitdir && em_is_self_gone(ev->mask)) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: gitdir removed");
+			goto force_shutdown;
+		}
+
+		/*
+		 * Self events on other directories are reported again
+		 * (with a name) by their parent's watch.
+		 */
+		if (!ev->len)
+			continue;
+
+		switch (fsmonitor_classify_path_absolute(state, path.buf)) {
+
+		case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+		case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+			/* special case cookie files within .git or gitdir */
+
+			/* Use just the filename of the cookie file. */
+			if (!(ev->mask & IN_CREATE))
+				break;
+			slash = find_last_dir_sep(path.buf);
+			string_list_append(&cookie_list,
+					   slash ? slash + 1 : path.buf);
+			break;
+
+		case IS_INSIDE_DOT_GIT:
+		case IS_INSIDE_GITDIR:
+			/* ignore all other paths inside of .git or gitdir */
+			break;
+
+		case IS_DOT_GIT:
+		case IS_GITDIR:
+			/*
+			 * If .git directory is deleted or renamed away,
+			 * we have to quit.
+			 */
+			if (em_is_dir_gone(ev->mask)) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed");
+				goto force_shutdown;
+			}
+			break;
+
+		case IS_WORKDIR_PATH:
+			/* try to queue normal pathnames */
+			rel = path.buf + state->path_worktree_watch.len + 1;
+
+			if (!batch)
+				batch = fsmonitor_batch__new();
+			fsmonitor_batch__add_path(batch, rel);
+
+			if (!(ev->mask & IN_ISDIR))
+				break;
+
+			/*
+			 * Also add the directory spelling so that the
+			 * client invalidates everything below it.
+			 */
+			strbuf_addch(&path, '/');
+			fsmonitor_batch__add_path(batch, path.buf +
+				state->path_worktree_watch.len + 1);
+			strbuf_setlen(&path, path.len - 1);
+
+			if (em_is_dir_gone(ev->mask))
+				remove_watches_recursive(data, path.buf);
+			else if (em_is_dir_arrived(ev->mask) &&
+				 add_watches_recursive(state, &path, &batch) < 0)
+				goto force_error_stop;
+			break;
+
+		case IS_OUTSIDE_CONE:
+		default:
+			trace_printf_key(&trace_fsmonitor,
+					 "ignoring '%s'", path.buf);
+			break;
+		}
+	}
+
+	fsmonitor_publish(state, batch, &cookie_list);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return 0;
+
+force_error_stop:
+	data->shutdown_style = FORCE_ERROR_STOP;
+	goto cleanup;
+
+force_shutdown:
+	data->shutdown_style = FORCE_SHUTDOWN;
+
+cleanup:
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return -1;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct strbuf path = STRBUF_INIT;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+
+	data->fd_stop[0] = -1;
+	data->fd_stop[1] = -1;
+	data->wd_gitdir = -1;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+
+	data->fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (data->fd_inotify < 0) {
+		error_errno(_("inotify_init1() failed"));
+		goto failed;
+	}
+
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create pipe"));
+		goto failed;
+	}
+
+	/*
+	 * Watch the worktree, recursively.  This skips ".git" (because
+	 * it is classified as IS_DOT_GIT) but not nested ".git" files
+	 * and directories of submodules.
+	 */
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	data->wd_worktree = add_watches_recursive(state, &path, NULL);
+	if (data->wd_worktree <= 0)
+		goto failed;
+
+	/*
+	 * Watch an external <gitdir> itself so that we notice if it is
+	 * deleted.  (When it is ".git", we see that in the worktree root.)
+	 */
+	if (state->nr_paths_watching > 1) {
+		data->wd_gitdir = add_watch(data, state->path_gitdir_watch.buf,
+					    IN_DELETE_SELF | IN_MOVE_SELF |
+					    IN_ONLYDIR);
+		if (data->wd_gitdir <= 0)
+			goto failed;
+	}
+
+	/*
+	 * And watch the cookie directory so that we can sync with clients.
+	 */
+	strbuf_reset(&path);
+	strbuf_addbuf(&path, &state->path_cookie_prefix);
+	strbuf_strip_suffix(&path, "/");
+	if (add_watch(data, path.buf, IN_CREATE | IN_ONLYDIR) <= 0)
+		goto failed;
+
+	data->event_buf = xmalloc(EVENT_BUF_SIZE);
+
+	trace_printf_key(&trace_fsmonitor, "inotify: watching %u directories",
+			 hashmap_get_size(&data->watches));
+
+	strbuf_release(&path);
+	return 0;
+
+failed:
+	error(_("Unable to create inotify watches."));
+
+	strbuf_release(&path);
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent)
+		free(w->path);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+	free(data->event_buf);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+
+	data = state->listen_data;
+
+	xwrite(data->fd_stop[1], "q", 1);
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct pollfd pfd[2];
+
+	data = state->listen_data;
+
+	pfd[0].fd = data->fd_inotify;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = data->fd_stop[0];
+	pfd[1].events = POLLIN;
+
+	/*
+	 * Our fs event listener is now running, so it's safe to start
+	 * serving client requests.
+	 */
+	ipc_server_start_async(state->ipc_server_data);
+
+	for (;;) {
+		ssize_t len;
+
+		if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("poll() on inotify fd failed"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (pfd[1].revents) {
+			data->shutdown_style = SHUTDOWN_EVENT;
+			break;
+		}
+
+		if (!pfd[0].revents)
+			continue;
+
+		len = read(data->fd_inotify, data->event_buf, EVENT_BUF_SIZE);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			error_errno(_("read() on inotify fd failed"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (process_events(state, data->event_buf, len))
+			break;
+	}
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
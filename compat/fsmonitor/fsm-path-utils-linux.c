@@ -0,0 +1,112 @@
+#include "git-compat-util.h"
+#include "fsmonitor-ll.h"
+#include "fsmonitor-path-utils.h"
+#include "trace.h"
+#include <sys/vfs.h>
+
+/*
+ * Linux does not give us the name of the filesystem type in
+ * `struct statfs`, only its magic number.  Map the ones that we
+ * care about (and a few common local ones, for tracing) to names.
+ * The magic numbers are from <linux/magic.h> and statfs(2); we
+ * do not include the kernel header because not all of them are
+ * present in every version of it.
+ */
+static const struct {
+	unsigned long magic;
+	const char *name;
+	int is_remote;
+} fs_types[] = {
+	{ 0x00006969, "nfs", 1 },
+	{ 0x0000517b, "smb", 1 },
+	{ 0xff534d42, "cifs", 1 },
+	{ 0xfe534d42, "smb2", 1 },
+	{ 0x73757245, "coda", 1 },
+	{ 0x5346414f, "afs", 1 },
+	{ 0x6b414653, "afs", 1 },
+	{ 0x01021997, "v9fs", 1 },
+	{ 0x00c36400, "ceph", 1 },
+	{ 0x01161970, "gfs2", 1 },
+	{ 0x7461636f, "ocfs2", 1 },
+	{ 0x0000564c, "ncp", 1 },
+
+	{ 0x00004d44, "msdos", 0 },
+	{ 0x2011bab0, "exfat", 0 },
+	{ 0x5346544e, "ntfs", 0 },
+	{ 0x0000ef53, "ext4", 0 },
+	{ 0x58465342, "xfs", 0 },
+	{ 0x9123683e, "btrfs", 0 },
+	{ 0x01021994, "tmpfs", 0 },
+	{ 0x794c7630, "overlayfs", 0 },
+	{ 0x65735546, "fuse", 0 },
+	{ 0x2fc12fc1, "zfs", 0 },
+	{ 0xf2f52010, "f2fs", 0 },
+};
+
+int fsmonitor__get_fs_info(const char *path, struct fs_info *fs_info)
+{
+	struct statfs fs;
+	unsigned long magic;
+	const char *name = "unknown";
+
+	if (statfs(path, &fs) == -1) {
+		int saved_errno = errno;
+		trace_printf_key(&trace_fsmonitor, "statfs('%s') failed: %s",
+				 path, strerror(saved_errno));
+		errno = saved_errno;
+		return -1;
+	}
+
+	/* `f_type` is signed on some architectures; compare as 32 bits */
+	magic = (unsigned long)fs.f_type & 0xffffffffUL;
+
+	fs_info->is_remote = 0;
+	for (size_t k = 0; k < ARRAY_SIZE(fs_types); k++) {
+		if (fs_types[k].magic == magic) {
+			name = fs_types[k].name;
+			fs_info->is_remote = fs_types[k].is_remote;
+			break;
+		}
+	}
+
+	trace_printf_key(&trace_fsmonitor,
+			 "statfs('%s') [type 0x%08lx] '%s'",
+			 path, magic, name);
+
+	fs_info->typename = xstrdup(name);
+
+	trace_printf_key(&trace_fsmonitor,
+				"'%s' is_remote: %d",
+				path, fs_info->is_remote);
+	return 0;
+}
+
+int fsmonitor__is_fs_remote(const char *path)
+{
+	struct fs_info fs;
+	if (fsmonitor__get_fs_info(path, &fs))
+		return -1;
+
+	free(fs.typename);
+
+	return fs.is_remote;
+}
+
+/*
+ * No-op for now.  Linux does not have the synthetic firmlinks that
+ * macOS puts in the root directory.
+ */
+int fsmonitor__get_alias(const char *path UNUSED,
+			 struct alias_info *info UNUSED)
+{
+	return 0;
+}
+
+/*
+ * No-op for now.
+ */
+char *fsmonitor__resolve_alias(const char *path UNUSED,
+			       const struct alias_info *info UNUSED)
+{
+	return NULL;
+}
@@ -42,6 +42,7 @@ struct spanhash {
 struct spanhash_top {
 	int alloc_log2;
 	int free;
+	unsigned crlf : 1;
 	struct spanhash data[FLEX_ARRAY];
 };
 
@@ -56,6 +57,7 @@ static struct spanhash_top *spanhash_rehash(struct spanhash_top *orig)
 			     st_mult(sizeof(struct spanhash), sz)));
 	new_spanhash->alloc_log2 = orig->alloc_log2 + 1;
 	new_spanhash->free = INITIAL_FREE(new_spanhash->alloc_log2);
+	new_spanhash->crlf = orig->crlf;
 	memset(new_spanhash->data, 0, sizeof(struct spanhash) * sz);
 	for (i = 0; i < osz; i++) {
 		struct spanhash *o = &(orig->data[i]);
@@ -135,6 +137,7 @@ static struct spanhash_top *hash_chars(struct repository *r,
 			      st_mult(sizeof(struct spanhash), (size_t)1 << i)));
 	hash->alloc_log2 = i;
 	hash->free = INITIAL_FREE(i);
+	hash->crlf = 0;
 	memset(hash->data, 0, sizeof(struct spanhash) * ((size_t)1 << i));
 
 	n = 0;
@@ -145,8 +148,11 @@ static struct spanhash_top *hash_chars(struct repository *r,
 		sz--;
 
 		/* Ignore CR in CRLF sequence if text */
-		if (is_text && c == '\r' && sz && *buf == '\n')
-			continue;
+		if (c == '\r' && sz && *buf == '\n') {
+			hash->crlf = 1;
+			if (is_text)
+				continue;
+		}
 
 		accum1 = (accum1 << 7) ^ (accum2 >> 25);
 		accum2 = (accum2 << 7) ^ (old_1 >> 25);
@@ -163,9 +169,34 @@ static struct spanhash_top *hash_chars(struct repository *r,
 		hash = add_spanhash(hash, hashval, n);
 	}
 	QSORT(hash->data, (size_t)1ul << hash->alloc_log2, spanhash_cmp);
+
+	/*
+	 * The table is never full, so the used entries are now followed by
+	 * at least one empty one, which diffcore_count_changes() stops at.
+	 * Drop the rest: the tables of all rename candidates are kept for
+	 * the whole rename detection, and are walked over and over again.
+	 */
+	for (n = 0; hash->data[n].cnt; n++)
+		; /* nothing */
+	hash = xrealloc(hash, st_add(sizeof(*hash),
+				     st_mult(sizeof(struct spanhash), n + 1)));
 	return hash;
 }
 
+void diffcore_populate_count(struct repository *r,
+			     struct diff_filespec *one)
+{
+	if (!one->cnt_data)
+		one->cnt_data = hash_chars(r, one);
+}
+
+int diffcore_count_has_crlf(void *count)
+{
+	struct spanhash_top *top = count;
+
+	return top->crlf;
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
@@ -14,9 +14,13 @@
 #include "oid-array.h"
 #include "progress.h"
 #include "promisor-remote.h"
+#include "rename-cache.h"
 #include "string-list.h"
 #include "strmap.h"
 #include "trace2.h"
+#include "config.h"
+#include "gettext.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -129,6 +133,16 @@ static void inexact_prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
+static int sizes_are_similar(unsigned long a, unsigned long b,
+			     int minimum_score)
+{
+	unsigned long max_size = a > b ? a : b;
+	unsigned long base_size = a < b ? a : b;
+
+	return max_size * (MAX_SCORE - minimum_score) >=
+		(max_size - base_size) * MAX_SCORE;
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
@@ -148,7 +162,7 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
+	unsigned long max_size, src_copied, literal_added;
 	int score;
 
 	/* We deal only with regular files.  Symlink renames are handled
@@ -177,8 +191,6 @@ static int estimate_similarity(struct repository *r,
 		return 0;
 
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
 
 	/* We would not consider edits that change the file size so
 	 * drastically.  delta_size must be smaller than
@@ -188,9 +200,16 @@ static int estimate_similarity(struct repository *r,
 	 * and the final score computation below would not have a
 	 * divide-by-zero issue.
 	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (!sizes_are_similar(src->size, dst->size, minimum_score))
 		return 0;
 
+	/* Only blobs are cached, as files in the worktree can change. */
+	if (src->oid_valid && dst->oid_valid) {
+		score = rename_cache_lookup(r, &src->oid, &dst->oid);
+		if (score >= 0)
+			return score;
+	}
+
 	dpf_opt->check_size_only = 0;
 
 	if (!src->cnt_data && diff_populate_filespec(r, src, dpf_opt))
@@ -210,9 +229,37 @@ static int estimate_similarity(struct repository *r,
 		score = 0; /* should not happen */
 	else
 		score = (int)(src_copied * MAX_SCORE / max_size);
+
+	/*
+	 * CRs in CRLF are counted or not depending on whether the blob is
+	 * binary, which depends on the attributes of its path.
+	 */
+	if (src->oid_valid && dst->oid_valid &&
+	    !diffcore_count_has_crlf(src->cnt_data) &&
+	    !diffcore_count_has_crlf(dst->cnt_data))
+		rename_cache_add(r, &src->oid, &dst->oid, score);
 	return score;
 }
 
+/*
+ * What estimate_similarity() returns for a pair whose spanhashes have not
+ * been computed, because its score is in the rename cache.
+ */
+static int cached_similarity(struct repository *r,
+			     struct diff_filespec *src,
+			     struct diff_filespec *dst,
+			     int minimum_score)
+{
+	int score;
+
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode) ||
+	    !src->oid_valid || !dst->oid_valid ||
+	    !sizes_are_similar(src->size, dst->size, minimum_score))
+		return 0;
+	score = rename_cache_lookup(r, &src->oid, &dst->oid);
+	return score < 0 ? 0 : score;
+}
+
 static void record_rename_pair(int dst_index, int src_index, int score)
 {
 	struct diff_filepair *src = rename_src[src_index].p;
@@ -1077,6 +1124,426 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * Fill the row of the score matrix for the rename destination "dst_index",
+ * i.e. the NUM_CANDIDATE_PER_DST best sources for it. With "threaded",
+ * the spanhashes of all the candidates that can be similar enough and
+ * are not in the rename cache are already computed by
+ * prepare_rename_counts() and are the only thing looked at.
+ */
+static void fill_score_row(struct repository *r, struct diff_score *m,
+			   int dst_index, int skip_unmodified, int want_copies,
+			   int minimum_score,
+			   struct diff_populate_filespec_options *dpf_opt,
+			   int threaded)
+{
+	struct diff_filespec *two = rename_dst[dst_index].p->two;
+	int j;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		assert(!one->rename_used || want_copies || break_idx);
+
+		if (skip_unmodified &&
+		    diff_unmodified_pair(rename_src[j].p))
+			continue;
+
+		if (threaded && (!one->cnt_data || !two->cnt_data))
+			this_src.score = cached_similarity(r, one, two,
+							   minimum_score);
+		else
+			this_src.score = estimate_similarity(r, one, two,
+							     minimum_score,
+							     dpf_opt);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = dst_index;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+		if (threaded)
+			continue;
+		/*
+		 * Once we run estimate_similarity,
+		 * We do not need the text anymore.
+		 */
+		diff_free_filespec_blob(one);
+		diff_free_filespec_blob(two);
+	}
+}
+
+/*
+ * Fill the score matrix with a row for each rename destination that is
+ * not already handled by exact or basename matches. Returns the number
+ * of rows filled.
+ */
+static int fill_score_matrix(struct repository *r, struct diff_score *mx,
+			     int skip_unmodified, int want_copies,
+			     int minimum_score,
+			     struct diff_populate_filespec_options *dpf_opt,
+			     struct progress *progress)
+{
+	int i, dst_cnt;
+
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+		if (rename_dst[i].is_rename)
+			continue; /* exact or basename match already handled */
+
+		fill_score_row(r, &mx[dst_cnt * NUM_CANDIDATE_PER_DST], i,
+			       skip_unmodified, want_copies, minimum_score,
+			       dpf_opt, 0);
+		dst_cnt++;
+		display_progress(progress,
+				 (uint64_t)dst_cnt * (uint64_t)rename_src_nr);
+	}
+	return dst_cnt;
+}
+
+/*
+ * The blobs of the rename candidates are read by the main thread in
+ * batches of about this many bytes, while the other threads compute
+ * their spanhashes.
+ */
+#define RENAME_COUNT_BATCH_SIZE (64 * 1024 * 1024)
+
+struct rename_threads {
+	struct repository *repo;
+	pthread_mutex_t mutex;
+
+	/* the candidates whose spanhash is computed by this batch */
+	struct diff_filespec **batch;
+	int batch_nr, next_in_batch;
+
+	/* the score matrix, and the rename_dst index of each of its rows */
+	struct diff_score *mx;
+	int *rows;
+	int nr_rows, next_row;
+	int skip_unmodified, want_copies, minimum_score, use_cache;
+	struct diff_populate_filespec_options *dpf_opt;
+	struct progress *progress;
+	uint64_t progress_nr;
+};
+
+static int get_rename_threads(struct repository *r, int num_destinations)
+{
+	char *env_threads = getenv("GIT_TEST_RENAME_THREADS");
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	if (env_threads && *env_threads) {
+		if (strtol_i(env_threads, 10, &nr_threads))
+			die(_("invalid value for '%s': '%s'"),
+			    "GIT_TEST_RENAME_THREADS", env_threads);
+	} else if (repo_config_get_int(r, "diff.renamethreads", &nr_threads)) {
+		nr_threads = 1;
+	}
+	if (nr_threads < 1)
+		nr_threads = online_cpus();
+	return nr_threads < num_destinations ? nr_threads : num_destinations;
+}
+
+static void run_rename_threads(struct rename_threads *rt, int nr_threads,
+			       void *(*fn)(void *))
+{
+	pthread_t *threads;
+	int i;
+
+	CALLOC_ARRAY(threads, nr_threads - 1);
+	for (i = 0; i < nr_threads - 1; i++) {
+		int err = pthread_create(&threads[i], NULL, fn, rt);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	fn(rt);
+	for (i = 0; i < nr_threads - 1; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static void *count_thread(void *data)
+{
+	struct rename_threads *rt = data;
+
+	for (;;) {
+		struct diff_filespec *one;
+
+		pthread_mutex_lock(&rt->mutex);
+		if (rt->next_in_batch >= rt->batch_nr) {
+			pthread_mutex_unlock(&rt->mutex);
+			break;
+		}
+		one = rt->batch[rt->next_in_batch++];
+		pthread_mutex_unlock(&rt->mutex);
+
+		if (one)
+			diffcore_populate_count(rt->repo, one);
+	}
+	return NULL;
+}
+
+static void *score_thread(void *data)
+{
+	struct rename_threads *rt = data;
+	struct diff_populate_filespec_options dpf_opt = *rt->dpf_opt;
+
+	for (;;) {
+		int row;
+
+		pthread_mutex_lock(&rt->mutex);
+		if (rt->next_row >= rt->nr_rows) {
+			pthread_mutex_unlock(&rt->mutex);
+			break;
+		}
+		row = rt->next_row++;
+		pthread_mutex_unlock(&rt->mutex);
+
+		fill_score_row(rt->repo, &rt->mx[row * NUM_CANDIDATE_PER_DST],
+			       rt->rows[row], rt->skip_unmodified,
+			       rt->want_copies, rt->minimum_score, &dpf_opt, 1);
+
+		pthread_mutex_lock(&rt->mutex);
+		rt->progress_nr += rename_src_nr;
+		display_progress(rt->progress, rt->progress_nr);
+		pthread_mutex_unlock(&rt->mutex);
+	}
+	return NULL;
+}
+
+struct rename_candidate {
+	unsigned long size;
+	struct diff_filespec *spec;
+	int needed;
+};
+
+static int rename_candidate_cmp(const void *a_, const void *b_)
+{
+	const struct rename_candidate *a = a_, *b = b_;
+
+	return a->size < b->size ? -1 : a->size > b->size;
+}
+
+/*
+ * Find the range [*lo, *hi) of the candidates, sorted by size, whose size
+ * is similar enough to "size" (see sizes_are_similar()). The closer the
+ * sizes, the more similar they are, so it is contiguous.
+ */
+static void similar_size_range(unsigned long size,
+			       const struct rename_candidate *list, int nr,
+			       int minimum_score, int *lo_p, int *hi_p)
+{
+	int lo = 0, hi = nr, mid;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (list[mi].size < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	mid = lo;
+
+	/* the smaller ones get more similar towards "mid" */
+	lo = 0;
+	hi = mid;
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (sizes_are_similar(size, list[mi].size, minimum_score))
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	*lo_p = lo;
+
+	/* and the larger ones less similar from it */
+	lo = mid;
+	hi = nr;
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (sizes_are_similar(size, list[mi].size, minimum_score))
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	*hi_p = lo;
+}
+
+static int filespec_ptr_cmp(const void *a_, const void *b_)
+{
+	const struct diff_filespec *a = *(const struct diff_filespec **)a_;
+	const struct diff_filespec *b = *(const struct diff_filespec **)b_;
+
+	return a < b ? -1 : a > b;
+}
+
+/* the same source can be a candidate for copies and renames */
+static int uniq_filespecs(struct diff_filespec **list, int nr)
+{
+	int i, j;
+
+	for (i = j = 0; i < nr; i++)
+		if (!j || list[i] != list[j - 1])
+			list[j++] = list[i];
+	return j;
+}
+
+/*
+ * Compute the spanhash of every rename candidate for which the loop in
+ * fill_score_row() would: the regular files having a candidate on the
+ * other side with a size that is similar enough (see estimate_similarity()),
+ * unless the score of all such pairs is in the rename cache.
+ */
+static void prepare_rename_counts(struct rename_threads *rt, int nr_threads)
+{
+	struct rename_candidate *src, *dst;
+	struct diff_filespec **todo;
+	int src_nr = 0, dst_nr = 0, todo_nr = 0;
+	int i, j;
+
+	CALLOC_ARRAY(src, rename_src_nr);
+	CALLOC_ARRAY(dst, rename_dst_nr);
+
+	rt->dpf_opt->check_size_only = 1;
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (rt->skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (!S_ISREG(one->mode) ||
+		    (!one->cnt_data &&
+		     diff_populate_filespec(rt->repo, one, rt->dpf_opt)))
+			continue;
+		src[src_nr].size = one->size;
+		src[src_nr++].spec = one;
+	}
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].p->two;
+
+		if (rename_dst[i].is_rename)
+			continue;
+		if (!S_ISREG(two->mode) ||
+		    (!two->cnt_data &&
+		     diff_populate_filespec(rt->repo, two, rt->dpf_opt)))
+			continue;
+		dst[dst_nr].size = two->size;
+		dst[dst_nr++].spec = two;
+	}
+	QSORT(src, src_nr, rename_candidate_cmp);
+	QSORT(dst, dst_nr, rename_candidate_cmp);
+
+	for (i = 0; i < dst_nr; i++) {
+		struct diff_filespec *two = dst[i].spec;
+		int lo, hi;
+
+		similar_size_range(dst[i].size, src, src_nr, rt->minimum_score,
+				   &lo, &hi);
+		if (!rt->use_cache) {
+			dst[i].needed = lo < hi;
+			continue;
+		}
+		for (j = lo; j < hi; j++) {
+			struct diff_filespec *one = src[j].spec;
+
+			if (dst[i].needed && src[j].needed)
+				continue;
+			if (!one->oid_valid || !two->oid_valid ||
+			    rename_cache_lookup(rt->repo, &one->oid, &two->oid) < 0)
+				dst[i].needed = src[j].needed = 1;
+		}
+	}
+	for (i = 0; !rt->use_cache && i < src_nr; i++) {
+		int lo, hi;
+
+		similar_size_range(src[i].size, dst, dst_nr, rt->minimum_score,
+				   &lo, &hi);
+		src[i].needed = lo < hi;
+	}
+
+	ALLOC_ARRAY(todo, st_add(src_nr, dst_nr));
+	for (i = 0; i < src_nr; i++)
+		if (src[i].needed && !src[i].spec->cnt_data)
+			todo[todo_nr++] = src[i].spec;
+	for (i = 0; i < dst_nr; i++)
+		if (dst[i].needed && !dst[i].spec->cnt_data)
+			todo[todo_nr++] = dst[i].spec;
+	QSORT(todo, todo_nr, filespec_ptr_cmp);
+	todo_nr = uniq_filespecs(todo, todo_nr);
+
+	rt->dpf_opt->check_size_only = 0;
+	for (i = 0; i < todo_nr; ) {
+		size_t batch_size = 0;
+
+		rt->batch = todo + i;
+		rt->batch_nr = 0;
+		rt->next_in_batch = 0;
+		while (i < todo_nr && batch_size < RENAME_COUNT_BATCH_SIZE) {
+			struct diff_filespec *one = todo[i++];
+
+			rt->batch[rt->batch_nr++] = one;
+			if (diff_populate_filespec(rt->repo, one, rt->dpf_opt)) {
+				rt->batch[rt->batch_nr - 1] = NULL;
+				continue;
+			}
+			/* this may look at the attributes */
+			diff_filespec_is_binary(rt->repo, one);
+			batch_size += one->size;
+		}
+
+		run_rename_threads(rt, nr_threads, count_thread);
+
+		for (j = 0; j < rt->batch_nr; j++)
+			if (rt->batch[j])
+				diff_free_filespec_blob(rt->batch[j]);
+	}
+
+	free(todo);
+	free(src);
+	free(dst);
+}
+
+/*
+ * Like fill_score_matrix(), with "nr_threads" threads each taking the next destination to score.
+ * Returns the number of rows filled.
+ */
+static int fill_score_matrix_threaded(struct repository *r,
+				      struct diff_score *mx, int nr_threads,
+				      int skip_unmodified, int want_copies,
+				      int minimum_score, int use_cache,
+				      struct diff_populate_filespec_options *dpf_opt,
+				      struct progress *progress)
+{
+	struct rename_threads rt = {
+		.repo = r,
+		.mx = mx,
+		.skip_unmodified = skip_unmodified,
+		.want_copies = want_copies,
+		.minimum_score = minimum_score,
+		.use_cache = use_cache,
+		.dpf_opt = dpf_opt,
+		.progress = progress,
+	};
+	int i;
+
+	trace2_data_intmax("diff", r, "rename/threads", nr_threads);
+	pthread_mutex_init(&rt.mutex, NULL);
+
+	prepare_rename_counts(&rt, nr_threads);
+
+	ALLOC_ARRAY(rt.rows, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].is_rename)
+			rt.rows[rt.nr_rows++] = i;
+	run_rename_threads(&rt, nr_threads, score_thread);
+
+	free(rt.rows);
+	pthread_mutex_destroy(&rt.mutex);
+	return rt.nr_rows;
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -1389,8 +1856,8 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq = DIFF_QUEUE_INIT;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_destinations, dst_cnt;
+	int i, rename_count, skip_unmodified = 0;
+	int num_destinations, dst_cnt, nr_threads, use_cache;
 	int num_sources, want_copies;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
@@ -1579,47 +2046,21 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
-	}
+	use_cache = rename_cache_prepare(options->repo,
+					 (uint64_t)num_destinations * num_sources);
+	nr_threads = get_rename_threads(options->repo, num_destinations);
+	if (nr_threads > 1)
+		dst_cnt = fill_score_matrix_threaded(options->repo, mx,
+						     nr_threads, skip_unmodified,
+						     want_copies, minimum_score,
+						     use_cache, &dpf_options,
+						     progress);
+	else
+		dst_cnt = fill_score_matrix(options->repo, mx, skip_unmodified,
+					    want_copies, minimum_score,
+					    &dpf_options, progress);
 	stop_progress(&progress);
+	rename_cache_flush(options->repo);
 
 	/* cost matrix sorted by most to least similar pair */
 	STABLE_QSORT(mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
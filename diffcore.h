@@ -225,6 +225,20 @@ int diffcore_count_changes(struct repository *r,
 			   unsigned long *src_copied,
 			   unsigned long *literal_added);
 
+/*
+ * Compute the one->cnt_data diffcore_count_changes() uses, from the
+ * already populated one->data. It does not look at anything else than
+ * "one" if diff_filespec_is_binary() has already been called on it.
+ */
+void diffcore_populate_count(struct repository *r,
+			     struct diff_filespec *one);
+
+/*
+ * Whether the data a cnt_data was computed from has CRLF line endings,
+ * which are counted differently depending on whether it is binary.
+ */
+int diffcore_count_has_crlf(void *count);
+
 /*
  * If filespec contains an OID and if that object is missing from the given
  * repository, add that OID to to_fetch.
@@ -42,7 +42,7 @@ struct bitmap *bitmap_dup(const struct bitmap *src)
 	return dst;
 }
 
-static void bitmap_grow(struct bitmap *self, size_t word_alloc)
+void bitmap_grow(struct bitmap *self, size_t word_alloc)
 {
 	size_t old_size = self->word_alloc;
 	ALLOC_GROW(self->words, word_alloc, self->word_alloc);
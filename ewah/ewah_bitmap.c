@@ -267,6 +267,37 @@ void ewah_each_bit(struct ewah_bitmap *self, void (*callback)(size_t, void*), vo
 	}
 }
 
+int ewah_any_bit_set(struct ewah_bitmap *self, const size_t *pos, size_t nr)
+{
+	size_t word = 0;
+	size_t pointer = 0;
+	size_t i = 0;
+
+	while (pointer < self->buffer_size && i < nr) {
+		eword_t *rlw = &self->buffer[pointer];
+		size_t run = rlw_get_running_len(rlw);
+		size_t literals = rlw_get_literal_words(rlw);
+
+		word += run;
+		for (; i < nr && pos[i] / BITS_IN_EWORD < word; i++)
+			if (rlw_get_run_bit(rlw))
+				return 1;
+
+		++pointer;
+
+		for (; i < nr && pos[i] / BITS_IN_EWORD < word + literals; i++) {
+			eword_t literal = self->buffer[pointer + pos[i] / BITS_IN_EWORD - word];
+			if (literal & ((eword_t)1 << (pos[i] % BITS_IN_EWORD)))
+				return 1;
+		}
+
+		word += literals;
+		pointer += literals;
+	}
+
+	return 0;
+}
+
 /**
  * Clear all the bits in the bitmap. Does not free or resize
  * memory.
@@ -95,6 +95,15 @@ uint32_t ewah_checksum(struct ewah_bitmap *self);
  */
 void ewah_each_bit(struct ewah_bitmap *self, ewah_callback callback, void *payload);
 
+/**
+ * Return 1 if any of the `nr` bits at the positions `pos`, which must
+ * be sorted in increasing order, is set on the bitmap, 0 otherwise.
+ *
+ * Like `ewah_each_bit`, this skips over runs of identical words without
+ * decompressing them.
+ */
+int ewah_any_bit_set(struct ewah_bitmap *self, const size_t *pos, size_t nr);
+
 /**
  * Set a given bit on the bitmap.
  *
@@ -199,4 +208,63 @@ size_t bitmap_popcount(struct bitmap *self);
 size_t ewah_bitmap_popcount(struct ewah_bitmap *self);
 int bitmap_is_empty(struct bitmap *self);
 
+/*
+ * Grow "self" so that it has room for at least "word_alloc" words,
+ * zeroing the new ones.
+ */
+void bitmap_grow(struct bitmap *self, size_t word_alloc);
+
+/**
+ * Read-only roaring bitmap, pointing into a serialized buffer (usually
+ * an mmap'd .bitmap file). See roaring.c for the format.
+ */
+enum roaring_container_type {
+	ROARING_CONTAINER_ARRAY = 1,
+	ROARING_CONTAINER_BITSET = 2,
+	ROARING_CONTAINER_RUN = 3,
+};
+
+struct roaring_container {
+	uint16_t key;
+	uint8_t type;
+	/* values for arrays, runs for run containers, set bits for bitsets */
+	uint32_t nr;
+	const unsigned char *data;
+};
+
+struct roaring_bitmap {
+	uint32_t bit_size;
+	struct roaring_container *containers;
+	size_t nr;
+};
+
+/*
+ * Serialize "ewah" in roaring format. Returns the number of bytes
+ * written, or -1 if "write_fun" fails.
+ */
+ssize_t roaring_serialize_ewah(struct ewah_bitmap *ewah,
+			       int (*write_fun)(void *out, const void *buf, size_t len),
+			       void *out);
+
+/*
+ * Parse a roaring bitmap at the beginning of "map". The container
+ * payloads are not copied, so "map" must outlive "self". Returns the
+ * number of bytes consumed, or -1 on error.
+ */
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map, size_t len);
+void roaring_release(struct roaring_bitmap *self);
+void roaring_free(struct roaring_bitmap *self);
+
+int roaring_get(const struct roaring_bitmap *self, size_t pos);
+size_t roaring_popcount(const struct roaring_bitmap *self);
+
+/*
+ * OR "other" into "self", which is grown as needed. The container
+ * payloads are not validated when reading the bitmap, so this never
+ * writes outside of the chunk a container belongs to.
+ */
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other);
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *self);
+struct ewah_bitmap *roaring_to_ewah(const struct roaring_bitmap *self);
+
 #endif
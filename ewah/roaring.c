@@ -0,0 +1,464 @@
+/*
+ * Roaring bitmaps, as used by version 2 of the reachability bitmap
+ * format.
+ *
+ * A roaring bitmap splits the 32-bit position space into chunks of
+ * 2^16 bits. Each non-empty chunk is stored in a "container" whose
+ * representation is chosen to be the smallest one for its contents:
+ *
+ *   - an array container is a sorted list of the (low 16 bits of the)
+ *     positions that are set, good for sparse chunks;
+ *
+ *   - a run container is a sorted list of (start, length - 1) pairs,
+ *     good for chunks made of long stretches of set bits;
+ *
+ *   - a bitset container is a plain 2^16-bit bitmap, good for dense
+ *     chunks without much structure.
+ *
+ * Unlike EWAH, this gives random access to any bit by a binary search
+ * over the containers, and combining a container into an uncompressed
+ * `struct bitmap` is a tight loop over at most 1024 words.
+ *
+ * We never build roaring bitmaps in memory; they are serialized
+ * straight from an EWAH bitmap by the writer, and read back from the
+ * mmap'd .bitmap file without copying the container payloads.
+ */
+#include "git-compat-util.h"
+#include "ewok.h"
+#include "strbuf.h"
+
+#define ROARING_CHUNK_BITS (1U << 16)
+#define ROARING_CHUNK_WORDS (ROARING_CHUNK_BITS / BITS_IN_EWORD)
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_HEADER_SIZE 8 /* be16 key, u8 type, u8 unused, be32 nr */
+
+static size_t container_payload_size(uint8_t type, uint32_t nr)
+{
+	switch (type) {
+	case ROARING_CONTAINER_ARRAY:
+		return st_mult(nr, 2);
+	case ROARING_CONTAINER_RUN:
+		return st_mult(nr, 4);
+	case ROARING_CONTAINER_BITSET:
+		return ROARING_CHUNK_WORDS * sizeof(eword_t);
+	}
+	return 0;
+}
+
+/*
+ * Count the runs of set bits within one chunk. A run starts at every
+ * set bit whose predecessor is clear.
+ */
+static uint32_t chunk_nr_runs(const eword_t *words)
+{
+	uint32_t nr = 0;
+	eword_t carry = 0;
+	size_t i;
+
+	for (i = 0; i < ROARING_CHUNK_WORDS; i++) {
+		eword_t w = words[i];
+		nr += ewah_bit_popcount64(w & ~((w << 1) | carry));
+		carry = w >> (BITS_IN_EWORD - 1);
+	}
+	return nr;
+}
+
+static uint32_t chunk_popcount(const eword_t *words)
+{
+	uint32_t nr = 0;
+	size_t i;
+
+	for (i = 0; i < ROARING_CHUNK_WORDS; i++)
+		nr += ewah_bit_popcount64(words[i]);
+	return nr;
+}
+
+/* Return the first position >= pos in the chunk whose bit is "set". */
+static uint32_t chunk_next(const eword_t *words, uint32_t pos, int set)
+{
+	while (pos < ROARING_CHUNK_BITS) {
+		eword_t w = words[pos / BITS_IN_EWORD];
+
+		if (!set)
+			w = ~w;
+		w >>= pos % BITS_IN_EWORD;
+		if (w)
+			return pos + ewah_bit_ctz64(w);
+		pos = (pos / BITS_IN_EWORD + 1) * BITS_IN_EWORD;
+	}
+	return ROARING_CHUNK_BITS;
+}
+
+static void add_be16(struct strbuf *sb, uint16_t v)
+{
+	uint16_t be = htons(v);
+	strbuf_add(sb, &be, sizeof(be));
+}
+
+static void add_be32(struct strbuf *sb, uint32_t v)
+{
+	unsigned char buf[4];
+	put_be32(buf, v);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void add_chunk(struct strbuf *headers, struct strbuf *payload,
+		      uint16_t key, const eword_t *words)
+{
+	uint32_t card = chunk_popcount(words);
+	uint32_t runs, pos;
+	size_t array_size, run_size, bitset_size;
+	uint8_t type;
+	uint32_t nr;
+
+	if (!card)
+		return;
+
+	runs = chunk_nr_runs(words);
+	array_size = card <= ROARING_ARRAY_MAX ?
+		container_payload_size(ROARING_CONTAINER_ARRAY, card) : SIZE_MAX;
+	run_size = container_payload_size(ROARING_CONTAINER_RUN, runs);
+	bitset_size = container_payload_size(ROARING_CONTAINER_BITSET, card);
+
+	if (run_size < array_size && run_size < bitset_size) {
+		type = ROARING_CONTAINER_RUN;
+		nr = runs;
+		for (pos = chunk_next(words, 0, 1);
+		     pos < ROARING_CHUNK_BITS;
+		     pos = chunk_next(words, pos, 1)) {
+			uint32_t end = chunk_next(words, pos, 0);
+			add_be16(payload, pos);
+			add_be16(payload, end - pos - 1);
+			pos = end;
+		}
+	} else if (array_size < bitset_size) {
+		type = ROARING_CONTAINER_ARRAY;
+		nr = card;
+		for (pos = chunk_next(words, 0, 1);
+		     pos < ROARING_CHUNK_BITS;
+		     pos = chunk_next(words, pos + 1, 1))
+			add_be16(payload, pos);
+	} else {
+		size_t i;
+
+		type = ROARING_CONTAINER_BITSET;
+		nr = card;
+		for (i = 0; i < ROARING_CHUNK_WORDS; i++) {
+			unsigned char buf[8];
+			put_be64(buf, words[i]);
+			strbuf_add(payload, buf, sizeof(buf));
+		}
+	}
+
+	add_be16(headers, key);
+	strbuf_addch(headers, type);
+	strbuf_addch(headers, 0);
+	add_be32(headers, nr);
+}
+
+ssize_t roaring_serialize_ewah(struct ewah_bitmap *ewah,
+			       int (*write_fun)(void *, const void *, size_t),
+			       void *data)
+{
+	struct strbuf headers = STRBUF_INIT, payload = STRBUF_INIT;
+	struct ewah_iterator it;
+	eword_t *words;
+	eword_t word;
+	uint32_t nr_containers;
+	uint16_t key = 0;
+	size_t i = 0;
+	unsigned char buf[8];
+	ssize_t ret = -1;
+
+	CALLOC_ARRAY(words, ROARING_CHUNK_WORDS);
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&word, &it)) {
+		words[i++] = word;
+		if (i == ROARING_CHUNK_WORDS) {
+			add_chunk(&headers, &payload, key++, words);
+			memset(words, 0, ROARING_CHUNK_WORDS * sizeof(eword_t));
+			i = 0;
+		}
+	}
+	if (i)
+		add_chunk(&headers, &payload, key, words);
+	free(words);
+
+	nr_containers = headers.len / ROARING_HEADER_SIZE;
+	put_be32(buf, ewah->bit_size);
+	put_be32(buf + 4, nr_containers);
+
+	if (write_fun(data, buf, 8) != 8 ||
+	    write_fun(data, headers.buf, headers.len) != (int)headers.len ||
+	    write_fun(data, payload.buf, payload.len) != (int)payload.len)
+		goto out;
+
+	ret = 8 + headers.len + payload.len;
+out:
+	strbuf_release(&headers);
+	strbuf_release(&payload);
+	return ret;
+}
+
+ssize_t roaring_read_mmap(struct roaring_bitmap *self, const void *map,
+			  size_t len)
+{
+	const unsigned char *ptr = map, *end = ptr + len;
+	const unsigned char *headers, *payload;
+	size_t i;
+
+	memset(self, 0, sizeof(*self));
+
+	if (len < 8)
+		return error("corrupt roaring bitmap: eof before header");
+	self->bit_size = get_be32(ptr);
+	self->nr = get_be32(ptr + 4);
+	ptr += 8;
+
+	if ((size_t)(end - ptr) / ROARING_HEADER_SIZE < self->nr)
+		return error("corrupt roaring bitmap: eof in container headers");
+	headers = ptr;
+	payload = ptr + self->nr * ROARING_HEADER_SIZE;
+
+	ALLOC_ARRAY(self->containers, self->nr);
+	for (i = 0; i < self->nr; i++) {
+		struct roaring_container *c = &self->containers[i];
+		const unsigned char *h = headers + i * ROARING_HEADER_SIZE;
+		size_t size;
+
+		c->key = get_be16(h);
+		c->type = h[2];
+		c->nr = get_be32(h + 4);
+
+		if (h[3])
+			goto corrupt;
+		if (i && c->key <= self->containers[i - 1].key)
+			goto corrupt;
+		/* bitmap_or_roaring() grows its result up to the last key */
+		if (!self->bit_size || c->key > (self->bit_size - 1) >> 16)
+			goto corrupt;
+		if (!c->nr)
+			goto corrupt;
+		switch (c->type) {
+		case ROARING_CONTAINER_ARRAY:
+			if (c->nr > ROARING_ARRAY_MAX)
+				goto corrupt;
+			break;
+		case ROARING_CONTAINER_RUN:
+			if (c->nr > ROARING_CHUNK_BITS / 2)
+				goto corrupt;
+			break;
+		case ROARING_CONTAINER_BITSET:
+			if (c->nr > ROARING_CHUNK_BITS)
+				goto corrupt;
+			break;
+		default:
+			goto corrupt;
+		}
+
+		size = container_payload_size(c->type, c->nr);
+		if ((size_t)(end - payload) < size) {
+			roaring_release(self);
+			return error("corrupt roaring bitmap: eof in container data");
+		}
+		c->data = payload;
+		payload += size;
+	}
+
+	return payload - (const unsigned char *)map;
+
+corrupt:
+	roaring_release(self);
+	return error("corrupt roaring bitmap: invalid container header");
+}
+
+void roaring_release(struct roaring_bitmap *self)
+{
+	FREE_AND_NULL(self->containers);
+	self->nr = 0;
+}
+
+void roaring_free(struct roaring_bitmap *self)
+{
+	if (!self)
+		return;
+	roaring_release(self);
+	free(self);
+}
+
+static const struct roaring_container *find_container(const struct roaring_bitmap *self,
+						      uint16_t key)
+{
+	size_t lo = 0, hi = self->nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		uint16_t k = self->containers[mi].key;
+
+		if (k == key)
+			return &self->containers[mi];
+		if (k < key)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+int roaring_get(const struct roaring_bitmap *self, size_t pos)
+{
+	const struct roaring_container *c;
+	uint16_t low = pos & 0xffff;
+	size_t lo, hi;
+
+	if ((uint64_t)pos >> 32)
+		return 0;
+	c = find_container(self, pos >> 16);
+	if (!c)
+		return 0;
+
+	switch (c->type) {
+	case ROARING_CONTAINER_BITSET:
+		return !!(get_be64(c->data + (low / BITS_IN_EWORD) * 8) &
+			  ((eword_t)1 << (low % BITS_IN_EWORD)));
+	case ROARING_CONTAINER_ARRAY:
+		lo = 0;
+		hi = c->nr;
+		while (lo < hi) {
+			size_t mi = lo + (hi - lo) / 2;
+			uint16_t v = get_be16(c->data + mi * 2);
+			if (v == low)
+				return 1;
+			if (v < low)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		return 0;
+	case ROARING_CONTAINER_RUN:
+		/* find the last run starting at or before "low" */
+		lo = 0;
+		hi = c->nr;
+		while (lo < hi) {
+			size_t mi = lo + (hi - lo) / 2;
+			if (get_be16(c->data + mi * 4) <= low)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		if (!lo)
+			return 0;
+		lo--;
+		return low - get_be16(c->data + lo * 4) <=
+			get_be16(c->data + lo * 4 + 2);
+	}
+	BUG("unknown roaring container type %d", c->type);
+}
+
+size_t roaring_popcount(const struct roaring_bitmap *self)
+{
+	size_t nr = 0, i, j;
+
+	for (i = 0; i < self->nr; i++) {
+		const struct roaring_container *c = &self->containers[i];
+
+		if (c->type != ROARING_CONTAINER_RUN) {
+			nr += c->nr;
+			continue;
+		}
+		for (j = 0; j < c->nr; j++)
+			nr += get_be16(c->data + j * 4 + 2) + 1;
+	}
+	return nr;
+}
+
+static void set_bit_range(eword_t *words, uint32_t from, uint32_t to)
+{
+	size_t first = from / BITS_IN_EWORD, last = to / BITS_IN_EWORD;
+	eword_t first_mask = ~(eword_t)0 << (from % BITS_IN_EWORD);
+	eword_t last_mask = ~(eword_t)0 >> (BITS_IN_EWORD - 1 - to % BITS_IN_EWORD);
+	size_t i;
+
+	if (first == last) {
+		words[first] |= first_mask & last_mask;
+		return;
+	}
+	words[first] |= first_mask;
+	for (i = first + 1; i < last; i++)
+		words[i] = ~(eword_t)0;
+	words[last] |= last_mask;
+}
+
+/*
+ * OR the bits of container "c" into "words", which must have room for
+ * a whole chunk. Nothing in the container is trusted beyond its header:
+ * values that are out of order or runs that reach past the end of the
+ * chunk still only touch the chunk's own words.
+ */
+static void container_or_words(eword_t *words, const struct roaring_container *c)
+{
+	size_t j;
+
+	switch (c->type) {
+	case ROARING_CONTAINER_BITSET:
+		for (j = 0; j < ROARING_CHUNK_WORDS; j++)
+			words[j] |= get_be64(c->data + j * 8);
+		break;
+	case ROARING_CONTAINER_ARRAY:
+		for (j = 0; j < c->nr; j++) {
+			uint16_t v = get_be16(c->data + j * 2);
+			words[v / BITS_IN_EWORD] |=
+				(eword_t)1 << (v % BITS_IN_EWORD);
+		}
+		break;
+	case ROARING_CONTAINER_RUN:
+		for (j = 0; j < c->nr; j++) {
+			uint32_t start = get_be16(c->data + j * 4);
+			uint32_t last = start + get_be16(c->data + j * 4 + 2);
+
+			/* do not let a corrupt run spill into the next chunk */
+			if (last >= ROARING_CHUNK_BITS)
+				last = ROARING_CHUNK_BITS - 1;
+			set_bit_range(words, start, last);
+		}
+		break;
+	default:
+		BUG("unknown roaring container type %d", c->type);
+	}
+}
+
+void bitmap_or_roaring(struct bitmap *self, const struct roaring_bitmap *other)
+{
+	size_t i;
+
+	if (!other->nr)
+		return;
+
+	/*
+	 * Containers are sorted by key, so the chunk of the last one is
+	 * the highest one we may have to write to.
+	 */
+	bitmap_grow(self, ((size_t)other->containers[other->nr - 1].key + 1) *
+			  ROARING_CHUNK_WORDS);
+
+	for (i = 0; i < other->nr; i++) {
+		const struct roaring_container *c = &other->containers[i];
+
+		container_or_words(self->words + (size_t)c->key * ROARING_CHUNK_WORDS, c);
+	}
+}
+
+struct bitmap *roaring_to_bitmap(const struct roaring_bitmap *self)
+{
+	struct bitmap *bitmap = bitmap_new();
+	bitmap_or_roaring(bitmap, self);
+	return bitmap;
+}
+
+struct ewah_bitmap *roaring_to_ewah(const struct roaring_bitmap *self)
+{
+	struct bitmap *bitmap = roaring_to_bitmap(self);
+	struct ewah_bitmap *ewah = bitmap_to_ewah(bitmap);
+	bitmap_free(bitmap);
+	return ewah;
+}
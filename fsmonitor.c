@@ -314,6 +314,38 @@ static size_t handle_using_dir_name_hash_icase(
 	return nr_in_cone;
 }
 
+/*
+ * An event for a tracked file usually means that only its contents
+ * changed, which cannot change the set of untracked files: those of
+ * its directory are still the same, and that directory cannot be
+ * shown as untracked, since it contains a tracked file. Invalidating
+ * the untracked-cache anyway would make the next status re-read not
+ * only that directory but (with DIR_SHOW_OTHER_DIRECTORIES) all of
+ * its parents, up to the root of the worktree.
+ *
+ * We still need to invalidate it when the path became a directory,
+ * since the daemon may not report the files inside of it, and for the
+ * per-directory ignore files, since the untracked-cache remembers
+ * which directories have none.
+ */
+static int fsmonitor_event_affects_untracked(struct index_state *istate,
+					     const struct cache_entry *ce)
+{
+	const char *slash = strrchr(ce->name, '/');
+	const char *basename = slash ? slash + 1 : ce->name;
+	struct stat st;
+
+	if (!istate->untracked || !istate->untracked->root)
+		return 0;
+	if (!S_ISREG(ce->ce_mode) && !S_ISLNK(ce->ce_mode))
+		return 1;
+	if (!fspathcmp(basename, istate->untracked->exclude_per_dir))
+		return 1;
+	if (lstat(ce->name, &st))
+		return errno != ENOENT && errno != ENOTDIR;
+	return S_ISDIR(st.st_mode);
+}
+
 /*
  * The daemon sent an observed pathname without a trailing slash.
  * (This is the normal case.)  We do not know if it is a tracked or
@@ -331,14 +363,20 @@ static size_t handle_path_without_trailing_slash(
 	struct index_state *istate, const char *name, int pos)
 {
 	/*
-	 * Mark the untracked cache dirty for this path (regardless of
-	 * whether or not we find an exact match for it in the index).
-	 * Since the path is unqualified (no trailing slash hint in the
-	 * FSEvent), it may refer to a file or directory. So we should
-	 * not assume one or the other and should always let the untracked
-	 * cache decide what needs to invalidated.
+	 * Mark the untracked cache dirty for this path (unless we find
+	 * an exact match for a tracked file in the index that is still
+	 * one on disk). Since the path is unqualified (no trailing slash
+	 * hint in the FSEvent), it may refer to a file or directory. So
+	 * we should not assume one or the other and should otherwise let
+	 * the untracked cache decide what needs to invalidated.
 	 */
-	untracked_cache_invalidate_trimmed_path(istate, name, 0);
+	if (pos < 0 ||
+	    fsmonitor_event_affects_untracked(istate, istate->cache[pos]))
+		untracked_cache_invalidate_trimmed_path(istate, name, 0);
+	else
+		trace_printf_key(&trace_fsmonitor,
+				 "fsmonitor_refresh_callback UC-SKIP: '%s'",
+				 name);
 
 	if (pos >= 0) {
 		/*
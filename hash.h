@@ -119,6 +119,10 @@
 #ifdef platform_SHA256_Clone
 #define git_SHA256_Clone	platform_SHA256_Clone
 #endif
+#ifdef platform_SHA256_Final_multi
+#define git_SHA256_Final_multi	platform_SHA256_Final_multi
+#define git_SHA256_LANES	platform_SHA256_LANES
+#endif
 
 #ifdef SHA1_MAX_BLOCK_SIZE
 #include "compat/sha1-chunked.h"
@@ -247,6 +251,10 @@ typedef void (*git_hash_clone_fn)(git_hash_ctx *dst, const git_hash_ctx *src);
 typedef void (*git_hash_update_fn)(git_hash_ctx *ctx, const void *in, size_t len);
 typedef void (*git_hash_final_fn)(unsigned char *hash, git_hash_ctx *ctx);
 typedef void (*git_hash_final_oid_fn)(struct object_id *oid, git_hash_ctx *ctx);
+typedef void (*git_hash_final_oid_multi_fn)(struct object_id **oid,
+					    git_hash_ctx **ctx,
+					    const void **in, const size_t *len,
+					    size_t nr);
 
 struct git_hash_algo {
 	/*
@@ -282,6 +290,17 @@ struct git_hash_algo {
 	/* The hash finalization function for object IDs. */
 	git_hash_final_oid_fn final_oid_fn;
 
+	/*
+	 * Feed in[i] to ctx[i] and finalize it into oid[i] for each of
+	 * the "nr" contexts, as update_fn and final_oid_fn would.
+	 * Implementations may hash up to multi_lanes of the contexts in
+	 * parallel; the others handle them one after the other.
+	 */
+	git_hash_final_oid_multi_fn final_oid_multi_fn;
+
+	/* The number of contexts final_oid_multi_fn hashes in parallel. */
+	unsigned int multi_lanes;
+
 	/* The non-cryptographic hash initialization function. */
 	git_hash_init_fn unsafe_init_fn;
 
@@ -8,9 +8,18 @@ struct mp_block {
 	uintmax_t space[FLEX_ARRAY]; /* more */
 };
 
+struct mp_mapping {
+	struct mp_mapping *next;
+	void *start;
+	size_t len;
+};
+
 struct mem_pool {
 	struct mp_block *mp_block;
 
+	/* Memory mappings handed over with mem_pool_add_mapping(). */
+	struct mp_mapping *mappings;
+
 	/*
 	 * The amount of available memory to grow the pool by.
 	 * This size does not include the overhead for the mp_block.
@@ -60,6 +69,13 @@ char *mem_pool_strfmt(struct mem_pool *pool, const char *fmt, ...);
  */
 void mem_pool_combine(struct mem_pool *dst, struct mem_pool *src);
 
+/*
+ * Make the pool responsible for the memory mapping of 'len' bytes at
+ * 'start', so that anything allocated "in place" in the mapping lives as
+ * long as the pool. The mapping is unmapped by `mem_pool_discard`.
+ */
+void mem_pool_add_mapping(struct mem_pool *pool, void *start, size_t len);
+
 /*
  * Check if a memory pointed at by 'mem' is part of the range of
  * memory managed by the specified mem_pool.
@@ -403,13 +403,10 @@ static void normalize_file(mmfile_t *mm, const char *path, struct index_state *i
 	}
 }
 
-enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
-	     const char *path,
-	     mmfile_t *ancestor, const char *ancestor_label,
-	     mmfile_t *ours, const char *our_label,
-	     mmfile_t *theirs, const char *their_label,
-	     struct index_state *istate,
-	     const struct ll_merge_options *opts)
+const struct ll_merge_driver *ll_merge_find_driver(struct index_state *istate,
+						   const char *path,
+						   const struct ll_merge_options *opts,
+						   int *marker_size_p)
 {
 	struct attr_check *check = load_merge_attributes();
 	static const struct ll_merge_options default_opts = LL_MERGE_OPTIONS_INIT;
@@ -420,12 +417,6 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	if (!opts)
 		opts = &default_opts;
 
-	if (opts->renormalize) {
-		normalize_file(ancestor, path, istate);
-		normalize_file(ours, path, istate);
-		normalize_file(theirs, path, istate);
-	}
-
 	git_check_attr(istate, path, check);
 	ll_driver_name = check->items[0].value;
 	if (check->items[1].value) {
@@ -445,11 +436,58 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	if (opts->extra_marker_size) {
 		marker_size += opts->extra_marker_size;
 	}
+	*marker_size_p = marker_size;
+	return driver;
+}
+
+int ll_merge_driver_is_builtin(const struct ll_merge_driver *driver)
+{
+	return driver->fn != ll_ext_merge;
+}
+
+enum ll_merge_result ll_merge_with_driver(const struct ll_merge_driver *driver,
+					  int marker_size,
+					  mmbuffer_t *result_buf,
+					  const char *path,
+					  mmfile_t *ancestor, const char *ancestor_label,
+					  mmfile_t *ours, const char *our_label,
+					  mmfile_t *theirs, const char *their_label,
+					  const struct ll_merge_options *opts)
+{
+	static const struct ll_merge_options default_opts = LL_MERGE_OPTIONS_INIT;
+
+	if (!opts)
+		opts = &default_opts;
+
 	return driver->fn(driver, result_buf, path, ancestor, ancestor_label,
 			  ours, our_label, theirs, their_label,
 			  opts, marker_size);
 }
 
+enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
+	     const char *path,
+	     mmfile_t *ancestor, const char *ancestor_label,
+	     mmfile_t *ours, const char *our_label,
+	     mmfile_t *theirs, const char *their_label,
+	     struct index_state *istate,
+	     const struct ll_merge_options *opts)
+{
+	const struct ll_merge_driver *driver;
+	int marker_size;
+
+	if (opts && opts->renormalize) {
+		normalize_file(ancestor, path, istate);
+		normalize_file(ours, path, istate);
+		normalize_file(theirs, path, istate);
+	}
+
+	driver = ll_merge_find_driver(istate, path, opts, &marker_size);
+	return ll_merge_with_driver(driver, marker_size, result_buf, path,
+				    ancestor, ancestor_label,
+				    ours, our_label, theirs, their_label,
+				    opts);
+}
+
 int ll_merge_marker_size(struct index_state *istate, const char *path)
 {
 	static struct attr_check *check;
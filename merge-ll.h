@@ -108,6 +108,30 @@ enum ll_merge_result ll_merge(mmbuffer_t *result_buf,
 	     struct index_state *istate,
 	     const struct ll_merge_options *opts);
 
+struct ll_merge_driver;
+
+/**
+ * The first half of `ll_merge()` without renormalization: find the merge
+ * driver for `path` and its conflict marker size, which looks at the
+ * attributes and the configuration. The second half,
+ * `ll_merge_with_driver()`, can then be run by another thread if the
+ * driver is one of the built-in ones, as they do not look at anything
+ * else than their arguments.
+ */
+const struct ll_merge_driver *ll_merge_find_driver(struct index_state *istate,
+						   const char *path,
+						   const struct ll_merge_options *opts,
+						   int *marker_size);
+int ll_merge_driver_is_builtin(const struct ll_merge_driver *driver);
+enum ll_merge_result ll_merge_with_driver(const struct ll_merge_driver *driver,
+					  int marker_size,
+					  mmbuffer_t *result_buf,
+					  const char *path,
+					  mmfile_t *ancestor, const char *ancestor_label,
+					  mmfile_t *ours, const char *our_label,
+					  mmfile_t *theirs, const char *their_label,
+					  const struct ll_merge_options *opts);
+
 int ll_merge_marker_size(struct index_state *istate, const char *path);
 void reset_merge_attributes(void);
 
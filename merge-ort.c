@@ -26,6 +26,7 @@
 #include "cache-tree.h"
 #include "commit.h"
 #include "commit-reach.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
 #include "dir.h"
@@ -46,6 +47,7 @@
 #include "revision.h"
 #include "sparse-index.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 #include "unpack-trees.h"
@@ -401,6 +403,12 @@ struct merge_options_internal {
 	/* call_depth: recursion level counter for merging merge bases */
 	int call_depth;
 
+	/*
+	 * premerged: the content merge of the entry process_entries() is
+	 * processing, if it was done ahead by merge_contents_in_threads()
+	 */
+	struct premerged_content *premerged;
+
 	/* field that holds submodule conflict information */
 	struct string_list conflicted_submodules;
 };
@@ -669,6 +677,36 @@ static void free_strmap_strings(struct strmap *map)
 	}
 }
 
+static void clear_conflicts(struct strmap *conflicts, int reinitialize)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	/* Release and free each strbuf found in output */
+	strmap_for_each_entry(conflicts, &iter, e) {
+		struct string_list *list = e->value;
+		for (int i = 0; i < list->nr; i++) {
+			struct logical_conflict_info *info =
+				list->items[i].util;
+			strvec_clear(&info->paths);
+		}
+		/*
+		 * While strictly speaking we don't need to
+		 * free(conflicts) here because we could pass
+		 * free_values=1 when calling strmap_clear() on
+		 * opti->conflicts, that would require strmap_clear
+		 * to do another strmap_for_each_entry() loop, so we
+		 * just free it while we're iterating anyway.
+		 */
+		string_list_clear(list, 1);
+		free(list);
+	}
+	if (reinitialize)
+		strmap_partial_clear(conflicts, 0);
+	else
+		strmap_clear(conflicts, 0);
+}
+
 static void clear_or_reinit_internal_opts(struct merge_options_internal *opti,
 					  int reinitialize)
 {
@@ -717,31 +755,8 @@ static void clear_or_reinit_internal_opts(struct merge_options_internal *opti,
 	renames->cached_pairs_valid_side = 0;
 	renames->dir_rename_mask = 0;
 
-	if (!reinitialize) {
-		struct hashmap_iter iter;
-		struct strmap_entry *e;
-
-		/* Release and free each strbuf found in output */
-		strmap_for_each_entry(&opti->conflicts, &iter, e) {
-			struct string_list *list = e->value;
-			for (int i = 0; i < list->nr; i++) {
-				struct logical_conflict_info *info =
-					list->items[i].util;
-				strvec_clear(&info->paths);
-			}
-			/*
-			 * While strictly speaking we don't need to
-			 * free(conflicts) here because we could pass
-			 * free_values=1 when calling strmap_clear() on
-			 * opti->conflicts, that would require strmap_clear
-			 * to do another strmap_for_each_entry() loop, so we
-			 * just free it while we're iterating anyway.
-			 */
-			string_list_clear(list, 1);
-			free(list);
-		}
-		strmap_clear(&opti->conflicts, 0);
-	}
+	if (!reinitialize)
+		clear_conflicts(&opti->conflicts, 0);
 
 	mem_pool_discard(&opti->pool, 0);
 
@@ -2046,75 +2061,131 @@ static void initialize_attr_index(struct merge_options *opt)
 	}
 }
 
-static int merge_3way(struct merge_options *opt,
-		      const char *path,
-		      const struct object_id *o,
-		      const struct object_id *a,
-		      const struct object_id *b,
-		      const char *pathnames[3],
-		      const int extra_marker_size,
-		      mmbuffer_t *result_buf)
+static void init_ll_merge_options(struct merge_options *opt,
+				  const int extra_marker_size,
+				  struct ll_merge_options *ll_opts)
 {
-	mmfile_t orig, src1, src2;
-	struct ll_merge_options ll_opts = LL_MERGE_OPTIONS_INIT;
-	char *base, *name1, *name2;
-	enum ll_merge_result merge_status;
-
-	if (!opt->priv->attr_index.initialized)
-		initialize_attr_index(opt);
-
-	ll_opts.renormalize = opt->renormalize;
-	ll_opts.extra_marker_size = extra_marker_size;
-	ll_opts.xdl_opts = opt->xdl_opts;
-	ll_opts.conflict_style = opt->conflict_style;
+	ll_opts->renormalize = opt->renormalize;
+	ll_opts->extra_marker_size = extra_marker_size;
+	ll_opts->xdl_opts = opt->xdl_opts;
+	ll_opts->conflict_style = opt->conflict_style;
 
 	if (opt->priv->call_depth) {
-		ll_opts.virtual_ancestor = 1;
-		ll_opts.variant = 0;
+		ll_opts->virtual_ancestor = 1;
+		ll_opts->variant = 0;
 	} else {
 		switch (opt->recursive_variant) {
 		case MERGE_VARIANT_OURS:
-			ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+			ll_opts->variant = XDL_MERGE_FAVOR_OURS;
 			break;
 		case MERGE_VARIANT_THEIRS:
-			ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+			ll_opts->variant = XDL_MERGE_FAVOR_THEIRS;
 			break;
 		default:
-			ll_opts.variant = 0;
+			ll_opts->variant = 0;
 			break;
 		}
 	}
+}
 
+static void get_merge_labels(struct merge_options *opt,
+			     const char *pathnames[3],
+			     char *labels[3])
+{
 	assert(pathnames[0] && pathnames[1] && pathnames[2] && opt->ancestor);
 	if (pathnames[0] == pathnames[1] && pathnames[1] == pathnames[2]) {
-		base  = mkpathdup("%s", opt->ancestor);
-		name1 = mkpathdup("%s", opt->branch1);
-		name2 = mkpathdup("%s", opt->branch2);
+		labels[0] = mkpathdup("%s", opt->ancestor);
+		labels[1] = mkpathdup("%s", opt->branch1);
+		labels[2] = mkpathdup("%s", opt->branch2);
 	} else {
-		base  = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
-		name1 = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
-		name2 = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
+		labels[0] = mkpathdup("%s:%s", opt->ancestor, pathnames[0]);
+		labels[1] = mkpathdup("%s:%s", opt->branch1,  pathnames[1]);
+		labels[2] = mkpathdup("%s:%s", opt->branch2,  pathnames[2]);
 	}
+}
 
-	read_mmblob(&orig, o);
-	read_mmblob(&src1, a);
-	read_mmblob(&src2, b);
+/*
+ * A content merge of an entry done by merge_contents_in_threads() before
+ * process_entries() gets to it, for merge_3way() to use.
+ */
+struct premerged_content {
+	struct conflict_info *ci;
+	const char *path;
+	struct object_id o, a, b;
+	int extra_marker_size;
+	const struct ll_merge_driver *driver;
+	int marker_size;
+	char *labels[3];
+	mmbuffer_t result;
+	enum ll_merge_result status;
+};
+
+static int use_premerged_content(struct merge_options *opt,
+				 const char *path,
+				 const struct object_id *o,
+				 const struct object_id *a,
+				 const struct object_id *b,
+				 const int extra_marker_size,
+				 mmbuffer_t *result_buf,
+				 enum ll_merge_result *merge_status)
+{
+	struct premerged_content *pc = opt->priv->premerged;
+
+	if (!pc || !pc->result.ptr ||
+	    strcmp(pc->path, path) ||
+	    !oideq(&pc->o, o) || !oideq(&pc->a, a) || !oideq(&pc->b, b) ||
+	    pc->extra_marker_size != extra_marker_size)
+		return 0;
 
-	merge_status = ll_merge(result_buf, path, &orig, base,
-				&src1, name1, &src2, name2,
-				&opt->priv->attr_index, &ll_opts);
+	*result_buf = pc->result;
+	*merge_status = pc->status;
+	pc->result.ptr = NULL;
+	return 1;
+}
+
+static int merge_3way(struct merge_options *opt,
+		      const char *path,
+		      const struct object_id *o,
+		      const struct object_id *a,
+		      const struct object_id *b,
+		      const char *pathnames[3],
+		      const int extra_marker_size,
+		      mmbuffer_t *result_buf)
+{
+	mmfile_t orig, src1, src2;
+	struct ll_merge_options ll_opts = LL_MERGE_OPTIONS_INIT;
+	char *labels[3];
+	enum ll_merge_result merge_status;
+
+	if (!opt->priv->attr_index.initialized)
+		initialize_attr_index(opt);
+
+	init_ll_merge_options(opt, extra_marker_size, &ll_opts);
+	get_merge_labels(opt, pathnames, labels);
+
+	if (!use_premerged_content(opt, path, o, a, b, extra_marker_size,
+				   result_buf, &merge_status)) {
+		read_mmblob(&orig, o);
+		read_mmblob(&src1, a);
+		read_mmblob(&src2, b);
+
+		merge_status = ll_merge(result_buf, path, &orig, labels[0],
+					&src1, labels[1], &src2, labels[2],
+					&opt->priv->attr_index, &ll_opts);
+
+		free(orig.ptr);
+		free(src1.ptr);
+		free(src2.ptr);
+	}
 	if (merge_status == LL_MERGE_BINARY_CONFLICT)
 		path_msg(opt, CONFLICT_BINARY, 0,
 			 path, NULL, NULL, NULL,
 			 "warning: Cannot merge binary files: %s (%s vs. %s)",
-			 path, name1, name2);
-
-	free(base);
-	free(name1);
-	free(name2);
-	free(orig.ptr);
-	free(src1.ptr);
-	free(src2.ptr);
+			 path, labels[1], labels[2]);
+
+	free(labels[0]);
+	free(labels[1]);
+	free(labels[2]);
 	return merge_status;
 }
 
@@ -4370,6 +4441,203 @@ static void prefetch_for_content_merges(struct merge_options *opt,
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * The content merges are done by merge_contents_in_threads() in batches of
+ * this many entries, whose results are kept until process_entries() gets
+ * to them.
+ */
+#define CONTENT_MERGE_BATCH 256
+
+/*
+ * Merges with fewer content merges than this, like most of those done by
+ * rebase and cherry-pick, do them one after the other: starting threads
+ * would cost more than it saves.
+ */
+#define MIN_THREADED_CONTENT_MERGES 16
+
+struct content_merges {
+	struct merge_options *opt;
+	struct ll_merge_options ll_opts;
+
+	struct premerged_content *items;
+	size_t nr, alloc;
+
+	/* the next one process_entries() will get to */
+	size_t next;
+
+	/* the ones of the current batch still to be merged, and its end */
+	size_t next_to_merge, batch_end;
+	pthread_mutex_t mutex;
+};
+
+static int get_merge_threads(struct merge_options *opt, size_t *min_merges)
+{
+	char *env_threads = getenv("GIT_TEST_MERGE_THREADS");
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+
+	*min_merges = MIN_THREADED_CONTENT_MERGES;
+	if (env_threads && *env_threads) {
+		if (strtol_i(env_threads, 10, &nr_threads))
+			die(_("invalid value for '%s': '%s'"),
+			    "GIT_TEST_MERGE_THREADS", env_threads);
+		*min_merges = 1;
+	} else if (repo_config_get_int(opt->repo, "merge.threads",
+				       &nr_threads)) {
+		nr_threads = 0;
+	}
+	if (nr_threads < 1)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+/*
+ * Find the entries that process_entry() will do a content merge of with
+ * one of the built-in merge drivers, in the order it will get to them.
+ * The others, and the content merges done for renames, are done by
+ * merge_3way() as usual.
+ */
+static void find_content_merges(struct merge_options *opt,
+				struct string_list *plist,
+				struct content_merges *cm)
+{
+	struct string_list_item *e;
+
+	/* this needs the attributes of the files being merged */
+	if (opt->renormalize)
+		return;
+	if (!opt->priv->attr_index.initialized)
+		initialize_attr_index(opt);
+	init_ll_merge_options(opt, opt->priv->call_depth * 2, &cm->ll_opts);
+
+	for (e = &plist->items[plist->nr-1]; e >= plist->items; --e) {
+		struct conflict_info *ci = e->util;
+		struct premerged_content *pc;
+		const struct ll_merge_driver *driver;
+		int marker_size;
+
+		/* Same as prefetch_for_content_merges() */
+		if (ci->merged.clean)
+			continue;
+		if (ci->match_mask || ci->filemask < 6 ||
+		    !S_ISREG(ci->stages[1].mode) ||
+		    !S_ISREG(ci->stages[2].mode) ||
+		    oideq(&ci->stages[1].oid, &ci->stages[2].oid))
+			continue;
+		if (ci->filemask == 7 &&
+		    S_ISREG(ci->stages[0].mode) &&
+		    (oideq(&ci->stages[0].oid, &ci->stages[1].oid) ||
+		     oideq(&ci->stages[0].oid, &ci->stages[2].oid)))
+			continue;
+
+		/* process_entry() may move these elsewhere first */
+		if (ci->dirmask || ci->df_conflict)
+			continue;
+
+		driver = ll_merge_find_driver(&opt->priv->attr_index, e->string,
+					      &cm->ll_opts, &marker_size);
+		if (!ll_merge_driver_is_builtin(driver))
+			continue;
+
+		ALLOC_GROW(cm->items, cm->nr + 1, cm->alloc);
+		pc = &cm->items[cm->nr++];
+		memset(pc, 0, sizeof(*pc));
+		pc->ci = ci;
+		pc->path = e->string;
+		if ((S_IFMT & ci->stages[0].mode) != (S_IFMT & ci->stages[1].mode))
+			oidcpy(&pc->o, null_oid());
+		else
+			oidcpy(&pc->o, &ci->stages[0].oid);
+		oidcpy(&pc->a, &ci->stages[1].oid);
+		oidcpy(&pc->b, &ci->stages[2].oid);
+		pc->extra_marker_size = opt->priv->call_depth * 2;
+		pc->driver = driver;
+		pc->marker_size = marker_size;
+	}
+}
+
+static void *content_merge_thread(void *data)
+{
+	struct content_merges *cm = data;
+
+	trace2_thread_start("content_merge");
+	for (;;) {
+		struct premerged_content *pc;
+		mmfile_t orig, src1, src2;
+
+		pthread_mutex_lock(&cm->mutex);
+		if (cm->next_to_merge >= cm->batch_end) {
+			pthread_mutex_unlock(&cm->mutex);
+			break;
+		}
+		pc = &cm->items[cm->next_to_merge++];
+		pthread_mutex_unlock(&cm->mutex);
+
+		read_mmblob(&orig, &pc->o);
+		read_mmblob(&src1, &pc->a);
+		read_mmblob(&src2, &pc->b);
+		pc->status = ll_merge_with_driver(pc->driver, pc->marker_size,
+						  &pc->result, pc->path,
+						  &orig, pc->labels[0],
+						  &src1, pc->labels[1],
+						  &src2, pc->labels[2],
+						  &cm->ll_opts);
+		free(orig.ptr);
+		free(src1.ptr);
+		free(src2.ptr);
+	}
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Do the next batch of content merges, starting with the one process_entries()
+ * is getting to, with "nr_threads" threads. Their results are picked up by
+ * merge_3way(), while everything else, from writing the merged blobs to
+ * reporting conflicts, is still done in order.
+ */
+static void merge_contents_in_threads(struct content_merges *cm, int nr_threads)
+{
+	pthread_t *threads;
+	size_t i;
+	int err, nr_started = 0;
+
+	cm->next_to_merge = cm->next;
+	cm->batch_end = cm->next + CONTENT_MERGE_BATCH;
+	if (cm->batch_end > cm->nr)
+		cm->batch_end = cm->nr;
+	for (i = cm->next; i < cm->batch_end; i++)
+		get_merge_labels(cm->opt, cm->items[i].ci->pathnames,
+				 cm->items[i].labels);
+	if (nr_threads > cm->batch_end - cm->next)
+		nr_threads = cm->batch_end - cm->next;
+
+	enable_obj_read_lock();
+	CALLOC_ARRAY(threads, nr_threads);
+	for (; nr_started < nr_threads; nr_started++) {
+		err = pthread_create(&threads[nr_started], NULL,
+				     content_merge_thread, cm);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	disable_obj_read_lock();
+}
+
+static void release_premerged_content(struct premerged_content *pc)
+{
+	free(pc->labels[0]);
+	free(pc->labels[1]);
+	free(pc->labels[2]);
+	free(pc->result.ptr);
+	memset(pc->labels, 0, sizeof(pc->labels));
+	pc->result.ptr = NULL;
+}
+
 static int process_entries(struct merge_options *opt,
 			   struct object_id *result_oid)
 {
@@ -4380,6 +4648,9 @@ static int process_entries(struct merge_options *opt,
 	struct directory_versions dir_metadata = { STRING_LIST_INIT_NODUP,
 						   STRING_LIST_INIT_NODUP,
 						   NULL, 0 };
+	struct content_merges cm = { .opt = opt };
+	size_t min_merges = 0;
+	int nr_threads;
 	int ret = 0;
 
 	trace2_region_enter("merge", "process_entries setup", opt->repo);
@@ -4418,6 +4689,20 @@ static int process_entries(struct merge_options *opt,
 	 */
 	trace2_region_enter("merge", "processing", opt->repo);
 	prefetch_for_content_merges(opt, &plist);
+	nr_threads = get_merge_threads(opt, &min_merges);
+	if (nr_threads > 1)
+		find_content_merges(opt, &plist, &cm);
+	if (cm.nr < min_merges) {
+		FREE_AND_NULL(cm.items);
+		cm.nr = cm.alloc = 0;
+	}
+	if (cm.nr) {
+		trace2_data_intmax("merge", opt->repo, "content_merge/threads",
+				   nr_threads);
+		trace2_data_intmax("merge", opt->repo, "content_merge/threaded",
+				   cm.nr);
+		pthread_mutex_init(&cm.mutex, NULL);
+	}
 	for (entry = &plist.items[plist.nr-1]; entry >= plist.items; --entry) {
 		char *path = entry->string;
 		/*
@@ -4436,10 +4721,19 @@ static int process_entries(struct merge_options *opt,
 			record_entry_for_tree(&dir_metadata, path, mi);
 		else {
 			struct conflict_info *ci = (struct conflict_info *)mi;
-			if (process_entry(opt, path, ci, &dir_metadata) < 0) {
-				ret = -1;
+
+			if (cm.next < cm.nr && cm.items[cm.next].ci == ci) {
+				if (cm.next >= cm.batch_end)
+					merge_contents_in_threads(&cm, nr_threads);
+				opt->priv->premerged = &cm.items[cm.next++];
+			}
+			ret = process_entry(opt, path, ci, &dir_metadata);
+			if (opt->priv->premerged) {
+				release_premerged_content(opt->priv->premerged);
+				opt->priv->premerged = NULL;
+			}
+			if (ret < 0)
 				goto cleanup;
-			};
 		}
 	}
 	trace2_region_leave("merge", "processing", opt->repo);
@@ -4458,6 +4752,14 @@ static int process_entries(struct merge_options *opt,
 		       opt->repo->hash_algo->rawsz) < 0)
 		ret = -1;
 cleanup:
+	if (cm.nr) {
+		size_t i;
+
+		for (i = cm.next; i < cm.batch_end; i++)
+			release_premerged_content(&cm.items[i]);
+		free(cm.items);
+		pthread_mutex_destroy(&cm.mutex);
+	}
 	string_list_clear(&plist, 0);
 	string_list_clear(&dir_metadata.versions, 0);
 	string_list_clear(&dir_metadata.offsets, 0);
@@ -4956,6 +5258,12 @@ static void merge_start(struct merge_options *opt, struct merge_result *result)
 	trace2_region_enter("merge", "allocate/init", opt->repo);
 	if (opt->priv) {
 		clear_or_reinit_internal_opts(opt->priv, 1);
+		/*
+		 * The messages of the previous merge are kept by the
+		 * reinitialization above for the outer merges of a recursive
+		 * merge, but do not belong to this new one.
+		 */
+		clear_conflicts(&opt->priv->conflicts, 1);
 		string_list_init_nodup(&opt->priv->conflicted_submodules);
 		trace2_region_leave("merge", "allocate/init", opt->repo);
 		return;
@@ -19,12 +19,19 @@
 #include "list-objects.h"
 #include "path.h"
 #include "pack-revindex.h"
+#include "thread-utils.h"
 
 #define PACK_EXPIRED UINT_MAX
 #define BITMAP_POS_UNKNOWN (~((uint32_t)0))
 #define MIDX_CHUNK_FANOUT_SIZE (sizeof(uint32_t) * 256)
 #define MIDX_CHUNK_LARGE_OFFSET_WIDTH (sizeof(uint64_t))
 
+/*
+ * Do not bother spawning a thread for fewer objects than this; below
+ * it the cost of creating the thread outweighs the work it saves.
+ */
+#define MIDX_MIN_OBJECTS_PER_THREAD 50000
+
 extern int midx_checksum_valid(struct multi_pack_index *m);
 extern void clear_midx_files_ext(const char *object_dir, const char *ext,
 				 const char *keep_hash);
@@ -111,6 +118,8 @@ struct write_midx_context {
 
 	struct string_list *to_include;
 
+	int nr_threads;
+
 	struct repository *repo;
 };
 
@@ -318,39 +327,62 @@ static void midx_fanout_add_pack_fanout(struct midx_fanout *fanout,
 }
 
 /*
- * It is possible to artificially get into a state where there are many
- * duplicate copies of objects. That can create high memory pressure if
- * we are to create a list of all objects before de-duplication. To reduce
- * this memory pressure without a significant performance drop, automatically
- * group objects by the first byte of their object id. Use the IDX fanout
- * tables to group the data, copy to a local array, then sort.
- *
- * Copy only the de-duplicated entries (selected by most-recent modified time
- * of a packfile containing the object).
+ * Split the "nr" units whose sizes are given in "weight" into
+ * "nr_parts" contiguous ranges of roughly equal total weight. Part "i"
+ * covers the units in [bounds[i], bounds[i + 1]).
  */
-static void compute_sorted_entries(struct write_midx_context *ctx,
-				   uint32_t start_pack)
+static void split_by_weight(const size_t *weight, uint32_t nr,
+			    int nr_parts, uint32_t *bounds)
 {
-	uint32_t cur_fanout, cur_pack, cur_object;
-	size_t alloc_objects, total_objects = 0;
-	struct midx_fanout fanout = { 0 };
+	size_t total = 0, sum = 0;
+	uint32_t i;
+	int part = 1;
 
-	for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++)
-		total_objects = st_add(total_objects,
-				       ctx->info[cur_pack].p->num_objects);
+	for (i = 0; i < nr; i++)
+		total += weight[i];
 
-	/*
-	 * As we de-duplicate by fanout value, we expect the fanout
-	 * slices to be evenly distributed, with some noise. Hence,
-	 * allocate slightly more than one 256th.
-	 */
-	alloc_objects = fanout.alloc = total_objects > 3200 ? total_objects / 200 : 16;
+	bounds[0] = 0;
+	for (i = 0; i < nr && part < nr_parts; i++) {
+		sum += weight[i];
+		while (part < nr_parts && sum >= total / nr_parts * part)
+			bounds[part++] = i + 1;
+	}
+	while (part <= nr_parts)
+		bounds[part++] = nr;
+}
+
+struct midx_entries_range {
+	struct write_midx_context *ctx;
+	uint32_t start_pack;
+	uint32_t fanout_begin, fanout_end;
+	size_t alloc_objects;
+
+	struct pack_midx_entry *entries;
+	size_t entries_nr;
+
+	pthread_t thread;
+};
 
+/*
+ * Collect, sort and de-duplicate the objects whose first byte falls
+ * within [range->fanout_begin, range->fanout_end). The slices for
+ * different first bytes are independent of each other, so disjoint
+ * ranges can be handled concurrently.
+ */
+static void compute_sorted_entries_range(struct midx_entries_range *range)
+{
+	struct write_midx_context *ctx = range->ctx;
+	uint32_t start_pack = range->start_pack;
+	uint32_t cur_fanout, cur_pack, cur_object;
+	size_t alloc_objects = range->alloc_objects;
+	struct midx_fanout fanout = { 0 };
+
+	fanout.alloc = alloc_objects;
 	ALLOC_ARRAY(fanout.entries, fanout.alloc);
-	ALLOC_ARRAY(ctx->entries, alloc_objects);
-	ctx->entries_nr = 0;
+	ALLOC_ARRAY(range->entries, alloc_objects);
+	range->entries_nr = 0;
 
-	for (cur_fanout = 0; cur_fanout < 256; cur_fanout++) {
+	for (cur_fanout = range->fanout_begin; cur_fanout < range->fanout_end; cur_fanout++) {
 		fanout.nr = 0;
 
 		if (ctx->m && !ctx->incremental)
@@ -384,18 +416,143 @@ static void compute_sorted_entries(struct write_midx_context *ctx,
 					 &fanout.entries[cur_object].oid))
 				continue;
 
-			ALLOC_GROW(ctx->entries, st_add(ctx->entries_nr, 1),
+			ALLOC_GROW(range->entries, st_add(range->entries_nr, 1),
 				   alloc_objects);
-			memcpy(&ctx->entries[ctx->entries_nr],
+			memcpy(&range->entries[range->entries_nr],
 			       &fanout.entries[cur_object],
 			       sizeof(struct pack_midx_entry));
-			ctx->entries_nr++;
+			range->entries_nr++;
 		}
 	}
 
 	free(fanout.entries);
 }
 
+static void *compute_sorted_entries_thread(void *data)
+{
+	compute_sorted_entries_range(data);
+	return NULL;
+}
+
+static size_t midx_fanout_slice_nr(struct write_midx_context *ctx,
+				   uint32_t start_pack, uint32_t cur_fanout)
+{
+	size_t nr = 0;
+	uint32_t cur_pack;
+
+	for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++) {
+		struct packed_git *p = ctx->info[cur_pack].p;
+		nr += get_pack_fanout(p, cur_fanout);
+		if (cur_fanout)
+			nr -= get_pack_fanout(p, cur_fanout - 1);
+	}
+	return nr;
+}
+
+/*
+ * It is possible to artificially get into a state where there are many
+ * duplicate copies of objects. That can create high memory pressure if
+ * we are to create a list of all objects before de-duplication. To reduce
+ * this memory pressure without a significant performance drop, automatically
+ * group objects by the first byte of their object id. Use the IDX fanout
+ * tables to group the data, copy to a local array, then sort.
+ *
+ * Copy only the de-duplicated entries (selected by most-recent modified time
+ * of a packfile containing the object).
+ *
+ * With more than one thread, each thread handles a contiguous range of
+ * first bytes, chosen so that the ranges hold about the same number of
+ * objects, and the results are concatenated in order.
+ */
+static void compute_sorted_entries(struct write_midx_context *ctx,
+				   uint32_t start_pack)
+{
+	uint32_t cur_pack;
+	size_t total_objects = 0;
+	struct midx_entries_range *ranges;
+	int nr_threads = ctx->nr_threads;
+	int i;
+
+	for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++)
+		total_objects = st_add(total_objects,
+				       ctx->info[cur_pack].p->num_objects);
+
+	if (nr_threads > total_objects / MIDX_MIN_OBJECTS_PER_THREAD)
+		nr_threads = total_objects / MIDX_MIN_OBJECTS_PER_THREAD;
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	CALLOC_ARRAY(ranges, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		ranges[i].ctx = ctx;
+		ranges[i].start_pack = start_pack;
+		/*
+		 * As we de-duplicate by fanout value, we expect the fanout
+		 * slices to be evenly distributed, with some noise. Hence,
+		 * allocate slightly more than one 256th.
+		 */
+		ranges[i].alloc_objects =
+			total_objects > 3200 ? total_objects / 200 : 16;
+	}
+
+	if (nr_threads == 1) {
+		ranges[0].fanout_begin = 0;
+		ranges[0].fanout_end = 256;
+		compute_sorted_entries_range(&ranges[0]);
+
+		ctx->entries = ranges[0].entries;
+		ctx->entries_nr = ranges[0].entries_nr;
+	} else {
+		size_t weight[256];
+		uint32_t bounds[257];
+		uint32_t cur_fanout;
+
+		trace2_region_enter("midx", "compute_sorted_entries/threaded",
+				    ctx->repo);
+
+		for (cur_fanout = 0; cur_fanout < 256; cur_fanout++)
+			weight[cur_fanout] = midx_fanout_slice_nr(ctx, start_pack,
+								  cur_fanout);
+		split_by_weight(weight, 256, nr_threads, bounds);
+
+		for (i = 0; i < nr_threads; i++) {
+			int err;
+
+			ranges[i].fanout_begin = bounds[i];
+			ranges[i].fanout_end = bounds[i + 1];
+			err = pthread_create(&ranges[i].thread, NULL,
+					     compute_sorted_entries_thread,
+					     &ranges[i]);
+			if (err)
+				die(_("unable to create thread: %s"),
+				    strerror(err));
+		}
+
+		ctx->entries_nr = 0;
+		for (i = 0; i < nr_threads; i++) {
+			pthread_join(ranges[i].thread, NULL);
+			ctx->entries_nr = st_add(ctx->entries_nr,
+						 ranges[i].entries_nr);
+		}
+
+		ALLOC_ARRAY(ctx->entries, ctx->entries_nr);
+		ctx->entries_nr = 0;
+		for (i = 0; i < nr_threads; i++) {
+			COPY_ARRAY(ctx->entries + ctx->entries_nr,
+				   ranges[i].entries, ranges[i].entries_nr);
+			ctx->entries_nr += ranges[i].entries_nr;
+			free(ranges[i].entries);
+		}
+
+		trace2_data_intmax("midx", ctx->repo,
+				   "compute_sorted_entries/threads", nr_threads);
+		trace2_region_leave("midx", "compute_sorted_entries/threaded",
+				    ctx->repo);
+	}
+
+	free(ranges);
+}
+
 static int write_midx_pack_names(struct hashfile *f, void *data)
 {
 	struct write_midx_context *ctx = data;
@@ -601,6 +758,109 @@ static int midx_pack_order_cmp(const void *va, const void *vb)
 		return 0;
 }
 
+struct midx_pack_order_range {
+	struct midx_pack_order_data *data;
+	const size_t *bucket_start;
+	uint32_t bucket_begin, bucket_end;
+	pthread_t thread;
+};
+
+static void midx_pack_order_sort_range(struct midx_pack_order_range *range)
+{
+	uint32_t i;
+
+	for (i = range->bucket_begin; i < range->bucket_end; i++) {
+		size_t start = range->bucket_start[i];
+		size_t nr = range->bucket_start[i + 1] - start;
+		QSORT(range->data + start, nr, midx_pack_order_cmp);
+	}
+}
+
+static void *midx_pack_order_thread(void *data)
+{
+	midx_pack_order_sort_range(data);
+	return NULL;
+}
+
+/*
+ * Sort the objects into pack order, i.e., by (preferred, pack, offset).
+ * Rather than sorting all objects at once, we first distribute them
+ * into one bucket per (preferred, pack) pair, which is linear, and
+ * then sort each bucket by offset. The buckets are independent and
+ * are sorted in parallel when we have more than one thread.
+ */
+static void midx_pack_order_sort(struct write_midx_context *ctx,
+				 struct midx_pack_order_data *data)
+{
+	struct midx_pack_order_data *sorted;
+	struct midx_pack_order_range *ranges;
+	uint32_t nr_buckets = st_mult(ctx->nr, 2);
+	size_t *bucket_start, *bucket_pos, *weight;
+	uint32_t *bounds;
+	int nr_threads = ctx->nr_threads;
+	size_t i;
+	int t;
+
+#define PACK_ORDER_BUCKET(d) \
+	(((d)->pack & (1U << 31) ? ctx->nr : 0) + ((d)->pack & ~(1U << 31)))
+
+	CALLOC_ARRAY(bucket_start, nr_buckets + 1);
+	for (i = 0; i < ctx->entries_nr; i++)
+		bucket_start[PACK_ORDER_BUCKET(&data[i]) + 1]++;
+	CALLOC_ARRAY(weight, nr_buckets);
+	for (i = 0; i < nr_buckets; i++) {
+		weight[i] = bucket_start[i + 1];
+		bucket_start[i + 1] += bucket_start[i];
+	}
+
+	ALLOC_ARRAY(bucket_pos, nr_buckets);
+	COPY_ARRAY(bucket_pos, bucket_start, nr_buckets);
+	ALLOC_ARRAY(sorted, ctx->entries_nr);
+	for (i = 0; i < ctx->entries_nr; i++)
+		sorted[bucket_pos[PACK_ORDER_BUCKET(&data[i])]++] = data[i];
+	COPY_ARRAY(data, sorted, ctx->entries_nr);
+	free(sorted);
+	free(bucket_pos);
+
+#undef PACK_ORDER_BUCKET
+
+	if (nr_threads > ctx->entries_nr / MIDX_MIN_OBJECTS_PER_THREAD)
+		nr_threads = ctx->entries_nr / MIDX_MIN_OBJECTS_PER_THREAD;
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	ALLOC_ARRAY(bounds, nr_threads + 1);
+	split_by_weight(weight, nr_buckets, nr_threads, bounds);
+
+	CALLOC_ARRAY(ranges, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		ranges[t].data = data;
+		ranges[t].bucket_start = bucket_start;
+		ranges[t].bucket_begin = bounds[t];
+		ranges[t].bucket_end = bounds[t + 1];
+	}
+
+	if (nr_threads == 1) {
+		midx_pack_order_sort_range(&ranges[0]);
+	} else {
+		for (t = 0; t < nr_threads; t++) {
+			int err = pthread_create(&ranges[t].thread, NULL,
+						 midx_pack_order_thread,
+						 &ranges[t]);
+			if (err)
+				die(_("unable to create thread: %s"),
+				    strerror(err));
+		}
+		for (t = 0; t < nr_threads; t++)
+			pthread_join(ranges[t].thread, NULL);
+	}
+
+	free(ranges);
+	free(bounds);
+	free(weight);
+	free(bucket_start);
+}
+
 static uint32_t *midx_pack_order(struct write_midx_context *ctx)
 {
 	struct midx_pack_order_data *data;
@@ -625,7 +885,7 @@ static uint32_t *midx_pack_order(struct write_midx_context *ctx)
 		data[i].offset = e->offset;
 	}
 
-	QSORT(data, ctx->entries_nr, midx_pack_order_cmp);
+	midx_pack_order_sort(ctx, data);
 
 	for (i = 0; i < ctx->entries_nr; i++) {
 		struct pack_midx_entry *e = &ctx->entries[data[i].nr];
@@ -829,20 +1089,31 @@ static struct commit **find_commits_for_midx_bitmap(uint32_t *indexed_commits_nr
 	return cb.commits;
 }
 
-static int write_midx_bitmap(struct repository *r, const char *midx_name,
+static int write_midx_bitmap(struct write_midx_context *ctx,
+			     const char *object_dir, const char *midx_name,
 			     const unsigned char *midx_hash,
 			     struct packing_data *pdata,
 			     struct commit **commits,
 			     uint32_t commits_nr,
-			     uint32_t *pack_order,
 			     unsigned flags)
 {
+	struct repository *r = ctx->repo;
 	int ret, i;
 	uint16_t options = 0;
 	struct bitmap_writer writer;
 	struct pack_idx_entry **index;
-	char *bitmap_name = xstrfmt("%s-%s.bitmap", midx_name,
-				    hash_to_hex_algop(midx_hash, r->hash_algo));
+	char *bitmap_name;
+
+	if (ctx->incremental) {
+		struct strbuf buf = STRBUF_INIT;
+
+		get_split_midx_filename_ext(r->hash_algo, &buf, object_dir,
+					    midx_hash, MIDX_EXT_BITMAP);
+		bitmap_name = strbuf_detach(&buf, NULL);
+	} else {
+		bitmap_name = xstrfmt("%s-%s.bitmap", midx_name,
+				      hash_to_hex_algop(midx_hash, r->hash_algo));
+	}
 
 	trace2_region_enter("midx", "write_midx_bitmap", r);
 
@@ -861,7 +1132,8 @@ static int write_midx_bitmap(struct repository *r, const char *midx_name,
 	for (i = 0; i < pdata->nr_objects; i++)
 		index[i] = &pdata->objects[i].idx;
 
-	bitmap_writer_init(&writer, r, pdata);
+	bitmap_writer_init(&writer, r, pdata,
+			   ctx->incremental ? ctx->base_midx : NULL);
 	bitmap_writer_show_progress(&writer, flags & MIDX_PROGRESS);
 	bitmap_writer_build_type_index(&writer, index);
 
@@ -879,7 +1151,7 @@ static int write_midx_bitmap(struct repository *r, const char *midx_name,
 	 * bitmap_writer_finish().
 	 */
 	for (i = 0; i < pdata->nr_objects; i++)
-		index[pack_order[i]] = &pdata->objects[i].idx;
+		index[ctx->pack_order[i]] = &pdata->objects[i].idx;
 
 	bitmap_writer_select_commits(&writer, commits, commits_nr);
 	ret = bitmap_writer_build(&writer);
@@ -1074,11 +1346,15 @@ static int write_midx_internal(struct repository *r, const char *object_dir,
 
 	trace2_region_enter("midx", "write_midx_internal", r);
 
+	if (repo_config_get_int(r, "pack.threads", &ctx.nr_threads) ||
+	    !ctx.nr_threads)
+		ctx.nr_threads = online_cpus();
+	if (!HAVE_THREADS || ctx.nr_threads < 1)
+		ctx.nr_threads = 1;
+
 	ctx.repo = r;
 
 	ctx.incremental = !!(flags & MIDX_WRITE_INCREMENTAL);
-	if (ctx.incremental && (flags & MIDX_WRITE_BITMAP))
-		die(_("cannot write incremental MIDX with bitmap"));
 
 	if (ctx.incremental)
 		strbuf_addf(&midx_name,
@@ -1165,6 +1441,23 @@ static int write_midx_internal(struct repository *r, const char *object_dir,
 	if (ctx.incremental && !ctx.nr)
 		goto cleanup; /* nothing to do */
 
+	if (ctx.incremental && ctx.base_midx && (flags & MIDX_WRITE_BITMAP)) {
+		/*
+		 * The bitmap of the new layer only covers the commits in
+		 * it, and relies on the layers below for everything else.
+		 */
+		struct bitmap_index *bitmap_git =
+			prepare_midx_bitmap_git(ctx.base_midx);
+
+		if (!bitmap_git) {
+			error(_("cannot write an incremental multi-pack bitmap "
+				"without bitmaps for the existing layers"));
+			result = 1;
+			goto cleanup;
+		}
+		free_bitmap_index(bitmap_git);
+	}
+
 	if (preferred_pack_name) {
 		ctx.preferred_pack_idx = -1;
 
@@ -1409,8 +1702,8 @@ static int write_midx_internal(struct repository *r, const char *object_dir,
 		FREE_AND_NULL(ctx.entries);
 		ctx.entries_nr = 0;
 
-		if (write_midx_bitmap(r, midx_name.buf, midx_hash, &pdata,
-				      commits, commits_nr, ctx.pack_order,
+		if (write_midx_bitmap(&ctx, object_dir, midx_name.buf,
+				      midx_hash, &pdata, commits, commits_nr,
 				      flags) < 0) {
 			error(_("could not write multi-pack bitmap"));
 			result = 1;
@@ -113,6 +113,21 @@ static void git_hash_sha1_final_oid(struct object_id *oid, git_hash_ctx *ctx)
 	oid->algo = GIT_HASH_SHA1;
 }
 
+static void git_hash_sha1_final_oid_multi(struct object_id **oid,
+					  git_hash_ctx **ctx,
+					  const void **in, const size_t *len,
+					  size_t nr)
+{
+	/*
+	 * The collision detection of sha1dc works on the state of a
+	 * single message, so there is nothing to interleave here.
+	 */
+	for (size_t i = 0; i < nr; i++) {
+		git_hash_sha1_update(ctx[i], in[i], len[i]);
+		git_hash_sha1_final_oid(oid[i], ctx[i]);
+	}
+}
+
 static void git_hash_sha1_init_unsafe(git_hash_ctx *ctx)
 {
 	git_SHA1_Init_unsafe(&ctx->sha1_unsafe);
@@ -172,6 +187,51 @@ static void git_hash_sha256_final_oid(struct object_id *oid, git_hash_ctx *ctx)
 	oid->algo = GIT_HASH_SHA256;
 }
 
+#ifdef git_SHA256_Final_multi
+static void git_hash_sha256_final_oid_multi(struct object_id **oid,
+					    git_hash_ctx **ctx,
+					    const void **in, const size_t *len,
+					    size_t nr)
+{
+	git_SHA256_CTX *c[64];
+	unsigned char *hash[64];
+
+	while (nr) {
+		size_t n = nr < ARRAY_SIZE(c) ? nr : ARRAY_SIZE(c);
+
+		for (size_t i = 0; i < n; i++) {
+			c[i] = &ctx[i]->sha256;
+			hash[i] = oid[i]->hash;
+		}
+		git_SHA256_Final_multi(c, in, len, hash, n);
+		for (size_t i = 0; i < n; i++) {
+			memset(oid[i]->hash + GIT_SHA256_RAWSZ, 0,
+			       GIT_MAX_RAWSZ - GIT_SHA256_RAWSZ);
+			oid[i]->algo = GIT_HASH_SHA256;
+		}
+
+		oid += n;
+		ctx += n;
+		in += n;
+		len += n;
+		nr -= n;
+	}
+}
+#define SHA256_MULTI_LANES git_SHA256_LANES
+#else
+static void git_hash_sha256_final_oid_multi(struct object_id **oid,
+					    git_hash_ctx **ctx,
+					    const void **in, const size_t *len,
+					    size_t nr)
+{
+	for (size_t i = 0; i < nr; i++) {
+		git_hash_sha256_update(ctx[i], in[i], len[i]);
+		git_hash_sha256_final_oid(oid[i], ctx[i]);
+	}
+}
+#define SHA256_MULTI_LANES 1
+#endif
+
 static void git_hash_unknown_init(git_hash_ctx *ctx UNUSED)
 {
 	BUG("trying to init unknown hash");
@@ -202,6 +262,15 @@ static void git_hash_unknown_final_oid(struct object_id *oid UNUSED,
 	BUG("trying to finalize unknown hash");
 }
 
+static void git_hash_unknown_final_oid_multi(struct object_id **oid UNUSED,
+					     git_hash_ctx **ctx UNUSED,
+					     const void **in UNUSED,
+					     const size_t *len UNUSED,
+					     size_t nr UNUSED)
+{
+	BUG("trying to finalize unknown hash");
+}
+
 const struct git_hash_algo hash_algos[GIT_HASH_NALGOS] = {
 	{
 		.name = NULL,
@@ -214,6 +283,8 @@ const struct git_hash_algo hash_algos[GIT_HASH_NALGOS] = {
 		.update_fn = git_hash_unknown_update,
 		.final_fn = git_hash_unknown_final,
 		.final_oid_fn = git_hash_unknown_final_oid,
+		.final_oid_multi_fn = git_hash_unknown_final_oid_multi,
+		.multi_lanes = 0,
 		.unsafe_init_fn = git_hash_unknown_init,
 		.unsafe_clone_fn = git_hash_unknown_clone,
 		.unsafe_update_fn = git_hash_unknown_update,
@@ -234,6 +305,8 @@ const struct git_hash_algo hash_algos[GIT_HASH_NALGOS] = {
 		.update_fn = git_hash_sha1_update,
 		.final_fn = git_hash_sha1_final,
 		.final_oid_fn = git_hash_sha1_final_oid,
+		.final_oid_multi_fn = git_hash_sha1_final_oid_multi,
+		.multi_lanes = 1,
 		.unsafe_init_fn = git_hash_sha1_init_unsafe,
 		.unsafe_clone_fn = git_hash_sha1_clone_unsafe,
 		.unsafe_update_fn = git_hash_sha1_update_unsafe,
@@ -254,6 +327,8 @@ const struct git_hash_algo hash_algos[GIT_HASH_NALGOS] = {
 		.update_fn = git_hash_sha256_update,
 		.final_fn = git_hash_sha256_final,
 		.final_oid_fn = git_hash_sha256_final_oid,
+		.final_oid_multi_fn = git_hash_sha256_final_oid_multi,
+		.multi_lanes = SHA256_MULTI_LANES,
 		.unsafe_init_fn = git_hash_sha256_init,
 		.unsafe_clone_fn = git_hash_sha256_clone,
 		.unsafe_update_fn = git_hash_sha256_update,
@@ -1600,19 +1675,19 @@ pthread_mutex_t obj_read_mutex;
 
 void enable_obj_read_lock(void)
 {
-	if (obj_read_use_lock)
+	if (obj_read_use_lock++)
 		return;
 
-	obj_read_use_lock = 1;
 	init_recursive_mutex(&obj_read_mutex);
 }
 
 void disable_obj_read_lock(void)
 {
 	if (!obj_read_use_lock)
+		BUG("disable_obj_read_lock() without enable_obj_read_lock()");
+	if (--obj_read_use_lock)
 		return;
 
-	obj_read_use_lock = 0;
 	pthread_mutex_destroy(&obj_read_mutex);
 }
 
@@ -2098,6 +2173,48 @@ void hash_object_file(const struct git_hash_algo *algo, const void *buf,
 	hash_object_file_literally(algo, buf, len, type_name(type), oid);
 }
 
+void hash_object_file_multi(const struct git_hash_algo *algo,
+			    struct hash_object_item *items, size_t nr)
+{
+	git_hash_ctx *ctx;
+	git_hash_ctx **ctxp;
+	struct object_id **oids;
+	const void **in;
+	size_t *len;
+
+	if (nr < 2 || algo->multi_lanes < 2) {
+		for (size_t i = 0; i < nr; i++)
+			hash_object_file(algo, items[i].buf, items[i].len,
+					 items[i].type, &items[i].oid);
+		return;
+	}
+
+	ALLOC_ARRAY(ctx, nr);
+	ALLOC_ARRAY(ctxp, nr);
+	ALLOC_ARRAY(oids, nr);
+	ALLOC_ARRAY(in, nr);
+	ALLOC_ARRAY(len, nr);
+	for (size_t i = 0; i < nr; i++) {
+		char hdr[MAX_HEADER_LEN];
+		int hdrlen = format_object_header(hdr, sizeof(hdr),
+						  items[i].type, items[i].len);
+
+		algo->init_fn(&ctx[i]);
+		algo->update_fn(&ctx[i], hdr, hdrlen);
+		ctxp[i] = &ctx[i];
+		oids[i] = &items[i].oid;
+		in[i] = items[i].buf;
+		len[i] = items[i].len;
+	}
+	algo->final_oid_multi_fn(oids, ctxp, in, len, nr);
+
+	free(ctx);
+	free(ctxp);
+	free(oids);
+	free(in);
+	free(len);
+}
+
 /* Finalize a file on disk, and close it. */
 static void close_loose_object(int fd, const char *filename)
 {
@@ -273,6 +273,21 @@ void hash_object_file(const struct git_hash_algo *algo, const void *buf,
 		      unsigned long len, enum object_type type,
 		      struct object_id *oid);
 
+struct hash_object_item {
+	const void *buf;
+	unsigned long len;
+	enum object_type type;
+	struct object_id oid; /* output */
+};
+
+/*
+ * Like hash_object_file(), for "nr" independent objects at once. This
+ * lets the hash implementation work on several of them in parallel
+ * (see "multi_lanes" in "struct git_hash_algo").
+ */
+void hash_object_file_multi(const struct git_hash_algo *algo,
+			    struct hash_object_item *items, size_t nr);
+
 int write_object_file_flags(const void *buf, unsigned long len,
 			    enum object_type type, struct object_id *oid,
 			    struct object_id *comapt_oid_in, unsigned flags);
@@ -435,6 +450,11 @@ void assert_oid_type(const struct object_id *oid, enum object_type expect);
  * reading functions. However, beware that in these cases zlib inflation won't
  * be performed in parallel, losing performance.
  *
+ * Enabling the lock may be nested: it stays enabled until every call to
+ * enable_obj_read_lock() has been matched by a call to disable_obj_read_lock().
+ * Both must be called from a thread that does not itself read objects
+ * concurrently, typically the one that starts and joins the workers.
+ *
  * TODO: oid_object_info_extended()'s call stack has a recursive behavior. If
  * any of its callees end up calling it, this recursive call won't benefit from
  * parallel inflation.
@@ -26,6 +26,8 @@
 #include "alloc.h"
 #include "refs.h"
 #include "strmap.h"
+#include "midx.h"
+#include "pack-revindex.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -43,18 +45,28 @@ static inline int bitmap_writer_nr_selected_commits(struct bitmap_writer *writer
 }
 
 void bitmap_writer_init(struct bitmap_writer *writer, struct repository *r,
-			struct packing_data *pdata)
+			struct packing_data *pdata,
+			struct multi_pack_index *base_midx)
 {
+	int roaring = 0;
+
 	memset(writer, 0, sizeof(struct bitmap_writer));
 	if (writer->bitmaps)
 		BUG("bitmap writer already initialized");
 	writer->bitmaps = kh_init_oid_map();
 	writer->pseudo_merge_commits = kh_init_oid_map();
 	writer->to_pack = pdata;
+	writer->base_midx = base_midx;
+	if (base_midx)
+		writer->base_objects = base_midx->num_objects +
+			base_midx->num_objects_in_base;
 
 	string_list_init_dup(&writer->pseudo_merge_groups);
 
 	load_pseudo_merges_from_config(r, &writer->pseudo_merge_groups);
+
+	repo_config_get_bool(r, "pack.writebitmaproaring", &roaring);
+	writer->version = roaring ? BITMAP_VERSION_ROARING : BITMAP_VERSION_EWAH;
 }
 
 static void free_pseudo_merge_commit_idx(struct pseudo_merge_commit_idx *idx)
@@ -142,19 +154,19 @@ void bitmap_writer_build_type_index(struct bitmap_writer *writer,
 
 		switch (real_type) {
 		case OBJ_COMMIT:
-			ewah_set(writer->commits, i);
+			ewah_set(writer->commits, i + writer->base_objects);
 			break;
 
 		case OBJ_TREE:
-			ewah_set(writer->trees, i);
+			ewah_set(writer->trees, i + writer->base_objects);
 			break;
 
 		case OBJ_BLOB:
-			ewah_set(writer->blobs, i);
+			ewah_set(writer->blobs, i + writer->base_objects);
 			break;
 
 		case OBJ_TAG:
-			ewah_set(writer->tags, i);
+			ewah_set(writer->tags, i + writer->base_objects);
 			break;
 
 		default:
@@ -204,11 +216,35 @@ void bitmap_writer_push_commit(struct bitmap_writer *writer,
 	writer->selected_nr++;
 }
 
+/*
+ * Make sure the reverse indexes of all base MIDX layers are loaded; they
+ * may have been closed along with the base bitmaps in the meantime.
+ */
+static int load_base_midx_revindex(struct multi_pack_index *m)
+{
+	for (; m; m = m->base_midx)
+		if (load_midx_revindex(m) < 0)
+			return -1;
+	return 0;
+}
+
 static uint32_t find_object_pos(struct bitmap_writer *writer,
 				const struct object_id *oid, int *found)
 {
 	struct object_entry *entry = packlist_find(writer->to_pack, oid);
 
+	if (!entry && writer->base_midx) {
+		uint32_t midx_pos, pack_pos;
+
+		if (bsearch_midx(oid, writer->base_midx, &midx_pos) &&
+		    !load_base_midx_revindex(writer->base_midx) &&
+		    !midx_to_pack_pos(writer->base_midx, midx_pos, &pack_pos)) {
+			if (found)
+				*found = 1;
+			return pack_pos;
+		}
+	}
+
 	if (!entry) {
 		if (found)
 			*found = 0;
@@ -219,7 +255,7 @@ static uint32_t find_object_pos(struct bitmap_writer *writer,
 
 	if (found)
 		*found = 1;
-	return oe_in_pack_pos(writer->to_pack, entry);
+	return oe_in_pack_pos(writer->to_pack, entry) + writer->base_objects;
 }
 
 static void compute_xor_offsets(struct bitmap_writer *writer)
@@ -234,7 +270,12 @@ static void compute_xor_offsets(struct bitmap_writer *writer)
 		struct ewah_bitmap *best_bitmap = stored->bitmap;
 		struct ewah_bitmap *test_xor;
 
-		if (stored->pseudo_merge)
+		/*
+		 * Roaring bitmaps are read without composing XOR chains,
+		 * so never write them as an XOR against another bitmap.
+		 */
+		if (stored->pseudo_merge ||
+		    writer->version == BITMAP_VERSION_ROARING)
 			goto next;
 
 		for (i = 1; i <= MAX_XOR_OFFSET_SEARCH; ++i) {
@@ -524,6 +565,17 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 				continue;
 			}
 			bitmap_free(remapped);
+		} else if (old_bitmap && writer->base_midx) {
+			/*
+			 * The bitmaps of the layers below us use the same
+			 * bit positions, so there is nothing to translate.
+			 */
+			struct ewah_bitmap *old = bitmap_for_commit(old_bitmap, c);
+			if (old) {
+				bitmap_or_ewah(ent->bitmap, old);
+				reused_bitmaps_nr++;
+				continue;
+			}
 		}
 
 		/*
@@ -595,11 +647,16 @@ int bitmap_writer_build(struct bitmap_writer *writer)
 	trace2_region_enter("pack-bitmap-write", "building_bitmaps_total",
 			    the_repository);
 
-	old_bitmap = prepare_bitmap_git(writer->to_pack->repo);
-	if (old_bitmap)
-		mapping = create_bitmap_mapping(old_bitmap, writer->to_pack);
-	else
+	if (writer->base_midx) {
+		old_bitmap = prepare_midx_bitmap_git(writer->base_midx);
 		mapping = NULL;
+	} else {
+		old_bitmap = prepare_bitmap_git(writer->to_pack->repo);
+		if (old_bitmap)
+			mapping = create_bitmap_mapping(old_bitmap, writer->to_pack);
+		else
+			mapping = NULL;
+	}
 
 	bitmap_builder_init(&bb, writer, old_bitmap);
 	for (i = bb.commits_nr; i > 0; i--) {
@@ -766,6 +823,19 @@ static inline void dump_bitmap(struct hashfile *f, struct ewah_bitmap *bitmap)
 		die("Failed to write bitmap index");
 }
 
+/*
+ * Write one of the type or commit bitmaps, in the format of the
+ * index version we are writing. Pseudo-merge bitmaps always use EWAH.
+ */
+static void dump_entry_bitmap(struct bitmap_writer *writer,
+			      struct hashfile *f, struct ewah_bitmap *bitmap)
+{
+	if (writer->version != BITMAP_VERSION_ROARING)
+		dump_bitmap(f, bitmap);
+	else if (roaring_serialize_ewah(bitmap, hashwrite_ewah_helper, f) < 0)
+		die("Failed to write bitmap index");
+}
+
 static const struct object_id *oid_access(size_t pos, const void *table)
 {
 	const struct pack_idx_entry * const *index = table;
@@ -790,7 +860,7 @@ static void write_selected_commits_v1(struct bitmap_writer *writer,
 		hashwrite_u8(f, stored->xor_offset);
 		hashwrite_u8(f, stored->flags);
 
-		dump_bitmap(f, stored->write_as);
+		dump_entry_bitmap(writer, f, stored->write_as);
 	}
 }
 
@@ -1014,7 +1084,6 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 			  const char *filename,
 			  uint16_t options)
 {
-	static uint16_t default_version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct strbuf tmp_file = STRBUF_INIT;
 	struct hashfile *f;
@@ -1031,16 +1100,16 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 	f = hashfd(fd, tmp_file.buf);
 
 	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
-	header.version = htons(default_version);
+	header.version = htons(writer->version);
 	header.options = htons(flags | options);
 	header.entry_count = htonl(bitmap_writer_nr_selected_commits(writer));
 	hashcpy(header.checksum, writer->pack_checksum, the_repository->hash_algo);
 
 	hashwrite(f, &header, sizeof(header) - GIT_MAX_RAWSZ + the_hash_algo->rawsz);
-	dump_bitmap(f, writer->commits);
-	dump_bitmap(f, writer->trees);
-	dump_bitmap(f, writer->blobs);
-	dump_bitmap(f, writer->tags);
+	dump_entry_bitmap(writer, f, writer->commits);
+	dump_entry_bitmap(writer, f, writer->trees);
+	dump_entry_bitmap(writer, f, writer->blobs);
+	dump_entry_bitmap(writer, f, writer->tags);
 
 	if (options & BITMAP_OPT_LOOKUP_TABLE)
 		CALLOC_ARRAY(offsets, writer->to_pack->nr_objects);
@@ -1053,7 +1122,7 @@ void bitmap_writer_finish(struct bitmap_writer *writer,
 
 		if (commit_pos < 0)
 			BUG(_("trying to write commit not in index"));
-		stored->commit_pos = commit_pos;
+		stored->commit_pos = commit_pos + writer->base_objects;
 	}
 
 	write_selected_commits_v1(writer, f, offsets);
@@ -32,6 +32,11 @@ struct stored_bitmap {
 	struct object_id oid;
 	struct ewah_bitmap *root;
 	struct stored_bitmap *xor;
+	/*
+	 * In a version 2 index, the bitmap as stored on disk; "root" is
+	 * then only filled in on demand for callers that need EWAH.
+	 */
+	struct roaring_bitmap *roaring;
 	int flags;
 };
 
@@ -54,6 +59,14 @@ struct bitmap_index {
 	struct packed_git *pack;
 	struct multi_pack_index *midx;
 
+	/*
+	 * If "midx" is a layer of an incremental MIDX chain with a base,
+	 * this is the bitmap index of the layer below it. Bit positions
+	 * are shared by all layers of the chain, so a layer only stores
+	 * bitmaps for its own commits and defers to "base" for the rest.
+	 */
+	struct bitmap_index *base;
+
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
 	size_t map_size; /* size of the mmaped buffer */
@@ -128,6 +141,9 @@ static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 	struct ewah_bitmap *parent;
 	struct ewah_bitmap *composed;
 
+	if (!st->root && st->roaring)
+		st->root = roaring_to_ewah(st->roaring);
+
 	if (!st->xor)
 		return st->root;
 
@@ -170,6 +186,66 @@ static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
 	return read_bitmap(index->map, index->map_size, &index->map_pos);
 }
 
+static struct roaring_bitmap *read_roaring_bitmap_1(struct bitmap_index *index)
+{
+	struct roaring_bitmap *b = xmalloc(sizeof(*b));
+	ssize_t bitmap_size = roaring_read_mmap(b, index->map + index->map_pos,
+						index->map_size - index->map_pos);
+
+	if (bitmap_size < 0) {
+		error(_("failed to load bitmap index (corrupted?)"));
+		free(b);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+
+	return b;
+}
+
+/*
+ * Read one of the type bitmaps. We always keep those as EWAH in
+ * memory, since they are only ever scanned from start to end.
+ */
+static struct ewah_bitmap *read_type_bitmap_1(struct bitmap_index *index)
+{
+	struct roaring_bitmap *roaring;
+	struct ewah_bitmap *ewah;
+
+	if (index->version != BITMAP_VERSION_ROARING)
+		return read_bitmap_1(index);
+
+	roaring = read_roaring_bitmap_1(index);
+	if (!roaring)
+		return NULL;
+	ewah = roaring_to_ewah(roaring);
+	roaring_free(roaring);
+	return ewah;
+}
+
+/*
+ * Read the bitmap of a commit entry into either "ewah" or "roaring",
+ * depending on the version of the index.
+ */
+static int read_entry_bitmap_1(struct bitmap_index *index,
+			       struct ewah_bitmap **ewah,
+			       struct roaring_bitmap **roaring)
+{
+	*ewah = NULL;
+	*roaring = NULL;
+
+	if (index->version == BITMAP_VERSION_ROARING)
+		*roaring = read_roaring_bitmap_1(index);
+	else
+		*ewah = read_bitmap_1(index);
+
+	return *ewah || *roaring ? 0 : -1;
+}
+
+/*
+ * The number of objects in this bitmap's own pack or MIDX layer (which
+ * is what its name-hash cache covers).
+ */
 static uint32_t bitmap_num_objects(struct bitmap_index *index)
 {
 	if (index->midx)
@@ -177,6 +253,17 @@ static uint32_t bitmap_num_objects(struct bitmap_index *index)
 	return index->pack->num_objects;
 }
 
+/*
+ * The number of bit positions used by the bitmap, including the objects
+ * of all base layers of an incremental MIDX.
+ */
+static uint32_t bitmap_num_objects_total(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects + index->midx->num_objects_in_base;
+	return index->pack->num_objects;
+}
+
 static struct repository *bitmap_repo(struct bitmap_index *bitmap_git)
 {
 	if (bitmap_is_midx(bitmap_git))
@@ -198,7 +285,8 @@ static int load_bitmap_header(struct bitmap_index *index)
 		return error(_("corrupted bitmap index file (wrong header)"));
 
 	index->version = ntohs(header->version);
-	if (index->version != 1)
+	if (index->version != BITMAP_VERSION_EWAH &&
+	    index->version != BITMAP_VERSION_ROARING)
 		return error(_("unsupported version '%d' for bitmap index file"), index->version);
 
 	/* Parse known bitmap format options */
@@ -277,6 +365,7 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 					  struct ewah_bitmap *root,
+					  struct roaring_bitmap *roaring,
 					  const struct object_id *oid,
 					  struct stored_bitmap *xor_with,
 					  int flags)
@@ -287,6 +376,7 @@ static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
 
 	stored = xmalloc(sizeof(struct stored_bitmap));
 	stored->root = root;
+	stored->roaring = roaring;
 	stored->xor = xor_with;
 	stored->flags = flags;
 	oidcpy(&stored->oid, oid);
@@ -330,6 +420,23 @@ static int nth_bitmap_object_oid(struct bitmap_index *index,
 	return nth_packed_object_id(oid, index->pack, n);
 }
 
+/*
+ * Return the name-hash of the object at position "index_pos" in the
+ * pack or MIDX, or zero if the layer holding it has no name-hash cache.
+ */
+static uint32_t bitmap_name_hash(struct bitmap_index *index,
+				 uint32_t index_pos)
+{
+	if (index->midx) {
+		while (index->base && index_pos < index->midx->num_objects_in_base)
+			index = index->base;
+		index_pos -= index->midx->num_objects_in_base;
+	}
+	if (!index->hashes)
+		return 0;
+	return get_be32(index->hashes + index_pos);
+}
+
 static int load_bitmap_entries_v1(struct bitmap_index *index)
 {
 	uint32_t i;
@@ -338,6 +445,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	for (i = 0; i < index->entry_count; ++i) {
 		int xor_offset, flags;
 		struct ewah_bitmap *bitmap = NULL;
+		struct roaring_bitmap *roaring = NULL;
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
 		struct object_id oid;
@@ -353,11 +461,11 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 			return error(_("corrupt ewah bitmap: commit index %u out of range"),
 				     (unsigned)commit_idx_pos);
 
-		bitmap = read_bitmap_1(index);
-		if (!bitmap)
+		if (read_entry_bitmap_1(index, &bitmap, &roaring) < 0)
 			return -1;
 
-		if (xor_offset > MAX_XOR_OFFSET || xor_offset > i)
+		if (xor_offset > MAX_XOR_OFFSET || xor_offset > i ||
+		    (roaring && xor_offset))
 			return error(_("corrupted bitmap pack index"));
 
 		if (xor_offset > 0) {
@@ -368,7 +476,7 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		}
 
 		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
-			index, bitmap, &oid, xor_bitmap, flags);
+			index, bitmap, roaring, &oid, xor_bitmap, flags);
 	}
 
 	return 0;
@@ -377,8 +485,15 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 char *midx_bitmap_filename(struct multi_pack_index *midx)
 {
 	struct strbuf buf = STRBUF_INIT;
-	get_midx_filename_ext(midx->repo->hash_algo, &buf, midx->object_dir,
-			      get_midx_checksum(midx), MIDX_EXT_BITMAP);
+	if (midx->has_chain)
+		get_split_midx_filename_ext(midx->repo->hash_algo, &buf,
+					    midx->object_dir,
+					    get_midx_checksum(midx),
+					    MIDX_EXT_BITMAP);
+	else
+		get_midx_filename_ext(midx->repo->hash_algo, &buf,
+				      midx->object_dir, get_midx_checksum(midx),
+				      MIDX_EXT_BITMAP);
 
 	return strbuf_detach(&buf, NULL);
 }
@@ -448,13 +563,26 @@ static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
 	for (i = 0; i < bitmap_git->midx->num_packs; i++) {
 		if (prepare_midx_pack(bitmap_repo(bitmap_git),
 				      bitmap_git->midx,
-				      i)) {
+				      i + bitmap_git->midx->num_packs_in_base)) {
 			warning(_("could not open pack %s"),
 				bitmap_git->midx->pack_names[i]);
 			goto cleanup;
 		}
 	}
 
+	if (midx->base_midx) {
+		/*
+		 * The bitmaps of this layer only cover its own commits;
+		 * without the layers below it we cannot use them at all.
+		 */
+		bitmap_git->base = prepare_midx_bitmap_git(midx->base_midx);
+		if (!bitmap_git->base) {
+			warning(_("incremental multi-pack bitmap is missing "
+				  "a bitmap for one of its base layers"));
+			goto cleanup;
+		}
+	}
+
 	return 0;
 
 cleanup:
@@ -540,11 +668,22 @@ static int load_reverse_index(struct repository *r, struct bitmap_index *bitmap_
 			if (ret)
 				return ret;
 		}
+		/* the packs of base layers are taken care of by their bitmap */
 		return 0;
 	}
 	return load_pack_revindex(r, bitmap_git->pack);
 }
 
+static void combine_type_bitmap(struct ewah_bitmap **dst,
+				struct ewah_bitmap *base)
+{
+	struct ewah_bitmap *combined = ewah_pool_new();
+
+	ewah_xor(*dst, base, combined);
+	ewah_pool_free(*dst);
+	*dst = combined;
+}
+
 static int load_bitmap(struct repository *r, struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
@@ -555,12 +694,26 @@ static int load_bitmap(struct repository *r, struct bitmap_index *bitmap_git)
 	if (load_reverse_index(r, bitmap_git))
 		goto failed;
 
-	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->trees = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->blobs = read_bitmap_1(bitmap_git)) ||
-		!(bitmap_git->tags = read_bitmap_1(bitmap_git)))
+	if (!(bitmap_git->commits = read_type_bitmap_1(bitmap_git)) ||
+		!(bitmap_git->trees = read_type_bitmap_1(bitmap_git)) ||
+		!(bitmap_git->blobs = read_type_bitmap_1(bitmap_git)) ||
+		!(bitmap_git->tags = read_type_bitmap_1(bitmap_git)))
 		goto failed;
 
+	if (bitmap_git->base) {
+		/*
+		 * Each layer's type bitmaps only mark its own objects.
+		 * Fold in those of the base (which has already done the
+		 * same with its own base), so that the rest of the code
+		 * can keep looking at a single set of type bitmaps. Since
+		 * each object lives in exactly one layer, XOR is a union.
+		 */
+		combine_type_bitmap(&bitmap_git->commits, bitmap_git->base->commits);
+		combine_type_bitmap(&bitmap_git->trees, bitmap_git->base->trees);
+		combine_type_bitmap(&bitmap_git->blobs, bitmap_git->base->blobs);
+		combine_type_bitmap(&bitmap_git->tags, bitmap_git->base->tags);
+	}
+
 	if (!bitmap_git->table_lookup && load_bitmap_entries_v1(bitmap_git) < 0)
 		goto failed;
 
@@ -773,6 +926,7 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	struct bitmap_lookup_table_triplet triplet;
 	struct object_id *oid = &commit->object.oid;
 	struct ewah_bitmap *bitmap;
+	struct roaring_bitmap *roaring;
 	struct stored_bitmap *xor_bitmap = NULL;
 	const int bitmap_header_size = 6;
 	static struct bitmap_lookup_table_xor_item *xor_items = NULL;
@@ -842,12 +996,15 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 
 		bitmap_git->map_pos += sizeof(uint32_t) + sizeof(uint8_t);
 		xor_flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
-		bitmap = read_bitmap_1(bitmap_git);
-
-		if (!bitmap)
+		if (read_entry_bitmap_1(bitmap_git, &bitmap, &roaring) < 0)
+			goto corrupt;
+		if (roaring) {
+			roaring_free(roaring);
+			error(_("corrupt bitmap lookup table: xor chain in roaring bitmap index"));
 			goto corrupt;
+		}
 
-		xor_bitmap = store_bitmap(bitmap_git, bitmap, &xor_item->oid, xor_bitmap, xor_flags);
+		xor_bitmap = store_bitmap(bitmap_git, bitmap, NULL, &xor_item->oid, xor_bitmap, xor_flags);
 		xor_items_nr--;
 	}
 
@@ -883,12 +1040,15 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	 */
 	bitmap_git->map_pos += sizeof(uint32_t) + sizeof(uint8_t);
 	flags = read_u8(bitmap_git->map, &bitmap_git->map_pos);
-	bitmap = read_bitmap_1(bitmap_git);
-
-	if (!bitmap)
+	if (read_entry_bitmap_1(bitmap_git, &bitmap, &roaring) < 0)
+		goto corrupt;
+	if (roaring && xor_bitmap) {
+		roaring_free(roaring);
+		error(_("corrupt bitmap lookup table: xor chain in roaring bitmap index"));
 		goto corrupt;
+	}
 
-	return store_bitmap(bitmap_git, bitmap, oid, xor_bitmap, flags);
+	return store_bitmap(bitmap_git, bitmap, roaring, oid, xor_bitmap, flags);
 
 corrupt:
 	free(xor_items);
@@ -896,24 +1056,60 @@ static struct stored_bitmap *lazy_bitmap_for_commit(struct bitmap_index *bitmap_
 	return NULL;
 }
 
-struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
-				      struct commit *commit)
+static struct stored_bitmap *stored_bitmap_for_commit(struct bitmap_index *bitmap_git,
+						      struct commit *commit)
 {
 	khiter_t hash_pos = kh_get_oid_map(bitmap_git->bitmaps,
 					   commit->object.oid);
 	if (hash_pos >= kh_end(bitmap_git->bitmaps)) {
-		struct stored_bitmap *bitmap = NULL;
-		if (!bitmap_git->table_lookup)
-			return NULL;
+		struct stored_bitmap *st = NULL;
 
 		/* this is a fairly hot codepath - no trace2_region please */
 		/* NEEDSWORK: cache misses aren't recorded */
-		bitmap = lazy_bitmap_for_commit(bitmap_git, commit);
-		if (!bitmap)
-			return NULL;
-		return lookup_stored_bitmap(bitmap);
+		if (bitmap_git->table_lookup)
+			st = lazy_bitmap_for_commit(bitmap_git, commit);
+		if (!st && bitmap_git->base)
+			st = stored_bitmap_for_commit(bitmap_git->base, commit);
+		return st;
 	}
-	return lookup_stored_bitmap(kh_value(bitmap_git->bitmaps, hash_pos));
+	return kh_value(bitmap_git->bitmaps, hash_pos);
+}
+
+struct ewah_bitmap *bitmap_for_commit(struct bitmap_index *bitmap_git,
+				      struct commit *commit)
+{
+	struct stored_bitmap *bitmap = stored_bitmap_for_commit(bitmap_git,
+								commit);
+	if (!bitmap)
+		return NULL;
+	return lookup_stored_bitmap(bitmap);
+}
+
+/*
+ * OR the bitmap stored for "commit" (if any) into "base", allocating
+ * "base" if it is NULL. Roaring bitmaps are combined directly, without
+ * going through EWAH. Returns 1 if the commit had a bitmap, 0 otherwise.
+ */
+static int or_commit_bitmap(struct bitmap_index *bitmap_git,
+			    struct bitmap **base,
+			    struct commit *commit)
+{
+	struct stored_bitmap *st = stored_bitmap_for_commit(bitmap_git, commit);
+
+	if (!st)
+		return 0;
+
+	if (st->roaring && !st->xor) {
+		if (!*base)
+			*base = bitmap_new();
+		bitmap_or_roaring(*base, st->roaring);
+	} else if (!*base) {
+		*base = ewah_to_bitmap(lookup_stored_bitmap(st));
+	} else {
+		bitmap_or_ewah(*base, lookup_stored_bitmap(st));
+	}
+
+	return 1;
 }
 
 static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
@@ -924,7 +1120,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_num_objects(bitmap_git);
+		return bitmap_pos + bitmap_num_objects_total(bitmap_git);
 	}
 
 	return -1;
@@ -992,7 +1188,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_num_objects(bitmap_git);
+	return bitmap_pos + bitmap_num_objects_total(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -1040,19 +1236,14 @@ static int add_to_include_set(struct bitmap_index *bitmap_git,
 			      struct commit *commit,
 			      int bitmap_pos)
 {
-	struct ewah_bitmap *partial;
-
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
 
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	partial = bitmap_for_commit(bitmap_git, commit);
-	if (partial) {
+	if (or_commit_bitmap(bitmap_git, &data->base, commit)) {
 		existing_bitmaps_hits_nr++;
-
-		bitmap_or_ewah(data->base, partial);
 		return 0;
 	}
 
@@ -1111,20 +1302,12 @@ static int add_commit_to_bitmap(struct bitmap_index *bitmap_git,
 				struct bitmap **base,
 				struct commit *commit)
 {
-	struct ewah_bitmap *or_with = bitmap_for_commit(bitmap_git, commit);
-
-	if (!or_with) {
+	if (!or_commit_bitmap(bitmap_git, base, commit)) {
 		existing_bitmaps_misses_nr++;
 		return 0;
 	}
 
 	existing_bitmaps_hits_nr++;
-
-	if (!*base)
-		*base = ewah_to_bitmap(or_with);
-	else
-		bitmap_or_ewah(*base, or_with);
-
 	return 1;
 }
 
@@ -1339,7 +1522,7 @@ struct ewah_bitmap *pseudo_merge_bitmap_for_commit(struct bitmap_index *bitmap_g
 
 	for (p = commit->parents; p; p = p->next) {
 		int pos = bitmap_position(bitmap_git, &p->item->object.oid);
-		if (pos < 0 || pos >= bitmap_num_objects(bitmap_git))
+		if (pos < 0 || pos >= bitmap_num_objects_total(bitmap_git))
 			goto done;
 
 		bitmap_set(parents, pos);
@@ -1500,7 +1683,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, st_add(bitmap_num_objects(bitmap_git), i)))
+		if (!bitmap_get(objects, st_add(bitmap_num_objects_total(bitmap_git), i)))
 			continue;
 
 		obj = eindex->objects[i];
@@ -1583,7 +1766,7 @@ static void show_objects_for_type(
 				nth_midxed_object_oid(&oid, m, index_pos);
 
 				pack_id = nth_midxed_pack_int_id(m, index_pos);
-				pack = bitmap_git->midx->packs[pack_id];
+				pack = nth_midxed_pack(bitmap_git->midx, pack_id);
 			} else {
 				index_pos = pack_pos_to_index(bitmap_git->pack, pos + offset);
 				ofs = pack_pos_to_offset(bitmap_git->pack, pos + offset);
@@ -1592,8 +1775,7 @@ static void show_objects_for_type(
 				pack = bitmap_git->pack;
 			}
 
-			if (bitmap_git->hashes)
-				hash = get_be32(bitmap_git->hashes + index_pos);
+			hash = bitmap_name_hash(bitmap_git, index_pos);
 
 			show_reach(&oid, object_type, 0, hash, pack, ofs);
 		}
@@ -1679,7 +1861,7 @@ static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
 	 * them individually.
 	 */
 	for (i = 0; i < eindex->count; i++) {
-		size_t pos = st_add(i, bitmap_num_objects(bitmap_git));
+		size_t pos = st_add(i, bitmap_num_objects_total(bitmap_git));
 		if (eindex->objects[i]->type == type &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos))
@@ -1705,7 +1887,7 @@ static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 
 	oi.sizep = &size;
 
-	if (pos < bitmap_num_objects(bitmap_git)) {
+	if (pos < bitmap_num_objects_total(bitmap_git)) {
 		struct packed_git *pack;
 		off_t ofs;
 
@@ -1713,7 +1895,7 @@ static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 			uint32_t midx_pos = pack_pos_to_midx(bitmap_git->midx, pos);
 			uint32_t pack_id = nth_midxed_pack_int_id(bitmap_git->midx, midx_pos);
 
-			pack = bitmap_git->midx->packs[pack_id];
+			pack = nth_midxed_pack(bitmap_git->midx, pack_id);
 			ofs = nth_midxed_offset(bitmap_git->midx, midx_pos);
 		} else {
 			pack = bitmap_git->pack;
@@ -1729,7 +1911,7 @@ static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
 		}
 	} else {
 		struct eindex *eindex = &bitmap_git->ext_index;
-		struct object *obj = eindex->objects[pos - bitmap_num_objects(bitmap_git)];
+		struct object *obj = eindex->objects[pos - bitmap_num_objects_total(bitmap_git)];
 		if (oid_object_info_extended(bitmap_repo(bitmap_git), &obj->oid,
 					     &oi, 0) < 0)
 			die(_("unable to get size of %s"), oid_to_hex(&obj->oid));
@@ -1772,7 +1954,7 @@ static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
 	}
 
 	for (i = 0; i < eindex->count; i++) {
-		size_t pos = st_add(i, bitmap_num_objects(bitmap_git));
+		size_t pos = st_add(i, bitmap_num_objects_total(bitmap_git));
 		if (eindex->objects[i]->type == OBJ_BLOB &&
 		    bitmap_get(to_filter, pos) &&
 		    !bitmap_get(tips, pos) &&
@@ -1882,7 +2064,7 @@ static void filter_packed_objects_from_bitmap(struct bitmap_index *bitmap_git,
 	uint32_t objects_nr;
 	size_t i, pos;
 
-	objects_nr = bitmap_num_objects(bitmap_git);
+	objects_nr = bitmap_num_objects_total(bitmap_git);
 	pos = objects_nr / BITS_IN_EWORD;
 
 	if (pos > result->word_alloc)
@@ -2065,6 +2247,8 @@ static int try_partial_reuse(struct bitmap_index *bitmap_git,
 			     uint32_t pack_pos,
 			     off_t offset,
 			     struct bitmap *reuse,
+			     struct bitmap *rewrite,
+			     size_t *gap_end,
 			     struct pack_window **w_curs)
 {
 	off_t delta_obj_offset;
@@ -2097,7 +2281,16 @@ static int try_partial_reuse(struct bitmap_index *bitmap_git,
 		if (!base_offset)
 			return 0;
 
-		offset_to_pack_pos(pack->p, base_offset, &base_pos);
+		/*
+		 * Every object since the last one that is not reused is, so
+		 * if the base is among them, there is neither anything to
+		 * look up nor an offset to rewrite.
+		 */
+		if (rewrite && base_offset < delta_obj_offset &&
+		    base_offset >= pack_pos_to_offset(pack->p, *gap_end)) {
+			bitmap_set(reuse, bitmap_pos);
+			return 0;
+		}
 
 		if (bitmap_is_midx(bitmap_git)) {
 			/*
@@ -2145,6 +2338,18 @@ static int try_partial_reuse(struct bitmap_index *bitmap_git,
 		 */
 		if (!bitmap_get(reuse, base_bitmap_pos))
 			return 0;
+
+		/*
+		 * If an object between the base and this delta is not
+		 * copied as-is, the offset to the base changes and has to
+		 * be rewritten, which may change the size of this object
+		 * too. Everything else can be copied verbatim.
+		 */
+		if (rewrite && type == OBJ_OFS_DELTA &&
+		    base_bitmap_pos < *gap_end) {
+			bitmap_set(rewrite, bitmap_pos);
+			*gap_end = bitmap_pos + 1;
+		}
 	}
 
 	/*
@@ -2156,11 +2361,13 @@ static int try_partial_reuse(struct bitmap_index *bitmap_git,
 
 static void reuse_partial_packfile_from_bitmap_1(struct bitmap_index *bitmap_git,
 						 struct bitmapped_pack *pack,
-						 struct bitmap *reuse)
+						 struct bitmap *reuse,
+						 struct bitmap *rewrite)
 {
 	struct bitmap *result = bitmap_git->result;
 	struct pack_window *w_curs = NULL;
 	size_t pos = pack->bitmap_pos / BITS_IN_EWORD;
+	size_t next_bit, gap_end = 0;
 
 	if (!pack->bitmap_pos) {
 		/*
@@ -2184,7 +2391,14 @@ static void reuse_partial_packfile_from_bitmap_1(struct bitmap_index *bitmap_git
 		       result->words[pos] == (eword_t)~0)
 			pos++;
 		memset(reuse->words, 0xFF, pos * sizeof(eword_t));
+	} else {
+		/*
+		 * Objects of the other packs are always written one by
+		 * one, see write_reused_pack() in builtin/pack-objects.c.
+		 */
+		rewrite = NULL;
 	}
+	next_bit = pos * BITS_IN_EWORD;
 
 	for (; pos < result->word_alloc; pos++) {
 		eword_t word = result->words[pos];
@@ -2226,8 +2440,18 @@ static void reuse_partial_packfile_from_bitmap_1(struct bitmap_index *bitmap_git
 				ofs = pack_pos_to_offset(pack->p, pack_pos);
 			}
 
+			/*
+			 * Remember where the last object that is not
+			 * reused is, to tell which deltas have to be
+			 * rewritten.
+			 */
+			if (bit_pos != next_bit)
+				gap_end = bit_pos;
+			next_bit = bit_pos + 1;
+
 			if (try_partial_reuse(bitmap_git, pack, bit_pos,
-					      pack_pos, ofs, reuse, &w_curs) < 0) {
+					      pack_pos, ofs, reuse, rewrite,
+					      &gap_end, &w_curs) < 0) {
 				/*
 				 * try_partial_reuse indicated we couldn't reuse
 				 * any bits, so there is no point in trying more
@@ -2239,6 +2463,8 @@ static void reuse_partial_packfile_from_bitmap_1(struct bitmap_index *bitmap_git
 				 */
 				goto done;
 			}
+			if (!bitmap_get(reuse, bit_pos))
+				gap_end = bit_pos + 1;
 		}
 	}
 
@@ -2262,12 +2488,13 @@ void reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 					struct bitmapped_pack **packs_out,
 					size_t *packs_nr_out,
 					struct bitmap **reuse_out,
+					struct bitmap **rewrite_out,
 					int multi_pack_reuse)
 {
 	struct repository *r = bitmap_repo(bitmap_git);
 	struct bitmapped_pack *packs = NULL;
 	struct bitmap *result = bitmap_git->result;
-	struct bitmap *reuse;
+	struct bitmap *reuse, *rewrite;
 	size_t i;
 	size_t packs_nr = 0, packs_alloc = 0;
 	size_t word_alloc;
@@ -2275,6 +2502,13 @@ void reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 
 	assert(result);
 
+	/*
+	 * NEEDSWORK: verbatim pack reuse does not know about the layers of
+	 * an incremental MIDX yet; send everything through the usual path.
+	 */
+	if (bitmap_git->base)
+		return;
+
 	load_reverse_index(r, bitmap_git);
 
 	if (!bitmap_is_midx(bitmap_git) || !bitmap_git->midx->chunk_bitmapped_packs)
@@ -2350,13 +2584,16 @@ void reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	if (objects_nr % BITS_IN_EWORD)
 		word_alloc++;
 	reuse = bitmap_word_alloc(word_alloc);
+	rewrite = bitmap_word_alloc(word_alloc);
 
 	for (i = 0; i < packs_nr; i++)
-		reuse_partial_packfile_from_bitmap_1(bitmap_git, &packs[i], reuse);
+		reuse_partial_packfile_from_bitmap_1(bitmap_git, &packs[i],
+						     reuse, rewrite);
 
 	if (bitmap_is_empty(reuse)) {
 		free(packs);
 		bitmap_free(reuse);
+		bitmap_free(rewrite);
 		return;
 	}
 
@@ -2368,6 +2605,7 @@ void reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 	*packs_out = packs;
 	*packs_nr_out = packs_nr;
 	*reuse_out = reuse;
+	*rewrite_out = rewrite;
 }
 
 int bitmap_walk_contains(struct bitmap_index *bitmap_git,
@@ -2382,6 +2620,32 @@ int bitmap_walk_contains(struct bitmap_index *bitmap_git,
 	return idx >= 0 && bitmap_get(bitmap, idx);
 }
 
+int bitmap_object_position(struct bitmap_index *bitmap_git,
+			   const struct object_id *oid)
+{
+	return bitmap_position(bitmap_git, oid);
+}
+
+int bitmap_commit_contains_any(struct bitmap_index *bitmap_git,
+			       struct commit *commit,
+			       const size_t *pos, size_t nr)
+{
+	struct stored_bitmap *st = stored_bitmap_for_commit(bitmap_git, commit);
+	size_t i;
+
+	if (!st)
+		return -1;
+
+	if (st->roaring && !st->xor) {
+		for (i = 0; i < nr; i++)
+			if (roaring_get(st->roaring, pos[i]))
+				return 1;
+		return 0;
+	}
+
+	return ewah_any_bit_set(lookup_stored_bitmap(st), pos, nr);
+}
+
 void traverse_bitmap_commit_list(struct bitmap_index *bitmap_git,
 				 struct rev_info *revs,
 				 show_reachable_fn show_reachable)
@@ -2419,7 +2683,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
 		    bitmap_get(objects,
-			       st_add(bitmap_num_objects(bitmap_git), i)))
+			       st_add(bitmap_num_objects_total(bitmap_git), i)))
 			count++;
 	}
 
@@ -2599,22 +2863,25 @@ int test_bitmap_commits(struct repository *r)
 	struct object_id oid;
 	MAYBE_UNUSED void *value;
 	struct bitmap_index *bitmap_git = prepare_bitmap_git(r);
+	struct bitmap_index *b;
 
 	if (!bitmap_git)
 		die(_("failed to load bitmap indexes"));
 
-	/*
-	 * As this function is only used to print bitmap selected
-	 * commits, we don't have to read the commit table.
-	 */
-	if (bitmap_git->table_lookup) {
-		if (load_bitmap_entries_v1(bitmap_git) < 0)
-			die(_("failed to load bitmap indexes"));
-	}
+	for (b = bitmap_git; b; b = b->base) {
+		/*
+		 * As this function is only used to print bitmap selected
+		 * commits, we don't have to read the commit table.
+		 */
+		if (b->table_lookup) {
+			if (load_bitmap_entries_v1(b) < 0)
+				die(_("failed to load bitmap indexes"));
+		}
 
-	kh_foreach(bitmap_git->bitmaps, oid, value, {
-		printf_ln("%s", oid_to_hex(&oid));
-	});
+		kh_foreach(b->bitmaps, oid, value, {
+			printf_ln("%s", oid_to_hex(&oid));
+		});
+	}
 
 	free_bitmap_index(bitmap_git);
 
@@ -2630,7 +2897,7 @@ int test_bitmap_hashes(struct repository *r)
 	if (!bitmap_git || !bitmap_git->hashes)
 		goto cleanup;
 
-	for (i = 0; i < bitmap_num_objects(bitmap_git); i++) {
+	for (i = 0; i < bitmap_num_objects_total(bitmap_git); i++) {
 		if (bitmap_is_midx(bitmap_git))
 			index_pos = pack_pos_to_midx(bitmap_git->midx, i);
 		else
@@ -2639,7 +2906,7 @@ int test_bitmap_hashes(struct repository *r)
 		nth_bitmap_object_oid(bitmap_git, &oid, index_pos);
 
 		printf_ln("%s %"PRIu32"",
-		       oid_to_hex(&oid), get_be32(bitmap_git->hashes + index_pos));
+		       oid_to_hex(&oid), bitmap_name_hash(bitmap_git, index_pos));
 	}
 
 cleanup:
@@ -2818,7 +3085,7 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 		BUG("rebuild_existing_bitmaps: missing required rev-cache "
 		    "extension");
 
-	num_objects = bitmap_num_objects(bitmap_git);
+	num_objects = bitmap_num_objects_total(bitmap_git);
 	CALLOC_ARRAY(reposition, num_objects);
 
 	for (i = 0; i < num_objects; ++i) {
@@ -2835,8 +3102,8 @@ uint32_t *create_bitmap_mapping(struct bitmap_index *bitmap_git,
 
 		if (oe) {
 			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
-			if (bitmap_git->hashes && !oe->hash)
-				oe->hash = get_be32(bitmap_git->hashes + index_pos);
+			if (!oe->hash)
+				oe->hash = bitmap_name_hash(bitmap_git, index_pos);
 		}
 	}
 
@@ -2858,6 +3125,7 @@ void free_bitmap_index(struct bitmap_index *b)
 		struct stored_bitmap *sb;
 		kh_foreach_value(b->bitmaps, sb, {
 			ewah_pool_free(sb->root);
+			roaring_free(sb->roaring);
 			free(sb);
 		});
 	}
@@ -2881,6 +3149,7 @@ void free_bitmap_index(struct bitmap_index *b)
 		close_midx_revindex(b->midx);
 	}
 	free_pseudo_merge_map(&b->pseudo_merges);
+	free_bitmap_index(b->base);
 	free(b);
 }
 
@@ -2922,7 +3191,7 @@ static off_t get_disk_usage_for_type(struct bitmap_index *bitmap_git,
 				off_t offset = nth_midxed_offset(bitmap_git->midx, midx_pos);
 
 				uint32_t pack_id = nth_midxed_pack_int_id(bitmap_git->midx, midx_pos);
-				struct packed_git *pack = bitmap_git->midx->packs[pack_id];
+				struct packed_git *pack = nth_midxed_pack(bitmap_git->midx, pack_id);
 
 				if (offset_to_pack_pos(pack, offset, &pack_pos) < 0) {
 					struct object_id oid;
@@ -2961,7 +3230,7 @@ static off_t get_disk_usage_for_extended(struct bitmap_index *bitmap_git)
 		struct object *obj = eindex->objects[i];
 
 		if (!bitmap_get(result,
-				st_add(bitmap_num_objects(bitmap_git), i)))
+				st_add(bitmap_num_objects_total(bitmap_git), i)))
 			continue;
 
 		if (oid_object_info_extended(bitmap_repo(bitmap_git), &obj->oid,
@@ -3052,9 +3321,12 @@ int verify_bitmap_files(struct repository *r)
 
 	for (struct multi_pack_index *m = get_multi_pack_index(r);
 	     m; m = m->next) {
-		char *midx_bitmap_name = midx_bitmap_filename(m);
-		res |= verify_bitmap_file(midx_bitmap_name);
-		free(midx_bitmap_name);
+		for (struct multi_pack_index *layer = m; layer;
+		     layer = layer->base_midx) {
+			char *midx_bitmap_name = midx_bitmap_filename(layer);
+			res |= verify_bitmap_file(midx_bitmap_name);
+			free(midx_bitmap_name);
+		}
 	}
 
 	for (struct packed_git *p = get_all_packs(r);
@@ -13,6 +13,14 @@ struct rev_info;
 
 static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 
+/*
+ * Version 1 stores every bitmap using EWAH compression; version 2
+ * stores the type and commit bitmaps as roaring bitmaps, without XOR
+ * compression (see Documentation/technical/bitmap-format.txt).
+ */
+#define BITMAP_VERSION_EWAH 1
+#define BITMAP_VERSION_ROARING 2
+
 struct bitmap_disk_header {
 	char magic[ARRAY_SIZE(BITMAP_IDX_SIGNATURE)];
 	uint16_t version;
@@ -83,10 +91,17 @@ int test_bitmap_pseudo_merge_objects(struct repository *r, uint32_t n);
 
 struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
 					 int filter_provided_objects);
+/*
+ * Besides the objects that can be reused, "rewrite_out" gets those of the
+ * first pack whose offset to their delta base has to be rewritten because
+ * an object in between is not sent as-is. The other objects of that pack
+ * can be copied verbatim.
+ */
 void reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 					struct bitmapped_pack **packs_out,
 					size_t *packs_nr_out,
 					struct bitmap **reuse_out,
+					struct bitmap **rewrite_out,
 					int multi_pack_reuse);
 int rebuild_existing_bitmaps(struct bitmap_index *, struct packing_data *mapping,
 			     kh_oid_map_t *reused_bitmaps, int show_progress);
@@ -94,6 +109,20 @@ void free_bitmap_index(struct bitmap_index *);
 int bitmap_walk_contains(struct bitmap_index *,
 			 struct bitmap *bitmap, const struct object_id *oid);
 
+/*
+ * Return the position of "oid" in the bitmaps of "bitmap_git", or -1 if
+ * it is not in the bitmapped pack(s).
+ */
+int bitmap_object_position(struct bitmap_index *, const struct object_id *oid);
+
+/*
+ * Return 1 if any of the "nr" objects at the positions "pos", sorted in
+ * increasing order, is reachable according to the bitmap stored for
+ * "commit", 0 if none is, and -1 if there is no bitmap for "commit".
+ */
+int bitmap_commit_contains_any(struct bitmap_index *, struct commit *commit,
+			       const size_t *pos, size_t nr);
+
 /*
  * After a traversal has been performed by prepare_bitmap_walk(), this can be
  * queried to see if a particular object was reachable from any of the
@@ -122,10 +151,22 @@ struct bitmap_writer {
 	struct progress *progress;
 	int show_progress;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
+
+	/* BITMAP_VERSION_EWAH or BITMAP_VERSION_ROARING */
+	uint16_t version;
+
+	/*
+	 * When writing the bitmap of a new incremental MIDX layer, the
+	 * layers below it. Objects in "to_pack" come after the
+	 * "base_objects" objects of those layers in bit position order.
+	 */
+	struct multi_pack_index *base_midx;
+	uint32_t base_objects;
 };
 
 void bitmap_writer_init(struct bitmap_writer *writer, struct repository *r,
-			struct packing_data *pdata);
+			struct packing_data *pdata,
+			struct multi_pack_index *base_midx);
 void bitmap_writer_show_progress(struct bitmap_writer *writer, int show);
 void bitmap_writer_set_checksum(struct bitmap_writer *writer,
 				const unsigned char *sha1);
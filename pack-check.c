@@ -49,6 +49,49 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * Objects whose contents are in-core and that still need their names
+ * checked. We collect a few of them so that the hash implementation
+ * can work on them in parallel (see hash_object_file_multi()), but not
+ * too much data at once.
+ */
+#define VERIFY_BATCH_MAX 16
+#define VERIFY_BATCH_BYTES (1024 * 1024)
+
+struct verify_batch {
+	struct hash_object_item item[VERIFY_BATCH_MAX];
+	struct object_id expect[VERIFY_BATCH_MAX];
+	size_t nr, alloc;
+	unsigned long bytes;
+};
+
+static int flush_verify_batch(struct repository *r, struct packed_git *p,
+			      struct verify_batch *batch, verify_fn fn)
+{
+	int err = 0;
+
+	hash_object_file_multi(r->hash_algo, batch->item, batch->nr);
+	for (size_t i = 0; i < batch->nr; i++) {
+		struct hash_object_item *item = &batch->item[i];
+		void *data = (void *)item->buf;
+
+		if (!oideq(&batch->expect[i], &item->oid))
+			err = error("packed %s from %s is corrupt",
+				    oid_to_hex(&batch->expect[i]), p->pack_name);
+		else if (fn) {
+			int eaten = 0;
+			err |= fn(&batch->expect[i], item->type, item->len,
+				  data, &eaten);
+			if (eaten)
+				data = NULL;
+		}
+		free(data);
+	}
+	batch->nr = 0;
+	batch->bytes = 0;
+	return err;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
 			   struct pack_window **w_curs,
@@ -64,6 +107,7 @@ static int verify_packfile(struct repository *r,
 	uint32_t nr_objects, i;
 	int err = 0;
 	struct idx_entry *entries;
+	struct verify_batch batch = { 0 };
 
 	if (!is_pack_valid(p))
 		return error("packfile %s cannot be accessed", p->pack_name);
@@ -103,6 +147,7 @@ static int verify_packfile(struct repository *r,
 		entries[i].nr = i;
 	}
 	QSORT(entries, nr_objects, compare_entries);
+	batch.alloc = r->hash_algo->multi_lanes > 1 ? VERIFY_BATCH_MAX : 1;
 
 	for (i = 0; i < nr_objects; i++) {
 		void *data;
@@ -144,28 +189,36 @@ static int verify_packfile(struct repository *r,
 			data_valid = 1;
 		}
 
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(&oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (data && check_object_signature(r, &oid, data, size,
-							type) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (!data && stream_object_signature(r, &oid) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(&oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
+		if (data) {
+			struct hash_object_item *item = &batch.item[batch.nr];
+
+			item->buf = data;
+			item->len = size;
+			item->type = type;
+			oidcpy(&batch.expect[batch.nr++], &oid);
+			batch.bytes += size;
+			if (batch.nr == batch.alloc ||
+			    batch.bytes >= VERIFY_BATCH_BYTES)
+				err |= flush_verify_batch(r, p, &batch, fn);
+		} else {
+			/* report problems in pack order */
+			err |= flush_verify_batch(r, p, &batch, fn);
+			if (data_valid)
+				err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+					    oid_to_hex(&oid), p->pack_name,
+					    (uintmax_t)entries[i].offset);
+			else if (stream_object_signature(r, &oid) < 0)
+				err = error("packed %s from %s is corrupt",
+					    oid_to_hex(&oid), p->pack_name);
+			else if (fn) {
+				int eaten = 0;
+				err |= fn(&oid, type, size, NULL, &eaten);
+			}
 		}
 		if (((base_count + i) & 1023) == 0)
 			display_progress(progress, base_count + i);
-		free(data);
-
 	}
+	err |= flush_verify_batch(r, p, &batch, fn);
 	display_progress(progress, base_count + i);
 	free(entries);
 
@@ -124,6 +124,9 @@ off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
  * pack_pos_to_midx converts the object at position "pos" within the MIDX
  * pseudo-pack into a MIDX position.
  *
+ * If "m" is part of an incremental MIDX chain, both positions are relative
+ * to the whole chain: the objects of each layer follow those of its base.
+ *
  * If the reverse index has not yet been loaded, or the position is out of
  * bounds, this function aborts.
  *
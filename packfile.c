@@ -24,6 +24,8 @@
 #include "commit-graph.h"
 #include "pack-revindex.h"
 #include "promisor-remote.h"
+#include "json-writer.h"
+#include "trace2.h"
 
 char *odb_pack_name(struct repository *r, struct strbuf *buf,
 		    const unsigned char *hash, const char *ext)
@@ -1385,11 +1387,122 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
+/*
+ * The delta base cache is process-global and shared by every thread
+ * that reads objects.  Callers that read objects from more than one
+ * thread must do so under obj_read_lock() (see object-store-ll.h),
+ * which also serializes all access to the cache and its statistics.
+ */
 static struct hashmap delta_base_cache;
 static size_t delta_base_cached;
 
 static LIST_HEAD(delta_base_cache_lru);
 
+/*
+ * When core.deltaBaseCacheAdaptive is set, the cache may grow past
+ * core.deltaBaseCacheLimit, up to this multiple of it, if it keeps
+ * evicting bases and missing on lookups.
+ */
+#define DELTA_BASE_CACHE_ADAPTIVE_FACTOR 4
+
+/* Do not resize until we have seen this many lookups. */
+#define DELTA_BASE_CACHE_ADAPTIVE_WARMUP 1024
+
+/*
+ * Grow the cache when fewer than this percentage of lookups are
+ * served by it.
+ */
+#define DELTA_BASE_CACHE_ADAPTIVE_MIN_HIT_PERCENT 50
+
+static struct {
+	/*
+	 * Both counted once per object that we are asked to unpack: a
+	 * hit if the object itself or one of the bases in its delta chain
+	 * came from the cache, a miss otherwise.
+	 */
+	uintmax_t hits;
+	uintmax_t misses;
+	uintmax_t evictions;
+	uintmax_t evicted_bytes;
+	size_t peak_bytes;
+	size_t nr_entries;
+	size_t adaptive_limit;
+	int max_chain_depth;
+} delta_base_cache_stats;
+
+static int delta_base_cache_atexit_registered;
+
+static void trace2_delta_base_cache_statistics_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	jw_object_begin(&jw, 0);
+	jw_object_intmax(&jw, "hits", delta_base_cache_stats.hits);
+	jw_object_intmax(&jw, "misses", delta_base_cache_stats.misses);
+	jw_object_intmax(&jw, "evictions", delta_base_cache_stats.evictions);
+	jw_object_intmax(&jw, "evicted_bytes",
+			 delta_base_cache_stats.evicted_bytes);
+	jw_object_intmax(&jw, "peak_bytes", delta_base_cache_stats.peak_bytes);
+	jw_object_intmax(&jw, "max_chain_depth",
+			 delta_base_cache_stats.max_chain_depth);
+	if (delta_base_cache_stats.adaptive_limit)
+		jw_object_intmax(&jw, "adaptive_limit",
+				 delta_base_cache_stats.adaptive_limit);
+	jw_end(&jw);
+
+	trace2_data_json("delta_base_cache", NULL, "statistics", &jw);
+
+	jw_release(&jw);
+}
+
+/*
+ * Return the number of bytes that the delta base cache may hold.
+ *
+ * In adaptive mode we look at how the cache has been doing so far.
+ * If we are evicting bases and too few of the objects we unpack are
+ * served by the cache, then the working set does not fit.  The working set
+ * of a single chain is roughly its depth times the average size of a
+ * cached base, and we want room for a couple of them so that walking
+ * neighbouring objects (as "log -p" and blame do) finds their shared
+ * bases.  Grow towards that, but never past the configured ceiling,
+ * and never shrink: the memory has been used already.
+ */
+static size_t delta_base_cache_limit(struct repository *r)
+{
+	size_t limit = r->settings.delta_base_cache_limit;
+	uintmax_t lookups = delta_base_cache_stats.hits +
+			    delta_base_cache_stats.misses;
+	size_t ceiling, avg, want;
+
+	if (!r->settings.delta_base_cache_adaptive)
+		return limit;
+
+	if (delta_base_cache_stats.adaptive_limit < limit)
+		delta_base_cache_stats.adaptive_limit = limit;
+
+	if (!delta_base_cache_stats.evictions ||
+	    !delta_base_cache_stats.nr_entries ||
+	    lookups < DELTA_BASE_CACHE_ADAPTIVE_WARMUP ||
+	    delta_base_cache_stats.hits * 100 >=
+	    lookups * DELTA_BASE_CACHE_ADAPTIVE_MIN_HIT_PERCENT)
+		return delta_base_cache_stats.adaptive_limit;
+
+	ceiling = limit;
+	if (unsigned_mult_overflows(ceiling, DELTA_BASE_CACHE_ADAPTIVE_FACTOR))
+		ceiling = SIZE_MAX;
+	else
+		ceiling *= DELTA_BASE_CACHE_ADAPTIVE_FACTOR;
+
+	avg = delta_base_cached / delta_base_cache_stats.nr_entries;
+	want = st_mult(st_mult(avg, delta_base_cache_stats.max_chain_depth), 2);
+	if (want > ceiling)
+		want = ceiling;
+	if (want > delta_base_cache_stats.adaptive_limit)
+		delta_base_cache_stats.adaptive_limit = want;
+
+	return delta_base_cache_stats.adaptive_limit;
+}
+
 struct delta_base_cache_key {
 	struct packed_git *p;
 	off_t base_offset;
@@ -1467,6 +1580,7 @@ static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
 	list_del(&ent->lru);
 	delta_base_cached -= ent->size;
+	delta_base_cache_stats.nr_entries--;
 	free(ent);
 }
 
@@ -1480,6 +1594,7 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 	if (!ent)
 		return unpack_entry(r, p, base_offset, type, base_size);
 
+	delta_base_cache_stats.hits++;
 	if (type)
 		*type = ent->type;
 	if (base_size)
@@ -1528,6 +1643,8 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 			list_entry(lru, struct delta_base_cache_entry, lru);
 		if (delta_base_cached <= delta_base_cache_limit)
 			break;
+		delta_base_cache_stats.evictions++;
+		delta_base_cache_stats.evicted_bytes += f->size;
 		release_delta_base_cache(f);
 	}
 
@@ -1543,6 +1660,15 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
 	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
 	hashmap_add(&delta_base_cache, &ent->ent);
+
+	delta_base_cache_stats.nr_entries++;
+	if (delta_base_cached > delta_base_cache_stats.peak_bytes)
+		delta_base_cache_stats.peak_bytes = delta_base_cached;
+
+	if (trace2_is_enabled() && !delta_base_cache_atexit_registered) {
+		atexit(trace2_delta_base_cache_statistics_atexit);
+		delta_base_cache_atexit_registered = 1;
+	}
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1784,6 +1910,19 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		curpos = obj_offset = base_offset;
 	}
 
+	/*
+	 * Count whether the cache saved us from inflating the object or
+	 * any base of its delta chain, and how deep we went.  Callers that
+	 * find the object itself in the cache do not get here, and count
+	 * their hit themselves.
+	 */
+	if (base_from_cache)
+		delta_base_cache_stats.hits++;
+	else
+		delta_base_cache_stats.misses++;
+	if (delta_stack_nr > delta_base_cache_stats.max_chain_depth)
+		delta_base_cache_stats.max_chain_depth = delta_stack_nr;
+
 	/* PHASE 2: handle the base */
 	switch (type) {
 	case OBJ_OFS_DELTA:
@@ -1891,7 +2030,7 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		 */
 		if (!external_base)
 			add_delta_base_cache(p, base_obj_offset, base, base_size,
-					     p->repo->settings.delta_base_cache_limit,
+					     delta_base_cache_limit(p->repo),
 					     type);
 
 		free(delta_data);
@@ -18,9 +18,27 @@
 #include "thread-utils.h"
 #include "trace2.h"
 
+/*
+ * When streaming (see init_parallel_checkout_streaming()), the queue is sent
+ * to the workers in batches of PC_STREAM_BATCH_SIZE items, and each worker
+ * has at most PC_STREAM_MAX_BATCHES batches whose results we have not read
+ * yet. This bounds the size of the pending results to a few KB, so that the
+ * workers never block on writing them (even with small pipe buffers), which
+ * could otherwise deadlock with us blocking on sending them more items.
+ */
+#define PC_STREAM_BATCH_SIZE 16
+#define PC_STREAM_MAX_BATCHES 2
+
 struct pc_worker {
 	struct child_process cp;
-	size_t next_item_to_complete, nr_items_to_complete;
+	/*
+	 * The items sent to this worker whose results we are still waiting
+	 * for, as ranges of the queue in the order that they were sent.
+	 */
+	struct pc_worker_batch {
+		size_t start, nr;
+	} batch[PC_STREAM_MAX_BATCHES];
+	int nr_batches;
 };
 
 struct parallel_checkout {
@@ -29,6 +47,16 @@ struct parallel_checkout {
 	size_t nr, alloc;
 	struct progress *progress;
 	unsigned int *progress_cnt;
+
+	/* Only used when streaming. */
+	int streaming;
+	struct checkout *state;
+	int num_workers, threshold;
+	struct pc_worker *workers;
+	struct pollfd *pfds;
+	size_t nr_sent;
+	/* The number of workers that have not closed their output yet. */
+	int num_active_workers;
 };
 
 static struct parallel_checkout parallel_checkout;
@@ -74,6 +102,20 @@ void init_parallel_checkout(void)
 	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
 }
 
+void init_parallel_checkout_streaming(struct checkout *state, int num_workers,
+				      int threshold, struct progress *progress,
+				      unsigned int *progress_cnt)
+{
+	init_parallel_checkout();
+
+	parallel_checkout.streaming = 1;
+	parallel_checkout.state = state;
+	parallel_checkout.num_workers = num_workers;
+	parallel_checkout.threshold = threshold;
+	parallel_checkout.progress = progress;
+	parallel_checkout.progress_cnt = progress_cnt;
+}
+
 static void finish_parallel_checkout(void)
 {
 	if (parallel_checkout.status == PC_UNINITIALIZED)
@@ -151,6 +193,8 @@ static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
 	}
 }
 
+static void stream_queued_items(int all);
+
 int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca,
 		     int *checkout_counter)
 {
@@ -171,6 +215,9 @@ int enqueue_checkout(struct cache_entry *ce, struct conv_attrs *ca,
 	pc_item->checkout_counter = checkout_counter;
 	parallel_checkout.nr++;
 
+	if (parallel_checkout.streaming)
+		stream_queued_items(0);
+
 	return 0;
 }
 
@@ -406,8 +453,9 @@ void write_pc_item(struct parallel_checkout_item *pc_item,
 	strbuf_release(&path);
 }
 
-static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
+static int send_one_item(int fd, struct parallel_checkout_item *pc_item)
 {
+	int ret;
 	size_t len_data;
 	char *data, *variant;
 	struct pc_item_fixed_portion *fixed_portion;
@@ -441,28 +489,32 @@ static void send_one_item(int fd, struct parallel_checkout_item *pc_item)
 	}
 	memcpy(variant, pc_item->ce->name, name_len);
 
-	packet_write(fd, data, len_data);
+	ret = packet_write_gently(fd, data, len_data);
 
 	free(data);
+	return ret;
 }
 
-static void send_batch(int fd, size_t start, size_t nr)
+static int send_batch(int fd, size_t start, size_t nr)
 {
 	size_t i;
+	int ret = 0;
+
 	sigchain_push(SIGPIPE, SIG_IGN);
-	for (i = 0; i < nr; i++)
-		send_one_item(fd, &parallel_checkout.items[start + i]);
-	packet_flush(fd);
+	for (i = 0; i < nr && !ret; i++)
+		ret = send_one_item(fd, &parallel_checkout.items[start + i]);
+	if (!ret)
+		ret = packet_flush_gently(fd);
 	sigchain_pop(SIGPIPE);
+	return ret;
 }
 
-static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
+static struct pc_worker *start_workers(struct checkout *state, int num_workers)
 {
 	struct pc_worker *workers;
-	int i, workers_with_one_extra_item;
-	size_t base_batch_size, batch_beginning = 0;
+	int i;
 
-	ALLOC_ARRAY(workers, num_workers);
+	CALLOC_ARRAY(workers, num_workers);
 
 	for (i = 0; i < num_workers; i++) {
 		struct child_process *cp = &workers[i].cp;
@@ -479,6 +531,38 @@ static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
 			die("failed to spawn checkout worker");
 	}
 
+	return workers;
+}
+
+/*
+ * Return -1 if the worker could not be given the batch, e.g. because it
+ * already exited. Its input is closed then, and the items stay pending.
+ */
+static int send_batch_to_worker(struct pc_worker *worker, size_t start,
+				size_t nr)
+{
+	struct pc_worker_batch *batch;
+
+	if (worker->nr_batches == ARRAY_SIZE(worker->batch))
+		BUG("too many pending batches for checkout worker");
+
+	if (send_batch(worker->cp.in, start, nr)) {
+		close(worker->cp.in);
+		worker->cp.in = -1;
+		return -1;
+	}
+	batch = &worker->batch[worker->nr_batches++];
+	batch->start = start;
+	batch->nr = nr;
+	return 0;
+}
+
+static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
+{
+	struct pc_worker *workers = start_workers(state, num_workers);
+	int i, workers_with_one_extra_item;
+	size_t base_batch_size, batch_beginning = 0;
+
 	base_batch_size = parallel_checkout.nr / num_workers;
 	workers_with_one_extra_item = parallel_checkout.nr % num_workers;
 
@@ -490,10 +574,11 @@ static struct pc_worker *setup_workers(struct checkout *state, int num_workers)
 		if (i < workers_with_one_extra_item)
 			batch_size++;
 
-		send_batch(worker->cp.in, batch_beginning, batch_size);
-		worker->next_item_to_complete = batch_beginning;
-		worker->nr_items_to_complete = batch_size;
-
+		if (!send_batch_to_worker(worker, batch_beginning, batch_size)) {
+			/* That was all; let the worker know that it can finish. */
+			close(worker->cp.in);
+			worker->cp.in = -1;
+		}
 		batch_beginning += batch_size;
 	}
 
@@ -562,14 +647,18 @@ static void parse_and_save_result(const char *buffer, int len,
 		assert_pc_item_result_size(len, (int)PC_ITEM_RESULT_BASE_SIZE);
 	}
 
-	if (!worker->nr_items_to_complete)
+	if (!worker->nr_batches)
 		BUG("received result from supposedly finished checkout worker");
-	if (res->id != worker->next_item_to_complete)
+	if (res->id != worker->batch[0].start)
 		BUG("unexpected item id from checkout worker (got %"PRIuMAX", exp %"PRIuMAX")",
-		    (uintmax_t)res->id, (uintmax_t)worker->next_item_to_complete);
+		    (uintmax_t)res->id, (uintmax_t)worker->batch[0].start);
 
-	worker->next_item_to_complete++;
-	worker->nr_items_to_complete--;
+	worker->batch[0].start++;
+	if (!--worker->batch[0].nr) {
+		worker->nr_batches--;
+		MOVE_ARRAY(worker->batch, worker->batch + 1,
+			   worker->nr_batches);
+	}
 
 	pc_item = &parallel_checkout.items[res->id];
 	pc_item->status = res->status;
@@ -580,59 +669,177 @@ static void parse_and_save_result(const char *buffer, int len,
 		advance_progress_meter();
 }
 
-static void gather_results_from_workers(struct pc_worker *workers,
-					int num_workers)
+static void worker_finished(struct pc_worker *worker, int i,
+			    struct pollfd *pfd)
+{
+	if (worker->nr_batches)
+		error("checkout worker %d exited before sending all results", i);
+	worker->nr_batches = 0;
+	pfd->fd = -1;
+}
+
+static struct pollfd *poll_fds_for_workers(struct pc_worker *workers,
+					    int num_workers)
 {
-	int i, active_workers = num_workers;
 	struct pollfd *pfds;
+	int i;
 
 	CALLOC_ARRAY(pfds, num_workers);
 	for (i = 0; i < num_workers; i++) {
 		pfds[i].fd = workers[i].cp.out;
 		pfds[i].events = POLLIN;
 	}
+	return pfds;
+}
 
-	while (active_workers) {
-		int nr = poll(pfds, num_workers, -1);
+/*
+ * Wait for up to "timeout" milliseconds (as in poll()) for results from the
+ * workers, and save those that arrived. Return the number of workers that
+ * finished in the meantime. The items of a worker that finished before
+ * sending all of its results are left pending, and are reported as failed
+ * by handle_results().
+ */
+static int receive_results(struct pc_worker *workers, struct pollfd *pfds,
+			   int num_workers, int timeout)
+{
+	int i, finished = 0;
+	int nr = poll(pfds, num_workers, timeout);
 
-		if (nr < 0) {
-			if (errno == EINTR)
-				continue;
-			die_errno("failed to poll checkout workers");
-		}
+	if (nr < 0) {
+		if (errno == EINTR)
+			return 0;
+		die_errno("failed to poll checkout workers");
+	}
 
-		for (i = 0; i < num_workers && nr > 0; i++) {
-			struct pc_worker *worker = &workers[i];
-			struct pollfd *pfd = &pfds[i];
-
-			if (!pfd->revents)
-				continue;
-
-			if (pfd->revents & POLLIN) {
-				int len = packet_read(pfd->fd, packet_buffer,
-						      sizeof(packet_buffer), 0);
-
-				if (len < 0) {
-					BUG("packet_read() returned negative value");
-				} else if (!len) {
-					pfd->fd = -1;
-					active_workers--;
-				} else {
-					parse_and_save_result(packet_buffer,
-							      len, worker);
-				}
-			} else if (pfd->revents & POLLHUP) {
-				pfd->fd = -1;
-				active_workers--;
-			} else if (pfd->revents & (POLLNVAL | POLLERR)) {
-				die("error polling from checkout worker");
+	for (i = 0; i < num_workers && nr > 0; i++) {
+		struct pc_worker *worker = &workers[i];
+		struct pollfd *pfd = &pfds[i];
+
+		if (!pfd->revents)
+			continue;
+
+		if (pfd->revents & POLLIN) {
+			int len = packet_read(pfd->fd, packet_buffer,
+					      sizeof(packet_buffer), 0);
+
+			if (len < 0) {
+				BUG("packet_read() returned negative value");
+			} else if (!len) {
+				worker_finished(worker, i, pfd);
+				finished++;
+			} else {
+				parse_and_save_result(packet_buffer,
+						      len, worker);
 			}
+		} else if (pfd->revents & POLLHUP) {
+			worker_finished(worker, i, pfd);
+			finished++;
+		} else if (pfd->revents & (POLLNVAL | POLLERR)) {
+			die("error polling from checkout worker");
+		}
+
+		nr--;
+	}
+
+	return finished;
+}
+
+static void gather_results_from_workers(struct pc_worker *workers,
+					struct pollfd *pfds, int num_workers,
+					int active_workers)
+{
+	while (active_workers)
+		active_workers -= receive_results(workers, pfds, num_workers, -1);
+}
+
+static struct pc_worker *least_busy_worker(void)
+{
+	struct pc_worker *best = NULL;
+	int i;
+
+	for (i = 0; i < parallel_checkout.num_workers; i++) {
+		struct pc_worker *worker = &parallel_checkout.workers[i];
 
-			nr--;
+		if (parallel_checkout.pfds[i].fd < 0 || worker->cp.in < 0)
+			continue; /* the worker is gone */
+		if (worker->nr_batches == ARRAY_SIZE(worker->batch))
+			continue;
+		if (!best || worker->nr_batches < best->nr_batches)
+			best = worker;
+	}
+	return best;
+}
+
+/*
+ * Send the queued items that were not sent yet to the workers, starting
+ * them first if the queue got long enough. Unless "all" is set, keep the
+ * last incomplete batch in the queue, and leave the items there instead
+ * of waiting for busy workers.
+ */
+static void stream_queued_items(int all)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+
+	if (!all && pc->nr - pc->nr_sent < PC_STREAM_BATCH_SIZE)
+		return;
+
+	if (!pc->workers) {
+		if (pc->nr < pc->threshold || pc->nr < PC_STREAM_BATCH_SIZE)
+			return;
+		pc->workers = start_workers(pc->state, pc->num_workers);
+		pc->pfds = poll_fds_for_workers(pc->workers, pc->num_workers);
+		pc->num_active_workers = pc->num_workers;
+	}
+
+	while (pc->nr_sent < pc->nr) {
+		size_t nr = pc->nr - pc->nr_sent;
+		struct pc_worker *worker;
+
+		if (nr > PC_STREAM_BATCH_SIZE)
+			nr = PC_STREAM_BATCH_SIZE;
+		else if (nr < PC_STREAM_BATCH_SIZE && !all)
+			break;
+
+		pc->num_active_workers -= receive_results(pc->workers, pc->pfds,
+							  pc->num_workers, 0);
+		worker = least_busy_worker();
+		if (!worker) {
+			/*
+			 * If all workers are gone, leave the remaining items
+			 * pending; they are reported as failed at the end.
+			 */
+			if (!all || !pc->num_active_workers)
+				break;
+			pc->num_active_workers -=
+				receive_results(pc->workers, pc->pfds,
+						pc->num_workers, -1);
+			continue;
 		}
+
+		if (send_batch_to_worker(worker, pc->nr_sent, nr))
+			continue; /* try the next worker */
+		pc->nr_sent += nr;
 	}
+}
 
-	free(pfds);
+static void finish_streaming(void)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+	int i;
+
+	trace2_data_intmax("pcheckout", NULL, "streamed", pc->nr_sent);
+
+	stream_queued_items(1);
+	for (i = 0; i < pc->num_workers; i++) {
+		if (pc->workers[i].cp.in < 0)
+			continue;
+		close(pc->workers[i].cp.in);
+		pc->workers[i].cp.in = -1;
+	}
+	gather_results_from_workers(pc->workers, pc->pfds, pc->num_workers,
+				    pc->num_active_workers);
+	finish_workers(pc->workers, pc->num_workers);
+	free(pc->pfds);
 }
 
 static void write_items_sequentially(struct checkout *state)
@@ -662,12 +869,18 @@ int run_parallel_checkout(struct checkout *state, int num_workers, int threshold
 	if (parallel_checkout.nr < num_workers)
 		num_workers = parallel_checkout.nr;
 
-	if (num_workers <= 1 || parallel_checkout.nr < threshold) {
+	if (parallel_checkout.workers) {
+		finish_streaming();
+	} else if (num_workers <= 1 || parallel_checkout.nr < threshold) {
 		write_items_sequentially(state);
 	} else {
 		struct pc_worker *workers = setup_workers(state, num_workers);
-		gather_results_from_workers(workers, num_workers);
+		struct pollfd *pfds = poll_fds_for_workers(workers, num_workers);
+
+		gather_results_from_workers(workers, pfds, num_workers,
+					    num_workers);
 		finish_workers(workers, num_workers);
+		free(pfds);
 	}
 
 	ret = handle_results(state);
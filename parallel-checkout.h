@@ -26,6 +26,18 @@ void get_parallel_checkout_configs(int *num_workers, int *threshold);
  */
 void init_parallel_checkout(void);
 
+/*
+ * Like init_parallel_checkout(), but start the workers as soon as the queue
+ * reaches the given threshold, and send them the entries while the caller is
+ * still enqueueing more. The caller must finish with run_parallel_checkout()
+ * using the same arguments. This is only safe when the caller does not write
+ * any file whose path may collide with the enqueued ones, e.g. when filling
+ * an empty working tree on a case-sensitive file system.
+ */
+void init_parallel_checkout_streaming(struct checkout *state, int num_workers,
+				      int threshold, struct progress *progress,
+				      unsigned int *progress_cnt);
+
 /*
  * Return -1 if parallel checkout is currently not accepting entries or if the
  * entry is not eligible for parallel checkout. Otherwise, enqueue the entry
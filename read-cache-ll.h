@@ -17,7 +17,7 @@ struct cache_header {
 };
 
 #define INDEX_FORMAT_LB 2
-#define INDEX_FORMAT_UB 4
+#define INDEX_FORMAT_UB 5
 
 struct cache_entry {
 	struct hashmap_entry ent;
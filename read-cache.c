@@ -1969,6 +1969,200 @@ static void post_read_index_from(struct index_state *istate)
 	tweak_fsmonitor(istate);
 }
 
+/*
+ * An index version 5 entry, whose fields are all stored in little-endian
+ * byte order, followed by the NUL-terminated name and padding up to a
+ * multiple of 8 bytes. The entries are preceded by the offset of the name
+ * in a record, and by the size of all the records.
+ *
+ * The record is laid out like "struct cache_entry" on little-endian
+ * platforms with 64-bit pointers, so that there the entries can be used
+ * right where they were read instead of being parsed one by one. The
+ * reserved fields take the place of members that only make sense in
+ * memory; they are written as zero and ignored when reading.
+ */
+struct ondisk_cache_entry_v5 {
+	uint8_t reserved_ent[16];
+	uint32_t ctime_sec, ctime_nsec;
+	uint32_t mtime_sec, mtime_nsec;
+	uint32_t dev, ino, uid, gid, size;
+	uint32_t mode;
+	uint32_t flags;
+	uint32_t reserved_mem_pool_allocated;
+	uint32_t namelen;
+	uint32_t reserved_index;
+	uint8_t hash[GIT_MAX_RAWSZ];
+	uint32_t hash_algo;
+	char name[FLEX_ARRAY];
+};
+
+#define CE_V5_HEADER_SIZE 12
+#define CE_V5_CTIME offsetof(struct ondisk_cache_entry_v5, ctime_sec)
+#define CE_V5_MTIME offsetof(struct ondisk_cache_entry_v5, mtime_sec)
+#define CE_V5_DEV offsetof(struct ondisk_cache_entry_v5, dev)
+#define CE_V5_INO offsetof(struct ondisk_cache_entry_v5, ino)
+#define CE_V5_UID offsetof(struct ondisk_cache_entry_v5, uid)
+#define CE_V5_GID offsetof(struct ondisk_cache_entry_v5, gid)
+#define CE_V5_SIZE offsetof(struct ondisk_cache_entry_v5, size)
+#define CE_V5_MODE offsetof(struct ondisk_cache_entry_v5, mode)
+#define CE_V5_FLAGS offsetof(struct ondisk_cache_entry_v5, flags)
+#define CE_V5_NAMELEN offsetof(struct ondisk_cache_entry_v5, namelen)
+#define CE_V5_OID offsetof(struct ondisk_cache_entry_v5, hash)
+#define CE_V5_OID_ALGO offsetof(struct ondisk_cache_entry_v5, hash_algo)
+#define CE_V5_NAME offsetof(struct ondisk_cache_entry_v5, name)
+#define ce_v5_size(len) (((CE_V5_NAME + (len) + 1) + 7) & ~7)
+
+#define CE_V5_ONDISK_FLAGS (CE_STAGEMASK | CE_VALID | CE_EXTENDED | \
+			    CE_EXTENDED_FLAGS)
+
+#if GIT_BYTE_ORDER == GIT_LITTLE_ENDIAN && UINTPTR_MAX == UINT64_MAX
+#define INDEX_V5_NATIVE 1
+#else
+#define INDEX_V5_NATIVE 0
+#endif
+
+/*
+ * Where the entries are meant to be used in place, fail the build if
+ * "struct cache_entry" no longer matches the on-disk record.
+ */
+#define CE_V5_SAME(member, field) \
+	BUILD_ASSERT_OR_ZERO(!INDEX_V5_NATIVE || \
+			     offsetof(struct cache_entry, member) == \
+			     offsetof(struct ondisk_cache_entry_v5, field))
+
+static int index_v5_is_native(void)
+{
+	return INDEX_V5_NATIVE +
+	       CE_V5_SAME(ce_stat_data.sd_ctime.sec, ctime_sec) +
+	       CE_V5_SAME(ce_stat_data.sd_ctime.nsec, ctime_nsec) +
+	       CE_V5_SAME(ce_stat_data.sd_mtime.sec, mtime_sec) +
+	       CE_V5_SAME(ce_stat_data.sd_mtime.nsec, mtime_nsec) +
+	       CE_V5_SAME(ce_stat_data.sd_dev, dev) +
+	       CE_V5_SAME(ce_stat_data.sd_ino, ino) +
+	       CE_V5_SAME(ce_stat_data.sd_uid, uid) +
+	       CE_V5_SAME(ce_stat_data.sd_gid, gid) +
+	       CE_V5_SAME(ce_stat_data.sd_size, size) +
+	       CE_V5_SAME(ce_mode, mode) +
+	       CE_V5_SAME(ce_flags, flags) +
+	       CE_V5_SAME(mem_pool_allocated, reserved_mem_pool_allocated) +
+	       CE_V5_SAME(ce_namelen, namelen) +
+	       CE_V5_SAME(index, reserved_index) +
+	       CE_V5_SAME(oid.hash, hash) +
+	       CE_V5_SAME(oid.algo, hash_algo) +
+	       CE_V5_SAME(name, name);
+}
+
+static void check_v5_entry(const char *record, size_t avail, size_t *len)
+{
+	if (avail < CE_V5_NAME + 1)
+		die(_("index file corrupt"));
+	*len = get_le32(record + CE_V5_NAMELEN);
+	if (*len > avail - CE_V5_NAME - 1 || record[CE_V5_NAME + *len] ||
+	    ce_v5_size(*len) > avail)
+		die(_("index file corrupt"));
+	if (get_le32(record + CE_V5_FLAGS) & ~CE_V5_ONDISK_FLAGS)
+		die(_("unknown index entry format 0x%08x"),
+		    get_le32(record + CE_V5_FLAGS));
+	if (get_le32(record + CE_V5_OID_ALGO) != hash_algo_by_ptr(the_hash_algo))
+		die(_("index entry uses a different hash algorithm"));
+}
+
+static struct cache_entry *create_from_disk_v5(struct mem_pool *ce_mem_pool,
+					       const char *record, size_t len)
+{
+	struct cache_entry *ce = mem_pool__ce_alloc(ce_mem_pool, len);
+
+	ce->ce_stat_data.sd_ctime.sec = get_le32(record + CE_V5_CTIME);
+	ce->ce_stat_data.sd_ctime.nsec = get_le32(record + CE_V5_CTIME + 4);
+	ce->ce_stat_data.sd_mtime.sec = get_le32(record + CE_V5_MTIME);
+	ce->ce_stat_data.sd_mtime.nsec = get_le32(record + CE_V5_MTIME + 4);
+	ce->ce_stat_data.sd_dev = get_le32(record + CE_V5_DEV);
+	ce->ce_stat_data.sd_ino = get_le32(record + CE_V5_INO);
+	ce->ce_stat_data.sd_uid = get_le32(record + CE_V5_UID);
+	ce->ce_stat_data.sd_gid = get_le32(record + CE_V5_GID);
+	ce->ce_stat_data.sd_size = get_le32(record + CE_V5_SIZE);
+	ce->ce_mode = get_le32(record + CE_V5_MODE);
+	ce->ce_flags = get_le32(record + CE_V5_FLAGS);
+	ce->ce_namelen = len;
+	ce->index = 0;
+	oidread(&ce->oid, (const unsigned char *)record + CE_V5_OID,
+		the_repository->hash_algo);
+	memcpy(ce->name, record + CE_V5_NAME, len + 1);
+	return ce;
+}
+
+/*
+ * Load the version 5 entries. Where possible, the entries are used right
+ * where they are in the (private and writable) mapping of the index file,
+ * in which case the mapping is handed over to the memory pool of the
+ * index, and "*adopted_mmap" is set.
+ */
+static unsigned long load_cache_entries_v5(struct index_state *istate,
+			const char *mmap, size_t mmap_size, unsigned long src_offset,
+			int *adopted_mmap MAYBE_UNUSED)
+{
+	size_t size, pos = 0, len;
+	const char *records;
+	int i;
+
+	if (mmap_size - the_hash_algo->rawsz - src_offset < CE_V5_HEADER_SIZE)
+		die(_("index file corrupt"));
+	if (get_le32(mmap + src_offset) != CE_V5_NAME)
+		die(_("unknown index version 5 entry layout"));
+	size = get_le64(mmap + src_offset + 4);
+	src_offset += CE_V5_HEADER_SIZE;
+	if (size > mmap_size - the_hash_algo->rawsz - src_offset)
+		die(_("index file corrupt"));
+	records = mmap + src_offset;
+
+	istate->ce_mem_pool = xmalloc(sizeof(*istate->ce_mem_pool));
+
+	if (!index_v5_is_native()) {
+		mem_pool_init(istate->ce_mem_pool, size);
+		for (i = 0; i < istate->cache_nr; i++) {
+			check_v5_entry(records + pos, size - pos, &len);
+			set_index_entry(istate, i,
+					create_from_disk_v5(istate->ce_mem_pool,
+							    records + pos, len));
+			pos += ce_v5_size(len);
+		}
+	} else {
+		char *entries;
+
+		mem_pool_init(istate->ce_mem_pool, 0);
+#if defined(NO_MMAP) || defined(USE_WIN32_MMAP)
+		/*
+		 * A mapped file cannot be replaced on Windows, and without
+		 * mmap() the "mapping" cannot be written to; copy the
+		 * records instead.
+		 */
+		entries = mem_pool_alloc(istate->ce_mem_pool, size);
+		memcpy(entries, records, size);
+#else
+		entries = (char *)records;
+		mem_pool_add_mapping(istate->ce_mem_pool, (void *)mmap, mmap_size);
+		*adopted_mmap = 1;
+#endif
+
+		for (i = 0; i < istate->cache_nr; i++) {
+			struct cache_entry *ce = (struct cache_entry *)(entries + pos);
+
+			check_v5_entry(entries + pos, size - pos, &len);
+			/* Only write when needed, to not dirty the pages */
+			if (ce->mem_pool_allocated != 1)
+				ce->mem_pool_allocated = 1;
+			if (ce->index)
+				ce->index = 0;
+			set_index_entry(istate, i, ce);
+			pos += ce_v5_size(len);
+		}
+	}
+	if (pos != size)
+		die(_("index file corrupt"));
+
+	return CE_V5_HEADER_SIZE + size;
+}
+
 static size_t estimate_cache_size_from_compressed(unsigned int entries)
 {
 	return entries * (sizeof(struct cache_entry) + CACHE_ENTRY_PATH_LENGTH);
@@ -2210,6 +2404,27 @@ static void set_new_index_sparsity(struct index_state *istate)
 		istate->sparse_index = 1;
 }
 
+/*
+ * Version 5 entries may be used right where they are in the mapping of the
+ * index, and updated there (privately, the file is not modified), so such
+ * an index needs a writable mapping. Peek at the header to find out, so
+ * that other versions keep a read-only one.
+ */
+static int index_mmap_prot(int fd MAYBE_UNUSED)
+{
+#if defined(NO_MMAP) || defined(USE_WIN32_MMAP)
+	return PROT_READ;
+#else
+	struct cache_header hdr;
+
+	if (!index_v5_is_native() ||
+	    pread_in_full(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    ntohl(hdr.hdr_version) != 5)
+		return PROT_READ;
+	return PROT_READ | PROT_WRITE;
+#endif
+}
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
@@ -2223,6 +2438,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	size_t extension_offset = 0;
 	int nr_threads, cpus;
 	struct index_entry_offset_table *ieot = NULL;
+	int adopted_mmap = 0;
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -2246,7 +2462,7 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	if (mmap_size < sizeof(struct cache_header) + the_hash_algo->rawsz)
 		die(_("%s: index file smaller than expected"), path);
 
-	mmap = xmmap_gently(NULL, mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	mmap = xmmap_gently(NULL, mmap_size, index_mmap_prot(fd), MAP_PRIVATE, fd, 0);
 	if (mmap == MAP_FAILED)
 		die_errno(_("%s: unable to map index file%s"), path,
 			mmap_os_err());
@@ -2302,12 +2518,15 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	 * Locate and read the index entry offset table so that we can use it
 	 * to multi-thread the reading of the cache entries.
 	 */
-	if (extension_offset && nr_threads > 1)
+	if (extension_offset && nr_threads > 1 && istate->version != 5)
 		ieot = read_ieot_extension(mmap, mmap_size, extension_offset);
 
 	if (ieot) {
 		src_offset += load_cache_entries_threaded(istate, mmap, mmap_size, nr_threads, ieot);
 		free(ieot);
+	} else if (istate->version == 5) {
+		src_offset += load_cache_entries_v5(istate, mmap, mmap_size,
+						    src_offset, &adopted_mmap);
 	} else {
 		src_offset += load_all_cache_entries(istate, mmap, mmap_size, src_offset);
 	}
@@ -2324,7 +2543,8 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 		p.src_offset = src_offset;
 		load_index_extensions(&p);
 	}
-	munmap((void *)mmap, mmap_size);
+	if (!adopted_mmap)
+		munmap((void *)mmap, mmap_size);
 
 	/*
 	 * TODO trace2: replace "the_repository" with the actual repo instance
@@ -2659,8 +2879,22 @@ static void copy_cache_entry_to_ondisk(struct ondisk_cache_entry *ondisk,
 	}
 }
 
-static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
-			  struct strbuf *previous_name, struct ondisk_cache_entry *ondisk)
+/*
+ * Entries are either written straight to the index file, or serialized
+ * into a buffer when done by a thread (see write_entries_threaded()).
+ */
+static void ce_write_data(struct hashfile *f, struct strbuf *out,
+			  const void *data, size_t len)
+{
+	if (out)
+		strbuf_add(out, data, len);
+	else
+		hashwrite(f, data, len);
+}
+
+static int ce_write_entry(struct hashfile *f, struct strbuf *out,
+			  struct cache_entry *ce, struct strbuf *previous_name,
+			  struct ondisk_cache_entry *ondisk)
 {
 	int size;
 	unsigned int saved_namelen;
@@ -2678,9 +2912,9 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	if (!previous_name) {
 		int len = ce_namelen(ce);
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, ce->name, len);
-		hashwrite(f, padding, align_padding_size(size, len));
+		ce_write_data(f, out, ondisk, size);
+		ce_write_data(f, out, ce->name, len);
+		ce_write_data(f, out, padding, align_padding_size(size, len));
 	} else {
 		int common, to_remove, prefix_size;
 		unsigned char to_remove_vi[16];
@@ -2694,10 +2928,10 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 		prefix_size = encode_varint(to_remove, to_remove_vi);
 
 		copy_cache_entry_to_ondisk(ondisk, ce);
-		hashwrite(f, ondisk, size);
-		hashwrite(f, to_remove_vi, prefix_size);
-		hashwrite(f, ce->name + common, ce_namelen(ce) - common);
-		hashwrite(f, padding, 1);
+		ce_write_data(f, out, ondisk, size);
+		ce_write_data(f, out, to_remove_vi, prefix_size);
+		ce_write_data(f, out, ce->name + common, ce_namelen(ce) - common);
+		ce_write_data(f, out, padding, 1);
 
 		strbuf_splice(previous_name, common, to_remove,
 			      ce->name + common, ce_namelen(ce) - common);
@@ -2710,6 +2944,58 @@ static int ce_write_entry(struct hashfile *f, struct cache_entry *ce,
 	return 0;
 }
 
+static void ce_write_entry_v5(struct hashfile *f, struct cache_entry *ce)
+{
+	unsigned char record[CE_V5_NAME] = { 0 };
+	static unsigned char padding[8] = { 0x00 };
+	size_t len = (ce->ce_flags & CE_STRIP_NAME) ? 0 : ce_namelen(ce);
+	unsigned int flags;
+
+	put_le32(record + CE_V5_CTIME, ce->ce_stat_data.sd_ctime.sec);
+	put_le32(record + CE_V5_CTIME + 4, ce->ce_stat_data.sd_ctime.nsec);
+	put_le32(record + CE_V5_MTIME, ce->ce_stat_data.sd_mtime.sec);
+	put_le32(record + CE_V5_MTIME + 4, ce->ce_stat_data.sd_mtime.nsec);
+	put_le32(record + CE_V5_DEV, ce->ce_stat_data.sd_dev);
+	put_le32(record + CE_V5_INO, ce->ce_stat_data.sd_ino);
+	put_le32(record + CE_V5_UID, ce->ce_stat_data.sd_uid);
+	put_le32(record + CE_V5_GID, ce->ce_stat_data.sd_gid);
+	put_le32(record + CE_V5_SIZE, ce->ce_stat_data.sd_size);
+	put_le32(record + CE_V5_MODE, ce->ce_mode);
+	flags = ce->ce_flags & CE_V5_ONDISK_FLAGS & ~CE_EXTENDED;
+	if (flags & CE_EXTENDED_FLAGS)
+		flags |= CE_EXTENDED;
+	put_le32(record + CE_V5_FLAGS, flags);
+	put_le32(record + CE_V5_NAMELEN, len);
+	memcpy(record + CE_V5_OID, ce->oid.hash, the_hash_algo->rawsz);
+	put_le32(record + CE_V5_OID_ALGO, hash_algo_by_ptr(the_hash_algo));
+
+	hashwrite(f, record, sizeof(record));
+	hashwrite(f, ce->name, len);
+	hashwrite(f, padding, ce_v5_size(len) - CE_V5_NAME - len);
+
+	ce->ce_flags &= ~CE_STRIP_NAME;
+}
+
+static void write_index_v5_header(struct hashfile *f,
+				  struct index_state *istate)
+{
+	unsigned char hdr[CE_V5_HEADER_SIZE];
+	uint64_t size = 0;
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		size += ce_v5_size((ce->ce_flags & CE_STRIP_NAME) ?
+				   0 : ce_namelen(ce));
+	}
+
+	put_le32(hdr, CE_V5_NAME);
+	put_le64(hdr + 4, size);
+	hashwrite(f, hdr, sizeof(hdr));
+}
+
 /*
  * This function verifies if index_state has the correct sha1 of the
  * index file.  Don't die if we have any other failure, just return 0.
@@ -2808,6 +3094,149 @@ static int record_ieot(void)
 	return !repo_config_get_index_threads(the_repository, &val) && val != 1;
 }
 
+static int prepare_entry_for_write(struct index_state *istate,
+				   struct cache_entry *ce, int *drop_cache_tree)
+{
+	int err = 0;
+
+	if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+		ce_smudge_racily_clean_entry(istate, ce);
+	if (is_null_oid(&ce->oid)) {
+		static const char msg[] = "cache entry has null sha1: %s";
+		static int allow = -1;
+
+		if (allow < 0)
+			allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
+		if (allow)
+			warning(msg, ce->name);
+		else
+			err = error(msg, ce->name);
+
+		*drop_cache_tree = 1;
+	}
+	return err;
+}
+
+struct write_entries_thread_data
+{
+	pthread_t pthread;
+	struct cache_entry **cache;
+	int start, end;		/* range of the cache written by this thread */
+	int version4;
+	size_t previous_len;	/* V4: name length of the entry before "start" */
+	int nr;			/* return # of entries written */
+	struct strbuf out;	/* return the serialized entries */
+};
+
+/*
+ * A thread proc to serialize one block of cache entries; the main thread
+ * then feeds the blocks to the hashfile in order.
+ */
+static void *write_entries_thread(void *_data)
+{
+	struct write_entries_thread_data *p = _data;
+	struct ondisk_cache_entry ondisk;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name = NULL;
+	int i;
+
+	if (p->version4) {
+		/*
+		 * Like the sequential writer does at the start of an IEOT
+		 * block, use a previous name with nothing in common with
+		 * this entry, but still strip the whole previous name.
+		 */
+		strbuf_addchars(&previous_name_buf, 0, p->previous_len);
+		previous_name = &previous_name_buf;
+	}
+
+	for (i = p->start; i < p->end; i++) {
+		struct cache_entry *ce = p->cache[i];
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		ce_write_entry(NULL, &p->out, ce, previous_name, &ondisk);
+		p->nr++;
+	}
+
+	strbuf_release(&previous_name_buf);
+	return NULL;
+}
+
+/*
+ * Write the cache entries using one thread per IEOT block, producing
+ * exactly the same output as the sequential loop in do_write_index().
+ * Every entry must have been through prepare_entry_for_write() already.
+ */
+static void write_entries_threaded(struct index_state *istate,
+				   struct hashfile *f,
+				   struct index_entry_offset_table *ieot,
+				   int ieot_entries, int version4)
+{
+	struct cache_entry **cache = istate->cache;
+	int entries = istate->cache_nr;
+	struct write_entries_thread_data *data;
+	int i, nr_blocks = 0, start = 0, err;
+	size_t previous_len = 0;
+
+	CALLOC_ARRAY(data, DIV_ROUND_UP(entries, ieot_entries));
+
+	while (start < entries) {
+		struct write_entries_thread_data *p = &data[nr_blocks++];
+		int end = start;
+
+		/*
+		 * As in the sequential loop, a block only ends at a multiple
+		 * of ieot_entries that is not a removed entry.
+		 */
+		do {
+			end += ieot_entries - end % ieot_entries;
+		} while (end < entries && (cache[end]->ce_flags & CE_REMOVE));
+		if (end > entries)
+			end = entries;
+
+		p->cache = cache;
+		p->start = start;
+		p->end = end;
+		p->version4 = version4;
+		p->previous_len = previous_len;
+		strbuf_init(&p->out, 0);
+
+		if (version4) {
+			for (i = end - 1; i >= start; i--) {
+				struct cache_entry *ce = cache[i];
+				if (ce->ce_flags & CE_REMOVE)
+					continue;
+				previous_len = (ce->ce_flags & CE_STRIP_NAME) ?
+					0 : ce_namelen(ce);
+				break;
+			}
+		}
+
+		err = pthread_create(&p->pthread, NULL, write_entries_thread, p);
+		if (err)
+			die(_("unable to create write_entries thread: %s"), strerror(err));
+
+		start = end;
+	}
+
+	for (i = 0; i < nr_blocks; i++) {
+		struct write_entries_thread_data *p = &data[i];
+
+		err = pthread_join(p->pthread, NULL);
+		if (err)
+			die(_("unable to join write_entries thread: %s"), strerror(err));
+
+		if (p->nr || i < nr_blocks - 1) {
+			ieot->entries[ieot->nr].nr = p->nr;
+			ieot->entries[ieot->nr].offset = hashfile_total(f);
+			ieot->nr++;
+		}
+		hashwrite(f, p->out.buf, p->out.len);
+		strbuf_release(&p->out);
+	}
+
+	free(data);
+}
+
 enum write_extensions {
 	WRITE_NO_EXTENSION =              0,
 	WRITE_SPLIT_INDEX_EXTENSION =     1<<0,
@@ -2845,7 +3274,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	struct index_entry_offset_table *ieot = NULL;
 	struct repository *r = istate->repo;
 	struct strbuf sb = STRBUF_INIT;
-	int nr, nr_threads, ret;
+	int nr_threads, ret;
 
 	f = hashfd(tempfile->fd, tempfile->filename.buf);
 
@@ -2878,11 +3307,14 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	hdr.hdr_entries = htonl(entries - removed);
 
 	hashwrite(f, &hdr, sizeof(hdr));
+	if (hdr_version == 5)
+		write_index_v5_header(f, istate);
 
 	if (!HAVE_THREADS || repo_config_get_index_threads(the_repository, &nr_threads))
 		nr_threads = 1;
 
-	if (nr_threads != 1 && record_ieot()) {
+	/* Version 5 entries need no parsing, hence no offset table */
+	if (nr_threads != 1 && record_ieot() && hdr_version != 5) {
 		int ieot_blocks, cpus;
 
 		/*
@@ -2912,56 +3344,38 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		}
 	}
 
-	offset = hashfile_total(f);
-
-	nr = 0;
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 
-	for (i = 0; i < entries; i++) {
-		struct cache_entry *ce = cache[i];
-		if (ce->ce_flags & CE_REMOVE)
-			continue;
-		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
-			ce_smudge_racily_clean_entry(istate, ce);
-		if (is_null_oid(&ce->oid)) {
-			static const char msg[] = "cache entry has null sha1: %s";
-			static int allow = -1;
-
-			if (allow < 0)
-				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
-			if (allow)
-				warning(msg, ce->name);
-			else
-				err = error(msg, ce->name);
-
-			drop_cache_tree = 1;
+	if (ieot) {
+		/*
+		 * With an offset table, the blocks of entries can be
+		 * serialized in parallel once they have all been checked.
+		 */
+		for (i = 0; i < entries && !err; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			err = prepare_entry_for_write(istate, ce,
+						      &drop_cache_tree);
 		}
-		if (ieot && i && (i % ieot_entries == 0)) {
-			ieot->entries[ieot->nr].nr = nr;
-			ieot->entries[ieot->nr].offset = offset;
-			ieot->nr++;
-			/*
-			 * If we have a V4 index, set the first byte to an invalid
-			 * character to ensure there is nothing common with the previous
-			 * entry
-			 */
-			if (previous_name)
-				previous_name->buf[0] = 0;
-			nr = 0;
-
-			offset = hashfile_total(f);
+		if (!err)
+			write_entries_threaded(istate, f, ieot, ieot_entries,
+					       previous_name != NULL);
+	} else {
+		for (i = 0; i < entries; i++) {
+			struct cache_entry *ce = cache[i];
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			err = prepare_entry_for_write(istate, ce,
+						      &drop_cache_tree);
+			if (hdr_version == 5)
+				ce_write_entry_v5(f, ce);
+			else if (ce_write_entry(f, NULL, ce, previous_name,
+						(struct ondisk_cache_entry *)&ondisk) < 0)
+				err = -1;
+			if (err)
+				break;
 		}
-		if (ce_write_entry(f, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
-			err = -1;
-
-		if (err)
-			break;
-		nr++;
-	}
-	if (ieot && nr) {
-		ieot->entries[ieot->nr].nr = nr;
-		ieot->entries[ieot->nr].offset = offset;
-		ieot->nr++;
 	}
 	strbuf_release(&previous_name_buf);
 
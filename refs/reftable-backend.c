@@ -21,6 +21,7 @@
 #include "../reftable/reftable-error.h"
 #include "../reftable/reftable-iterator.h"
 #include "../repo-settings.h"
+#include "../run-command.h"
 #include "../setup.h"
 #include "../strmap.h"
 #include "../trace2.h"
@@ -37,6 +38,40 @@
 struct reftable_backend {
 	struct reftable_stack *stack;
 	struct reftable_iterator it;
+	/* The git directory that hosts the stack in its "reftable" directory. */
+	char *gitdir;
+	/* The store this backend belongs to. */
+	struct reftable_ref_store *refs;
+};
+
+struct reftable_ref_store {
+	struct ref_store base;
+
+	/*
+	 * The main backend refers to the common dir and thus contains common
+	 * refs as well as refs of the main repository.
+	 */
+	struct reftable_backend main_backend;
+	/*
+	 * The worktree backend refers to the gitdir in case the refdb is opened
+	 * via a worktree. It thus contains the per-worktree refs.
+	 */
+	struct reftable_backend worktree_backend;
+	/*
+	 * Map of worktree backends by their respective worktree names. The map
+	 * is populated lazily when we try to resolve `worktrees/$worktree` refs.
+	 */
+	struct strmap worktree_backends;
+	struct reftable_write_options write_options;
+	/*
+	 * Compactions that rewrite at least this many bytes are performed by
+	 * git-maintenance(1) when "reftable.autoCompaction" is "background".
+	 */
+	unsigned long background_compaction_threshold;
+
+	unsigned int store_flags;
+	enum log_refs_config log_all_ref_updates;
+	int err;
 };
 
 static void reftable_backend_on_reload(void *payload)
@@ -45,14 +80,78 @@ static void reftable_backend_on_reload(void *payload)
 	reftable_iterator_destroy(&be->it);
 }
 
+/*
+ * Compactions which rewrite fewer bytes than this are cheaper than spawning
+ * a separate process and are thus still performed by the writer itself.
+ */
+#define DEFAULT_BACKGROUND_COMPACTION_THRESHOLD (1024 * 1024)
+
+/*
+ * Compact the stack by spawning git-maintenance(1) so that the writer which
+ * noticed that the stack needs compaction does not have to wait for it. The
+ * maintenance lock ensures that concurrent writers spawn at most one such
+ * process at a time. If it is held already, the running maintenance may not
+ * get to the refs in time, so we compact the stack ourselves instead of
+ * letting tables pile up.
+ */
+static int reftable_backend_compact_in_background(void *payload, uint64_t bytes)
+{
+	struct reftable_backend *be = payload;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct lock_file lk = LOCK_INIT;
+	char *lock_path;
+	int locked, ret;
+
+	if (bytes < be->refs->background_compaction_threshold)
+		return 0;
+
+	lock_path = xstrfmt("%s/maintenance",
+			    repo_get_object_directory(be->refs->base.repo));
+	locked = hold_lock_file_for_update(&lk, lock_path, LOCK_NO_DEREF) >= 0;
+	if (locked)
+		rollback_lock_file(&lk);
+	free(lock_path);
+	if (!locked)
+		return 0;
+
+	/* Compact the stack ourselves if auto-maintenance is disabled. */
+	if (!prepare_auto_maintenance(be->refs->base.repo, 1, &cmd))
+		return 0;
+	strvec_push(&cmd.args, "--task=pack-refs");
+	prepare_other_repo_env(&cmd.env, be->gitdir);
+	cmd.no_stdin = 1;
+	cmd.stdout_to_stderr = 1;
+	/* We only touch refs, so there is no need to close packfiles. */
+	cmd.close_object_store = 0;
+
+	trace2_region_enter("reftable", "compact-in-background", NULL);
+	ret = run_command(&cmd);
+	trace2_region_leave("reftable", "compact-in-background", NULL);
+
+	/* Compact the stack ourselves if maintenance could not be run. */
+	return !ret;
+}
+
 static int reftable_backend_init(struct reftable_backend *be,
-				 const char *path,
-				 const struct reftable_write_options *_opts)
+				 struct reftable_ref_store *refs,
+				 const char *gitdir)
 {
-	struct reftable_write_options opts = *_opts;
+	struct reftable_write_options opts = refs->write_options;
+	struct strbuf path = STRBUF_INIT;
+	int ret;
+
 	opts.on_reload = reftable_backend_on_reload;
 	opts.on_reload_payload = be;
-	return reftable_new_stack(&be->stack, path, &opts);
+	if (opts.on_auto_compact)
+		opts.on_auto_compact_payload = be;
+
+	be->refs = refs;
+	be->gitdir = absolute_pathdup(gitdir);
+	strbuf_addf(&path, "%s/reftable", gitdir);
+	ret = reftable_new_stack(&be->stack, path.buf, &opts);
+
+	strbuf_release(&path);
+	return ret;
 }
 
 static void reftable_backend_release(struct reftable_backend *be)
@@ -60,6 +159,7 @@ static void reftable_backend_release(struct reftable_backend *be)
 	reftable_stack_destroy(be->stack);
 	be->stack = NULL;
 	reftable_iterator_destroy(&be->it);
+	FREE_AND_NULL(be->gitdir);
 }
 
 static int reftable_backend_read_ref(struct reftable_backend *be,
@@ -121,31 +221,6 @@ static int reftable_backend_read_ref(struct reftable_backend *be,
 	return ret;
 }
 
-struct reftable_ref_store {
-	struct ref_store base;
-
-	/*
-	 * The main backend refers to the common dir and thus contains common
-	 * refs as well as refs of the main repository.
-	 */
-	struct reftable_backend main_backend;
-	/*
-	 * The worktree backend refers to the gitdir in case the refdb is opened
-	 * via a worktree. It thus contains the per-worktree refs.
-	 */
-	struct reftable_backend worktree_backend;
-	/*
-	 * Map of worktree backends by their respective worktree names. The map
-	 * is populated lazily when we try to resolve `worktrees/$worktree` refs.
-	 */
-	struct strmap worktree_backends;
-	struct reftable_write_options write_options;
-
-	unsigned int store_flags;
-	enum log_refs_config log_all_ref_updates;
-	int err;
-};
-
 /*
  * Downcast ref_store to reftable_ref_store. Die if ref_store is not a
  * reftable_ref_store. required_flags is compared with ref_store's store_flags
@@ -224,12 +299,11 @@ static int backend_for(struct reftable_backend **out,
 		 */
 		be = strmap_get(&store->worktree_backends, wtname_buf.buf);
 		if (!be) {
-			strbuf_addf(&wt_dir, "%s/worktrees/%s/reftable",
+			strbuf_addf(&wt_dir, "%s/worktrees/%s",
 				    store->base.repo->commondir, wtname_buf.buf);
 
 			CALLOC_ARRAY(be, 1);
-			store->err = reftable_backend_init(be, wt_dir.buf,
-							   &store->write_options);
+			store->err = reftable_backend_init(be, store, wt_dir.buf);
 			assert(store->err != REFTABLE_API_ERROR);
 
 			strmap_put(&store->worktree_backends, wtname_buf.buf, be);
@@ -315,9 +389,10 @@ static void fill_reftable_log_record(struct reftable_log_record *log, const stru
 
 static int reftable_be_config(const char *var, const char *value,
 			      const struct config_context *ctx,
-			      void *_opts)
+			      void *_refs)
 {
-	struct reftable_write_options *opts = _opts;
+	struct reftable_ref_store *refs = _refs;
+	struct reftable_write_options *opts = &refs->write_options;
 
 	if (!strcmp(var, "reftable.blocksize")) {
 		unsigned long block_size = git_config_ulong(var, value, ctx->kvi);
@@ -336,6 +411,20 @@ static int reftable_be_config(const char *var, const char *value,
 		if (factor > UINT8_MAX)
 			die("reftable geometric factor cannot exceed %u", (unsigned)UINT8_MAX);
 		opts->auto_compaction_factor = factor;
+	} else if (!strcmp(var, "reftable.autocompaction")) {
+		int enabled = git_parse_maybe_bool(value);
+		if (enabled >= 0) {
+			opts->disable_auto_compact = !enabled;
+			opts->on_auto_compact = NULL;
+		} else if (value && !strcmp(value, "background")) {
+			opts->disable_auto_compact = 0;
+			opts->on_auto_compact = reftable_backend_compact_in_background;
+		} else {
+			die(_("invalid value for '%s': '%s'"), var, value);
+		}
+	} else if (!strcmp(var, "reftable.backgroundcompactionthreshold")) {
+		refs->background_compaction_threshold =
+			git_config_ulong(var, value, ctx->kvi);
 	} else if (!strcmp(var, "reftable.locktimeout")) {
 		int64_t lock_timeout = git_config_int64(var, value, ctx->kvi);
 		if (lock_timeout > LONG_MAX)
@@ -381,12 +470,15 @@ static struct ref_store *reftable_be_init(struct repository *repo,
 		BUG("unknown hash algorithm %d", repo->hash_algo->format_id);
 	}
 	refs->write_options.default_permissions = calc_shared_perm(0666 & ~mask);
-	refs->write_options.disable_auto_compact =
-		!git_env_bool("GIT_TEST_REFTABLE_AUTOCOMPACTION", 1);
 	refs->write_options.lock_timeout_ms = 100;
 	refs->write_options.fsync = reftable_be_fsync;
 
-	git_config(reftable_be_config, &refs->write_options);
+	refs->background_compaction_threshold = DEFAULT_BACKGROUND_COMPACTION_THRESHOLD;
+
+	git_config(reftable_be_config, refs);
+
+	if (!git_env_bool("GIT_TEST_REFTABLE_AUTOCOMPACTION", 1))
+		refs->write_options.disable_auto_compact = 1;
 
 	/*
 	 * It is somewhat unfortunate that we have to mirror the default block
@@ -410,9 +502,8 @@ static struct ref_store *reftable_be_init(struct repository *repo,
 		strbuf_reset(&path);
 		strbuf_realpath(&path, gitdir, 0);
 	}
-	strbuf_addstr(&path, "/reftable");
-	refs->err = reftable_backend_init(&refs->main_backend, path.buf,
-					  &refs->write_options);
+	refs->err = reftable_backend_init(&refs->main_backend, refs,
+					  path.buf);
 	if (refs->err)
 		goto done;
 
@@ -425,11 +516,8 @@ static struct ref_store *reftable_be_init(struct repository *repo,
 	 * do it efficiently.
 	 */
 	if (is_worktree) {
-		strbuf_reset(&path);
-		strbuf_addf(&path, "%s/reftable", gitdir);
-
-		refs->err = reftable_backend_init(&refs->worktree_backend, path.buf,
-						  &refs->write_options);
+		refs->err = reftable_backend_init(&refs->worktree_backend, refs,
+						  gitdir);
 		if (refs->err)
 			goto done;
 	}
@@ -1660,6 +1748,7 @@ static int reftable_be_pack_refs(struct ref_store *ref_store,
 {
 	struct reftable_ref_store *refs =
 		reftable_be_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB, "pack_refs");
+	struct reftable_compaction_stats *stats;
 	struct reftable_stack *stack;
 	int ret;
 
@@ -1685,6 +1774,15 @@ static int reftable_be_pack_refs(struct ref_store *ref_store,
 		goto out;
 
 out:
+	stats = reftable_stack_compaction_stats(stack);
+	trace2_data_intmax("reftable", ref_store->repo, "compaction-attempts",
+			   stats->attempts);
+	trace2_data_intmax("reftable", ref_store->repo, "compaction-failures",
+			   stats->failures);
+	trace2_data_intmax("reftable", ref_store->repo, "compaction-bytes",
+			   stats->bytes);
+	trace2_data_intmax("reftable", ref_store->repo, "compaction-entries",
+			   stats->entries_written);
 	return ret;
 }
 
@@ -0,0 +1,195 @@
+/*
+Copyright 2020 Google LLC
+
+Use of this source code is governed by a BSD-style
+license that can be found in the LICENSE file or at
+https://developers.google.com/open-source/licenses/bsd
+*/
+
+#include "system.h"
+#include "blockcache.h"
+
+#include "basics.h"
+#include "reftable-error.h"
+
+struct block_cache_entry {
+	const struct reftable_reader *r;
+	uint64_t off;
+	uint32_t full_block_size;
+	uint64_t last_used;
+
+	/*
+	 * One reference is held by the cache as long as the entry is cached,
+	 * and one by each block handed out by `block_cache_get()`.
+	 */
+	uint64_t refcount;
+
+	uint8_t *data;
+	size_t len;
+};
+
+struct block_cache {
+	struct block_cache_entry **entries;
+	size_t entries_len;
+	size_t entries_alloc;
+
+	size_t bytes;
+	size_t max_bytes;
+
+	/* Incremented on every hit to track which entry was used last. */
+	uint64_t clock;
+	uint64_t refcount;
+};
+
+static void block_cache_entry_decref(struct block_cache_entry *e)
+{
+	if (--e->refcount)
+		return;
+	reftable_free(e->data);
+	reftable_free(e);
+}
+
+static void block_cache_return_block(void *arg,
+				     struct reftable_block *block UNUSED)
+{
+	block_cache_entry_decref(arg);
+}
+
+/*
+ * Cached blocks are handed out with this source, which only knows how to
+ * give the block back.
+ */
+static struct reftable_block_source_vtable block_cache_vtable = {
+	.return_block = &block_cache_return_block,
+};
+
+int block_cache_new(struct block_cache **out, size_t max_bytes)
+{
+	struct block_cache *cache;
+
+	REFTABLE_CALLOC_ARRAY(cache, 1);
+	if (!cache)
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
+	cache->max_bytes = max_bytes;
+	cache->refcount = 1;
+
+	*out = cache;
+	return 0;
+}
+
+void block_cache_incref(struct block_cache *cache)
+{
+	if (!cache->refcount)
+		BUG("cannot increment ref counter of dead block cache");
+	cache->refcount++;
+}
+
+static void block_cache_remove(struct block_cache *cache, size_t i)
+{
+	struct block_cache_entry *e = cache->entries[i];
+
+	cache->bytes -= e->len;
+	cache->entries[i] = cache->entries[--cache->entries_len];
+	block_cache_entry_decref(e);
+}
+
+void block_cache_decref(struct block_cache *cache)
+{
+	if (!cache)
+		return;
+	if (!cache->refcount)
+		BUG("cannot decrement ref counter of dead block cache");
+	if (--cache->refcount)
+		return;
+
+	while (cache->entries_len)
+		block_cache_remove(cache, cache->entries_len - 1);
+	reftable_free(cache->entries);
+	reftable_free(cache);
+}
+
+int block_cache_get(struct block_cache *cache, const struct reftable_reader *r,
+		    uint64_t off, struct reftable_block *dest,
+		    uint32_t *full_block_size)
+{
+	/*
+	 * The cache only ever holds a couple hundred blocks, which makes a
+	 * linear scan cheap compared to inflating a block.
+	 */
+	for (size_t i = 0; i < cache->entries_len; i++) {
+		struct block_cache_entry *e = cache->entries[i];
+
+		if (e->r != r || e->off != off)
+			continue;
+
+		e->last_used = ++cache->clock;
+		e->refcount++;
+
+		dest->data = e->data;
+		dest->len = e->len;
+		dest->source.ops = &block_cache_vtable;
+		dest->source.arg = e;
+		*full_block_size = e->full_block_size;
+		return 1;
+	}
+
+	return 0;
+}
+
+int block_cache_put(struct block_cache *cache, const struct reftable_reader *r,
+		    uint64_t off, const struct reftable_block *block,
+		    uint32_t full_block_size)
+{
+	struct block_cache_entry *e;
+
+	if (block->len > cache->max_bytes)
+		return 0;
+
+	while (cache->bytes + block->len > cache->max_bytes) {
+		size_t lru = 0;
+
+		for (size_t i = 1; i < cache->entries_len; i++)
+			if (cache->entries[i]->last_used <
+			    cache->entries[lru]->last_used)
+				lru = i;
+		block_cache_remove(cache, lru);
+	}
+
+	REFTABLE_ALLOC_GROW(cache->entries, cache->entries_len + 1,
+			    cache->entries_alloc);
+	if (!cache->entries) {
+		cache->entries_len = cache->entries_alloc = 0;
+		cache->bytes = 0;
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
+	}
+
+	REFTABLE_CALLOC_ARRAY(e, 1);
+	if (!e)
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
+	REFTABLE_ALLOC_ARRAY(e->data, block->len);
+	if (!e->data) {
+		reftable_free(e);
+		return REFTABLE_OUT_OF_MEMORY_ERROR;
+	}
+	memcpy(e->data, block->data, block->len);
+	e->len = block->len;
+	e->r = r;
+	e->off = off;
+	e->full_block_size = full_block_size;
+	e->last_used = ++cache->clock;
+	e->refcount = 1;
+
+	cache->entries[cache->entries_len++] = e;
+	cache->bytes += e->len;
+	return 0;
+}
+
+void block_cache_drop_reader(struct block_cache *cache,
+			     const struct reftable_reader *r)
+{
+	size_t i = cache->entries_len;
+
+	while (i--)
+		if (cache->entries[i]->r == r)
+			block_cache_remove(cache, i);
+}
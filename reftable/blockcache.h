@@ -0,0 +1,57 @@
+/*
+Copyright 2020 Google LLC
+
+Use of this source code is governed by a BSD-style
+license that can be found in the LICENSE file or at
+https://developers.google.com/open-source/licenses/bsd
+*/
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "system.h"
+#include "reftable-blocksource.h"
+
+struct reftable_reader;
+
+/*
+ * A size-bounded cache of decompressed blocks. Inflating a log block is by far
+ * the most expensive part of seeking to it, and callers tend to repeatedly
+ * seek into the same blocks, e.g. when reading the reflogs of many refs in
+ * order. The cache is shared by all readers of a stack so that it stays warm
+ * across reloads of the stack.
+ *
+ * The cache is reference counted: each reader using it holds a reference.
+ */
+struct block_cache;
+
+/* Create a new cache that holds at most `max_bytes` of block data. */
+int block_cache_new(struct block_cache **out, size_t max_bytes);
+
+void block_cache_incref(struct block_cache *cache);
+void block_cache_decref(struct block_cache *cache);
+
+/*
+ * Look up the block at offset `off` of reader `r`. On a hit, `dest` is set up
+ * to refer to the cached data, and must be returned with
+ * `reftable_block_done()` once no longer used. `full_block_size` is set to
+ * the size of the block in the file. Returns 1 on a hit, 0 otherwise.
+ */
+int block_cache_get(struct block_cache *cache, const struct reftable_reader *r,
+		    uint64_t off, struct reftable_block *dest,
+		    uint32_t *full_block_size);
+
+/*
+ * Store a copy of the decompressed block at offset `off` of reader `r`,
+ * evicting the least recently used blocks as needed. Blocks larger than the
+ * cache are not stored.
+ */
+int block_cache_put(struct block_cache *cache, const struct reftable_reader *r,
+		    uint64_t off, const struct reftable_block *block,
+		    uint32_t full_block_size);
+
+/* Drop all blocks of reader `r`, which is about to be released. */
+void block_cache_drop_reader(struct block_cache *cache,
+			     const struct reftable_reader *r);
+
+#endif
@@ -10,6 +10,7 @@ license that can be found in the LICENSE file or at
 
 #include "system.h"
 #include "block.h"
+#include "blockcache.h"
 #include "constants.h"
 #include "iter.h"
 #include "record.h"
@@ -171,6 +172,14 @@ struct table_iter {
 	struct block_reader br;
 	struct block_iter bi;
 	int is_finished;
+
+	/*
+	 * The last key of the current block, as found in the index when
+	 * seeking to the block. This allows subsequent seeks to keys that are
+	 * contained in the same block to skip walking the index.
+	 */
+	struct reftable_buf block_last_key;
+	int block_last_key_valid;
 };
 
 static int table_iter_init(struct table_iter *ti, struct reftable_reader *r)
@@ -226,10 +235,26 @@ int reader_init_block_reader(struct reftable_reader *r, struct block_reader *br,
 	int err = 0;
 	uint32_t header_off = next_off ? 0 : header_size(r->version);
 	int32_t block_size = 0;
+	uint32_t full_block_size;
 
 	if (next_off >= r->size)
 		return 1;
 
+	if (r->block_cache &&
+	    block_cache_get(r->block_cache, r, next_off, &block,
+			    &full_block_size)) {
+		if (want_typ != BLOCK_TYPE_ANY &&
+		    block.data[header_off] != want_typ) {
+			err = 1;
+			goto done;
+		}
+
+		err = block_reader_init_decompressed(br, &block, header_off,
+						     full_block_size,
+						     hash_size(r->hash_id));
+		goto done;
+	}
+
 	err = reader_get_block(r, &block, next_off, guess_block_size);
 	if (err < 0)
 		goto done;
@@ -255,6 +280,16 @@ int reader_init_block_reader(struct reftable_reader *r, struct block_reader *br,
 
 	err = block_reader_init(br, &block, header_off, r->block_size,
 				hash_size(r->hash_id));
+	if (err < 0)
+		goto done;
+
+	/*
+	 * Only log blocks are compressed. All other blocks are read straight
+	 * from the block source, so there is nothing to gain by caching them.
+	 */
+	if (r->block_cache && block_typ == BLOCK_TYPE_LOG)
+		err = block_cache_put(r->block_cache, r, next_off, &br->block,
+				      br->full_block_size);
 done:
 	reftable_block_done(&block);
 
@@ -265,6 +300,7 @@ static void table_iter_close(struct table_iter *ti)
 {
 	table_iter_block_done(ti);
 	block_iter_close(&ti->bi);
+	reftable_buf_release(&ti->block_last_key);
 	reftable_reader_decref(ti->r);
 }
 
@@ -273,6 +309,7 @@ static int table_iter_next_block(struct table_iter *ti)
 	uint64_t next_block_off = ti->block_off + ti->br.full_block_size;
 	int err;
 
+	ti->block_last_key_valid = 0;
 	err = reader_init_block_reader(ti->r, &ti->br, next_block_off, ti->typ);
 	if (err > 0)
 		ti->is_finished = 1;
@@ -323,6 +360,7 @@ static int table_iter_seek_to(struct table_iter *ti, uint64_t off, uint8_t typ)
 {
 	int err;
 
+	ti->block_last_key_valid = 0;
 	err = reader_init_block_reader(ti->r, &ti->br, off, typ);
 	if (err != 0)
 		return err;
@@ -492,7 +530,13 @@ static int table_iter_seek_indexed(struct table_iter *ti,
 			goto done;
 
 		if (ti->typ == reftable_record_type(rec)) {
-			err = 0;
+			reftable_buf_reset(&ti->block_last_key);
+			err = reftable_buf_add(&ti->block_last_key,
+					       index_result.u.idx.last_key.buf,
+					       index_result.u.idx.last_key.len);
+			if (err < 0)
+				goto done;
+			ti->block_last_key_valid = 1;
 			break;
 		}
 
@@ -508,6 +552,44 @@ static int table_iter_seek_indexed(struct table_iter *ti,
 	return err;
 }
 
+/*
+ * Seek to `want` in the current block, provided that it must be contained in
+ * it. Returns 1 if the key may be in a different block.
+ */
+static int table_iter_seek_in_block(struct table_iter *ti,
+				    struct reftable_record *want)
+{
+	struct reftable_buf want_key = REFTABLE_BUF_INIT;
+	struct reftable_buf first_key = REFTABLE_BUF_INIT;
+	int err;
+
+	err = reftable_record_key(want, &want_key);
+	if (err < 0)
+		goto done;
+	if (reftable_buf_cmp(&want_key, &ti->block_last_key) > 0) {
+		err = 1;
+		goto done;
+	}
+
+	err = block_reader_first_key(&ti->br, &first_key);
+	if (err < 0)
+		goto done;
+	if (reftable_buf_cmp(&want_key, &first_key) < 0) {
+		err = 1;
+		goto done;
+	}
+
+	err = block_iter_seek_key(&ti->bi, &ti->br, &want_key);
+	if (err < 0)
+		goto done;
+	ti->is_finished = 0;
+
+done:
+	reftable_buf_release(&want_key);
+	reftable_buf_release(&first_key);
+	return err;
+}
+
 static int table_iter_seek(struct table_iter *ti,
 			   struct reftable_record *want)
 {
@@ -515,6 +597,17 @@ static int table_iter_seek(struct table_iter *ti,
 	struct reftable_reader_offsets *offs = reader_offsets_for(ti->r, typ);
 	int err;
 
+	/*
+	 * Callers often seek to keys in ascending order, e.g. when looking up
+	 * many references or iterating over many prefixes. Avoid going through
+	 * the index when the wanted key is in the block we are already at.
+	 */
+	if (ti->block_last_key_valid && ti->typ == typ) {
+		err = table_iter_seek_in_block(ti, want);
+		if (err <= 0)
+			return err;
+	}
+
 	err = table_iter_seek_start(ti, reftable_record_type(want),
 				    !!offs->index_offset);
 	if (err < 0)
@@ -683,11 +776,26 @@ void reftable_reader_decref(struct reftable_reader *r)
 		BUG("cannot decrement ref counter of dead reader");
 	if (--r->refcount)
 		return;
+	if (r->block_cache) {
+		block_cache_drop_reader(r->block_cache, r);
+		block_cache_decref(r->block_cache);
+	}
 	block_source_close(&r->source);
 	REFTABLE_FREE_AND_NULL(r->name);
 	reftable_free(r);
 }
 
+void reader_set_block_cache(struct reftable_reader *r,
+			    struct block_cache *cache)
+{
+	if (r->block_cache) {
+		block_cache_drop_reader(r->block_cache, r);
+		block_cache_decref(r->block_cache);
+	}
+	block_cache_incref(cache);
+	r->block_cache = cache;
+}
+
 static int reftable_reader_refs_for_indexed(struct reftable_reader *r,
 					    struct reftable_iterator *it,
 					    uint8_t *oid)
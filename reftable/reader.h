@@ -21,6 +21,8 @@ int block_source_read_block(struct reftable_block_source *source,
 			    uint32_t size);
 void block_source_close(struct reftable_block_source *source);
 
+struct block_cache;
+
 /* metadata for a block type */
 struct reftable_reader_offsets {
 	int is_present;
@@ -52,6 +54,9 @@ struct reftable_reader {
 	struct reftable_reader_offsets log_offsets;
 
 	uint64_t refcount;
+
+	/* Cache of decompressed blocks, shared by the readers of a stack. */
+	struct block_cache *block_cache;
 };
 
 const char *reader_name(struct reftable_reader *r);
@@ -60,6 +65,10 @@ int reader_init_iter(struct reftable_reader *r,
 		     struct reftable_iterator *it,
 		     uint8_t typ);
 
+/* Make `r` cache decompressed blocks in `cache`. */
+void reader_set_block_cache(struct reftable_reader *r,
+			    struct block_cache *cache);
+
 /* initialize a block reader to read from `r` */
 int reader_init_block_reader(struct reftable_reader *r, struct block_reader *br,
 			     uint64_t next_off, uint8_t want_typ);
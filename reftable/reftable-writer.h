@@ -77,6 +77,21 @@ struct reftable_write_options {
 	 */
 	void (*on_reload)(void *payload);
 	void *on_reload_payload;
+
+	/*
+	 * Optional callback function to execute when the stack needs to be
+	 * auto-compacted after an addition has been committed. It receives the
+	 * number of bytes the compaction would have to rewrite, and allows
+	 * the caller to perform expensive compactions out of band, e.g. in a
+	 * separate process, so that writers do not have to wait for them. If
+	 * the callback returns 0, the stack is compacted as usual. It is not
+	 * called when the stack has grown to more than twice the number of
+	 * tables auto-compaction would leave, which is then compacted by the
+	 * writer so that tables cannot pile up. Has no effect when
+	 * `disable_auto_compact` is set.
+	 */
+	int (*on_auto_compact)(void *payload, uint64_t bytes);
+	void *on_auto_compact_payload;
 };
 
 /* reftable_block_stats holds statistics for a single block type */
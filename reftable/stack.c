@@ -9,6 +9,7 @@ license that can be found in the LICENSE file or at
 #include "stack.h"
 
 #include "system.h"
+#include "blockcache.h"
 #include "constants.h"
 #include "merged.h"
 #include "reader.h"
@@ -28,6 +29,10 @@ static int stack_write_compact(struct reftable_stack *st,
 static void reftable_addition_close(struct reftable_addition *add);
 static int reftable_stack_reload_maybe_reuse(struct reftable_stack *st,
 					     int reuse_open);
+static int stack_auto_compaction_segment(struct reftable_stack *st,
+					 struct segment *seg);
+static int segment_size(struct segment *s);
+static int stack_is_overgrown(struct reftable_stack *st);
 
 static int stack_filename(struct reftable_buf *dest, struct reftable_stack *st,
 			  const char *name)
@@ -100,6 +105,10 @@ int reftable_new_stack(struct reftable_stack **dest, const char *dir,
 		goto out;
 	}
 
+	err = block_cache_new(&p->block_cache, DEFAULT_BLOCK_CACHE_SIZE);
+	if (err < 0)
+		goto out;
+
 	err = reftable_stack_reload_maybe_reuse(p, 1);
 	if (err < 0)
 		goto out;
@@ -248,6 +257,7 @@ void reftable_stack_destroy(struct reftable_stack *st)
 		st->list_fd = -1;
 	}
 
+	block_cache_decref(st->block_cache);
 	REFTABLE_FREE_AND_NULL(st->list_file);
 	REFTABLE_FREE_AND_NULL(st->reftable_dir);
 	reftable_free(st);
@@ -343,6 +353,7 @@ static int reftable_stack_reload_once(struct reftable_stack *st,
 			err = reftable_reader_new(&rd, &src, name);
 			if (err < 0)
 				goto done;
+			reader_set_block_cache(rd, st->block_cache);
 		}
 
 		new_readers[new_readers_len] = rd;
@@ -803,20 +814,38 @@ int reftable_addition_commit(struct reftable_addition *add)
 	if (err)
 		goto done;
 
-	if (!add->stack->opts.disable_auto_compact) {
+	if (add->stack->opts.disable_auto_compact)
+		goto done;
+
+	if (add->stack->opts.on_auto_compact &&
+	    !stack_is_overgrown(add->stack)) {
 		/*
-		 * Auto-compact the stack to keep the number of tables in
-		 * control. It is possible that a concurrent writer is already
-		 * trying to compact parts of the stack, which would lead to a
-		 * `REFTABLE_LOCK_ERROR` because parts of the stack are locked
-		 * already. This is a benign error though, so we ignore it.
+		 * The caller may want to compact the stack out of band so that
+		 * this writer does not have to wait for the compaction.
 		 */
-		err = reftable_stack_auto_compact(add->stack);
-		if (err < 0 && err != REFTABLE_LOCK_ERROR)
+		struct segment seg;
+
+		err = stack_auto_compaction_segment(add->stack, &seg);
+		if (err < 0)
+			goto done;
+		if (!segment_size(&seg) ||
+		    add->stack->opts.on_auto_compact(add->stack->opts.on_auto_compact_payload,
+						     seg.bytes))
 			goto done;
-		err = 0;
 	}
 
+	/*
+	 * Auto-compact the stack to keep the number of tables in control. It
+	 * is possible that a concurrent writer is already trying to compact
+	 * parts of the stack, which would lead to a `REFTABLE_LOCK_ERROR`
+	 * because parts of the stack are locked already. This is a benign
+	 * error though, so we ignore it.
+	 */
+	err = reftable_stack_auto_compact(add->stack);
+	if (err < 0 && err != REFTABLE_LOCK_ERROR)
+		goto done;
+	err = 0;
+
 done:
 	reftable_addition_close(add);
 	return err;
@@ -1626,11 +1655,16 @@ static uint64_t *stack_table_sizes_for_compaction(struct reftable_stack *st)
 	return sizes;
 }
 
-int reftable_stack_auto_compact(struct reftable_stack *st)
+/*
+ * Compute the range of tables that auto-compaction would merge. The segment
+ * is empty in case the stack does not need to be compacted.
+ */
+static int stack_auto_compaction_segment(struct reftable_stack *st,
+					 struct segment *seg)
 {
-	struct segment seg;
 	uint64_t *sizes;
 
+	memset(seg, 0, sizeof(*seg));
 	if (st->merged->readers_len < 2)
 		return 0;
 
@@ -1638,10 +1672,53 @@ int reftable_stack_auto_compact(struct reftable_stack *st)
 	if (!sizes)
 		return REFTABLE_OUT_OF_MEMORY_ERROR;
 
-	seg = suggest_compaction_segment(sizes, st->merged->readers_len,
-					 st->opts.auto_compaction_factor);
+	*seg = suggest_compaction_segment(sizes, st->merged->readers_len,
+					  st->opts.auto_compaction_factor);
 	reftable_free(sizes);
 
+	return 0;
+}
+
+/*
+ * A stack whose tables each are at least `factor` times as large as the next
+ * one holds about log_factor(total size / size of the smallest table) tables.
+ * Report whether the stack has grown to more than twice that many, e.g.
+ * because out-of-band compaction does not keep up with the writers.
+ */
+static int stack_is_overgrown(struct reftable_stack *st)
+{
+	uint8_t factor = st->opts.auto_compaction_factor;
+	uint64_t total = 0, smallest = UINT64_MAX, ratio;
+	size_t expected = 1;
+
+	if (!factor)
+		factor = DEFAULT_GEOMETRIC_FACTOR;
+
+	for (size_t i = 0; i < st->merged->readers_len; i++) {
+		uint64_t size = st->readers[i]->size;
+
+		total += size;
+		if (size < smallest)
+			smallest = size;
+	}
+	if (!total || !smallest)
+		return 0;
+
+	for (ratio = total / smallest; ratio >= factor; ratio /= factor)
+		expected++;
+
+	return st->merged->readers_len > 2 * expected;
+}
+
+int reftable_stack_auto_compact(struct reftable_stack *st)
+{
+	struct segment seg;
+	int err;
+
+	err = stack_auto_compaction_segment(st, &seg);
+	if (err < 0)
+		return err;
+
 	if (segment_size(&seg) > 0)
 		return stack_compact_range(st, seg.start, seg.end - 1,
 					   NULL, STACK_COMPACT_RANGE_BEST_EFFORT);
@@ -26,6 +26,9 @@ struct reftable_stack {
 	size_t readers_len;
 	struct reftable_merged_table *merged;
 	struct reftable_compaction_stats stats;
+
+	/* Decompressed blocks, shared by all readers of the stack. */
+	struct block_cache *block_cache;
 };
 
 int read_lines(const char *filename, char ***lines);
@@ -0,0 +1,547 @@
+#include "git-compat-util.h"
+#include "rename-cache.h"
+#include "chunk-format.h"
+#include "config.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "hash.h"
+#include "lockfile.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "repository.h"
+#include "thread-utils.h"
+#include "trace2.h"
+
+/*
+ * The rename cache file is a chunk-format file:
+ *
+ *   - a header of 4 bytes of signature "RNMC", one byte of version (1),
+ *     one byte of hash version (see oid_version()), one byte with the
+ *     number of chunks and one reserved byte,
+ *
+ *   - the table of contents of the chunks,
+ *
+ *   - "RCFO": 256 4-byte entries, the number of pairs whose source
+ *     object name starts with a byte lower or equal to the index,
+ *
+ *   - "RCPR": the pairs of (source, destination) blob object names,
+ *     sorted,
+ *
+ *   - "RCDT": for each pair, the 4-byte similarity score followed by the
+ *     4-byte generation of the file it was first written to, both in
+ *     network order. The generation is used to evict the oldest scores
+ *     first,
+ *
+ *   - the checksum of all of the above.
+ */
+#define RENAME_CACHE_SIGNATURE 0x524e4d43 /* "RNMC" */
+#define RENAME_CACHE_VERSION 1
+#define RENAME_CACHE_HEADER_SIZE 8
+#define RENAME_CACHE_CHUNKID_FANOUT 0x5243464f /* "RCFO" */
+#define RENAME_CACHE_CHUNKID_PAIRS 0x52435052 /* "RCPR" */
+#define RENAME_CACHE_CHUNKID_DATA 0x52434454 /* "RCDT" */
+#define RENAME_CACHE_FANOUT_SIZE (4 * 256)
+#define RENAME_CACHE_DATA_WIDTH 8
+
+#define DEFAULT_RENAME_CACHE_MAX_ENTRIES 262144
+
+/*
+ * Computing a score means reading and hashing two blobs, which costs
+ * much more than copying an entry when rewriting the file: only rewrite
+ * it once the new scores are more than 1/RENAME_CACHE_WRITE_RATIO of it.
+ */
+#define RENAME_CACHE_WRITE_RATIO 64
+
+struct rename_cache_entry {
+	struct object_id src, dst;
+	uint32_t score, generation;
+};
+
+static struct rename_cache {
+	struct repository *repo;
+	int initialized;
+	int max_entries;
+	int active;
+
+	/* the cache file, if any */
+	void *map;
+	size_t map_size;
+	const unsigned char *fanout;
+	const unsigned char *pairs;
+	const unsigned char *data;
+	uint32_t nr;
+
+	/* sorted scores not in the file yet */
+	struct rename_cache_entry *pending;
+	size_t pending_nr, pending_alloc;
+
+	/* scores added since the last flush, protected by the mutex */
+	struct rename_cache_entry *added;
+	size_t added_nr, added_alloc;
+	pthread_mutex_t mutex;
+} rename_cache;
+
+static char *rename_cache_path(struct repository *r)
+{
+	return xstrfmt("%s/info/rename-cache", r->objects->odb->path);
+}
+
+static void unload_rename_cache_file(struct rename_cache *c)
+{
+	if (c->map)
+		munmap(c->map, c->map_size);
+	c->map = NULL;
+	c->map_size = 0;
+	c->fanout = c->pairs = c->data = NULL;
+	c->nr = 0;
+}
+
+static int load_rename_cache_file(struct rename_cache *c)
+{
+	char *path = rename_cache_path(c->repo);
+	const unsigned char *data;
+	struct chunkfile *cf = NULL;
+	size_t fanout_size, pairs_size, data_size;
+	size_t pair_width = 2 * c->repo->hash_algo->rawsz;
+	struct stat st;
+	int i, fd, ret = -1;
+
+	unload_rename_cache_file(c);
+
+	fd = git_open(path);
+	if (fd < 0) {
+		free(path);
+		return 0;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		free(path);
+		return 0;
+	}
+	c->map_size = xsize_t(st.st_size);
+	if (c->map_size < RENAME_CACHE_HEADER_SIZE + 4 * CHUNK_TOC_ENTRY_SIZE +
+			  RENAME_CACHE_FANOUT_SIZE + c->repo->hash_algo->rawsz) {
+		close(fd);
+		c->map_size = 0;
+		error(_("rename cache file '%s' is too small"), path);
+		free(path);
+		return -1;
+	}
+	c->map = xmmap(NULL, c->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = c->map;
+
+	if (get_be32(data) != RENAME_CACHE_SIGNATURE ||
+	    data[4] != RENAME_CACHE_VERSION ||
+	    data[5] != oid_version(c->repo->hash_algo)) {
+		error(_("rename cache file '%s' has an unknown format"), path);
+		goto out;
+	}
+
+	cf = init_chunkfile(NULL);
+	if (read_table_of_contents(cf, data, c->map_size,
+				   RENAME_CACHE_HEADER_SIZE, data[6], 1))
+		goto out;
+	if (pair_chunk(cf, RENAME_CACHE_CHUNKID_FANOUT, &c->fanout, &fanout_size) ||
+	    pair_chunk(cf, RENAME_CACHE_CHUNKID_PAIRS, &c->pairs, &pairs_size) ||
+	    pair_chunk(cf, RENAME_CACHE_CHUNKID_DATA, &c->data, &data_size) ||
+	    fanout_size != RENAME_CACHE_FANOUT_SIZE ||
+	    pairs_size % pair_width ||
+	    data_size % RENAME_CACHE_DATA_WIDTH ||
+	    pairs_size / pair_width != data_size / RENAME_CACHE_DATA_WIDTH ||
+	    get_be32(c->fanout + 4 * 255) != pairs_size / pair_width) {
+		error(_("rename cache file '%s' is corrupt"), path);
+		goto out;
+	}
+	c->nr = pairs_size / pair_width;
+	for (i = 1; i < 256; i++) {
+		if (get_be32(c->fanout + 4 * (i - 1)) >
+		    get_be32(c->fanout + 4 * i)) {
+			error(_("rename cache file '%s' has fanout values out of order"),
+			      path);
+			goto out;
+		}
+	}
+	ret = 0;
+
+out:
+	free_chunkfile(cf);
+	free(path);
+	if (ret)
+		unload_rename_cache_file(c);
+	return ret;
+}
+
+int rename_cache_prepare(struct repository *r, uint64_t nr_pairs)
+{
+	struct rename_cache *c = &rename_cache;
+	int enabled = 0;
+
+	if (!c->initialized) {
+		c->initialized = 1;
+		if (repo_config_get_bool(r, "diff.renamecache", &enabled) ||
+		    !enabled)
+			return 0;
+		if (repo_config_get_int(r, "diff.renamecachemaxentries",
+					&c->max_entries))
+			c->max_entries = DEFAULT_RENAME_CACHE_MAX_ENTRIES;
+		if (c->max_entries < 0)
+			c->max_entries = 0;
+
+		c->repo = r;
+		pthread_mutex_init(&c->mutex, NULL);
+		load_rename_cache_file(c);
+	}
+
+	/*
+	 * Most of the scores would be evicted before being used again, and
+	 * looking all of them up would cost more than it saves.
+	 */
+	c->active = c->repo == r && nr_pairs <= (uint64_t)c->max_entries;
+	return c->active;
+}
+
+static int entry_cmp(const void *a_, const void *b_)
+{
+	const struct rename_cache_entry *a = a_, *b = b_;
+	int cmp = oidcmp(&a->src, &b->src);
+
+	return cmp ? cmp : oidcmp(&a->dst, &b->dst);
+}
+
+static int lookup_rename_cache_file(struct rename_cache *c,
+				    const struct object_id *src,
+				    const struct object_id *dst)
+{
+	size_t rawsz = c->repo->hash_algo->rawsz;
+	uint32_t lo, hi;
+
+	if (!c->nr)
+		return -1;
+	lo = src->hash[0] ? get_be32(c->fanout + 4 * (src->hash[0] - 1)) : 0;
+	hi = get_be32(c->fanout + 4 * src->hash[0]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *pair = c->pairs + mi * 2 * rawsz;
+		int cmp = memcmp(src->hash, pair, rawsz);
+
+		if (!cmp)
+			cmp = memcmp(dst->hash, pair + rawsz, rawsz);
+		if (!cmp)
+			return get_be32(c->data + mi * RENAME_CACHE_DATA_WIDTH);
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+static int lookup_pending(struct rename_cache *c,
+			  const struct object_id *src,
+			  const struct object_id *dst)
+{
+	size_t lo = 0, hi = c->pending_nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		struct rename_cache_entry *e = &c->pending[mi];
+		int cmp = oidcmp(src, &e->src);
+
+		if (!cmp)
+			cmp = oidcmp(dst, &e->dst);
+		if (!cmp)
+			return e->score;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+int rename_cache_lookup(struct repository *r,
+			const struct object_id *src,
+			const struct object_id *dst)
+{
+	struct rename_cache *c = &rename_cache;
+	int score;
+
+	if (!c->active || c->repo != r)
+		return -1;
+
+	score = lookup_rename_cache_file(c, src, dst);
+	if (score < 0)
+		score = lookup_pending(c, src, dst);
+	return score;
+}
+
+void rename_cache_add(struct repository *r,
+		      const struct object_id *src,
+		      const struct object_id *dst,
+		      int score)
+{
+	struct rename_cache *c = &rename_cache;
+	struct rename_cache_entry *e;
+
+	if (!c->active || c->repo != r)
+		return;
+
+	pthread_mutex_lock(&c->mutex);
+	/* more would be evicted when writing them anyway */
+	if (c->added_nr < (size_t)c->max_entries) {
+		ALLOC_GROW(c->added, c->added_nr + 1, c->added_alloc);
+		e = &c->added[c->added_nr++];
+		oidcpy(&e->src, src);
+		oidcpy(&e->dst, dst);
+		e->score = score;
+		e->generation = 0;
+	}
+	pthread_mutex_unlock(&c->mutex);
+}
+
+static int uint32_desc_cmp(const void *a_, const void *b_)
+{
+	uint32_t a = *(const uint32_t *)a_, b = *(const uint32_t *)b_;
+
+	return a > b ? -1 : a < b;
+}
+
+struct rename_cache_write {
+	struct rename_cache_entry *entries;
+	size_t nr;
+	size_t rawsz;
+};
+
+static int write_fanout_chunk(struct hashfile *f, void *data)
+{
+	struct rename_cache_write *w = data;
+	size_t i = 0;
+	int byte;
+
+	for (byte = 0; byte < 256; byte++) {
+		while (i < w->nr && w->entries[i].src.hash[0] == byte)
+			i++;
+		hashwrite_be32(f, i);
+	}
+	return 0;
+}
+
+static int write_pairs_chunk(struct hashfile *f, void *data)
+{
+	struct rename_cache_write *w = data;
+	size_t i;
+
+	for (i = 0; i < w->nr; i++) {
+		hashwrite(f, w->entries[i].src.hash, w->rawsz);
+		hashwrite(f, w->entries[i].dst.hash, w->rawsz);
+	}
+	return 0;
+}
+
+static int write_data_chunk(struct hashfile *f, void *data)
+{
+	struct rename_cache_write *w = data;
+	size_t i;
+
+	for (i = 0; i < w->nr; i++) {
+		hashwrite_be32(f, w->entries[i].score);
+		hashwrite_be32(f, w->entries[i].generation);
+	}
+	return 0;
+}
+
+/*
+ * Keep the "max" entries written last, dropping the oldest generations
+ * first. The order of the entries is kept.
+ */
+static void evict_oldest(struct rename_cache_write *w, size_t max)
+{
+	uint32_t *generations, cutoff;
+	size_t i, j, nr_at_cutoff;
+
+	if (w->nr <= max)
+		return;
+	if (!max) {
+		w->nr = 0;
+		return;
+	}
+
+	ALLOC_ARRAY(generations, w->nr);
+	for (i = 0; i < w->nr; i++)
+		generations[i] = w->entries[i].generation;
+	QSORT(generations, w->nr, uint32_desc_cmp);
+	cutoff = generations[max - 1];
+	for (i = nr_at_cutoff = 0; i < max; i++)
+		if (generations[i] == cutoff)
+			nr_at_cutoff++;
+	free(generations);
+
+	for (i = j = 0; i < w->nr; i++) {
+		struct rename_cache_entry *e = &w->entries[i];
+
+		if (e->generation < cutoff)
+			continue;
+		if (e->generation == cutoff) {
+			if (!nr_at_cutoff)
+				continue;
+			nr_at_cutoff--;
+		}
+		w->entries[j++] = *e;
+	}
+	w->nr = j;
+}
+
+/*
+ * Rewrite the cache file with its current entries and the pending ones,
+ * without the pairs of missing blobs if "prune" is set.
+ */
+static int write_rename_cache(struct rename_cache *c, int prune)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct rename_cache_write w = { 0 };
+	struct hashfile *f;
+	struct chunkfile *cf;
+	char *path = rename_cache_path(c->repo);
+	size_t rawsz = c->repo->hash_algo->rawsz;
+	uint32_t generation = 0;
+	size_t i, j;
+	int corrupt, ret = 0;
+
+	if (hold_lock_file_for_update(&lk, path, 0) < 0) {
+		/* somebody else is writing it; try again later */
+		free(path);
+		return 0;
+	}
+
+	/* it may have been rewritten since we read it */
+	corrupt = load_rename_cache_file(c) < 0;
+
+	w.rawsz = rawsz;
+	ALLOC_ARRAY(w.entries, st_add(c->nr, c->pending_nr));
+	for (i = 0; i < c->nr; i++) {
+		struct rename_cache_entry *e = &w.entries[w.nr++];
+
+		oidread(&e->src, c->pairs + i * 2 * rawsz, c->repo->hash_algo);
+		oidread(&e->dst, c->pairs + i * 2 * rawsz + rawsz,
+			c->repo->hash_algo);
+		e->score = get_be32(c->data + i * RENAME_CACHE_DATA_WIDTH);
+		e->generation = get_be32(c->data + i * RENAME_CACHE_DATA_WIDTH + 4);
+		if (generation < e->generation)
+			generation = e->generation;
+	}
+	for (i = 0; i < c->pending_nr; i++) {
+		w.entries[w.nr] = c->pending[i];
+		w.entries[w.nr++].generation = generation + 1;
+	}
+	QSORT(w.entries, w.nr, entry_cmp);
+
+	for (i = j = 0; i < w.nr; i++) {
+		struct rename_cache_entry *e = &w.entries[i];
+
+		/* another process may have written the same pair */
+		if (j && !entry_cmp(e, &w.entries[j - 1]))
+			continue;
+		if (prune &&
+		    (!has_object(c->repo, &e->src, 0) ||
+		     !has_object(c->repo, &e->dst, 0)))
+			continue;
+		w.entries[j++] = *e;
+	}
+	w.nr = j;
+	evict_oldest(&w, c->max_entries);
+
+	/* entries are only ever dropped, so the same count means no change */
+	if (!corrupt && !c->pending_nr && w.nr == c->nr) {
+		rollback_lock_file(&lk);
+		free(w.entries);
+		free(path);
+		return 0;
+	}
+	trace2_data_intmax("diff", c->repo, "rename_cache/entries", w.nr);
+
+	f = hashfd(get_lock_file_fd(&lk), get_lock_file_path(&lk));
+	cf = init_chunkfile(f);
+	add_chunk(cf, RENAME_CACHE_CHUNKID_FANOUT, RENAME_CACHE_FANOUT_SIZE,
+		  write_fanout_chunk);
+	add_chunk(cf, RENAME_CACHE_CHUNKID_PAIRS, st_mult(2 * rawsz, w.nr),
+		  write_pairs_chunk);
+	add_chunk(cf, RENAME_CACHE_CHUNKID_DATA,
+		  st_mult(RENAME_CACHE_DATA_WIDTH, w.nr), write_data_chunk);
+
+	hashwrite_be32(f, RENAME_CACHE_SIGNATURE);
+	hashwrite_u8(f, RENAME_CACHE_VERSION);
+	hashwrite_u8(f, oid_version(c->repo->hash_algo));
+	hashwrite_u8(f, get_num_chunks(cf));
+	hashwrite_u8(f, 0); /* unused */
+	write_chunkfile(cf, &w);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_NONE, CSUM_HASH_IN_STREAM);
+	free_chunkfile(cf);
+	free(w.entries);
+
+	unload_rename_cache_file(c);
+	if (commit_lock_file(&lk)) {
+		ret = error_errno(_("unable to write '%s'"), path);
+	} else {
+		FREE_AND_NULL(c->pending);
+		c->pending_nr = c->pending_alloc = 0;
+	}
+	load_rename_cache_file(c);
+	free(path);
+	return ret;
+}
+
+void rename_cache_flush(struct repository *r)
+{
+	struct rename_cache *c = &rename_cache;
+	size_t i, added = 0;
+
+	if (!c->repo || c->repo != r)
+		return;
+
+	QSORT(c->added, c->added_nr, entry_cmp);
+	ALLOC_GROW(c->pending, st_add(c->pending_nr, c->added_nr),
+		   c->pending_alloc);
+	for (i = 0; i < c->added_nr; i++) {
+		struct rename_cache_entry *e = &c->added[i];
+
+		if ((i && !entry_cmp(e, e - 1)) ||
+		    lookup_rename_cache_file(c, &e->src, &e->dst) >= 0 ||
+		    lookup_pending(c, &e->src, &e->dst) >= 0)
+			continue;
+		c->pending[c->pending_nr + added++] = *e;
+	}
+	if (added) {
+		c->pending_nr += added;
+		QSORT(c->pending, c->pending_nr, entry_cmp);
+	}
+	c->added_nr = 0;
+	trace2_data_intmax("diff", r, "rename_cache/added", added);
+
+	if (c->pending_nr &&
+	    st_mult(c->pending_nr, RENAME_CACHE_WRITE_RATIO) >= c->nr)
+		write_rename_cache(c, 0);
+}
+
+int rename_cache_gc(struct repository *r)
+{
+	struct rename_cache *c = &rename_cache;
+	char *path;
+	int enabled = 0, ret;
+
+	if (repo_config_get_bool(r, "diff.renamecache", &enabled) || !enabled) {
+		/* not enabled anymore: the file is just wasted space */
+		path = rename_cache_path(r);
+		if (unlink(path) && errno != ENOENT)
+			ret = error_errno(_("unable to remove '%s'"), path);
+		else
+			ret = 0;
+		free(path);
+		return ret;
+	}
+
+	/* the cache is in use for another repository already */
+	if (!rename_cache_prepare(r, 0))
+		return 0;
+	return write_rename_cache(c, 1);
+}
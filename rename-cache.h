@@ -0,0 +1,57 @@
+#ifndef RENAME_CACHE_H
+#define RENAME_CACHE_H
+
+struct repository;
+struct object_id;
+
+/*
+ * The rename cache remembers the similarity scores of pairs of blobs
+ * computed by inexact rename detection, so that later commands comparing
+ * the same blobs do not have to read and compare them again. It lives in
+ * $GIT_DIR/objects/info/rename-cache and is enabled by diff.renameCache.
+ */
+
+/*
+ * Read the configuration and the cache file if needed, before a rename
+ * detection comparing up to "nr_pairs" pairs of files in "r". Returns 1
+ * if the cache is to be used for it, 0 if it is not enabled for "r" or
+ * if it cannot hold that many pairs. Must be called by the main thread
+ * before any of the functions below.
+ */
+int rename_cache_prepare(struct repository *r, uint64_t nr_pairs);
+
+/*
+ * Returns the score of the pair if it is in the cache, -1 otherwise
+ * (including when the cache is not used for "r"). Scores added by the
+ * current rename detection are only found once rename_cache_flush() has
+ * been called. Can be called by several threads.
+ */
+int rename_cache_lookup(struct repository *r,
+			const struct object_id *src,
+			const struct object_id *dst);
+
+/*
+ * Remember the score of a pair. Can be called by several threads.
+ */
+void rename_cache_add(struct repository *r,
+		      const struct object_id *src,
+		      const struct object_id *dst,
+		      int score);
+
+/*
+ * Make the scores added so far available to rename_cache_lookup(), and
+ * write them to the cache file once there are enough of them to be worth
+ * rewriting it.
+ */
+void rename_cache_flush(struct repository *r);
+
+/*
+ * Rewrite the cache file without the pairs of blobs that do not exist
+ * anymore, and within the configured size, or remove it if the cache is
+ * not enabled anymore in "r". Does nothing if the cache is in use for
+ * another repository. Returns 0 on success, also when there is no cache
+ * file, and -1 on error.
+ */
+int rename_cache_gc(struct repository *r);
+
+#endif /* RENAME_CACHE_H */
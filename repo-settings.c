@@ -128,6 +128,8 @@ void prepare_repo_settings(struct repository *r)
 
 	if (!repo_config_get_ulong(r, "core.deltabasecachelimit", &ulongval))
 		r->settings.delta_base_cache_limit = ulongval;
+	repo_cfg_bool(r, "core.deltabasecacheadaptive",
+		      &r->settings.delta_base_cache_adaptive, 0);
 
 	if (!repo_config_get_ulong(r, "core.packedgitwindowsize", &ulongval)) {
 		int pgsz_x2 = getpagesize() * 2;
@@ -59,6 +59,7 @@ struct repo_settings {
 	int warn_ambiguous_refs; /* lazily loaded via accessor */
 
 	size_t delta_base_cache_limit;
+	int delta_base_cache_adaptive;
 	size_t packed_git_window_size;
 	size_t packed_git_limit;
 };
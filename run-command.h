@@ -5,6 +5,8 @@
 
 #include "strvec.h"
 
+struct repository;
+
 /**
  * The run-command API offers a versatile tool to run sub-processes with
  * redirected input and output as well as with a modified environment
@@ -223,11 +225,12 @@ int finish_command_in_signal(struct child_process *);
 int run_command(struct child_process *);
 
 /*
- * Prepare a `struct child_process` to run auto-maintenance. Returns 1 if the
- * process has been prepared and is ready to run, or 0 in case auto-maintenance
- * should be skipped.
+ * Prepare a `struct child_process` to run auto-maintenance as configured in
+ * "r". Returns 1 if the process has been prepared and is ready to run, or 0
+ * in case auto-maintenance should be skipped.
  */
-int prepare_auto_maintenance(int quiet, struct child_process *maint);
+int prepare_auto_maintenance(struct repository *r, int quiet,
+			     struct child_process *maint);
 
 /*
  * Trigger an auto-gc
@@ -16,9 +16,25 @@ void blk_SHA256_Init(blk_SHA256_CTX *ctx);
 void blk_SHA256_Update(blk_SHA256_CTX *ctx, const void *data, size_t len);
 void blk_SHA256_Final(unsigned char *digest, blk_SHA256_CTX *ctx);
 
+/*
+ * Equivalent to calling blk_SHA256_Update(ctx[i], data[i], len[i]) and
+ * then blk_SHA256_Final(digest[i], ctx[i]) for each of the "nr"
+ * contexts, but hashes up to blk_SHA256_LANES of them in parallel.
+ */
+#if defined(__GNUC__)
+#define blk_SHA256_LANES 4
+#else
+#define blk_SHA256_LANES 1
+#endif
+void blk_SHA256_Final_multi(blk_SHA256_CTX **ctx, const void **data,
+			    const size_t *len, unsigned char **digest,
+			    size_t nr);
+
 #define platform_SHA256_CTX blk_SHA256_CTX
 #define platform_SHA256_Init blk_SHA256_Init
 #define platform_SHA256_Update blk_SHA256_Update
 #define platform_SHA256_Final blk_SHA256_Final
+#define platform_SHA256_Final_multi blk_SHA256_Final_multi
+#define platform_SHA256_LANES blk_SHA256_LANES
 
 #endif
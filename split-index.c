@@ -96,6 +96,13 @@ void move_cache_to_base_index(struct index_state *istate)
 		}
 
 		mem_pool_combine(istate->ce_mem_pool, istate->split_index->base->ce_mem_pool);
+
+		/*
+		 * The old base no longer owns the memory backing its
+		 * cache entries, so do not let release_index() below
+		 * validate them against its now empty pool.
+		 */
+		si->base->cache_nr = 0;
 	}
 
 	if (si->base)
@@ -6,6 +6,7 @@
 #include "commit.h"
 #include "repository.h"
 #include "setup.h"
+#include "trace.h"
 
 static struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
 
@@ -44,11 +45,99 @@ static void get_bloom_filter_for_commit(const struct object_id *commit_oid)
 	print_bloom_filter(filter);
 }
 
+/*
+ * Probe "path" against many synthetic filters, once key by key with
+ * bloom_filter_contains() and once with bloom_filter_contains_vec(),
+ * and report how long each took. The filters have the typical sizes
+ * of filters for commits changing a handful of paths.
+ */
+static void bench_contains(const char *path, int nr_filters, int rounds)
+{
+	struct bloom_filter *filters;
+	struct bloom_key *keys;
+	struct bloom_keyvec *vec;
+	size_t nr_keys = 1, len = strlen(path);
+	uint32_t rand = 1;
+	int maybe_keys = 0, maybe_vec = 0;
+	uint64_t start, ns_keys, ns_vec;
+
+	for (size_t i = 1; i < len; i++)
+		if (path[i] == '/')
+			nr_keys++;
+	ALLOC_ARRAY(keys, nr_keys);
+	vec = bloom_keyvec_new(path, len, &settings);
+	for (size_t i = 0; i < nr_keys; i++)
+		keys[i].hashes = vec->hashes + i * vec->num_hashes;
+
+	CALLOC_ARRAY(filters, nr_filters);
+	for (int i = 0; i < nr_filters; i++) {
+		int nr_paths = 1 + i % 12;
+
+		filters[i].len = (nr_paths * settings.bits_per_entry +
+				  BITS_PER_WORD - 1) / BITS_PER_WORD;
+		CALLOC_ARRAY(filters[i].data, filters[i].len);
+		for (int j = 0; j < nr_paths; j++) {
+			struct bloom_key key;
+			char buf[32];
+
+			rand = rand * 1103515245 + 12345;
+			if (!(rand % 61)) {
+				/* the path we look for has changed */
+				for (size_t k = 0; k < nr_keys; k++)
+					add_key_to_filter(&keys[k], &filters[i],
+							  &settings);
+				continue;
+			}
+			xsnprintf(buf, sizeof(buf), "dir%u/file%u",
+				  (rand >> 16) % 8, rand % 1000);
+			fill_bloom_key(buf, strlen(buf), &key, &settings);
+			add_key_to_filter(&key, &filters[i], &settings);
+			clear_bloom_key(&key);
+		}
+	}
+
+	start = getnanotime();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < nr_filters; i++) {
+			int result = 1;
+			for (size_t k = 0; result && k < nr_keys; k++)
+				result = bloom_filter_contains(&filters[i],
+							       &keys[k],
+							       &settings);
+			maybe_keys += result;
+		}
+	}
+	ns_keys = getnanotime() - start;
+
+	start = getnanotime();
+	for (int r = 0; r < rounds; r++)
+		for (int i = 0; i < nr_filters; i++)
+			maybe_vec += bloom_filter_contains_vec(&filters[i], vec);
+	ns_vec = getnanotime() - start;
+
+	if (maybe_keys != maybe_vec)
+		die("bloom_filter_contains_vec() disagrees: %d != %d",
+		    maybe_vec, maybe_keys);
+
+	printf("maybe: %d of %d\n", maybe_vec / rounds, nr_filters);
+	printf("contains: %.3f ns/filter\n",
+	       (double)ns_keys / rounds / nr_filters);
+	printf("contains_vec: %.3f ns/filter\n",
+	       (double)ns_vec / rounds / nr_filters);
+
+	for (int i = 0; i < nr_filters; i++)
+		free(filters[i].data);
+	free(filters);
+	free(keys);
+	bloom_keyvec_free(vec);
+}
+
 static const char *bloom_usage = "\n"
 "  test-tool bloom get_murmur3 <string>\n"
 "  test-tool bloom get_murmur3_seven_highbit\n"
 "  test-tool bloom generate_filter <string> [<string>...]\n"
-"  test-tool bloom get_filter_for_commit <commit-hex>\n";
+"  test-tool bloom get_filter_for_commit <commit-hex>\n"
+"  test-tool bloom bench_contains <path> <nr-filters> <rounds>\n";
 
 int cmd__bloom(int argc, const char **argv)
 {
@@ -100,5 +189,12 @@ int cmd__bloom(int argc, const char **argv)
 		get_bloom_filter_for_commit(&oid);
 	}
 
+	if (!strcmp(argv[1], "bench_contains")) {
+		if (argc < 5)
+			usage(bloom_usage);
+		bench_contains(argv[2], strtol(argv[3], NULL, 10),
+			       strtol(argv[4], NULL, 10));
+	}
+
 	return 0;
 }
@@ -10,15 +10,44 @@ static inline void compute_hash(const struct git_hash_algo *algo, git_hash_ctx *
 	algo->final_fn(final, ctx);
 }
 
+#define NUM_MULTI 32
+
+static inline void compute_hash_multi(const struct git_hash_algo *algo,
+				      git_hash_ctx *ctx, struct object_id *oid,
+				      const void *p, size_t len)
+{
+	git_hash_ctx *ctxp[NUM_MULTI];
+	struct object_id *oidp[NUM_MULTI];
+	const void *in[NUM_MULTI];
+	size_t lens[NUM_MULTI];
+
+	for (size_t i = 0; i < NUM_MULTI; i++) {
+		algo->init_fn(&ctx[i]);
+		ctxp[i] = &ctx[i];
+		oidp[i] = &oid[i];
+		in[i] = p;
+		lens[i] = len;
+	}
+	algo->final_oid_multi_fn(oidp, ctxp, in, lens, NUM_MULTI);
+}
+
 int cmd__hash_speed(int ac, const char **av)
 {
 	git_hash_ctx ctx;
 	unsigned char hash[GIT_MAX_RAWSZ];
+	git_hash_ctx *multi_ctx = NULL;
+	struct object_id *multi_oid = NULL;
 	clock_t initial, start, end;
 	unsigned bufsizes[] = { 64, 256, 1024, 8192, 16384 };
 	void *p;
 	const struct git_hash_algo *algo = NULL;
+	int multi = 0;
 
+	if (ac == 3 && !strcmp(av[1], "--multi")) {
+		multi = 1;
+		ac--;
+		av++;
+	}
 	if (ac == 2) {
 		for (size_t i = 1; i < GIT_HASH_NALGOS; i++) {
 			if (!strcmp(av[1], hash_algos[i].name)) {
@@ -28,12 +57,22 @@ int cmd__hash_speed(int ac, const char **av)
 		}
 	}
 	if (!algo)
-		die("usage: test-tool hash-speed algo_name");
+		die("usage: test-tool hash-speed [--multi] algo_name");
 
 	/* Use this as an offset to make overflow less likely. */
 	initial = clock();
 
 	printf("algo: %s\n", algo->name);
+	if (multi) {
+		/*
+		 * Hash NUM_MULTI buffers per iteration with
+		 * final_oid_multi_fn, to see the throughput of the
+		 * parallel lanes of the implementation.
+		 */
+		printf("lanes: %u\n", algo->multi_lanes);
+		ALLOC_ARRAY(multi_ctx, NUM_MULTI);
+		ALLOC_ARRAY(multi_oid, NUM_MULTI);
+	}
 
 	for (size_t i = 0; i < ARRAY_SIZE(bufsizes); i++) {
 		unsigned long j, kb;
@@ -41,7 +80,11 @@ int cmd__hash_speed(int ac, const char **av)
 		p = xcalloc(1, bufsizes[i]);
 		start = end = clock() - initial;
 		for (j = 0; ((end - start) / CLOCKS_PER_SEC) < NUM_SECONDS; j++) {
-			compute_hash(algo, &ctx, hash, p, bufsizes[i]);
+			if (multi)
+				compute_hash_multi(algo, multi_ctx, multi_oid,
+						   p, bufsizes[i]);
+			else
+				compute_hash(algo, &ctx, hash, p, bufsizes[i]);
 
 			/*
 			 * Only check elapsed time every 128 iterations to avoid
@@ -50,11 +93,13 @@ int cmd__hash_speed(int ac, const char **av)
 			if (!(j & 127))
 				end = clock() - initial;
 		}
-		kb = j * bufsizes[i];
+		kb = j * bufsizes[i] * (multi ? NUM_MULTI : 1);
 		kb_per_sec = kb / (1024 * ((double)end - start) / CLOCKS_PER_SEC);
 		printf("size %u: %lu iters; %lu KiB; %0.2f KiB/s\n", bufsizes[i], j, kb, kb_per_sec);
 		free(p);
 	}
 
+	free(multi_ctx);
+	free(multi_oid);
 	return 0;
 }
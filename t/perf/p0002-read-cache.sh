@@ -11,4 +11,15 @@ test_perf "read_cache/discard_cache $count times" "
 	test-tool read-cache $count
 "
 
+for version in 2 4 5
+do
+	test_expect_success "switch to index version $version" "
+		git update-index --index-version $version
+	"
+
+	test_perf "read_cache/discard_cache $count times (v$version)" "
+		test-tool read-cache $count
+	"
+done
+
 test_done
@@ -28,4 +28,28 @@ test_perf 'log -S' '
 	git log --raw -Sfoo >/dev/null
 '
 
+test_perf 'grep --threads=8 (concurrent readers)' '
+	git grep --threads=8 -c foo HEAD~10 HEAD >/dev/null || :
+'
+
+# Repack a copy with very deep delta chains, so that each object
+# read has to walk a long way back to its base.
+test_expect_success 'setup deep delta chains' '
+	git clone --no-local --bare . deep.git &&
+	git -C deep.git repack -adf --depth=250 --window=50
+'
+
+for adaptive in false true
+do
+	test_perf "log -p (deep chains, adaptive=$adaptive)" "
+		git -C deep.git -c core.deltaBaseCacheAdaptive=$adaptive \
+			log -p -1000 >/dev/null
+	"
+
+	test_perf "grep --threads=8 (deep chains, adaptive=$adaptive)" "
+		git -C deep.git -c core.deltaBaseCacheAdaptive=$adaptive \
+			grep --threads=8 -c foo HEAD~10 HEAD >/dev/null || :
+	"
+done
+
 test_done
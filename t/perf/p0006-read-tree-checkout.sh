@@ -57,6 +57,16 @@ test_perf "read-tree br_ballast_plus_1 ($nr_files)" '
 	done
 '
 
+# Unpack the top-level directories sequentially and with as many threads
+# as there are cores.
+for threads in 1 0
+do
+	test_perf "read-tree br_base br_ballast (checkout.unpackThreads=$threads)" "
+		git -c checkout.unpackThreads=$threads \\
+			read-tree -n -m br_base br_ballast
+	"
+done
+
 test_perf "switch between br_base br_ballast ($nr_files)" '
 	git checkout -q br_base &&
 	git checkout -q br_ballast
@@ -72,4 +82,21 @@ test_perf "switch between aliases ($nr_files)" '
 	git checkout -q br_ballast
 '
 
+test_perf "switch between br_base br_ballast (checkout.unpackThreads=0)" '
+	git -c checkout.unpackThreads=0 checkout -q br_base &&
+	git -c checkout.unpackThreads=0 checkout -q br_ballast
+'
+
+# Unlike the tests above, these do populate the whole working tree,
+# to measure the time until a fresh clone is checked out, with and
+# without the parallel checkout workers.
+for workers in 1 0
+do
+	test_perf "clone br_ballast (checkout.workers=$workers)" \
+		--setup "rm -rf clone" "
+		git -c checkout.workers=$workers \\
+			clone -q --branch br_ballast . clone
+	"
+done
+
 test_done
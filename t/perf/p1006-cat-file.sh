@@ -9,4 +9,31 @@ test_perf 'cat-file --batch-check' '
 	git cat-file --batch-all-objects --batch-check
 '
 
+test_expect_success 'setup list of objects' '
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >objects
+'
+
+test_perf 'cat-file --batch' '
+	git cat-file --batch --buffer <objects >/dev/null
+'
+
+for t in 2 4 8
+do
+	test_perf "cat-file --batch --threads=$t" "
+		git cat-file --batch --threads=$t <objects >/dev/null
+	"
+done
+
+test_perf 'cat-file --batch-check="%(objectsize:disk)"' '
+	git cat-file --batch-check="%(objectsize:disk)" --buffer <objects >/dev/null
+'
+
+for t in 2 4 8
+do
+	test_perf "cat-file --batch-check=\"%(objectsize:disk)\" --threads=$t" "
+		git cat-file --batch-check=\"%(objectsize:disk)\" --threads=$t \
+			<objects >/dev/null
+	"
+done
+
 test_done
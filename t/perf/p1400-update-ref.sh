@@ -30,4 +30,47 @@ test_perf "update-ref --stdin" '
 	git update-ref --stdin <instructions >/dev/null
 '
 
+test_expect_success "setup reftable repository" '
+	git init --ref-format=reftable reftable &&
+	test_commit -C reftable PRE &&
+	for i in $(test_seq 100000)
+	do
+		printf "create refs/heads/base-%d PRE\n" $i || return 1
+	done >base-instructions &&
+	git -C reftable update-ref --stdin <base-instructions &&
+	git -C reftable pack-refs &&
+	git -C reftable config maintenance.autoDetach true &&
+	git -C reftable config reftable.lockTimeout -1 &&
+	for i in $(test_seq 2000)
+	do
+		printf "update refs/heads/push-%d PRE\n" $i || return 1
+	done >push-instructions
+'
+
+# Run several pushers in parallel. Every now and then, one of them has to
+# merge its table into the big base table, which is where synchronous
+# auto-compaction makes it wait the longest.
+for mode in true background
+do
+	test_perf "update-ref with concurrent writers (autoCompaction=$mode)" "
+		git -C reftable config reftable.autoCompaction $mode &&
+		pids= &&
+		for writer in \$(test_seq 4)
+		do
+			(
+				for i in \$(test_seq 10)
+				do
+					sed -e s/push-/push-\$writer-/ push-instructions |
+					git -C reftable update-ref --stdin || exit 1
+				done
+			) &
+			pids=\"\$pids \$!\"
+		done &&
+		for pid in \$pids
+		do
+			wait \$pid || return 1
+		done
+	"
+done
+
 test_done
@@ -26,4 +26,19 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+# Large generated files, where preparing the lines for the diff (finding
+# and hashing them, and classifying identical ones) matters most.
+test_expect_success 'setup large generated files' '
+	test_seq 500000 | sed -e "s/^/generated line number /" >large-old &&
+	awk "{ print (NR % 1000) ? \$0 : \$0 \" changed\" }" large-old >large-new
+'
+
+for alg in myers histogram patience
+do
+	test_perf "diff --no-index of large files ($alg)" "
+		test_expect_code 1 git diff --no-index --diff-algorithm=$alg \
+			large-old large-new >/dev/null
+	"
+done
+
 test_done
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+test_description="Tests scaling of inexact rename detection with threads"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+# A commit moving many files to another directory while changing one
+# line in each, so that none of them is an exact or a basename rename
+# and all of them go through the score matrix.
+test_expect_success 'set up mass-rename commit' '
+	for i in $(test_seq 2000)
+	do
+		mkdir -p old/$((i % 50)) &&
+		test_seq $i $((i + 40)) >old/$((i % 50))/file-$i.txt || return 1
+	done &&
+	git add old &&
+	git commit -q -m old &&
+	for i in $(test_seq 2000)
+	do
+		mkdir -p new/$((i % 37)) &&
+		sed -e "20s/.*/changed/" <old/$((i % 50))/file-$i.txt \
+			>new/$((i % 37))/moved-$i.txt || return 1
+	done &&
+	git rm -q -r old &&
+	git add new &&
+	git commit -q -m new &&
+
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+for t in $threads
+do
+	export t
+	test_perf "diff -M, $t threads" '
+		git -c diff.renameThreads=$t -c diff.renameLimit=0 \
+			diff -M --raw HEAD^ HEAD >/dev/null
+	'
+done
+
+test_done
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+test_description="Tests scaling of the pack-objects delta search with threads"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+# Rather than counting up and doubling each time, count down from the endpoint,
+# halving each time. That ensures that our final test uses as many threads as
+# CPUs, even if it isn't a power of 2.
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+# Feed the same object list to every run, and do not reuse existing
+# deltas, so that each run does the full delta search.
+test_expect_success 'set up object list' '
+	git rev-list --objects --all >objects
+'
+
+for t in $threads
+do
+	THREADS=$t
+	export THREADS
+	test_perf "pack-objects --no-reuse-delta $t threads" '
+		git pack-objects --no-reuse-delta --threads=$THREADS \
+			--window=50 --stdout <objects >/dev/null
+	'
+done
+
+test_done
@@ -31,10 +31,15 @@ test_lookup_pack_bitmap () {
 		git config pack.writeBitmapLookupTable '"$1"'
 	'
 
+	test_expect_success "use roaring bitmaps: ${2:-false}" '
+		git config pack.writeBitmapRoaring '"${2:-false}"'
+	'
+
 	test_pack_bitmap
 }
 
 test_lookup_pack_bitmap false
 test_lookup_pack_bitmap true
+test_lookup_pack_bitmap true true
 
 test_done
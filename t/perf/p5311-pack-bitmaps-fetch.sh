@@ -45,6 +45,40 @@ test_fetch_bitmaps () {
 		test_perf "client $title (lookup=$1)" '
 			git index-pack --stdin --fix-thin <tmp.pack
 		'
+
+		# The same fetch, made again and again by many clients, through
+		# upload-pack with and without its response cache.
+		test_expect_success "setup fetch request from $days days ago" '
+			test-tool pkt-line pack >request <<-EOF
+			command=fetch
+			object-format=$(git rev-parse --show-object-format)
+			0001
+			thin-pack
+			ofs-delta
+			want $(git rev-parse HEAD)
+			have $tip
+			done
+			0000
+			EOF
+		'
+
+		test_perf "repeated fetch $title (lookup=$1)" '
+			GIT_PROTOCOL=version=2 \
+				git upload-pack --stateless-rpc . <request >/dev/null
+		'
+
+		test_expect_success "warm cache for fetch from $days days ago" '
+			rm -rf "$(git rev-parse --git-dir)/upload-pack-cache" &&
+			GIT_PROTOCOL=version=2 \
+				git -c uploadpack.packCache=true \
+				upload-pack --stateless-rpc . <request >/dev/null
+		'
+
+		test_perf "repeated fetch, cached $title (lookup=$1)" '
+			GIT_PROTOCOL=version=2 \
+				git -c uploadpack.packCache=true \
+				upload-pack --stateless-rpc . <request >/dev/null
+		'
 	done
 }
 
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+test_description="Tests scaling of changed-path Bloom filter computation with threads"
+
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+# Write the graph from scratch every time, so that no existing filters
+# can be reused and each run computes all of them.
+for t in $threads
+do
+	THREADS=$t
+	export THREADS
+	test_perf "commit-graph write --changed-paths, $t threads" '
+		rm -f .git/objects/info/commit-graph &&
+		rm -rf .git/objects/info/commit-graphs &&
+		git commit-graph write --reachable --changed-paths \
+			--no-progress --threads=$THREADS
+	'
+done
+
+test_done
@@ -64,4 +64,43 @@ test_bitmap () {
 test_bitmap false
 test_bitmap true
 
+test_expect_success 'split objects into many packs' '
+	git repack -ad &&
+	git cat-file --batch-all-objects --batch-check="%(objectname)" >objects &&
+	split -l 10000 objects chunk. &&
+	for c in chunk.*
+	do
+		git pack-objects -q .git/objects/pack/pack <$c >/dev/null || return 1
+	done &&
+	rm -f objects chunk.*
+'
+
+# Count down from the number of CPUs, halving each time, so that the
+# final test uses as many threads as there are CPUs.
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+for t in $threads
+do
+	THREADS=$t
+	export THREADS
+
+	test_perf "multi-pack-index write ($t threads)" \
+		--setup 'rm -f .git/objects/pack/multi-pack-index*' '
+		git -c pack.threads=$THREADS multi-pack-index write
+	'
+
+	test_perf "multi-pack-index write --bitmap ($t threads)" \
+		--setup 'rm -f .git/objects/pack/multi-pack-index*' '
+		git -c pack.threads=$THREADS multi-pack-index write --bitmap
+	'
+done
+
 test_done
@@ -0,0 +1,62 @@
+#!/bin/sh
+
+test_description='negotiation performance of upload-pack with many refs
+
+The client wants many branches forked from a long history, and sends
+"have" lines for commits of its own, which the server does not know,
+mixed with old commits of that history. Every unknown "have" makes
+upload-pack check whether all the wants reach a common commit yet.
+'
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'create history with many branches' '
+	test_commit_bulk --ref=refs/heads/main --id=main 5000 &&
+	for i in $(test_seq 1000)
+	do
+		cat <<-EOF || return 1
+		commit refs/heads/branch-$i
+		committer C O Mitter <committer@example.com> $((1500000000 + $i)) +0000
+		data <<X
+		branch $i
+		X
+		from main~$i
+
+		EOF
+	done >input &&
+	git fast-import <input &&
+	git repack -adb &&
+	git commit-graph write --reachable
+'
+
+test_expect_success 'create negotiation request' '
+	git for-each-ref --format="want %(objectname)" "refs/heads/branch-*" >wants &&
+	sed -e "1s/\$/ multi_ack_detailed no-done/" wants >wants.caps &&
+	git rev-list main~1100 --max-count=100 >common &&
+	for c in $(cat common)
+	do
+		echo "have $c" &&
+		for i in $(test_seq 100)
+		do
+			printf "have %s%08x\n" "${c%????????}" $i || return 1
+		done || return 1
+	done >haves &&
+	{
+		cat wants.caps &&
+		echo 0000 &&
+		cat haves &&
+		echo 0000 &&
+		echo done
+	} | test-tool pkt-line pack >request
+'
+
+test_perf 'negotiate with bitmaps' '
+	git -c uploadpack.negotiationBitmaps=true upload-pack . <request >/dev/null
+'
+
+test_perf 'negotiate without bitmaps' '
+	git -c uploadpack.negotiationBitmaps=false upload-pack . <request >/dev/null
+'
+
+test_done
@@ -39,4 +39,16 @@ test_perf 'gc' '
 	git -C bare.git gc
 '
 
+test_expect_success 'setup bitmaps for pack reuse' '
+	git repack -adb
+'
+
+test_perf 'server side of clone without blobs' '
+	git pack-objects --stdout --revs --all --filter=blob:none </dev/null >/dev/null
+'
+
+test_perf 'server side of clone without trees' '
+	git pack-objects --stdout --revs --all --filter=tree:0 </dev/null >/dev/null
+'
+
 test_done
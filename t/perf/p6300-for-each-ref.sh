@@ -84,4 +84,23 @@ test_expect_success 'pack refs' '
 '
 run_tests "packed"
 
+test_expect_success 'migrate to reftable' '
+	git refs migrate --ref-format=reftable &&
+	git pack-refs --all
+'
+run_tests "reftable"
+
+test_perf "for-each-ref (reftable, branches) + cat-file --batch-check (refnames)" "
+	for i in \$(test_seq $test_iteration_count); do
+		git for-each-ref --format='%(refname)' refs/heads/ | \
+			git cat-file --batch-check >/dev/null
+	done
+"
+
+test_perf "rev-list --reflog (reftable)" "
+	for i in \$(test_seq $test_iteration_count); do
+		git rev-list --no-walk --reflog >/dev/null
+	done
+"
+
 test_done
@@ -0,0 +1,56 @@
+#!/bin/sh
+
+test_description="Tests scaling of merge-tree content merges with threads"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+# Two branches changing different lines of the same many files, so that
+# every one of them needs a (clean) content merge.
+test_expect_success 'set up merge with many content merges' '
+	for i in $(test_seq 2000)
+	do
+		mkdir -p dir-$((i % 50)) &&
+		test_seq $i $((i + 200)) >dir-$((i % 50))/file-$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m base &&
+	git branch side &&
+	for i in $(test_seq 2000)
+	do
+		f=dir-$((i % 50))/file-$i &&
+		sed -e "10s/.*/ours/" $f >tmp &&
+		mv tmp $f || return 1
+	done &&
+	git commit -q -a -m ours &&
+	git tag ours &&
+	git checkout -q side &&
+	for i in $(test_seq 2000)
+	do
+		f=dir-$((i % 50))/file-$i &&
+		sed -e "190s/.*/theirs/" $f >tmp &&
+		mv tmp $f || return 1
+	done &&
+	git commit -q -a -m theirs &&
+	git tag theirs &&
+
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+for t in $threads
+do
+	export t
+	test_perf "merge-tree --write-tree, $t threads" '
+		git -c merge.threads=$t \
+			merge-tree --write-tree ours theirs >/dev/null
+	'
+done
+
+test_done
@@ -0,0 +1,71 @@
+#!/bin/sh
+
+test_description="Tests throughput of many merges with merge-tree --stdin"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+# An upstream renaming many files, and a topic of many commits each
+# changing one of them, to be picked one after the other onto upstream
+# like a merge queue would.
+test_expect_success 'set up a sequence of picks across renames' '
+	for i in $(test_seq 1000)
+	do
+		mkdir -p dir-$((i % 20)) &&
+		test_seq $i $((i + 100)) >dir-$((i % 20))/file-$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m base &&
+	git tag base &&
+	for i in $(test_seq 20)
+	do
+		git mv dir-$((i - 1)) moved-$((i - 1)) || return 1
+	done &&
+	git commit -q -m upstream &&
+	git tag upstream &&
+	git checkout -q base &&
+	for i in $(test_seq 100)
+	do
+		f=dir-$((i % 20))/file-$i &&
+		sed -e "50s/.*/topic $i/" $f >tmp &&
+		mv tmp $f &&
+		git commit -q -a -m "topic $i" || return 1
+	done &&
+	git tag topic &&
+
+	tree=$(git rev-parse upstream^{tree}) &&
+	for c in $(git rev-list --reverse base..topic)
+	do
+		echo "$c^ -- $tree $c" >>picks &&
+		tree=$(git merge-tree --merge-base=$c^ $tree $c) || return 1
+	done &&
+	git rev-list --reverse base..topic |
+	sed -e "s/$/ upstream/" >merges
+'
+
+test_perf 'merge-tree --write-tree, one process per pick' '
+	while read base sep side1 side2
+	do
+		git merge-tree --merge-base=$base $side1 $side2 >/dev/null ||
+		return 1
+	done <picks
+'
+
+test_perf 'merge-tree --stdin, sequence of picks' '
+	git merge-tree --stdin <picks >/dev/null
+'
+
+test_perf 'merge-tree --write-tree, one process per merge' '
+	while read side1 side2
+	do
+		git merge-tree --write-tree $side1 $side2 >/dev/null
+		test $? -le 1 || return 1
+	done <merges
+'
+
+test_perf 'merge-tree --stdin, merges' '
+	git merge-tree --stdin <merges >/dev/null
+'
+
+test_done
@@ -197,6 +197,16 @@ test_fsmonitor_suite () {
 		git status -uall
 	'
 
+	# Editing a tracked file should not force the untracked-cache
+	# to re-read the directories above it.  Restore the file
+	# afterwards so that it does not stay dirty for later tests.
+	#
+	test_perf_w_drop_caches "status (one file edited) ($DESC)" '
+		echo edit >>10000_files/1 &&
+		git status &&
+		git checkout -- 10000_files/1
+	'
+
 	# Update the mtimes on upto 100k files to make status think
 	# that they are dirty.  For simplicity, omit any files with
 	# LFs (i.e. anything that ls-files thinks it needs to dquote)
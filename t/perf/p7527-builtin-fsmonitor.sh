@@ -154,6 +154,22 @@ do_matrix () {
 
 	do_status "$t status after checkout"
 
+	# A quiescent worktree and a single small edit are the common
+	# interactive cases; this is where the daemon should let status
+	# skip the lstat() sweep over the whole index.
+	#
+	do_status "$t status with no changes"
+
+	test_expect_success "$t modify one tracked file" "
+		echo more >>$REPO/ballast/dir1/file1
+	"
+
+	do_status "$t status after small change"
+
+	test_expect_success "$t restore one tracked file" "
+		git -C $REPO checkout -- ballast/dir1/file1
+	"
+
 	# Modify many files in the matrix branch.
 	# Stage them.
 	# Commit them.
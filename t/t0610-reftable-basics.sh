@@ -348,6 +348,136 @@ test_expect_success 'ref transaction: env var disables compaction' '
 	test_line_count -lt $expected repo/.git/reftable/tables.list
 '
 
+test_expect_success 'ref transaction: config disables compaction' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	git -C repo config reftable.autoCompaction false &&
+
+	start=$(wc -l <repo/.git/reftable/tables.list) &&
+	iterations=5 &&
+	expected=$((start + iterations)) &&
+
+	for i in $(test_seq $iterations)
+	do
+		git -C repo update-ref branch-$i HEAD || return 1
+	done &&
+	test_line_count = $expected repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: rejects invalid auto-compaction mode' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo A &&
+	git -C repo config reftable.autoCompaction foo &&
+	test_must_fail git -C repo update-ref branch HEAD 2>err &&
+	test_grep "invalid value for ${SQ}reftable.autocompaction${SQ}" err
+'
+
+test_expect_success 'ref transaction: background compaction of small stacks happens inline' '
+	test_when_finished "rm -rf repo" &&
+
+	git init repo &&
+	test_commit -C repo --no-tag A &&
+	git -C repo config reftable.autoCompaction background &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	test_region ! reftable compact-in-background trace2.txt &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: background compaction spawns maintenance' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	test_commit -C repo --no-tag A &&
+	git -C repo config reftable.autoCompaction background &&
+	git -C repo config reftable.backgroundCompactionThreshold 0 &&
+	git -C repo config maintenance.autoDetach false &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	test_region reftable compact-in-background trace2.txt &&
+	test_subcommand git maintenance run --auto --quiet --no-detach \
+		--task=pack-refs <trace2.txt &&
+	test_trace2_data reftable compaction-attempts 1 <trace2.txt &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: background compaction honors maintenance.auto' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	test_commit -C repo --no-tag A &&
+	git -C repo config reftable.autoCompaction background &&
+	git -C repo config reftable.backgroundCompactionThreshold 0 &&
+	git -C repo config maintenance.auto false &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	test_region ! reftable compact-in-background trace2.txt &&
+	test_subcommand ! git maintenance run --auto --quiet --no-detach \
+		--task=pack-refs <trace2.txt &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: background compaction happens inline when maintenance fails' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	test_commit -C repo --no-tag A &&
+	git -C repo config reftable.autoCompaction background &&
+	git -C repo config reftable.backgroundCompactionThreshold 0 &&
+	git -C repo config maintenance.autoDetach false &&
+	# git-maintenance(1) dies on this, but git-update-ref(1) does not read it
+	git -C repo config gc.auto foo &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD 2>err &&
+	test_grep "bad numeric config value" err &&
+	test_region reftable compact-in-background trace2.txt &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: background compaction happens inline when maintenance is running' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	test_commit -C repo --no-tag A &&
+	git -C repo config reftable.autoCompaction background &&
+	git -C repo config reftable.backgroundCompactionThreshold 0 &&
+	git -C repo config maintenance.autoDetach false &&
+	touch repo/.git/objects/maintenance.lock &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	test_region ! reftable compact-in-background trace2.txt &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
+test_expect_success 'ref transaction: background compaction happens inline for overgrown stacks' '
+	test_when_finished "rm -rf repo trace2.txt" &&
+
+	git init repo &&
+	test_commit -C repo --no-tag A &&
+	for i in $(test_seq 20)
+	do
+		GIT_TEST_REFTABLE_AUTOCOMPACTION=false \
+			git -C repo update-ref refs/heads/branch-$i HEAD || return 1
+	done &&
+	git -C repo config reftable.autoCompaction background &&
+	git -C repo config reftable.backgroundCompactionThreshold 0 &&
+	git -C repo config maintenance.autoDetach false &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C repo update-ref refs/heads/branch HEAD &&
+	test_region ! reftable compact-in-background trace2.txt &&
+	test_line_count = 1 repo/.git/reftable/tables.list
+'
+
 test_expect_success 'ref transaction: alternating table sizes are compacted' '
 	test_when_finished "rm -rf repo" &&
 
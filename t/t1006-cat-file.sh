@@ -87,6 +87,7 @@ do
 done
 
 for opt in --buffer \
+	--threads=2 \
 	--follow-symlinks \
 	--batch-all-objects \
 	-z \
@@ -1157,6 +1158,41 @@ test_expect_success 'cat-file --batch="batman" with --batch-all-objects will wor
 	cmp expect actual
 '
 
+test_expect_success 'cat-file --batch --threads matches unthreaded output' '
+	{
+		cat objects &&
+		echo HEAD:does-not-exist &&
+		echo $ZERO_OID
+	} >input &&
+	git -C all-two cat-file --batch <input >expect &&
+	for t in 2 4 0
+	do
+		git -C all-two cat-file --batch --threads=$t <input >actual &&
+		cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'cat-file --batch-check --threads matches unthreaded output' '
+	git -C all-two cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(rest)" \
+		<input >expect &&
+	git -C all-two cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(rest)" \
+		--threads=3 <input >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cat-file --batch-command --threads matches unthreaded output' '
+	sed -e "s/^/contents /" -e "2s/^contents/info/" -e "5s/.*/flush/" \
+		<input >cmds &&
+	git -C all-two cat-file --batch-command --buffer <cmds >expect &&
+	git -C all-two cat-file --batch-command --threads=2 <cmds >actual &&
+	cmp expect actual
+'
+
+test_expect_success 'cat-file --threads rejects negative values' '
+	test_must_fail git cat-file --batch --threads=-1 </dev/null 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 test_expect_success 'cat-file %(objectsize:disk) with --batch-all-objects' '
 	# our state has both loose and packed objects,
 	# so find both for our expected output
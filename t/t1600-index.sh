@@ -133,4 +133,51 @@ test_expect_success 'index version config precedence' '
 	test_index_version 0 true 2 2
 '
 
+test_expect_success 'index written by threads can be read by any reader' '
+	mkdir dir &&
+	for i in $(test_seq 20)
+	do
+		echo $i >dir/file$i || return 1
+	done &&
+	for version in 2 4
+	do
+		rm -f .git/index &&
+		git -c index.threads=1 -c index.version=$version add a dir &&
+		git ls-files --debug >expect &&
+		git -c index.threads=3 update-index --force-write-index &&
+		git -c index.threads=1 ls-files --debug >actual &&
+		test_cmp expect actual &&
+		git -c index.threads=3 ls-files --debug >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'index version 5 round-trips entries and flags' '
+	rm -f .git/index &&
+	git -c index.version=2 add a dir &&
+	echo new >new &&
+	git add -N new &&
+	git update-index --skip-worktree dir/file1 &&
+	git update-index --assume-unchanged dir/file2 &&
+	git ls-files --debug -s -t >expect &&
+
+	git update-index --index-version 5 &&
+	echo 5 >expect.version &&
+	git update-index --show-index-version >actual.version &&
+	test_cmp expect.version actual.version &&
+	git ls-files --debug -s -t >actual &&
+	test_cmp expect actual &&
+	git diff-files --name-only >actual.diff &&
+	echo new >expect.diff &&
+	test_cmp expect.diff actual.diff &&
+
+	git add dir/file3 &&
+	git ls-files --debug -s -t >actual &&
+	test_cmp expect actual &&
+
+	git update-index --index-version 2 &&
+	git ls-files --debug -s -t >actual &&
+	test_cmp expect actual
+'
+
 test_done
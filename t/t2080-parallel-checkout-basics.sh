@@ -274,4 +274,39 @@ test_expect_success '"git checkout ." report should not include failed entries'
 	)
 '
 
+test_expect_success !CASE_INSENSITIVE_FS 'clone starts the workers before the end of the index' '
+	set_checkout_config 2 0 &&
+	git init many_files &&
+	(
+		cd many_files &&
+		for d in a b c d
+		do
+			mkdir $d &&
+			for i in $(test_seq 50)
+			do
+				echo "$d $i" >$d/$i || return 1
+			done || return 1
+		done &&
+		git add -A &&
+		git commit -m files
+	) &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace-streamed" \
+		test_checkout_workers 2 git clone many_files many_files_clone &&
+	grep "\"key\":\"streamed\"" trace-streamed >streamed &&
+	! grep "\"value\":\"0\"" streamed &&
+	verify_checkout many_files_clone &&
+	git diff --no-index many_files/a many_files_clone/a
+'
+
+test_expect_success !CASE_INSENSITIVE_FS 'clone fails when the workers die while streaming' '
+	set_checkout_config 2 0 &&
+	test_when_finished "rm -rf dead_workers_clone" &&
+	GIT_TEST_CHECKOUT_WORKER_DIE_AFTER=1 \
+		test_checkout_workers 2 test_must_fail \
+		git clone many_files dead_workers_clone 2>err &&
+	test_grep "exited before sending all results" err &&
+	test_grep "unable to checkout working tree" err
+'
+
 test_done
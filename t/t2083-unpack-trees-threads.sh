@@ -0,0 +1,132 @@
+#!/bin/sh
+
+test_description='unpack-trees with checkout.unpackThreads
+
+Verify that unpacking the top-level directories in threads gives the
+same index, working tree and errors as the sequential unpacking.
+'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_CHECKOUT_UNPACK_THREADS
+
+# Run a command with one and with four threads, each time from a copy of
+# the "repo" repository, and compare the index, the working tree and the
+# output.
+test_unpack_threads () {
+	for threads in 1 4
+	do
+		rm -rf "copy-$threads" &&
+		cp -R repo "copy-$threads" &&
+		(
+			cd "copy-$threads" &&
+			test_might_fail git -c checkout.unpackThreads=$threads \
+				"$@" >../out-$threads 2>&1 &&
+			git ls-files -s -t >../index-$threads &&
+			find . -path ./.git -prune -o -type f -print |
+			sort >../files-$threads
+		) || return 1
+	done &&
+	test_cmp out-1 out-4 &&
+	test_cmp index-1 index-4 &&
+	test_cmp files-1 files-4
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		for d in a b c d e
+		do
+			mkdir -p $d/sub &&
+			echo $d >$d/file &&
+			echo $d >$d/sub/file &&
+			echo $d >$d.txt || return 1
+		done &&
+		echo top >top &&
+		git add . &&
+		git commit -m base &&
+		git tag base &&
+
+		git checkout -b side &&
+		echo side >a/file &&
+		echo side >c/sub/new &&
+		git rm -q d/sub/file &&
+		rm -rf e &&
+		echo e >e &&
+		echo side >top &&
+		git add -A &&
+		git commit -m side &&
+
+		git checkout main &&
+		echo main >b/file &&
+		echo main >c/file &&
+		echo main >d/sub/file &&
+		echo main >top &&
+		git commit -am main
+	)
+'
+
+test_expect_success 'threads are used' '
+	(
+		cd repo &&
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" GIT_TRACE2_EVENT_NESTING=5 \
+			git -c checkout.unpackThreads=4 read-tree -m -n HEAD side &&
+		grep "\"key\":\"unpack_trees/threads\",\"value\":\"4\"" trace.event
+	)
+'
+
+test_expect_success 'checkout' '
+	test_unpack_threads checkout side
+'
+
+test_expect_success 'checkout with local changes' '
+	(
+		cd repo &&
+		echo dirty >b/sub/file &&
+		echo dirty >a.txt
+	) &&
+	test_unpack_threads checkout side &&
+	git -C repo checkout -f main
+'
+
+test_expect_success 'checkout refusing to overwrite changes' '
+	(
+		cd repo &&
+		echo dirty >a/file &&
+		echo dirty >c/sub/new &&
+		echo dirty >top
+	) &&
+	test_unpack_threads checkout side &&
+	grep "a/file" out-4 &&
+	grep "top" out-4 &&
+	git -C repo checkout -f main &&
+	git -C repo clean -fdq
+'
+
+test_expect_success 'two-way read-tree' '
+	test_unpack_threads read-tree -m -u base side
+'
+
+test_expect_success 'three-way read-tree' '
+	test_unpack_threads read-tree -m base main side
+'
+
+test_expect_success 'reset --hard and --merge' '
+	(
+		cd repo &&
+		echo dirty >b/file
+	) &&
+	test_unpack_threads reset --merge side &&
+	test_unpack_threads reset --hard side &&
+	git -C repo checkout -f main
+'
+
+test_expect_success 'merge' '
+	test_unpack_threads merge side
+'
+
+test_done
@@ -309,4 +309,32 @@ test_expect_success 'last line matters too' '
 	test_cmp expected actual.munged
 '
 
+test_expect_success 'rename detection with threads' '
+	mkdir threads &&
+	for i in $(test_seq 20)
+	do
+		test_seq $i $((i * 3)) >threads/file-$i || return 1
+	done &&
+	git add threads &&
+	git commit -m "files to move" &&
+	for i in $(test_seq 20)
+	do
+		{
+			cat threads/file-$i &&
+			echo changed
+		} >threads/moved-$((21 - i)) &&
+		rm threads/file-$i || return 1
+	done &&
+	git add -A threads &&
+	git commit -m "move files" &&
+	git -c diff.renameThreads=1 diff-tree -r -M -C --find-copies-harder \
+		HEAD^ HEAD >expect &&
+	test_grep "R[0-9]*	threads/file-10	threads/moved-11" expect &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c diff.renameThreads=4 diff-tree -r -M -C \
+		--find-copies-harder HEAD^ HEAD >actual &&
+	grep "\"key\":\"rename/threads\",\"value\":\"4\"" trace.event &&
+	test_cmp expect actual
+'
+
 test_done
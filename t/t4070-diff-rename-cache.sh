@@ -0,0 +1,174 @@
+#!/bin/sh
+
+test_description='rename detection with diff.renameCache
+
+Verify that the similarity scores of pairs of blobs are remembered in
+objects/info/rename-cache, give the same renames when reused, and that
+the cache is bounded and pruned by gc.
+'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_RENAME_THREADS
+
+cache=.git/objects/info/rename-cache
+
+# Write a file of 20 lines that are different for each name.
+make_file () {
+	for i in $(test_seq 20)
+	do
+		echo "line $i of $1" || return 1
+	done
+}
+
+# Run "git diff -M" with the cache, and with GIT_TRACE2_EVENT in "trace".
+cached_diff () {
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=5 \
+		git -c diff.renameCache=true diff -M "$@"
+}
+
+test_expect_success 'setup' '
+	mkdir old &&
+	for name in one two three
+	do
+		make_file $name >old/$name || return 1
+	done &&
+	git add old &&
+	git commit -m old &&
+	git tag before &&
+	mkdir new &&
+	for name in one two three
+	do
+		git mv old/$name new/moved-$name &&
+		echo edited >>new/moved-$name || return 1
+	done &&
+	git commit -a -m new &&
+	git tag after &&
+	git diff -M --name-status before after >expect
+'
+
+test_expect_success 'scores are written to the cache' '
+	test_path_is_missing $cache &&
+	cached_diff --name-status before after >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $cache &&
+	test_trace2_data diff rename_cache/added 9 <trace &&
+	test_trace2_data diff rename_cache/entries 9 <trace
+'
+
+test_expect_success 'scores are reused from the cache' '
+	cached_diff --name-status before after >actual &&
+	test_cmp expect actual &&
+	test_trace2_data diff rename_cache/added 0 <trace &&
+	! grep rename_cache/entries trace
+'
+
+test_expect_success 'scores are reused from the cache with threads' '
+	GIT_TEST_RENAME_THREADS=4 cached_diff --name-status before after >actual &&
+	test_cmp expect actual &&
+	test_trace2_data diff rename_cache/added 0 <trace
+'
+
+test_expect_success 'reused scores give the same copies' '
+	git diff -C -C --name-status before after >expect-copies &&
+	cached_diff -C -C --name-status before after >actual &&
+	test_cmp expect-copies actual
+'
+
+test_expect_success 'files in the working tree are not cached' '
+	test_when_finished "git reset --hard after" &&
+	git mv new/moved-one new/again-one &&
+	echo more >>new/again-one &&
+	cached_diff --name-status after >actual &&
+	grep "^R[0-9]*	new/moved-one	new/again-one" actual &&
+	test_trace2_data diff rename_cache/added 0 <trace
+'
+
+test_expect_success 'blobs with CRLF are not cached' '
+	test_when_finished "git reset --hard after" &&
+	make_file crlf | append_cr >crlf &&
+	git add crlf &&
+	git commit -m crlf &&
+	git mv crlf crlf-moved &&
+	echo edited >>crlf-moved &&
+	git commit -a -m crlf-moved &&
+	cached_diff --name-status HEAD^ HEAD >actual &&
+	grep "^R[0-9]*	crlf	crlf-moved" actual &&
+	test_trace2_data diff rename_cache/added 0 <trace
+'
+
+test_expect_success 'a corrupt cache is ignored' '
+	test_when_finished "rm -f $cache" &&
+	echo garbage >$cache &&
+	cached_diff --name-status before after >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "rename cache file .* is too small" err
+'
+
+test_expect_success 'a cache with an unordered fanout is ignored' '
+	test_when_finished "rm -f $cache" &&
+	cached_diff before after &&
+	# the fanout follows the 8-byte header and a table of contents
+	# of four 12-byte entries; make its first value the largest
+	printf "\377\377\377\377" |
+	dd of=$cache bs=1 seek=56 count=4 conv=notrunc &&
+	cached_diff --name-status before after >actual 2>err &&
+	test_cmp expect actual &&
+	test_grep "rename cache file .* has fanout values out of order" err
+'
+
+test_expect_success 'gc does not create a cache' '
+	test_path_is_missing $cache &&
+	git -c diff.renameCache=true gc &&
+	test_path_is_missing $cache
+'
+
+test_expect_success 'diff.renameCacheMaxEntries evicts the oldest scores' '
+	test_when_finished "rm -f $cache" &&
+	git -c diff.renameCacheMaxEntries=9 -c diff.renameCache=true \
+		diff -M before after &&
+	git checkout -b other before &&
+	for name in one two three
+	do
+		git mv old/$name other-$name &&
+		echo other >>other-$name || return 1
+	done &&
+	git commit -a -m other &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=5 \
+		git -c diff.renameCacheMaxEntries=9 -c diff.renameCache=true \
+		diff -M --name-status before other >actual &&
+	test_trace2_data diff rename_cache/entries 9 <trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TRACE2_EVENT_NESTING=5 \
+		git -c diff.renameCacheMaxEntries=9 -c diff.renameCache=true \
+		diff -M --name-status before other >actual &&
+	test_trace2_data diff rename_cache/added 0 <trace &&
+	git checkout -
+'
+
+test_expect_success 'gc drops the scores of missing blobs' '
+	cached_diff before after &&
+	cached_diff before other &&
+	test_trace2_data diff rename_cache/entries 18 <trace &&
+	git branch -D other &&
+	git reflog expire --expire=now --all &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c diff.renameCache=true gc --prune=now &&
+	test_trace2_data diff rename_cache/entries 9 <trace
+'
+
+test_expect_success 'gc does not rewrite a cache without missing blobs' '
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" \
+		git -c diff.renameCache=true gc &&
+	test_path_is_file $cache &&
+	! grep rename_cache/entries trace
+'
+
+test_expect_success 'gc removes the cache when it is disabled' '
+	test_path_is_file $cache &&
+	git gc &&
+	test_path_is_missing $cache
+'
+
+test_done
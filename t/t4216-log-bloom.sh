@@ -725,6 +725,39 @@ test_expect_success 'when writing commit graph, reuse changed-path of another ve
 	test_filter_upgraded 1 trace2.txt
 '
 
+test_expect_success 'changed-path filters do not depend on the number of threads' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 200)
+		do
+			dir="dir$((i % 7))/sub$((i % 3))" &&
+			mkdir -p "$dir" &&
+			echo $i >"$dir/file$((i % 5))" &&
+			if test $((i % 50)) = 0
+			then
+				for j in $(test_seq 1 20)
+				do
+					echo $j >"$dir/many-$j" || return 1
+				done
+			fi &&
+			git add . &&
+			git commit -q -m "$i" || return 1
+		done &&
+
+		GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=16 \
+			git commit-graph write --reachable --changed-paths --threads=1 &&
+		mv .git/objects/info/commit-graph expect &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=16 \
+			git commit-graph write --reachable --changed-paths --threads=4 &&
+		grep "\"key\":\"bloom-threads\",\"value\":\"4\"" trace2.txt &&
+		test_filter_trunc_large 4 trace2.txt &&
+		test_cmp_bin expect .git/objects/info/commit-graph
+	)
+'
+
 corrupt_graph () {
 	test_when_finished "rm -rf $graph" &&
 	git commit-graph write --reachable --changed-paths &&
@@ -945,12 +945,124 @@ test_expect_success 'check the input format when --stdin is passed' '
 	test_cmp expect actual
 '
 
+test_expect_success '--stdin reuses renames across a sequence of picks' '
+	test_when_finished "rm -rf repo" &&
+	git init repo &&
+	(
+		cd repo &&
+		test_seq 11 30 >numbers &&
+		git add numbers &&
+		git commit -m orig &&
+		git tag orig &&
+		test_seq 1 30 >numbers &&
+		git add numbers &&
+		git mv numbers sequence &&
+		git commit -m "Renamed (and modified) numbers -> sequence" &&
+		git tag upstream &&
+		git checkout orig &&
+		sed -e "s/^20$/twenty/" numbers >tmp && mv tmp numbers &&
+		git commit -a -m A &&
+		git tag A &&
+		sed -e "s/^25$/twenty-five/" numbers >tmp && mv tmp numbers &&
+		git commit -a -m B &&
+		git tag B &&
+		sed -e "s/^twenty$/20/" numbers >tmp && mv tmp numbers &&
+		git commit -a -m C &&
+		git tag C &&
+
+		printf "1\0" >expect &&
+		git merge-tree --messages -z --merge-base=A^ upstream A >>expect &&
+		printf "\0" >>expect &&
+		R1=$(git merge-tree --merge-base=A^ upstream A) &&
+		printf "1\0" >>expect &&
+		git merge-tree --messages -z --merge-base=B^ $R1 B >>expect &&
+		printf "\0" >>expect &&
+		R2=$(git merge-tree --merge-base=B^ $R1 B) &&
+		printf "1\0" >>expect &&
+		git merge-tree --messages -z --merge-base=C^ $R2 C >>expect &&
+		printf "\0" >>expect &&
+		printf "1\0" >>expect &&
+		git merge-tree --messages -z upstream C >>expect &&
+		printf "\0" >>expect &&
+
+		printf "%s\n" "A^ -- upstream A" "B^ -- $R1 B" "C^ -- $R2 C" \
+			"upstream C" >input &&
+		GIT_TRACE2_PERF="$(pwd)/trace.output" \
+			git merge-tree --messages --stdin <input >actual &&
+		test_cmp expect actual &&
+		grep region_enter.*diffcore_rename trace.output >calls &&
+		test_line_count = 2 calls
+	)
+'
+
 test_expect_success '--merge-base with tree OIDs' '
 	git merge-tree --merge-base=side1^ side1 side3 >with-commits &&
 	git merge-tree --merge-base=side1^^{tree} side1^{tree} side3^{tree} >with-trees &&
 	test_cmp with-commits with-trees
 '
 
+test_expect_success 'content merges in threads give the same results' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 20)
+		do
+			test_write_lines 1 2 3 4 5 6 7 8 9 $i >file-$i || return 1
+		done &&
+		printf "\0base" >binary &&
+		test_write_lines a b c >union &&
+		echo "union merge=union" >.git/info/attributes &&
+		git add . &&
+		git commit -m base &&
+		git branch side &&
+		for i in $(test_seq 20)
+		do
+			sed -e "1s/.*/ours/" file-$i >tmp &&
+			mv tmp file-$i || return 1
+		done &&
+		sed -e "5s/.*/ours/" file-7 >tmp && mv tmp file-7 &&
+		printf "\0ours" >binary &&
+		test_write_lines a b c ours >union &&
+		git commit -a -m ours &&
+		git tag ours &&
+		git checkout side &&
+		for i in $(test_seq 20)
+		do
+			sed -e "9s/.*/theirs/" file-$i >tmp &&
+			mv tmp file-$i || return 1
+		done &&
+		sed -e "5s/.*/theirs/" file-7 >tmp && mv tmp file-7 &&
+		printf "\0theirs" >binary &&
+		test_write_lines a b c theirs >union &&
+		git commit -a -m theirs &&
+		git tag theirs &&
+
+		test_expect_code 1 env GIT_TEST_MERGE_THREADS=1 \
+			git merge-tree --write-tree ours theirs >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TEST_MERGE_THREADS=4 \
+			test_expect_code 1 \
+			git merge-tree --write-tree ours theirs >actual &&
+		test_cmp expect actual &&
+		test_trace2_data merge content_merge/threaded 22 <trace &&
+		grep "CONFLICT (content): Merge conflict in file-7" actual &&
+		grep "Cannot merge binary files: binary" actual
+	)
+'
+
+test_expect_success 'merges with few content merges do not use threads' '
+	git -C threads checkout -b few ours~ &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 few >threads/file-1 &&
+	git -C threads commit -a -m few &&
+	rm -f threads/trace &&
+	GIT_TRACE2_EVENT="$(pwd)/threads/trace" \
+		git -C threads -c merge.threads=4 merge-tree --write-tree ours few &&
+	! grep content_merge/threads threads/trace &&
+	rm threads/trace &&
+	GIT_TRACE2_EVENT="$(pwd)/threads/trace" test_expect_code 1 \
+		git -C threads -c merge.threads=4 merge-tree --write-tree ours theirs &&
+	test_trace2_data merge content_merge/threads 4 <threads/trace
+'
+
 test_expect_success 'error out on missing tree objects' '
 	git init --bare missing-tree.git &&
 	git rev-list side3 >list &&
@@ -28,17 +28,20 @@ has_any () {
 
 test_bitmap_cases () {
 	writeLookupTable=false
+	writeRoaring=false
 	for i in "$@"
 	do
 		case "$i" in
 		"pack.writeBitmapLookupTable") writeLookupTable=true;;
+		"pack.writeBitmapRoaring") writeRoaring=true;;
 		esac
 	done
 
 	test_expect_success 'setup test repository' '
 		rm -fr * .git &&
 		git init &&
-		git config pack.writeBitmapLookupTable '"$writeLookupTable"'
+		git config pack.writeBitmapLookupTable '"$writeLookupTable"' &&
+		git config pack.writeBitmapRoaring '"$writeRoaring"'
 	'
 	setup_bitmap_history
 
@@ -259,6 +262,7 @@ test_bitmap_cases () {
 	test_expect_success 'truncated bitmap fails gracefully (ewah)' '
 		test_config pack.writebitmaphashcache false &&
 		test_config pack.writebitmaplookuptable false &&
+		test_config pack.writeBitmapRoaring false &&
 		git repack -ad &&
 		git rev-list --use-bitmap-index --count --all >expect &&
 		bitmap=$(ls .git/objects/pack/*.bitmap) &&
@@ -272,6 +276,7 @@ test_bitmap_cases () {
 
 	test_expect_success 'truncated bitmap fails gracefully (cache)' '
 		git config pack.writeBitmapLookupTable '"$writeLookupTable"' &&
+		git config pack.writeBitmapRoaring '"$writeRoaring"' &&
 		git repack -ad &&
 		git rev-list --use-bitmap-index --count --all >expect &&
 		bitmap=$(ls .git/objects/pack/*.bitmap) &&
@@ -371,6 +376,7 @@ test_bitmap_cases () {
 		(
 			cd repo &&
 			git config pack.writeBitmapLookupTable '"$writeLookupTable"' &&
+			git config pack.writeBitmapRoaring '"$writeRoaring"' &&
 
 			# create enough commits that not all are receive bitmap
 			# coverage even if they are all at the tip of some reference.
@@ -410,6 +416,7 @@ test_bitmap_cases () {
 		(
 			cd repo &&
 			git config pack.writeBitmapLookupTable '"$writeLookupTable"' &&
+			git config pack.writeBitmapRoaring '"$writeRoaring"' &&
 			test_commit_bulk --message="%s" 103 &&
 
 			cat >>.git/config <<-\EOF &&
@@ -431,6 +438,7 @@ test_bitmap_cases () {
 		(
 			cd repo &&
 			git config pack.writeBitmapLookupTable '"$writeLookupTable"' &&
+			git config pack.writeBitmapRoaring '"$writeRoaring"' &&
 
 			test_commit base &&
 
@@ -535,4 +543,39 @@ test_expect_success 'truncated bitmap fails gracefully (lookup table)' '
 	test_grep corrupted.bitmap.index stderr
 '
 
+test_bitmap_cases "pack.writeBitmapRoaring"
+
+test_expect_success 'roaring bitmaps are written as version 2' '
+	test_config pack.writeBitmapRoaring true &&
+	git repack -adb &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	echo " 00 02" >expect &&
+	od -An -tx1 -j4 -N2 $bitmap >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'roaring bitmaps with lookup table' '
+	test_config pack.writeBitmapRoaring true &&
+	test_config pack.writeBitmapLookupTable true &&
+	git repack -adb &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --count --objects --all >expect &&
+	git rev-list --use-bitmap-index --count --objects --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'truncated roaring bitmap fails gracefully' '
+	test_config pack.writeBitmapRoaring true &&
+	test_config pack.writebitmaphashcache false &&
+	git repack -adb &&
+	git rev-list --use-bitmap-index --count --all >expect &&
+	bitmap=$(ls .git/objects/pack/*.bitmap) &&
+	test_when_finished "rm -f $bitmap" &&
+	test_copy_bytes 512 <$bitmap >$bitmap.tmp &&
+	mv -f $bitmap.tmp $bitmap &&
+	git rev-list --use-bitmap-index --count --all >actual 2>stderr &&
+	test_cmp expect actual &&
+	test_grep corrupt stderr
+'
+
 test_done
@@ -96,6 +96,53 @@ test_expect_success 'packing produces a long delta' '
 	test_cmp expect actual
 '
 
+test_expect_success 'delta base cache reports chain statistics' '
+	test_when_finished "rm -rf dbc trace.event" &&
+	git init --bare dbc &&
+	git pack-objects --all --window=0 </dev/null \
+		dbc/objects/pack/pack &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C dbc cat-file --batch-all-objects --batch >/dev/null &&
+	grep "\"delta_base_cache\".*\"max_chain_depth\":9" trace.event
+'
+
+test_expect_success 'adaptive delta base cache never goes below the limit' '
+	test_when_finished "rm -rf dbc trace.event" &&
+	git init --bare dbc &&
+	git pack-objects --all --window=0 </dev/null \
+		dbc/objects/pack/pack &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C dbc -c core.deltaBaseCacheAdaptive=true \
+		-c core.deltaBaseCacheLimit=1k \
+		cat-file --batch-all-objects --batch >/dev/null &&
+	grep "\"delta_base_cache\".*\"adaptive_limit\":1024" trace.event
+'
+
+test_expect_success 'adaptive delta base cache grows when chains miss' '
+	test_when_finished "rm -rf dbc trace.event" &&
+	git init --bare dbc &&
+	git pack-objects --all --window=0 </dev/null \
+		dbc/objects/pack/pack &&
+	git -C dbc cat-file --batch-all-objects --batch-check="%(objectname)" >objects &&
+	# Read every object many times so that we get past the warm-up
+	# phase, with a cache that cannot even hold a single chain.
+	for i in $(test_seq 50)
+	do
+		cat objects || return 1
+	done >input &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C dbc -c core.deltaBaseCacheAdaptive=true \
+		-c core.deltaBaseCacheLimit=1k \
+		cat-file --batch <input >/dev/null &&
+	grep "\"delta_base_cache\".*\"adaptive_limit\":4096" trace.event &&
+
+	rm trace.event &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -C dbc -c core.deltaBaseCacheLimit=1k \
+		cat-file --batch <input >/dev/null &&
+	test_grep ! "\"adaptive_limit\"" trace.event
+'
+
 test_expect_success '--depth limits depth' '
 	pack=$(git pack-objects --all --depth=5 </dev/null pack) &&
 	echo 5 >expect &&
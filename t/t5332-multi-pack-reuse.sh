@@ -280,4 +280,42 @@ test_expect_success 'duplicate objects with verbatim reuse' '
 	)
 '
 
+test_expect_success 'filtered reuse rewrites deltas across omitted objects' '
+	git init filtered-reuse &&
+	(
+		cd filtered-reuse &&
+
+		git config pack.allowPackReuse single &&
+
+		for i in $(test_seq 32)
+		do
+			test_seq $i 100 >file &&
+			mkdir -p dir/$i &&
+			echo $i >dir/$i/file &&
+			git add file dir &&
+			test_tick &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -adfb &&
+
+		git rev-list --objects --filter=blob:none HEAD >expect.raw &&
+		cut -d" " -f1 <expect.raw | sort >expect &&
+		objects_nr=$(wc -l <expect) &&
+
+		: >trace2.txt &&
+		echo HEAD | GIT_TRACE2_EVENT="$PWD/trace2.txt" \
+			git pack-objects --stdout --revs --filter=blob:none \
+			>got.pack &&
+		test_pack_reused $objects_nr <trace2.txt &&
+
+		git index-pack -o got.idx got.pack &&
+		git show-index <got.idx | cut -d" " -f2 | sort >actual &&
+		test_cmp expect actual &&
+
+		# The deltas must resolve to the same objects, whose names
+		# were verified by index-pack.
+		git verify-pack got.idx
+	)
+'
+
 test_done
@@ -44,4 +44,112 @@ test_expect_success 'convert incremental to non-incremental' '
 
 compare_results_with_midx 'non-incremental MIDX conversion'
 
+test_expect_success 'incremental MIDX requires bitmaps in base layers' '
+	test_commit no-bitmap &&
+	git repack -d &&
+	git multi-pack-index write --incremental &&
+	cp $midx_chain chain.before &&
+
+	test_commit more &&
+	git repack -d &&
+	test_must_fail git multi-pack-index write --incremental --bitmap 2>err &&
+	test_grep "without bitmaps for the existing layers" err &&
+	test_cmp chain.before $midx_chain
+'
+
+test_expect_success 'write incremental MIDX layers with bitmaps' '
+	git init bitmaps &&
+	(
+		cd bitmaps &&
+
+		test_commit_bulk --id=first 16 &&
+		git repack -d &&
+		git multi-pack-index write --incremental --bitmap &&
+
+		test_commit_bulk --id=second 16 &&
+		git branch second-tip &&
+		git repack -d &&
+		git -c pack.writeBitmapLookupTable=true \
+			multi-pack-index write --incremental --bitmap &&
+
+		test_commit_bulk --id=third 16 &&
+		git repack -d &&
+		git multi-pack-index write --incremental --bitmap &&
+
+		test_line_count = 3 $midx_chain &&
+		for hash in $(cat $midx_chain)
+		do
+			test_path_is_file $midxdir/multi-pack-index-$hash.bitmap ||
+			return 1
+		done
+	)
+'
+
+test_expect_success 'each bitmap layer only covers its own commits' '
+	(
+		cd bitmaps &&
+
+		test-tool bitmap list-commits >bitmapped &&
+		sort -u bitmapped >bitmapped.sorted &&
+		test_line_count = 48 bitmapped &&
+		test_line_count = 48 bitmapped.sorted
+	)
+'
+
+test_expect_success 'incremental MIDX bitmaps give correct results' '
+	(
+		cd bitmaps &&
+
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --test-bitmap second-tip &&
+		git rev-list --test-bitmap HEAD~40 &&
+
+		for range in "--all" "HEAD ^second-tip" "second-tip ^HEAD~40"
+		do
+			git rev-list --objects $range >expect.raw &&
+			git rev-list --objects --use-bitmap-index $range >actual.raw &&
+			cut -d" " -f1 <expect.raw | sort >expect &&
+			cut -d" " -f1 <actual.raw | sort >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
+test_expect_success 'incremental MIDX bitmaps reuse bitmaps of base layers' '
+	(
+		cd bitmaps &&
+
+		test_commit_bulk --id=fourth 4 &&
+		git repack -d &&
+		GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+			git multi-pack-index write --incremental --bitmap &&
+		grep "\"key\":\"building_bitmaps_reused\",\"value\":\"[1-9]" trace2.txt &&
+
+		git rev-list --test-bitmap HEAD
+	)
+'
+
+test_expect_success 'convert non-incremental MIDX bitmap to incremental' '
+	git init convert &&
+	(
+		cd convert &&
+
+		test_commit_bulk --id=base 8 &&
+		git repack -ad &&
+		git multi-pack-index write --bitmap &&
+		old_hash="$(midx_checksum $objdir)" &&
+
+		test_commit_bulk --id=incr 8 &&
+		git repack -d &&
+		git multi-pack-index write --incremental --bitmap &&
+
+		test_path_is_missing $packdir/multi-pack-index &&
+		test_path_is_file $midxdir/multi-pack-index-$old_hash.bitmap &&
+		git rev-list --test-bitmap HEAD &&
+		git rev-list --count --objects --all >expect &&
+		git rev-list --count --objects --use-bitmap-index --all >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -1016,6 +1016,38 @@ test_expect_success 'fetch-pack with fsckObjects and keep-file does not segfault
 	    -C client fetch-pack -k -k ../server HEAD
 '
 
+test_expect_success 'setup negotiation with reachability bitmaps' '
+	rm -rf server client &&
+	git init server &&
+	test_commit_bulk -C server --id=both_have 100 &&
+	git clone server client &&
+	test_commit -C server server_has &&
+	git -C server repack -adb &&
+	test_commit_bulk -C client --id=client_has 20
+'
+
+for version in 0 2
+do
+	test_expect_success "protocol v$version server answers haves with bitmaps" '
+		test_when_finished "rm -rf clientv$version trace" &&
+		cp -r client clientv$version &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git -C clientv$version \
+			-c protocol.version=$version fetch origin server_has &&
+		test_trace2_data upload-pack negotiation/wants-by-bitmap 1 <trace &&
+		git -C clientv$version cat-file -e "$(git -C server rev-parse server_has)"
+	'
+
+	test_expect_success "protocol v$version with uploadpack.negotiationBitmaps=false" '
+		test_when_finished "rm -rf clientv$version trace" &&
+		test_config -C server uploadpack.negotiationBitmaps false &&
+		cp -r client clientv$version &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" git -C clientv$version \
+			-c protocol.version=$version fetch origin server_has &&
+		test_trace2_data upload-pack negotiation/wants-by-bitmap 0 <trace &&
+		git -C clientv$version cat-file -e "$(git -C server rev-parse server_has)"
+	'
+done
+
 test_expect_success 'filtering by size' '
 	rm -rf server client &&
 	test_create_repo server &&
@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='upload-pack response cache'
+
+. ./test-lib.sh
+
+cache=.git/upload-pack-cache
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git config uploadpack.packCache true
+'
+
+# Clone the repository into "dst" with GIT_TRACE2_EVENT in "trace".
+cached_clone () {
+	rm -rf dst trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git clone --no-local "$@" . dst
+}
+
+test_expect_success 'a response is cached' '
+	test_when_finished "rm -rf $cache" &&
+	cached_clone &&
+	test_trace2_data upload-pack pack-cache/hit 0 <trace &&
+	ls $cache/*.pack >packs &&
+	test_line_count = 1 packs &&
+
+	cached_clone &&
+	test_trace2_data upload-pack pack-cache/hit 1 <trace &&
+	git -C dst fsck &&
+	git rev-parse two >expect &&
+	git -C dst rev-parse origin/HEAD >actual &&
+	test_cmp expect actual
+'
+
+for v in 0 2
+do
+	test_expect_success "responses are replayed with protocol v$v" '
+		test_when_finished "rm -rf $cache" &&
+		cached_clone -c protocol.version=$v &&
+		cached_clone -c protocol.version=$v &&
+		test_trace2_data upload-pack pack-cache/hit 1 <trace &&
+		git -C dst fsck
+	'
+done
+
+test_expect_success 'different requests are cached separately' '
+	test_when_finished "rm -rf $cache" &&
+	cached_clone &&
+	git -C dst reset --hard one &&
+	git -C dst update-ref refs/remotes/origin/main one &&
+	test_commit three &&
+	rm -f trace &&
+	GIT_TRACE2_EVENT="$(pwd)/trace" git -C dst fetch --no-tags origin &&
+	test_trace2_data upload-pack pack-cache/hit 0 <trace &&
+	ls $cache/*.pack >packs &&
+	test_line_count = 2 packs
+'
+
+test_expect_success 'new tags are not missed when tags are included' '
+	test_when_finished "rm -rf $cache" &&
+	cached_clone &&
+	git tag -a -m "annotated" annotated HEAD &&
+	cached_clone &&
+	test_trace2_data upload-pack pack-cache/hit 0 <trace &&
+	git -C dst rev-parse annotated^{tag}
+'
+
+test_expect_success 'filtered requests are cached separately' '
+	test_when_finished "rm -rf $cache" &&
+	git config uploadpack.allowFilter true &&
+	cached_clone &&
+	cached_clone --no-checkout --filter=blob:none &&
+	test_trace2_data upload-pack pack-cache/hit 0 <trace &&
+	git -C dst rev-list --objects --missing=print --all >objects &&
+	grep "^?" objects
+'
+
+test_expect_success 'uploadpack.packCacheMaxSize drops responses' '
+	test_when_finished "rm -rf $cache" &&
+	git config uploadpack.packCacheMaxSize 1 &&
+	test_when_finished "git config --unset uploadpack.packCacheMaxSize" &&
+	cached_clone &&
+	test_trace2_data upload-pack pack-cache/hit 0 <trace &&
+	test_dir_is_empty $cache
+'
+
+test_expect_success 'uploadpack.packCacheMaxAge drops old responses' '
+	test_when_finished "rm -rf $cache" &&
+	cached_clone &&
+	ls $cache/*.pack >old &&
+	test-tool chmtime =-100 $(cat old) &&
+	git config uploadpack.packCacheMaxAge 10 &&
+	test_when_finished "git config --unset uploadpack.packCacheMaxAge" &&
+	cached_clone --no-checkout --filter=blob:none &&
+	ls $cache/*.pack >packs &&
+	test_line_count = 1 packs &&
+	! test_cmp old packs
+'
+
+test_expect_success 'the cache is not used unless enabled' '
+	git config uploadpack.packCache false &&
+	cached_clone &&
+	! grep pack-cache/hit trace &&
+	test_path_is_missing $cache
+'
+
+test_done
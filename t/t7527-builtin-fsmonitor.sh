@@ -1088,6 +1088,56 @@ test_expect_success 'split-index and FSMonitor work well together' '
 	)
 '
 
+test_expect_success UNTRACKED_CACHE 'editing tracked files keeps untracked-cache valid' '
+	test_when_finished "stop_daemon_delete_repo uc_edit" &&
+
+	git init uc_edit &&
+	mkdir -p uc_edit/dir1/dir2 &&
+	echo 1 >uc_edit/dir1/dir2/file &&
+	echo "*.ign" >uc_edit/dir1/.gitignore &&
+	git -C uc_edit add . &&
+	git -C uc_edit commit -q -m initial &&
+	git -C uc_edit config core.fsmonitor true &&
+	git -C uc_edit config core.untrackedcache true &&
+	start_daemon -C uc_edit &&
+
+	# populate the untracked-cache and get a real token
+	git -C uc_edit status &&
+	git -C uc_edit status &&
+
+	echo 2 >uc_edit/dir1/dir2/file &&
+	GIT_TRACE2_PERF="$PWD/uc_edit.perf" \
+		git -C uc_edit status --porcelain >actual &&
+	echo " M dir1/dir2/file" >expect &&
+	test_cmp expect actual &&
+	grep "\.opendir:0$" uc_edit.perf &&
+
+	>uc_edit/dir1/dir2/new &&
+	>uc_edit/dir1/dir2/file.ign &&
+	git -C uc_edit status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir1/dir2/file
+	?? dir1/dir2/new
+	EOF
+	test_cmp expect actual &&
+
+	echo new >>uc_edit/dir1/.gitignore &&
+	git -C uc_edit status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir1/.gitignore
+	 M dir1/dir2/file
+	EOF
+	test_cmp expect actual &&
+
+	rm uc_edit/dir1/dir2/file &&
+	mkdir uc_edit/dir1/dir2/file &&
+	>uc_edit/dir1/dir2/file/inner &&
+	git -C uc_edit status --porcelain >actual &&
+	git -C uc_edit -c core.fsmonitor=false -c core.untrackedcache=false \
+		status --porcelain >expect &&
+	test_cmp expect actual
+'
+
 # The FSMonitor daemon reports the OBSERVED pathname of modified files
 # and thus contains the OBSERVED spelling on case-insensitive file
 # systems.  The daemon does not (and should not) load the .git/index
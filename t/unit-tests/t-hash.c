@@ -24,6 +24,48 @@ static void check_hash_data(const void *data, size_t data_length,
 	}
 }
 
+/*
+ * Hash many messages of different lengths (and with different amounts
+ * of data already fed to their contexts) at once, and check that we
+ * get the same results as when hashing them one by one.
+ */
+static void check_hash_multi(const char *data, size_t data_length)
+{
+	for (size_t i = 1; i < ARRAY_SIZE(hash_algos); i++) {
+		const struct git_hash_algo *algop = &hash_algos[i];
+		git_hash_ctx ctx[150], *ctxp[150];
+		struct object_id oid[150], *oidp[150], expect;
+		const void *in[150];
+		size_t len[150];
+		size_t nr = ARRAY_SIZE(ctx);
+
+		for (size_t j = 0; j < nr; j++) {
+			algop->init_fn(&ctx[j]);
+			algop->update_fn(&ctx[j], data, j % 70);
+			ctxp[j] = &ctx[j];
+			oidp[j] = &oid[j];
+			in[j] = data + j;
+			len[j] = j * 7 % 200;
+		}
+		len[nr - 1] = data_length - nr;
+
+		algop->final_oid_multi_fn(oidp, ctxp, in, len, nr);
+
+		for (size_t j = 0; j < nr; j++) {
+			git_hash_ctx one;
+
+			algop->init_fn(&one);
+			algop->update_fn(&one, data, j % 70);
+			algop->update_fn(&one, in[j], len[j]);
+			algop->final_oid_fn(&expect, &one);
+			if (!check(oideq(&oid[j], &expect)) ||
+			    !check_int(oid[j].algo, ==, expect.algo))
+				test_msg("%s: message %"PRIuMAX" differs",
+					 algop->name, (uintmax_t)j);
+		}
+	}
+}
+
 /* Works with a NUL terminated string. Doesn't work if it should contain a NUL character. */
 #define TEST_HASH_STR(data, expected_sha1, expected_sha256) do { \
 		const char *expected_hashes[] = { expected_sha1, expected_sha256 }; \
@@ -77,6 +119,9 @@ int cmd_main(int argc UNUSED, const char **argv UNUSED)
 		"4b825dc642cb6eb9a060e54bf8d69288fbee4904",
 		"6ef19b41225c5369f1c104d45d8d85efa9b057b53b14b4b9b939dd74decc5321");
 
+	TEST(check_hash_multi(alphabet_100000.buf, alphabet_100000.len),
+	     "final_oid_multi_fn gives the same results as final_oid_fn");
+
 	strbuf_release(&aaaaaaaaaa_100000);
 	strbuf_release(&alphabet_100000);
 
@@ -1,5 +1,6 @@
 #include "test-lib.h"
 #include "lib-reftable.h"
+#include "reftable/blockcache.h"
 #include "reftable/blocksource.h"
 #include "reftable/reader.h"
 
@@ -88,9 +89,158 @@ static int t_reader_reseek(void)
 	return 0;
 }
 
+static int t_reader_seek_ascending(void)
+{
+	struct reftable_write_options opts = {
+		.block_size = 256,
+	};
+	struct reftable_ref_record records[100] = { 0 };
+	struct reftable_block_source source = { 0 };
+	struct reftable_ref_record ref = { 0 };
+	struct reftable_iterator it = { 0 };
+	struct reftable_reader *reader;
+	struct reftable_buf buf = REFTABLE_BUF_INIT;
+	char name[100];
+	int ret;
+
+	for (size_t i = 0; i < ARRAY_SIZE(records); i++) {
+		xsnprintf(name, sizeof(name), "refs/heads/branch-%04d",
+			  (int) i * 2);
+		records[i].refname = xstrdup(name);
+		records[i].value_type = REFTABLE_REF_VAL1;
+		t_reftable_set_hash(records[i].value.val1, i, REFTABLE_HASH_SHA1);
+	}
+
+	t_reftable_write_to_buf(&buf, records, ARRAY_SIZE(records), NULL, 0, &opts);
+	block_source_from_buf(&source, &buf);
+
+	ret = reftable_reader_new(&reader, &source, "name");
+	check(!ret);
+	check(reader->ref_offsets.index_offset > 0);
+
+	reftable_reader_init_ref_iterator(reader, &it);
+
+	/*
+	 * Seek to every existing and to every missing record in ascending
+	 * order, which mostly stays within the same block.
+	 */
+	for (size_t i = 0; i < ARRAY_SIZE(records); i++) {
+		ret = reftable_iterator_seek_ref(&it, records[i].refname);
+		check(!ret);
+		ret = reftable_iterator_next_ref(&it, &ref);
+		check(!ret);
+		check_str(ref.refname, records[i].refname);
+
+		xsnprintf(name, sizeof(name), "refs/heads/branch-%04d",
+			  (int) i * 2 + 1);
+		ret = reftable_iterator_seek_ref(&it, name);
+		if (i + 1 == ARRAY_SIZE(records)) {
+			/* The key is past the end of the table. */
+			check_int(ret, ==, 1);
+			break;
+		}
+		check(!ret);
+		ret = reftable_iterator_next_ref(&it, &ref);
+		check(!ret);
+		check_str(ref.refname, records[i + 1].refname);
+	}
+
+	/* Seeking backwards must work, too. */
+	for (size_t i = ARRAY_SIZE(records); i--; ) {
+		ret = reftable_iterator_seek_ref(&it, records[i].refname);
+		check(!ret);
+		ret = reftable_iterator_next_ref(&it, &ref);
+		check(!ret);
+		check_str(ref.refname, records[i].refname);
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(records); i++)
+		reftable_free(records[i].refname);
+	reftable_ref_record_release(&ref);
+	reftable_iterator_destroy(&it);
+	reftable_reader_decref(reader);
+	reftable_buf_release(&buf);
+	return 0;
+}
+
+static int t_reader_block_cache(void)
+{
+	struct reftable_write_options opts = {
+		.block_size = 256,
+	};
+	struct reftable_log_record logs[100] = { 0 };
+	struct reftable_block_source source = { 0 };
+	struct reftable_log_record log = { 0 };
+	struct reftable_iterator it = { 0 };
+	struct reftable_reader *reader;
+	struct block_cache *cache;
+	struct reftable_buf buf = REFTABLE_BUF_INIT;
+	char name[100];
+	int ret;
+
+	for (size_t i = 0; i < ARRAY_SIZE(logs); i++) {
+		xsnprintf(name, sizeof(name), "refs/heads/branch-%04d", (int) i);
+		logs[i].refname = xstrdup(name);
+		logs[i].update_index = i + 1;
+		logs[i].value_type = REFTABLE_LOG_UPDATE;
+		logs[i].value.update.name = xstrdup("committer");
+		logs[i].value.update.email = xstrdup("committer@example.com");
+		xsnprintf(name, sizeof(name), "message %d\n", (int) i);
+		logs[i].value.update.message = xstrdup(name);
+		t_reftable_set_hash(logs[i].value.update.new_hash, i,
+				    REFTABLE_HASH_SHA1);
+	}
+
+	t_reftable_write_to_buf(&buf, NULL, 0, logs, ARRAY_SIZE(logs), &opts);
+	block_source_from_buf(&source, &buf);
+
+	ret = reftable_reader_new(&reader, &source, "name");
+	check(!ret);
+
+	/* Only a couple of decompressed blocks fit into the cache. */
+	ret = block_cache_new(&cache, 1024);
+	check(!ret);
+	reader_set_block_cache(reader, cache);
+	block_cache_decref(cache);
+
+	reftable_reader_init_log_iterator(reader, &it);
+
+	/*
+	 * Read every log twice in a row, so that the second read hits the
+	 * cache, and then once more in reverse order so that we read from
+	 * blocks that have been evicted.
+	 */
+	for (size_t n = 0; n < 2 * ARRAY_SIZE(logs); n++) {
+		size_t i = n / 2;
+
+		ret = reftable_iterator_seek_log(&it, logs[i].refname);
+		check(!ret);
+		ret = reftable_iterator_next_log(&it, &log);
+		check(!ret);
+		check(reftable_log_record_equal(&log, &logs[i], REFTABLE_HASH_SIZE_SHA1));
+	}
+	for (size_t i = ARRAY_SIZE(logs); i--; ) {
+		ret = reftable_iterator_seek_log(&it, logs[i].refname);
+		check(!ret);
+		ret = reftable_iterator_next_log(&it, &log);
+		check(!ret);
+		check(reftable_log_record_equal(&log, &logs[i], REFTABLE_HASH_SIZE_SHA1));
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(logs); i++)
+		reftable_log_record_release(&logs[i]);
+	reftable_log_record_release(&log);
+	reftable_iterator_destroy(&it);
+	reftable_reader_decref(reader);
+	reftable_buf_release(&buf);
+	return 0;
+}
+
 int cmd_main(int argc UNUSED, const char *argv[] UNUSED)
 {
 	TEST(t_reader_seek_once(), "reader can seek once");
 	TEST(t_reader_reseek(), "reader can reseek multiple times");
+	TEST(t_reader_seek_ascending(), "reader can seek to ascending keys");
+	TEST(t_reader_block_cache(), "reader can read through a block cache");
 	return test_done();
 }
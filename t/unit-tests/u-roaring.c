@@ -0,0 +1,164 @@
+#include "unit-test.h"
+#include "ewah/ewok.h"
+#include "strbuf.h"
+
+static int write_strbuf(void *out, const void *buf, size_t len)
+{
+	strbuf_add(out, buf, len);
+	return len;
+}
+
+/*
+ * Serialize "ewah" as a roaring bitmap, read it back and check that
+ * every accessor agrees with the original.
+ */
+static void check_roundtrip(struct ewah_bitmap *ewah)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct roaring_bitmap roaring = { 0 };
+	struct bitmap *expect = ewah_to_bitmap(ewah);
+	struct bitmap *actual;
+	struct ewah_bitmap *back;
+	ssize_t len;
+
+	len = roaring_serialize_ewah(ewah, write_strbuf, &buf);
+	cl_assert_equal_i(len, buf.len);
+	cl_assert_equal_i(roaring_read_mmap(&roaring, buf.buf, buf.len), len);
+	cl_assert_equal_i(roaring.bit_size, ewah->bit_size);
+
+	cl_assert_equal_i(roaring_popcount(&roaring), bitmap_popcount(expect));
+	for (size_t i = 0; i < ewah->bit_size + 64; i++)
+		cl_assert_equal_i(roaring_get(&roaring, i), bitmap_get(expect, i));
+
+	actual = roaring_to_bitmap(&roaring);
+	cl_assert(bitmap_equals(actual, expect));
+	bitmap_free(actual);
+
+	back = roaring_to_ewah(&roaring);
+	cl_assert(bitmap_equals_ewah(expect, back));
+	ewah_free(back);
+
+	/* OR-ing into a bitmap must keep the bits that were already set */
+	actual = bitmap_new();
+	bitmap_set(actual, 3);
+	bitmap_set(actual, ewah->bit_size + 100);
+	bitmap_or_roaring(actual, &roaring);
+	bitmap_set(expect, 3);
+	bitmap_set(expect, ewah->bit_size + 100);
+	cl_assert(bitmap_equals(actual, expect));
+	bitmap_free(actual);
+
+	/* truncation must be detected */
+	cl_assert_equal_i(roaring_read_mmap(&roaring, buf.buf, 4), -1);
+	cl_assert_equal_i(roaring_read_mmap(&roaring, buf.buf, buf.len - 1), -1);
+
+	roaring_release(&roaring);
+	bitmap_free(expect);
+	strbuf_release(&buf);
+}
+
+void test_roaring__empty(void)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	check_roundtrip(ewah);
+	ewah_free(ewah);
+}
+
+void test_roaring__sparse(void)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	for (size_t i = 0; i < 200000; i += 977)
+		ewah_set(ewah, i);
+	check_roundtrip(ewah);
+	ewah_free(ewah);
+}
+
+void test_roaring__dense(void)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	for (size_t i = 0; i < 150000; i++)
+		if (i % 3)
+			ewah_set(ewah, i);
+	check_roundtrip(ewah);
+	ewah_free(ewah);
+}
+
+void test_roaring__runs(void)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	for (size_t i = 10; i < 70000; i++)
+		ewah_set(ewah, i);
+	for (size_t i = 131072; i < 131072 + 65536; i++)
+		ewah_set(ewah, i);
+	for (size_t i = 300000; i < 400000; i += 1000)
+		for (size_t j = 0; j < 50; j++)
+			ewah_set(ewah, i + j);
+	check_roundtrip(ewah);
+	ewah_free(ewah);
+}
+
+void test_roaring__mixed(void)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	for (size_t i = 0; i < 5; i++)
+		ewah_set(ewah, i * 7);
+	for (size_t i = 65536; i < 2 * 65536; i++)
+		if (i % 5 != 1)
+			ewah_set(ewah, i);
+	for (size_t i = 4 * 65536; i < 4 * 65536 + 20000; i++)
+		ewah_set(ewah, i);
+	ewah_set(ewah, 9 * 65536 + 65535);
+	check_roundtrip(ewah);
+	ewah_free(ewah);
+}
+
+/*
+ * Container payloads are not validated when reading, so OR-ing a
+ * container with out-of-order values must still stay within its chunk.
+ */
+void test_roaring__unsorted_array(void)
+{
+	const unsigned char buf[] = {
+		0x00, 0x01, 0x00, 0x00, /* bit_size */
+		0x00, 0x00, 0x00, 0x01, /* one container */
+		0x00, 0x00, ROARING_CONTAINER_ARRAY, 0x00, 0x00, 0x00, 0x00, 0x02,
+		0xff, 0xff, 0x00, 0x00, /* 65535, 0 */
+	};
+	struct roaring_bitmap roaring = { 0 };
+	struct bitmap *bitmap = bitmap_new();
+
+	cl_assert_equal_i(roaring_read_mmap(&roaring, buf, sizeof(buf)), sizeof(buf));
+	bitmap_or_roaring(bitmap, &roaring);
+	cl_assert_equal_i(bitmap_popcount(bitmap), 2);
+	cl_assert(bitmap_get(bitmap, 0));
+	cl_assert(bitmap_get(bitmap, 65535));
+
+	bitmap_free(bitmap);
+	roaring_release(&roaring);
+}
+
+void test_roaring__reserved_byte(void)
+{
+	const unsigned char buf[] = {
+		0x00, 0x00, 0x00, 0x40, /* bit_size */
+		0x00, 0x00, 0x00, 0x01, /* one container */
+		0x00, 0x00, ROARING_CONTAINER_ARRAY, 0x01, 0x00, 0x00, 0x00, 0x01,
+		0x00, 0x05,
+	};
+	struct roaring_bitmap roaring = { 0 };
+
+	cl_assert_equal_i(roaring_read_mmap(&roaring, buf, sizeof(buf)), -1);
+}
+
+void test_roaring__key_past_bit_size(void)
+{
+	const unsigned char buf[] = {
+		0x00, 0x01, 0x00, 0x00, /* bit_size */
+		0x00, 0x00, 0x00, 0x01, /* one container */
+		0xff, 0xff, ROARING_CONTAINER_ARRAY, 0x00, 0x00, 0x00, 0x00, 0x01,
+		0x00, 0x05,
+	};
+	struct roaring_bitmap roaring = { 0 };
+
+	cl_assert_equal_i(roaring_read_mmap(&roaring, buf, sizeof(buf)), -1);
+}
@@ -169,9 +169,12 @@ int tree_entry_gently(struct tree_desc *desc, struct name_entry *entry)
 	return 1;
 }
 
+/*
+ * Statistics only; the depth of a traversal is tracked in its
+ * traverse_info, so that traversals may run in several threads.
+ */
 static int traverse_trees_atexit_registered;
 static int traverse_trees_count;
-static int traverse_trees_cur_depth;
 static int traverse_trees_max_depth;
 
 static void trace2_traverse_trees_statistics_atexit(void)
@@ -442,14 +445,16 @@ int traverse_trees(struct index_state *istate,
 	int interesting = 1;
 	char *traverse_path;
 
-	if (traverse_trees_cur_depth > max_allowed_tree_depth)
+	if (info->depth > max_allowed_tree_depth)
 		return error("exceeded maximum allowed tree depth");
 
-	traverse_trees_count++;
-	traverse_trees_cur_depth++;
+	info->depth++;
 
-	if (traverse_trees_cur_depth > traverse_trees_max_depth)
-		traverse_trees_max_depth = traverse_trees_cur_depth;
+	obj_read_lock();
+	traverse_trees_count++;
+	if (info->depth > traverse_trees_max_depth)
+		traverse_trees_max_depth = info->depth;
+	obj_read_unlock();
 
 	ALLOC_ARRAY(entry, n);
 	ALLOC_ARRAY(tx, n);
@@ -553,7 +558,7 @@ int traverse_trees(struct index_state *istate,
 	info->traverse_path = NULL;
 	strbuf_release(&base);
 
-	traverse_trees_cur_depth--;
+	info->depth--;
 	return ret;
 }
 
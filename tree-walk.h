@@ -173,6 +173,12 @@ struct traverse_info {
 
 	/* tells whether to stop at the first error or not. */
 	int show_all_errors;
+
+	/*
+	 * is the number of traverse_trees() calls this traversal is nested
+	 * in; a copy of the traverse_info of the parent tree carries it over.
+	 */
+	int depth;
 };
 
 /**
@@ -31,6 +31,9 @@
 #include "entry.h"
 #include "parallel-checkout.h"
 #include "setup.h"
+#include "config.h"
+#include "thread-utils.h"
+#include "mem-pool.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -234,6 +237,81 @@ static void add_entry(struct unpack_trees_options *o,
 	do_add_entry(o, dup_cache_entry(ce, &o->internal.result), set, clear);
 }
 
+/*
+ * When unpacking in parallel (see traverse_trees_parallel()), each top-level
+ * directory that is a directory in all the trees is unpacked by a thread
+ * into its own slot, using its own copy of the options. The rest of the
+ * top-level entries are unpacked by the main thread into the slots in
+ * between, so that concatenating the slots gives the sequential result.
+ */
+struct unpack_trees_slot {
+	struct unpack_trees_options o;
+	struct unpack_trees_parallel *parallel;
+
+	/* the part of the source index unpacked by this slot */
+	struct index_state src;
+	struct cache_def lstat_cache;
+
+	/* rejected paths, with their unpack_trees_error_types in util */
+	struct string_list rejects;
+	int ret;
+
+	/* the top-level directory unpacked by this slot, if any */
+	int seq;
+	int n;
+	unsigned long mask;
+	struct name_entry names[MAX_UNPACK_TREES];
+};
+
+struct unpack_trees_parallel {
+	struct index_state *src_index;
+	struct traverse_info info;
+
+	/* the source index without the directories given to the threads */
+	struct index_state rest;
+
+	struct unpack_trees_slot *slots;
+	int nr_slots, alloc_slots;
+	int seq;
+
+	pthread_mutex_t mutex;
+	int next_slot;
+
+	/* serializes the accesses to what the slots share, see src_lock() */
+	pthread_mutex_t src_mutex;
+};
+
+/*
+ * The copies of the options used by threads only see their part of the
+ * source index as o->src_index; this returns the whole of it, which is
+ * needed for anything that may look outside of the part, like attributes
+ * or the cache-tree. Such accesses are serialized with src_lock().
+ */
+static struct index_state *full_src_index(struct unpack_trees_options *o)
+{
+	if (o->internal.slot)
+		return o->internal.slot->parallel->src_index;
+	return o->src_index;
+}
+
+/*
+ * Serialize the accesses of the threads to the whole source index, its
+ * cache-tree and untracked cache, and the exclude and directory scanning
+ * state. This is a no-op unless unpacking in parallel. The mutex is
+ * recursive, as e.g. check_ok_to_remove() may end up in verify_uptodate().
+ */
+static void src_lock(struct unpack_trees_options *o)
+{
+	if (o->internal.slot)
+		pthread_mutex_lock(&o->internal.slot->parallel->src_mutex);
+}
+
+static void src_unlock(struct unpack_trees_options *o)
+{
+	if (o->internal.slot)
+		pthread_mutex_unlock(&o->internal.slot->parallel->src_mutex);
+}
+
 /*
  * add error messages on path <path>
  * corresponding to the type <e> with the message <msg>
@@ -246,6 +324,16 @@ static int add_rejected_path(struct unpack_trees_options *o,
 	if (o->quiet)
 		return -1;
 
+	/*
+	 * Threads keep the paths to report them in the order a sequential
+	 * traversal would have, once all of them are done.
+	 */
+	if (o->internal.slot) {
+		string_list_append(&o->internal.slot->rejects, path)->util =
+			(void *)(intptr_t)e;
+		return -1;
+	}
+
 	if (!o->internal.show_all_errors)
 		return error(ERRORMSG(o, e), super_prefixed(path,
 							    o->super_prefix));
@@ -481,8 +569,20 @@ static int check_updates(struct unpack_trees_options *o,
 	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
 
 	enable_delayed_checkout(&state);
-	if (pc_workers > 1)
-		init_parallel_checkout();
+	if (pc_workers > 1) {
+		/*
+		 * A fresh clone writes into an empty working tree, so
+		 * on a case-sensitive file system none of the entries
+		 * can collide, and the workers can start writing while
+		 * we are still going through the index.
+		 */
+		if (o->clone && !ignore_case)
+			init_parallel_checkout_streaming(&state, pc_workers,
+							 pc_threshold, progress,
+							 &cnt);
+		else
+			init_parallel_checkout();
+	}
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -764,7 +864,11 @@ static int all_trees_same_as_cache_tree(int n, unsigned long dirmask,
 		if (!are_same_oid(names, names + i))
 			return 0;
 
-	return cache_tree_matches_traversal(o->src_index->cache_tree, names, info);
+	/* other threads may be invalidating paths in the cache-tree */
+	src_lock(o);
+	i = cache_tree_matches_traversal(o->src_index->cache_tree, names, info);
+	src_unlock(o);
+	return i;
 }
 
 static int index_pos_by_traverse_info(struct name_entry *names,
@@ -1869,6 +1973,404 @@ static void update_sparsity_for_prefix(const char *prefix,
 	strbuf_release(&ce_prefix);
 }
 
+static int can_unpack_in_parallel(struct unpack_trees_options *o)
+{
+	if (!o->merge || o->prefix || o->diff_index_cached ||
+	    o->internal.debug_unpack)
+		return 0;
+	if (o->fn != oneway_merge && o->fn != twoway_merge &&
+	    o->fn != threeway_merge)
+		return 0;
+	if (o->src_index->sparse_index || o->src_index->split_index ||
+	    o->internal.result.sparse_index)
+		return 0;
+	/* icase lookups and submodules look at the whole index */
+	if (ignore_case || should_update_submodules())
+		return 0;
+	if (o->pathspec && (o->pathspec->magic & PATHSPEC_ATTR))
+		return 0;
+	return 1;
+}
+
+static int get_unpack_threads(struct unpack_trees_options *o, int *min_dirs)
+{
+	char *env_threads = getenv("GIT_TEST_CHECKOUT_UNPACK_THREADS");
+	int nr_threads;
+
+	if (!HAVE_THREADS || !can_unpack_in_parallel(o))
+		return 1;
+
+	*min_dirs = 2;
+	if (env_threads && *env_threads) {
+		if (strtol_i(env_threads, 10, &nr_threads))
+			die(_("invalid value for '%s': '%s'"),
+			    "GIT_TEST_CHECKOUT_UNPACK_THREADS", env_threads);
+		*min_dirs = 1;
+	} else if (git_config_get_int("checkout.unpackthreads", &nr_threads)) {
+		nr_threads = 1;
+	}
+	if (nr_threads < 1)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
+static struct unpack_trees_slot *append_slot(struct unpack_trees_parallel *p)
+{
+	struct unpack_trees_slot *slot;
+
+	ALLOC_GROW(p->slots, p->nr_slots + 1, p->alloc_slots);
+	slot = &p->slots[p->nr_slots++];
+	memset(slot, 0, sizeof(*slot));
+	slot->seq = -1;
+	return slot;
+}
+
+/*
+ * Callback for the first pass over the top-level entries, which picks the
+ * directories that can be unpacked on their own: those that are a directory
+ * in all the trees that have them, and are neither a file nor a conflict in
+ * the index. Unpacking them does not touch anything outside of them.
+ */
+static int find_parallel_dir(int n, unsigned long mask,
+			     unsigned long dirmask,
+			     struct name_entry *names,
+			     struct traverse_info *info)
+{
+	struct unpack_trees_parallel *p = info->data;
+	struct index_state *istate = p->src_index;
+	struct unpack_trees_slot *slot;
+	const struct name_entry *e = names;
+	int seq = p->seq++;
+	int pos;
+
+	if (mask != dirmask)
+		return mask;
+
+	while (!e->mode)
+		e++;
+	pos = index_name_pos(istate, e->path, e->pathlen);
+	if (pos < 0)
+		pos = -pos - 1;
+	if (pos < istate->cache_nr &&
+	    ce_namelen(istate->cache[pos]) == e->pathlen &&
+	    !memcmp(istate->cache[pos]->name, e->path, e->pathlen))
+		return mask;
+
+	slot = append_slot(p);
+	slot->seq = seq;
+	slot->n = n;
+	slot->mask = mask;
+	COPY_ARRAY(slot->names, names, n);
+	append_slot(p);
+	return mask;
+}
+
+static void init_index_view(struct index_state *view,
+			    struct index_state *istate,
+			    struct cache_entry **cache, unsigned int nr)
+{
+	index_state_init(view, istate->repo);
+	view->cache = cache;
+	view->cache_nr = view->cache_alloc = nr;
+	view->timestamp = istate->timestamp;
+	view->cache_tree = istate->cache_tree;
+	view->version = istate->version;
+	view->initialized = 1;
+}
+
+/*
+ * Give each directory slot the run of index entries under its directory,
+ * and collect all the other entries in p->rest, which is what the slots
+ * unpacked by the main thread look at.
+ */
+static void split_src_index(struct unpack_trees_parallel *p)
+{
+	struct index_state *istate = p->src_index;
+	struct cache_entry **rest;
+	struct strbuf prefix = STRBUF_INIT;
+	unsigned int pos = 0, nr_rest = 0;
+	int i;
+
+	ALLOC_ARRAY(rest, istate->cache_nr);
+	for (i = 1; i < p->nr_slots; i += 2) {
+		struct unpack_trees_slot *slot = &p->slots[i];
+		const struct name_entry *e = slot->names;
+		unsigned int start;
+
+		while (!e->mode)
+			e++;
+		strbuf_reset(&prefix);
+		strbuf_add(&prefix, e->path, e->pathlen);
+		strbuf_addch(&prefix, '/');
+
+		while (pos < istate->cache_nr &&
+		       strncmp(istate->cache[pos]->name, prefix.buf, prefix.len) < 0)
+			rest[nr_rest++] = istate->cache[pos++];
+		start = pos;
+		while (pos < istate->cache_nr &&
+		       starts_with(istate->cache[pos]->name, prefix.buf))
+			pos++;
+		init_index_view(&slot->src, istate, istate->cache + start,
+				pos - start);
+	}
+	while (pos < istate->cache_nr)
+		rest[nr_rest++] = istate->cache[pos++];
+	init_index_view(&p->rest, istate, rest, nr_rest);
+
+	for (i = 0; i < p->nr_slots; i += 2)
+		p->slots[i].src = p->rest;
+	strbuf_release(&prefix);
+}
+
+static void init_slot(struct unpack_trees_parallel *p,
+		      struct unpack_trees_slot *slot,
+		      struct unpack_trees_options *o)
+{
+	slot->o = *o;
+	slot->o.src_index = &slot->src;
+	memset(slot->o.internal.unpack_rejects, 0,
+	       sizeof(slot->o.internal.unpack_rejects));
+	index_state_init(&slot->o.internal.result, p->src_index->repo);
+	slot->o.internal.result.initialized = 1;
+	slot->o.internal.cache_bottom = 0;
+	slot->o.internal.nontrivial_merge = 0;
+	slot->o.internal.slot = slot;
+	slot->parallel = p;
+	string_list_init_dup(&slot->rejects);
+	slot->lstat_cache = (struct cache_def)CACHE_DEF_INIT;
+}
+
+static void unpack_parallel_dirs(struct unpack_trees_parallel *p)
+{
+	for (;;) {
+		struct unpack_trees_slot *slot;
+		struct traverse_info info;
+		struct cache_entry *ce;
+
+		pthread_mutex_lock(&p->mutex);
+		if (p->next_slot >= p->nr_slots) {
+			pthread_mutex_unlock(&p->mutex);
+			break;
+		}
+		slot = &p->slots[p->next_slot];
+		p->next_slot += 2;
+		pthread_mutex_unlock(&p->mutex);
+
+		info = p->info;
+		info.data = &slot->o;
+		slot->ret = traverse_trees_recursive(slot->n, slot->mask, 0,
+						     slot->names, &info);
+		if (slot->ret < 0)
+			continue;
+
+		/* index entries that sort after all of the trees' ones */
+		while ((ce = next_cache_entry(&slot->o))) {
+			if (unpack_index_entry(ce, &slot->o) < 0) {
+				slot->ret = -1;
+				break;
+			}
+		}
+	}
+}
+
+static void *unpack_trees_thread(void *data)
+{
+	trace2_thread_start("unpack_trees");
+	unpack_parallel_dirs(data);
+	trace2_thread_exit();
+	return NULL;
+}
+
+/*
+ * Callback for the second pass, run by the main thread: unpack the
+ * top-level entries in between the directories picked by the first pass,
+ * moving on to the next slot whenever one of these directories is reached.
+ */
+static int unpack_callback_parallel(int n, unsigned long mask,
+				    unsigned long dirmask,
+				    struct name_entry *names,
+				    struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	struct unpack_trees_slot *slot = o->internal.slot;
+	struct unpack_trees_parallel *p = slot->parallel;
+	int seq, ret;
+
+	/* the traversal of subdirectories inherits this callback */
+	if (info->prev)
+		return unpack_callback(n, mask, dirmask, names, info);
+
+	seq = p->seq++;
+	if (slot < p->slots + p->nr_slots - 1 && slot[1].seq == seq) {
+		const struct name_entry *e = names;
+		struct cache_entry *ce;
+
+		/*
+		 * Index entries sorting before the directory belong to
+		 * this slot, just like unpack_callback() would have
+		 * unpacked them before recursing.
+		 */
+		while (!e->mode)
+			e++;
+		while ((ce = find_cache_entry(info, e)) &&
+		       compare_entry(ce, info, e) < 0) {
+			if (unpack_index_entry(ce, o) < 0) {
+				slot->ret = unpack_failed(o, NULL);
+				return slot->ret;
+			}
+		}
+		slot[2].o.internal.cache_bottom = o->internal.cache_bottom;
+		info->data = &slot[2].o;
+		return mask;
+	}
+
+	ret = unpack_callback(n, mask, dirmask, names, info);
+	if (ret < 0)
+		slot->ret = ret;
+	return ret;
+}
+
+/*
+ * Gather the results of the slots in order, as if a single thread had
+ * unpacked everything.
+ */
+static int finish_parallel_unpack(struct unpack_trees_parallel *p,
+				  struct unpack_trees_options *o)
+{
+	struct index_state *result = &o->internal.result;
+	int ret = 0;
+	int i, j;
+
+	for (i = 0; i < p->nr_slots; i++) {
+		struct unpack_trees_slot *slot = &p->slots[i];
+
+		for (j = 0; j < slot->rejects.nr; j++) {
+			const char *path = slot->rejects.items[j].string;
+			enum unpack_trees_error_types e =
+				(intptr_t)slot->rejects.items[j].util;
+
+			if (o->internal.show_all_errors)
+				string_list_append(&o->internal.unpack_rejects[e], path);
+			else
+				error(ERRORMSG(o, e), super_prefixed(path, o->super_prefix));
+		}
+		o->internal.nontrivial_merge |= slot->o.internal.nontrivial_merge;
+		if (slot->ret < 0) {
+			ret = slot->ret;
+			if (!o->internal.show_all_errors)
+				break;
+		}
+	}
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < p->nr_slots; i++) {
+		struct index_state *fragment = &p->slots[i].o.internal.result;
+
+		for (j = 0; j < fragment->cache_nr; j++) {
+			struct cache_entry *ce = fragment->cache[j];
+
+			if (result->cache_nr &&
+			    cmp_cache_name_compare(&result->cache[result->cache_nr - 1],
+						   &ce) >= 0)
+				BUG("unpacked entries out of order at '%s'", ce->name);
+			ce->ce_flags &= ~CE_HASHED;
+			add_index_entry(result, ce, ADD_CACHE_JUST_APPEND);
+		}
+		if (fragment->ce_mem_pool) {
+			if (!result->ce_mem_pool) {
+				CALLOC_ARRAY(result->ce_mem_pool, 1);
+				mem_pool_init(result->ce_mem_pool, 0);
+			}
+			mem_pool_combine(result->ce_mem_pool, fragment->ce_mem_pool);
+		}
+		fragment->cache_nr = 0;
+	}
+	return 0;
+}
+
+/*
+ * Unpack the top-level directories with "nr_threads" threads (including
+ * the main one), each of them into its own index, concatenated in order
+ * at the end. Falls back to traverse_trees() if there are fewer than
+ * "min_dirs" directories to spread among them.
+ */
+static int traverse_trees_parallel(unsigned len, struct tree_desc *t,
+				   struct traverse_info *info,
+				   int nr_threads, int min_dirs)
+{
+	struct unpack_trees_options *o = info->data;
+	struct unpack_trees_parallel p = { 0 };
+	struct traverse_info find_info = *info;
+	pthread_t *threads = NULL;
+	int nr_dirs, i, ret;
+
+	p.src_index = o->src_index;
+	append_slot(&p);
+	find_info.fn = find_parallel_dir;
+	find_info.data = &p;
+	find_info.show_all_errors = 1;
+	traverse_trees(o->src_index, len, t, &find_info);
+
+	nr_dirs = p.nr_slots / 2;
+	trace2_data_intmax("unpack_trees", the_repository, "unpack_trees/parallel_dirs",
+			   nr_dirs);
+	if (nr_dirs < min_dirs) {
+		free(p.slots);
+		return traverse_trees(o->src_index, len, t, info);
+	}
+
+	split_src_index(&p);
+	for (i = 0; i < p.nr_slots; i++)
+		init_slot(&p, &p.slots[i], o);
+	p.info = *info;
+	p.info.traverse_path = "";
+	p.info.depth = 1;
+	p.seq = 0;
+	p.next_slot = 1;
+	pthread_mutex_init(&p.mutex, NULL);
+	init_recursive_mutex(&p.src_mutex);
+
+	nr_threads = nr_threads - 1 < nr_dirs ? nr_threads - 1 : nr_dirs;
+	trace2_data_intmax("unpack_trees", the_repository, "unpack_trees/threads",
+			   nr_threads + 1);
+	enable_obj_read_lock();
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, unpack_trees_thread, &p);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	info->fn = unpack_callback_parallel;
+	info->data = &p.slots[0].o;
+	traverse_trees(&p.rest, len, t, info);
+	info->fn = unpack_callback;
+	info->data = o;
+
+	unpack_parallel_dirs(&p);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	disable_obj_read_lock();
+	free(threads);
+
+	ret = finish_parallel_unpack(&p, o);
+
+	for (i = 0; i < p.nr_slots; i++) {
+		struct unpack_trees_slot *slot = &p.slots[i];
+
+		slot->o.internal.result.cache_nr = 0;
+		discard_index(&slot->o.internal.result);
+		string_list_clear(&slot->rejects, 0);
+		cache_def_clear(&slot->lstat_cache);
+	}
+	free(p.rest.cache);
+	free(p.slots);
+	pthread_mutex_destroy(&p.mutex);
+	pthread_mutex_destroy(&p.src_mutex);
+	return ret;
+}
+
 static int verify_absent(const struct cache_entry *,
 			 enum unpack_trees_error_types,
 			 struct unpack_trees_options *);
@@ -1979,6 +2481,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len) {
 		const char *prefix = o->prefix ? o->prefix : "";
 		struct traverse_info info;
+		int nr_threads, min_dirs;
 
 		setup_traverse_info(&info, prefix);
 		info.fn = unpack_callback;
@@ -2005,7 +2508,12 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 		trace_performance_enter();
 		trace2_region_enter("unpack_trees", "traverse_trees", the_repository);
-		ret = traverse_trees(o->src_index, len, t, &info);
+		nr_threads = get_unpack_threads(o, &min_dirs);
+		if (nr_threads > 1)
+			ret = traverse_trees_parallel(len, t, &info,
+						      nr_threads, min_dirs);
+		else
+			ret = traverse_trees(o->src_index, len, t, &info);
 		trace2_region_leave("unpack_trees", "traverse_trees", the_repository);
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
@@ -2236,7 +2744,11 @@ static int verify_uptodate_1(const struct cache_entry *ce,
 
 	if (!lstat(ce->name, &st)) {
 		int flags = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE;
-		unsigned changed = ie_match_stat(o->src_index, ce, &st, flags);
+		unsigned changed;
+
+		src_lock(o);
+		changed = ie_match_stat(full_src_index(o), ce, &st, flags);
+		src_unlock(o);
 
 		if (submodule_from_ce(ce)) {
 			int r = check_submodule_move_head(ce,
@@ -2295,8 +2807,10 @@ static void invalidate_ce_path(const struct cache_entry *ce,
 {
 	if (!ce)
 		return;
-	cache_tree_invalidate_path(o->src_index, ce->name);
-	untracked_cache_invalidate_path(o->src_index, ce->name, 1);
+	src_lock(o);
+	cache_tree_invalidate_path(full_src_index(o), ce->name);
+	untracked_cache_invalidate_path(full_src_index(o), ce->name, 1);
+	src_unlock(o);
 }
 
 /*
@@ -2375,7 +2889,7 @@ static int verify_clean_subdirectory(const struct cache_entry *ce,
 	memset(&d, 0, sizeof(d));
 	if (o->internal.dir)
 		setup_standard_excludes(&d);
-	i = read_directory(&d, o->src_index, pathbuf, namelen+1, NULL);
+	i = read_directory(&d, full_src_index(o), pathbuf, namelen+1, NULL);
 	dir_clear(&d);
 	free(pathbuf);
 	if (i)
@@ -2410,11 +2924,11 @@ enum absent_checking_type {
 	ABSENT_ANY_DIRECTORY
 };
 
-static int check_ok_to_remove(const char *name, int len, int dtype,
-			      const struct cache_entry *ce, struct stat *st,
-			      enum unpack_trees_error_types error_type,
-			      enum absent_checking_type absent_type,
-			      struct unpack_trees_options *o)
+static int check_ok_to_remove_1(const char *name, int len, int dtype,
+				const struct cache_entry *ce, struct stat *st,
+				enum unpack_trees_error_types error_type,
+				enum absent_checking_type absent_type,
+				struct unpack_trees_options *o)
 {
 	const struct cache_entry *result;
 
@@ -2429,7 +2943,7 @@ static int check_ok_to_remove(const char *name, int len, int dtype,
 		return 0;
 
 	if (o->internal.dir &&
-	    is_excluded(o->internal.dir, o->src_index, name, &dtype))
+	    is_excluded(o->internal.dir, full_src_index(o), name, &dtype))
 		/*
 		 * ce->name is explicitly excluded, so it is Ok to
 		 * overwrite it.
@@ -2466,6 +2980,22 @@ static int check_ok_to_remove(const char *name, int len, int dtype,
 	return add_rejected_path(o, error_type, name);
 }
 
+static int check_ok_to_remove(const char *name, int len, int dtype,
+			      const struct cache_entry *ce, struct stat *st,
+			      enum unpack_trees_error_types error_type,
+			      enum absent_checking_type absent_type,
+			      struct unpack_trees_options *o)
+{
+	int ret;
+
+	/* the excludes and the directory scan are not thread-safe */
+	src_lock(o);
+	ret = check_ok_to_remove_1(name, len, dtype, ce, st, error_type,
+				   absent_type, o);
+	src_unlock(o);
+	return ret;
+}
+
 /*
  * We do not want to remove or overwrite a working tree file that
  * is not tracked, unless it is ignored.
@@ -2491,7 +3021,11 @@ static int verify_absent_1(const struct cache_entry *ce,
 		return 0;
 	}
 
-	len = check_leading_path(ce->name, ce_namelen(ce), 0);
+	if (o->internal.slot)
+		len = threaded_check_leading_path(&o->internal.slot->lstat_cache,
+						  ce->name, ce_namelen(ce), 0);
+	else
+		len = check_leading_path(ce->name, ce_namelen(ce), 0);
 	if (!len)
 		return 0;
 	else if (len > 0) {
@@ -3032,9 +3566,14 @@ int oneway_merge(const struct cache_entry * const *src,
 		if (o->reset && o->update && !ce_uptodate(old) && !ce_skip_worktree(old) &&
 			!(old->ce_flags & CE_FSMONITOR_VALID)) {
 			struct stat st;
-			if (lstat(old->name, &st) ||
-			    ie_match_stat(o->src_index, old, &st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE))
+			if (lstat(old->name, &st))
 				update |= CE_UPDATE;
+			else {
+				src_lock(o);
+				if (ie_match_stat(full_src_index(o), old, &st, CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE))
+					update |= CE_UPDATE;
+				src_unlock(o);
+			}
 		}
 		if (o->update && S_ISGITLINK(old->ce_mode) &&
 		    should_update_submodules() && !verify_uptodate(old, o))
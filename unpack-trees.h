@@ -11,6 +11,7 @@
 
 struct cache_entry;
 struct unpack_trees_options;
+struct unpack_trees_slot;
 struct pattern_list;
 
 typedef int (*merge_fn_t)(const struct cache_entry * const *src,
@@ -107,6 +108,12 @@ struct unpack_trees_options {
 
 		struct pattern_list *pl;
 		struct dir_struct *dir;
+
+		/*
+		 * Set in the copies of the options used to unpack part of
+		 * the trees in parallel with other threads.
+		 */
+		struct unpack_trees_slot *slot;
 	} internal;
 };
 
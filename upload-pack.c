@@ -14,6 +14,7 @@
 #include "oid-array.h"
 #include "object.h"
 #include "commit.h"
+#include "tag.h"
 #include "diff.h"
 #include "revision.h"
 #include "list-objects-filter-options.h"
@@ -32,6 +33,11 @@
 #include "write-or-die.h"
 #include "json-writer.h"
 #include "strmap.h"
+#include "tempfile.h"
+#include "dir.h"
+#include "path.h"
+#include "object-file.h"
+#include "pack-bitmap.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -78,6 +84,21 @@ struct upload_pack_data {
 	int keepalive;
 	int shallow_nr;
 	timestamp_t oldest_have;
+	timestamp_t min_have_generation;
+
+	/*
+	 * Wants known to reach a commit the other side has, which stay so
+	 * as haves are added (all the first "all_wants_reach_have" ones
+	 * do), and the bitmap positions of the haves and of their parents,
+	 * to answer ok_to_give_up() without walking.
+	 */
+	struct oidset wants_reaching_have;
+	int all_wants_reach_have;
+	struct bitmap_index *bitmap_git;
+	size_t *have_pos;
+	size_t have_pos_nr, have_pos_alloc;
+	int have_pos_seen;
+	int wants_by_bitmap;
 
 	unsigned int timeout;					/* v0 only */
 	enum {
@@ -113,6 +134,13 @@ struct upload_pack_data {
 	unsigned allow_filter_fallback : 1;
 	unsigned long tree_filter_max_depth;
 
+	unsigned negotiation_bitmaps : 1;
+	unsigned bitmap_prepared : 1;
+
+	unsigned pack_cache : 1;
+	unsigned long pack_cache_max_size;
+	unsigned long pack_cache_max_age;
+
 	unsigned done : 1;					/* v2 only */
 	unsigned allow_ref_in_want : 1;				/* v2 only */
 	unsigned allow_sideband_all : 1;			/* v2 only */
@@ -134,6 +162,7 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 	struct string_list uri_protocols = STRING_LIST_INIT_DUP;
 	struct object_array extra_edge_obj = OBJECT_ARRAY_INIT;
 	struct string_list allowed_filters = STRING_LIST_INIT_DUP;
+	struct oidset wants_reaching_have = OIDSET_INIT;
 
 	memset(data, 0, sizeof(*data));
 	data->symref = symref;
@@ -146,6 +175,9 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 	data->uri_protocols = uri_protocols;
 	data->extra_edge_obj = extra_edge_obj;
 	data->allowed_filters = allowed_filters;
+	data->wants_reaching_have = wants_reaching_have;
+	data->min_have_generation = GENERATION_NUMBER_INFINITY;
+	data->negotiation_bitmaps = 1;
 	data->allow_filter_fallback = 1;
 	data->tree_filter_max_depth = ULONG_MAX;
 	packet_writer_init(&data->writer, 1);
@@ -153,6 +185,8 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 
 	data->keepalive = 5;
 	data->advertise_sid = 0;
+	data->pack_cache_max_size = 1024 * 1024 * 1024;
+	data->pack_cache_max_age = 3600;
 }
 
 static void upload_pack_data_clear(struct upload_pack_data *data)
@@ -168,6 +202,9 @@ static void upload_pack_data_clear(struct upload_pack_data *data)
 	list_objects_filter_release(&data->filter_options);
 	string_list_clear(&data->allowed_filters, 0);
 	string_list_clear(&data->uri_protocols, 0);
+	oidset_clear(&data->wants_reaching_have);
+	free_bitmap_index(data->bitmap_git);
+	free(data->have_pos);
 
 	free((char *)data->pack_objects_hook);
 }
@@ -197,9 +234,9 @@ static void send_client_data(int fd, const char *data, ssize_t sz,
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct strbuf *buf = cb_data;
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", oid_to_hex(&graft->oid));
+		strbuf_addf(buf, "--shallow %s\n", oid_to_hex(&graft->oid));
 	return 0;
 }
 
@@ -214,6 +251,9 @@ struct output_state {
 	int used;
 	unsigned packfile_uris_started : 1;
 	unsigned packfile_started : 1;
+
+	/* if not NULL, a copy of everything relayed is written there */
+	struct tempfile *pack_cache;
 };
 
 static int relay_pack_data(int pack_objects_out, struct output_state *os,
@@ -236,6 +276,13 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	if (readsz < 0) {
 		return readsz;
 	}
+	if (os->pack_cache &&
+	    write_in_full(get_tempfile_fd(os->pack_cache),
+			  os->buffer + os->used, readsz) < 0) {
+		warning_errno(_("unable to write '%s'"),
+			      get_tempfile_path(os->pack_cache));
+		delete_tempfile(&os->pack_cache);
+	}
 	os->used += readsz;
 
 	while (!os->packfile_started) {
@@ -281,6 +328,142 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	return readsz;
 }
 
+static int hash_tag_ref(const char *refname, const char *referent UNUSED,
+			const struct object_id *oid, int flags UNUSED,
+			void *cb_data)
+{
+	git_hash_ctx *ctx = cb_data;
+
+	the_hash_algo->update_fn(ctx, refname, strlen(refname) + 1);
+	the_hash_algo->update_fn(ctx, oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+/*
+ * Name the file of the cached response to a pack-objects invocation with
+ * these arguments and input. The wanted objects are given by their object
+ * names, so the response only depends on the tags when they are to be
+ * included.
+ */
+static void pack_cache_path(struct strbuf *path,
+			    struct upload_pack_data *pack_data,
+			    const struct strvec *args,
+			    const struct strbuf *input)
+{
+	git_hash_ctx ctx;
+	unsigned char hash[GIT_MAX_RAWSZ];
+
+	the_hash_algo->init_fn(&ctx);
+	for (size_t i = 0; i < args->nr; i++) {
+		/* progress goes to stderr, which is not cached */
+		if (!strcmp(args->v[i], "--progress"))
+			continue;
+		the_hash_algo->update_fn(&ctx, args->v[i], strlen(args->v[i]) + 1);
+	}
+	the_hash_algo->update_fn(&ctx, input->buf, input->len);
+	if (pack_data->use_include_tag)
+		refs_for_each_tag_ref(get_main_ref_store(the_repository),
+				      hash_tag_ref, &ctx);
+	the_hash_algo->final_fn(hash, &ctx);
+
+	strbuf_reset(path);
+	strbuf_repo_git_path(path, the_repository, "upload-pack-cache/%s.pack",
+			     hash_to_hex(hash));
+}
+
+/*
+ * Remove the cached responses that have not been used for longer than
+ * uploadpack.packCacheMaxAge, and then the least recently used ones
+ * until they fit in uploadpack.packCacheMaxSize.
+ */
+static void prune_pack_cache(struct upload_pack_data *pack_data)
+{
+	struct cached_pack {
+		char *path;
+		time_t mtime;
+		off_t size;
+	} *packs = NULL;
+	size_t nr = 0, alloc = 0;
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	uintmax_t total = 0;
+	time_t now = time(NULL);
+	struct dirent *de;
+	DIR *dir;
+
+	strbuf_repo_git_path(&path, the_repository, "upload-pack-cache/");
+	dirlen = path.len;
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		struct stat st;
+
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		if (stat(path.buf, &st))
+			continue;
+		/* this also removes the leftovers of interrupted writes */
+		if (st.st_mtime + (time_t)pack_data->pack_cache_max_age < now) {
+			unlink_or_warn(path.buf);
+			continue;
+		}
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = xstrdup(path.buf);
+		packs[nr].mtime = st.st_mtime;
+		packs[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	while (total > pack_data->pack_cache_max_size) {
+		size_t oldest = 0;
+
+		for (size_t i = 1; i < nr; i++)
+			if (packs[i].mtime < packs[oldest].mtime)
+				oldest = i;
+		unlink_or_warn(packs[oldest].path);
+		total -= packs[oldest].size;
+		free(packs[oldest].path);
+		packs[oldest] = packs[--nr];
+	}
+
+	for (size_t i = 0; i < nr; i++)
+		free(packs[i].path);
+	free(packs);
+	strbuf_release(&path);
+}
+
+/*
+ * Send a cached response instead of running pack-objects. Returns 0 if
+ * it was sent, -1 if there is none.
+ */
+static int send_cached_pack(struct upload_pack_data *pack_data,
+			    struct output_state *output_state,
+			    const char *path)
+{
+	ssize_t result;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	/* remember that it was used, see prune_pack_cache() */
+	utime(path, NULL);
+
+	while ((result = relay_pack_data(fd, output_state,
+					 pack_data->use_sideband, 0)) > 0)
+		; /* keep relaying */
+	if (result < 0)
+		die_errno(_("unable to read '%s'"), path);
+	close(fd);
+	return 0;
+}
+
 static void create_pack_file(struct upload_pack_data *pack_data,
 			     const struct string_list *uri_protocols)
 {
@@ -289,9 +472,10 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	char progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
+	struct strbuf input = STRBUF_INIT;
+	struct strbuf cache_path = STRBUF_INIT;
 	ssize_t sz;
 	int i;
-	FILE *pipe_fd;
 
 	if (!pack_data->pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -330,6 +514,45 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 					 uri_protocols->items[i].string);
 	}
 
+	if (pack_data->shallow_nr)
+		for_each_commit_graft(write_one_shallow, &input);
+
+	for (i = 0; i < pack_data->want_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
+	strbuf_addstr(&input, "--not\n");
+	for (i = 0; i < pack_data->have_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
+	for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
+	strbuf_addch(&input, '\n');
+
+	/*
+	 * Packfile URIs depend on the configuration rather than on the
+	 * request, and a hook may well have its own cache.
+	 */
+	if (pack_data->pack_cache && !uri_protocols &&
+	    !pack_data->pack_objects_hook) {
+		pack_cache_path(&cache_path, pack_data, &pack_objects.args,
+				&input);
+		if (!send_cached_pack(pack_data, output_state, cache_path.buf)) {
+			trace2_data_intmax("upload-pack", the_repository,
+					   "pack-cache/hit", 1);
+			child_process_clear(&pack_objects);
+			goto flush;
+		}
+		trace2_data_intmax("upload-pack", the_repository,
+				   "pack-cache/hit", 0);
+		strbuf_addstr(&cache_path, ".XXXXXX");
+		if (safe_create_leading_directories(cache_path.buf) ||
+		    !(output_state->pack_cache =
+		      mks_tempfile(cache_path.buf)))
+			warning_errno(_("unable to create '%s'"), cache_path.buf);
+		strbuf_setlen(&cache_path, cache_path.len - strlen(".XXXXXX"));
+	}
+
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
@@ -338,24 +561,9 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	if (start_command(&pack_objects))
 		die("git upload-pack: unable to fork git-pack-objects");
 
-	pipe_fd = xfdopen(pack_objects.in, "w");
-
-	if (pack_data->shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
-
-	for (i = 0; i < pack_data->want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < pack_data->have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->have_obj.objects[i].item->oid));
-	for (i = 0; i < pack_data->extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&pack_data->extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
-	fflush(pipe_fd);
-	fclose(pipe_fd);
+	if (write_in_full(pack_objects.in, input.buf, input.len) < 0)
+		die_errno("git upload-pack: unable to write to git-pack-objects");
+	close(pack_objects.in);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -453,6 +661,14 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		goto fail;
 	}
 
+	if (output_state->pack_cache) {
+		if (rename_tempfile(&output_state->pack_cache, cache_path.buf))
+			warning_errno(_("unable to write '%s'"), cache_path.buf);
+		else
+			prune_pack_cache(pack_data);
+	}
+
+ flush:
 	/* flush the data */
 	if (output_state->used > 0) {
 		send_client_data(1, output_state->buffer, output_state->used,
@@ -460,17 +676,43 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		fprintf(stderr, "flushed.\n");
 	}
 	free(output_state);
+	strbuf_release(&input);
+	strbuf_release(&cache_path);
 	if (pack_data->use_sideband)
 		packet_flush(1);
 	return;
 
  fail:
+	delete_tempfile(&output_state->pack_cache);
 	free(output_state);
 	send_client_data(3, abort_msg, strlen(abort_msg),
 			 pack_data->use_sideband);
 	die("git upload-pack: %s", abort_msg);
 }
 
+/*
+ * No commit with a generation below that of all the commits the other
+ * side has can be one of them or reach one, so ok_to_give_up() does not
+ * have to walk there.
+ */
+static void update_min_have_generation(struct upload_pack_data *data,
+				       struct commit *commit)
+{
+	timestamp_t generation;
+
+	if (data->min_have_generation == GENERATION_NUMBER_ZERO)
+		return;
+	if (!generation_numbers_enabled(the_repository) ||
+	    repo_parse_commit(the_repository, commit)) {
+		data->min_have_generation = GENERATION_NUMBER_ZERO;
+		return;
+	}
+
+	generation = commit_graph_generation(commit);
+	if (generation < data->min_have_generation)
+		data->min_have_generation = generation;
+}
+
 static int do_got_oid(struct upload_pack_data *data, const struct object_id *oid)
 {
 	int we_knew_they_have = 0;
@@ -489,10 +731,13 @@ static int do_got_oid(struct upload_pack_data *data, const struct object_id *oid
 			o->flags |= THEY_HAVE;
 		if (!data->oldest_have || (commit->date < data->oldest_have))
 			data->oldest_have = commit->date;
+		update_min_have_generation(data, commit);
 		for (parents = commit->parents;
 		     parents;
-		     parents = parents->next)
+		     parents = parents->next) {
 			parents->item->object.flags |= THEY_HAVE;
+			update_min_have_generation(data, parents->item);
+		}
 	}
 	if (!we_knew_they_have) {
 		add_object_array(o, NULL, &data->have_obj);
@@ -512,16 +757,106 @@ static int got_oid(struct upload_pack_data *data,
 	return do_got_oid(data, oid);
 }
 
+static void add_have_pos(struct upload_pack_data *data, struct object *o)
+{
+	int pos = bitmap_object_position(data->bitmap_git, &o->oid);
+
+	if (pos < 0)
+		return;
+	ALLOC_GROW(data->have_pos, data->have_pos_nr + 1, data->have_pos_alloc);
+	data->have_pos[data->have_pos_nr++] = pos;
+}
+
+static int cmp_size_t(const void *va, const void *vb)
+{
+	const size_t *a = va, *b = vb;
+	return *a < *b ? -1 : *a > *b;
+}
+
+/*
+ * Returns 1 if the reachability bitmap of "want" shows that it reaches
+ * a commit the other side has, 0 if it does not or if "want" has no
+ * bitmap.
+ */
+static int want_reaches_have_by_bitmap(struct upload_pack_data *data,
+				       struct object *want)
+{
+	struct object *o;
+
+	if (!data->bitmap_prepared) {
+		data->bitmap_prepared = 1;
+		if (data->negotiation_bitmaps)
+			data->bitmap_git = prepare_bitmap_git(the_repository);
+	}
+	if (!data->bitmap_git)
+		return 0;
+
+	o = deref_tag(the_repository, want, NULL, 0);
+	if (!o || o->type != OBJ_COMMIT)
+		return 0;
+
+	if (data->have_pos_seen < data->have_obj.nr) {
+		for (; data->have_pos_seen < data->have_obj.nr; data->have_pos_seen++) {
+			struct object *have = data->have_obj.objects[data->have_pos_seen].item;
+			struct commit_list *parents;
+
+			if (have->type != OBJ_COMMIT)
+				continue;
+			add_have_pos(data, have);
+			for (parents = ((struct commit *)have)->parents;
+			     parents;
+			     parents = parents->next)
+				add_have_pos(data, &parents->item->object);
+		}
+		QSORT(data->have_pos, data->have_pos_nr, cmp_size_t);
+	}
+
+	return bitmap_commit_contains_any(data->bitmap_git, (struct commit *)o,
+					  data->have_pos,
+					  data->have_pos_nr) > 0;
+}
+
 static int ok_to_give_up(struct upload_pack_data *data)
 {
-	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
+	struct object_array wants = OBJECT_ARRAY_INIT;
+	int i, ret;
 
 	if (!data->have_obj.nr)
 		return 0;
+	if (data->all_wants_reach_have == data->want_obj.nr)
+		return 1;
+
+	/*
+	 * Answer what we can from the bitmaps, and walk only from the
+	 * wants that are not known to reach a have yet, down to the
+	 * oldest have and to the lowest generation of the haves.
+	 */
+	for (i = 0; i < data->want_obj.nr; i++) {
+		struct object *o = data->want_obj.objects[i].item;
 
-	return can_all_from_reach_with_flag(&data->want_obj, THEY_HAVE,
-					    COMMON_KNOWN, data->oldest_have,
-					    min_generation);
+		if (oidset_contains(&data->wants_reaching_have, &o->oid))
+			continue;
+		if (want_reaches_have_by_bitmap(data, o)) {
+			oidset_insert(&data->wants_reaching_have, &o->oid);
+			data->wants_by_bitmap++;
+			continue;
+		}
+		add_object_array(o, NULL, &wants);
+	}
+
+	ret = !wants.nr ||
+		can_all_from_reach_with_flag(&wants, THEY_HAVE, COMMON_KNOWN,
+					     data->oldest_have,
+					     data->min_have_generation);
+	object_array_clear(&wants);
+
+	if (ret) {
+		data->all_wants_reach_have = data->want_obj.nr;
+		trace2_data_intmax("upload-pack", the_repository,
+				   "negotiation/wants-by-bitmap",
+				   data->wants_by_bitmap);
+	}
+	return ret;
 }
 
 static int get_common_commits(struct upload_pack_data *data,
@@ -1385,6 +1720,14 @@ static int upload_pack_config(const char *var, const char *value,
 		data->allow_ref_in_want = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowsidebandall", var)) {
 		data->allow_sideband_all = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.negotiationbitmaps", var)) {
+		data->negotiation_bitmaps = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		data->pack_cache = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxsize", var)) {
+		data->pack_cache_max_size = git_config_ulong(var, value, ctx->kvi);
+	} else if (!strcmp("uploadpack.packcachemaxage", var)) {
+		data->pack_cache_max_age = git_config_ulong(var, value, ctx->kvi);
 	} else if (!strcmp("uploadpack.blobpackfileuri", var)) {
 		if (value)
 			data->allow_packfile_uris = 1;
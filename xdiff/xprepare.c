@@ -31,20 +31,27 @@
 
 
 typedef struct s_xdlclass {
-	struct s_xdlclass *next;
 	unsigned long ha;
 	char const *line;
 	long size;
-	long idx;
 	long len1, len2;
 } xdlclass_t;
 
+/*
+ * A slot of the open addressing table of the classifier. The hash of the
+ * line is kept next to the index of its class so that probing does not
+ * need to look at the classes themselves until the hashes match.
+ */
+typedef struct s_xdlclass_slot {
+	unsigned long ha;
+	long idx; /* index of the class plus one, 0 for an empty slot */
+} xdlclass_slot_t;
+
 typedef struct s_xdlclassifier {
 	unsigned int hbits;
 	long hsize;
-	xdlclass_t **rchash;
-	chastore_t ncha;
-	xdlclass_t **rcrecs;
+	xdlclass_slot_t *rchash;
+	xdlclass_t *rcrecs;
 	long alloc;
 	long count;
 	long flags;
@@ -55,8 +62,7 @@ typedef struct s_xdlclassifier {
 
 static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags);
 static void xdl_free_classifier(xdlclassifier_t *cf);
-static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
-			       unsigned int hbits, xrecord_t *rec);
+static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t *rec);
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
 			   xdlclassifier_t *cf, xdfile_t *xdf);
 static void xdl_free_ctx(xdfile_t *xdf);
@@ -74,13 +80,8 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 	cf->hbits = xdl_hashbits((unsigned int) size);
 	cf->hsize = 1 << cf->hbits;
 
-	if (xdl_cha_init(&cf->ncha, sizeof(xdlclass_t), size / 4 + 1) < 0) {
-
-		return -1;
-	}
 	if (!XDL_CALLOC_ARRAY(cf->rchash, cf->hsize)) {
 
-		xdl_cha_free(&cf->ncha);
 		return -1;
 	}
 
@@ -88,7 +89,6 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 	if (!XDL_ALLOC_ARRAY(cf->rcrecs, cf->alloc)) {
 
 		xdl_free(cf->rchash);
-		xdl_cha_free(&cf->ncha);
 		return -1;
 	}
 
@@ -102,48 +102,68 @@ static void xdl_free_classifier(xdlclassifier_t *cf) {
 
 	xdl_free(cf->rcrecs);
 	xdl_free(cf->rchash);
-	xdl_cha_free(&cf->ncha);
 }
 
 
-static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
-			       unsigned int hbits, xrecord_t *rec) {
-	long hi;
-	char const *line;
+static int xdl_grow_classifier(xdlclassifier_t *cf) {
+	xdlclass_slot_t *rchash;
+	unsigned int hbits = cf->hbits + 1;
+	long hsize = 1 << hbits, i, hi;
+
+	if (!XDL_CALLOC_ARRAY(rchash, hsize))
+		return -1;
+	for (i = 0; i < cf->count; i++) {
+		hi = (long) XDL_HASHLONG(cf->rcrecs[i].ha, hbits);
+		while (rchash[hi].idx)
+			hi = (hi + 1) & (hsize - 1);
+		rchash[hi].ha = cf->rcrecs[i].ha;
+		rchash[hi].idx = i + 1;
+	}
+	xdl_free(cf->rchash);
+	cf->rchash = rchash;
+	cf->hbits = hbits;
+	cf->hsize = hsize;
+
+	return 0;
+}
+
+
+static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t *rec) {
+	long hi, idx;
+	xdlclass_slot_t *slot;
 	xdlclass_t *rcrec;
 
-	line = rec->ptr;
 	hi = (long) XDL_HASHLONG(rec->ha, cf->hbits);
-	for (rcrec = cf->rchash[hi]; rcrec; rcrec = rcrec->next)
-		if (rcrec->ha == rec->ha &&
+	for (slot = &cf->rchash[hi]; slot->idx;
+	     hi = (hi + 1) & (cf->hsize - 1), slot = &cf->rchash[hi]) {
+		rcrec = &cf->rcrecs[slot->idx - 1];
+		if (slot->ha == rec->ha &&
 				xdl_recmatch(rcrec->line, rcrec->size,
 					rec->ptr, rec->size, cf->flags))
 			break;
+	}
 
-	if (!rcrec) {
-		if (!(rcrec = xdl_cha_alloc(&cf->ncha))) {
-
-			return -1;
-		}
-		rcrec->idx = cf->count++;
+	if (slot->idx) {
+		idx = slot->idx - 1;
+	} else {
+		idx = cf->count++;
 		if (XDL_ALLOC_GROW(cf->rcrecs, cf->count, cf->alloc))
 				return -1;
-		cf->rcrecs[rcrec->idx] = rcrec;
-		rcrec->line = line;
+		rcrec = &cf->rcrecs[idx];
+		rcrec->line = rec->ptr;
 		rcrec->size = rec->size;
 		rcrec->ha = rec->ha;
 		rcrec->len1 = rcrec->len2 = 0;
-		rcrec->next = cf->rchash[hi];
-		cf->rchash[hi] = rcrec;
+		slot->ha = rec->ha;
+		slot->idx = idx + 1;
+		if (cf->count * 2 > cf->hsize && xdl_grow_classifier(cf) < 0)
+			return -1;
 	}
 
+	rcrec = &cf->rcrecs[idx];
 	(pass == 1) ? rcrec->len1++ : rcrec->len2++;
 
-	rec->ha = (unsigned long) rcrec->idx;
-
-	hi = (long) XDL_HASHLONG(rec->ha, hbits);
-	rec->next = rhash[hi];
-	rhash[hi] = rec;
+	rec->ha = (unsigned long) idx;
 
 	return 0;
 }
@@ -151,13 +171,11 @@ static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t
 
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
 			   xdlclassifier_t *cf, xdfile_t *xdf) {
-	unsigned int hbits;
-	long nrec, hsize, bsize;
+	long nrec, bsize;
 	unsigned long hav;
 	char const *blk, *cur, *top, *prev;
 	xrecord_t *crec;
 	xrecord_t **recs;
-	xrecord_t **rhash;
 	unsigned long *ha;
 	char *rchg;
 	long *rindex;
@@ -165,7 +183,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	ha = NULL;
 	rindex = NULL;
 	rchg = NULL;
-	rhash = NULL;
 	recs = NULL;
 
 	if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), narec / 4 + 1) < 0)
@@ -173,11 +190,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	if (!XDL_ALLOC_ARRAY(recs, narec))
 		goto abort;
 
-	hbits = xdl_hashbits((unsigned int) narec);
-	hsize = 1 << hbits;
-	if (!XDL_CALLOC_ARRAY(rhash, hsize))
-		goto abort;
-
 	nrec = 0;
 	if ((cur = blk = xdl_mmfile_first(mf, &bsize))) {
 		for (top = blk + bsize; cur < top; ) {
@@ -191,7 +203,7 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 			crec->size = (long) (cur - prev);
 			crec->ha = hav;
 			recs[nrec++] = crec;
-			if (xdl_classify_record(pass, cf, rhash, hbits, crec) < 0)
+			if (xdl_classify_record(pass, cf, crec) < 0)
 				goto abort;
 		}
 	}
@@ -209,8 +221,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 
 	xdf->nrec = nrec;
 	xdf->recs = recs;
-	xdf->hbits = hbits;
-	xdf->rhash = rhash;
 	xdf->rchg = rchg + 1;
 	xdf->rindex = rindex;
 	xdf->nreff = 0;
@@ -224,7 +234,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	xdl_free(ha);
 	xdl_free(rindex);
 	xdl_free(rchg);
-	xdl_free(rhash);
 	xdl_free(recs);
 	xdl_cha_free(&xdf->rcha);
 	return -1;
@@ -233,7 +242,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 
 static void xdl_free_ctx(xdfile_t *xdf) {
 
-	xdl_free(xdf->rhash);
 	xdl_free(xdf->rindex);
 	xdl_free(xdf->rchg - 1);
 	xdl_free(xdf->ha);
@@ -252,8 +260,8 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	/*
 	 * For histogram diff, we can afford a smaller sample size and
 	 * thus a poorer estimate of the number of lines, as the hash
-	 * table (rhash) won't be filled up/grown. The number of lines
-	 * (nrecs) will be updated correctly anyway by
+	 * table of the classifier is grown as needed. The number of
+	 * lines (nrecs) will be updated correctly anyway by
 	 * xdl_prepare_ctx().
 	 */
 	sample = (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF
@@ -366,7 +374,6 @@ static int xdl_clean_mmatch(char const *dis, long i, long s, long e) {
 static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2) {
 	long i, nm, nreff, mlim;
 	xrecord_t **recs;
-	xdlclass_t *rcrec;
 	char *dis, *dis1, *dis2;
 
 	if (!XDL_CALLOC_ARRAY(dis, xdf1->nrec + xdf2->nrec + 2))
@@ -377,16 +384,14 @@ static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xd
 	if ((mlim = xdl_bogosqrt(xdf1->nrec)) > XDL_MAX_EQLIMIT)
 		mlim = XDL_MAX_EQLIMIT;
 	for (i = xdf1->dstart, recs = &xdf1->recs[xdf1->dstart]; i <= xdf1->dend; i++, recs++) {
-		rcrec = cf->rcrecs[(*recs)->ha];
-		nm = rcrec ? rcrec->len2 : 0;
+		nm = cf->rcrecs[(*recs)->ha].len2;
 		dis1[i] = (nm == 0) ? 0: (nm >= mlim) ? 2: 1;
 	}
 
 	if ((mlim = xdl_bogosqrt(xdf2->nrec)) > XDL_MAX_EQLIMIT)
 		mlim = XDL_MAX_EQLIMIT;
 	for (i = xdf2->dstart, recs = &xdf2->recs[xdf2->dstart]; i <= xdf2->dend; i++, recs++) {
-		rcrec = cf->rcrecs[(*recs)->ha];
-		nm = rcrec ? rcrec->len1 : 0;
+		nm = cf->rcrecs[(*recs)->ha].len1;
 		dis2[i] = (nm == 0) ? 0: (nm >= mlim) ? 2: 1;
 	}
 
@@ -297,15 +297,25 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
+	char const *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
+	/*
+	 * Let memchr() find the end of the line, which it does many bytes
+	 * at a time, so that the loop below has nothing to test but its
+	 * bound.
+	 */
+	eol = memchr(ptr, '\n', top - ptr);
+	*data = eol ? eol + 1 : top;
+	if (!eol)
+		eol = top;
+
+	for (; ptr < eol; ptr++) {
 		ha += (ha << 5);
 		ha ^= (unsigned long) *ptr;
 	}
-	*data = ptr < top ? ptr + 1: ptr;
 
 	return ha;
 }